@@ -2194,6 +2194,52 @@ bool blk_supports_write_perm(BlockBackend *blk)
     }
 }
 
+/*
+ * Returns the path of the host file holding the whole content of the
+ * BlockBackend at the same offsets, i.e. a file that can be mapped in
+ * place of reading the image, or NULL if there is none (format with its
+ * own layout, raw node with an offset, non-file protocol, ...).
+ * The caller must free the result with g_free().
+ */
+char *blk_get_mappable_filename(BlockBackend *blk)
+{
+    BlockDriverState *bs = blk_bs(blk);
+    BlockDriverState *file = NULL;
+    int64_t offset = 0;
+    int64_t len;
+
+    GLOBAL_STATE_CODE();
+
+    if (!bs) {
+        return NULL;
+    }
+
+    len = bdrv_getlength(bs);
+    if (len <= 0) {
+        return NULL;
+    }
+
+    while (offset < len) {
+        BlockDriverState *cur = NULL;
+        int64_t pnum;
+        int64_t map;
+        int ret;
+
+        ret = bdrv_block_status(bs, offset, len - offset, &pnum, &map, &cur);
+        if (ret < 0 || !(ret & BDRV_BLOCK_OFFSET_VALID) || pnum <= 0 ||
+            map != offset || !cur || (file && cur != file)) {
+            return NULL;
+        }
+        file = cur;
+        offset += pnum;
+    }
+
+    if (strcmp(bdrv_get_format_name(file), "file") != 0) {
+        return NULL;
+    }
+    return g_strdup(file->filename);
+}
+
 /*
  * Returns true if the BlockBackend can be written to in its current
  * configuration (i.e. if write permission have been requested)
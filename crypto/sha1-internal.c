@@ -9,6 +9,10 @@
 #include "sha1_i.h"
 #include "stddef.h"
 #include "string.h"
+#ifdef CONFIG_SHA_NI_OPT
+#include "host/cpuinfo.h"
+#include <immintrin.h>
+#endif
 
 typedef struct sha1_state SHA1_CTX;
 
@@ -225,3 +229,100 @@ void sha1_init(SHA1_CTX *context)
 }
 
 /* ===== end - public domain SHA1 implementation ===== */
+
+
+/* ===== start - multi-block compression ===== */
+
+static void sha1_compress_blocks_int(uint32_t state[5], const unsigned char *buffer, size_t blocks)
+{
+    for (size_t i = 0; i < blocks; i++) {
+        sha1_compress(state, buffer + i * 64);
+    }
+}
+
+#ifdef CONFIG_SHA_NI_OPT
+
+/* Perform 4 rounds, the round function is an immediate operand so it must be a constant */
+static inline __m128i __attribute__((always_inline, target("sha,sse4.1")))
+sha1_rnds4(__m128i abcd, __m128i e, int group)
+{
+    switch (group / 5) {
+    case 0:
+        return _mm_sha1rnds4_epu32(abcd, e, 0);
+    case 1:
+        return _mm_sha1rnds4_epu32(abcd, e, 1);
+    case 2:
+        return _mm_sha1rnds4_epu32(abcd, e, 2);
+    default:
+        return _mm_sha1rnds4_epu32(abcd, e, 3);
+    }
+}
+
+/*
+ * SHA extensions version, each iteration of the inner loop performs 4 rounds.
+ * The message schedule is kept in 4 registers, W[4g..4g+3] being in msg[g % 4].
+ */
+static void __attribute__((target("sha,sse4.1")))
+sha1_compress_blocks_shani(uint32_t state[5], const unsigned char *buffer, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+    __m128i e[2] = { _mm_set_epi32(state[4], 0, 0, 0), _mm_setzero_si128() };
+    __m128i msg[4];
+
+    for (size_t i = 0; i < blocks; i++, buffer += 64) {
+        const __m128i abcd_save = abcd;
+        const __m128i e_save = e[0];
+
+        for (int g = 0; g < 20; g++) {
+            if (g < 4) {
+                msg[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buffer + 16 * g)), mask);
+            }
+            if (g == 0) {
+                e[0] = _mm_add_epi32(e[0], msg[0]);
+            } else {
+                e[g % 2] = _mm_sha1nexte_epu32(e[g % 2], msg[g % 4]);
+            }
+            e[(g + 1) % 2] = abcd;
+            if (g >= 3 && g <= 18) {
+                /* Finish the schedule of W[4g+4..4g+7] */
+                msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], msg[g % 4]);
+            }
+            abcd = sha1_rnds4(abcd, e[g % 2], g);
+            if (g >= 1 && g <= 16) {
+                /* Start the schedule of W[4g+12..4g+15] */
+                msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], msg[g % 4]);
+            }
+            if (g >= 2 && g <= 17) {
+                msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], msg[g % 4]);
+            }
+        }
+
+        e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e[0], 3);
+}
+
+#endif /* CONFIG_SHA_NI_OPT */
+
+static void (*sha1_compress_blocks_accel)(uint32_t *, const unsigned char *, size_t) = sha1_compress_blocks_int;
+
+#ifdef CONFIG_SHA_NI_OPT
+static void __attribute__((constructor)) sha1_init_accel(void)
+{
+    if ((cpuinfo_init() & (CPUINFO_SHA | CPUINFO_SSE4)) == (CPUINFO_SHA | CPUINFO_SSE4)) {
+        sha1_compress_blocks_accel = sha1_compress_blocks_shani;
+    }
+}
+#endif /* CONFIG_SHA_NI_OPT */
+
+/* Hash `blocks` consecutive 512-bit blocks */
+void sha1_compress_blocks(uint32_t state[5], const unsigned char *buffer, size_t blocks)
+{
+    sha1_compress_blocks_accel(state, buffer, blocks);
+}
+
+/* ===== end - multi-block compression ===== */
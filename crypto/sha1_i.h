@@ -17,5 +17,6 @@ struct sha1_state {
 
 void sha1_init(struct sha1_state *context);
 void sha1_compress(uint32_t state[5], const unsigned char buffer[64]);
+void sha1_compress_blocks(uint32_t state[5], const unsigned char *buffer, size_t blocks);
 
 #endif /* SHA1_I_H */
@@ -14,6 +14,12 @@ int sha224_compress(sha224_state *md, unsigned char *buf)
 }
 
 
+void sha224_compress_blocks(sha224_state *md, const unsigned char *buf, size_t blocks)
+{
+    sha256_compress_blocks(md, buf, blocks);
+}
+
+
 void sha224_init(sha224_state *md)
 {
     /**
@@ -20,5 +20,6 @@ typedef struct sha256_state sha224_state;
 
 void sha224_init(sha224_state *md);
 int sha224_compress(sha224_state *md, unsigned char *buf);
+void sha224_compress_blocks(sha224_state *md, const unsigned char *buf, size_t blocks);
 
 #endif /* SHA224_I_H */
@@ -7,6 +7,10 @@
  */
 
 #include "sha256_i.h"
+#ifdef CONFIG_SHA_NI_OPT
+#include "host/cpuinfo.h"
+#include <immintrin.h>
+#endif
 
 static inline uint32_t WPA_GET_BE32(const uint8_t *a)
 {
@@ -105,3 +109,101 @@ void sha256_init(struct sha256_state *md)
 }
 
 /* ===== end - public domain SHA256 implementation ===== */
+
+
+/* ===== start - multi-block compression ===== */
+
+static void sha256_compress_blocks_int(struct sha256_state *md, const unsigned char *buf, size_t blocks)
+{
+    for (size_t i = 0; i < blocks; i++) {
+        sha256_compress(md, (unsigned char *) buf + i * 64);
+    }
+}
+
+#ifdef CONFIG_SHA_NI_OPT
+
+static const uint32_t K32[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * SHA extensions version, each iteration of the inner loop performs 4 rounds.
+ * The message schedule is kept in 4 registers, W[4g..4g+3] being in msg[g % 4].
+ */
+static void __attribute__((target("sha,sse4.1")))
+sha256_compress_blocks_shani(struct sha256_state *md, const unsigned char *buf, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, tmp, wk;
+    __m128i msg[4];
+
+    /* The instructions work on the ABEF and CDGH halves of the state */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &md->state[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &md->state[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (size_t i = 0; i < blocks; i++, buf += 64) {
+        const __m128i abef_save = state0;
+        const __m128i cdgh_save = state1;
+
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                msg[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 16 * g)), mask);
+            }
+            wk = _mm_add_epi32(msg[g % 4], _mm_loadu_si128((const __m128i *) &K32[4 * g]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+            if (g >= 3 && g <= 14) {
+                /* Finish the schedule of W[4g+4..4g+7] */
+                tmp = _mm_alignr_epi8(msg[g % 4], msg[(g + 3) % 4], 4);
+                msg[(g + 1) % 4] = _mm_add_epi32(msg[(g + 1) % 4], tmp);
+                msg[(g + 1) % 4] = _mm_sha256msg2_epu32(msg[(g + 1) % 4], msg[g % 4]);
+            }
+            wk = _mm_shuffle_epi32(wk, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+            if (g >= 1 && g <= 12) {
+                /* Start the schedule of W[4g+12..4g+15] */
+                msg[(g + 3) % 4] = _mm_sha256msg1_epu32(msg[(g + 3) % 4], msg[g % 4]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *) &md->state[0], state0);
+    _mm_storeu_si128((__m128i *) &md->state[4], state1);
+}
+
+#endif /* CONFIG_SHA_NI_OPT */
+
+static void (*sha256_compress_blocks_accel)(struct sha256_state *, const unsigned char *, size_t) =
+    sha256_compress_blocks_int;
+
+#ifdef CONFIG_SHA_NI_OPT
+static void __attribute__((constructor)) sha256_init_accel(void)
+{
+    if ((cpuinfo_init() & (CPUINFO_SHA | CPUINFO_SSE4)) == (CPUINFO_SHA | CPUINFO_SSE4)) {
+        sha256_compress_blocks_accel = sha256_compress_blocks_shani;
+    }
+}
+#endif /* CONFIG_SHA_NI_OPT */
+
+/* compress `blocks` consecutive 512-bit blocks */
+void sha256_compress_blocks(struct sha256_state *md, const unsigned char *buf, size_t blocks)
+{
+    sha256_compress_blocks_accel(md, buf, blocks);
+}
+
+/* ===== end - multi-block compression ===== */
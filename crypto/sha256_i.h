@@ -16,5 +16,6 @@ struct sha256_state {
 
 void sha256_init(struct sha256_state *md);
 int sha256_compress(struct sha256_state *md, unsigned char *buf);
+void sha256_compress_blocks(struct sha256_state *md, const unsigned char *buf, size_t blocks);
 
 #endif /* SHA256_I_H */
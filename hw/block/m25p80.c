@@ -509,6 +509,15 @@ struct Flash {
 
     int64_t dirty_page;
 
+    /*
+     * When set, the storage is a private mapping of the raw image file: pages
+     * are shared with the host page cache until they are written, the written
+     * pages become anonymous ones. As with the buffered storage, the writes
+     * are only saved to the image if the drive is writable.
+     */
+    bool mmap_cow;
+    bool storage_mapped;
+
     const FlashPartInfo *pi;
 
 };
@@ -1598,6 +1607,34 @@ static uint32_t m25p80_transfer8(SSIPeripheral *ss, uint32_t tx)
     return r;
 }
 
+static void m25p80_transfer_bulk(SSIPeripheral *ss, const uint8_t *tx,
+                                 uint8_t *rx, size_t len)
+{
+    Flash *s = M25P80(ss);
+    size_t i = 0;
+
+    while (i < len) {
+        if (s->state == STATE_READ) {
+            /* Data phase of a read command, copy up to the end of the flash */
+            uint32_t n = MIN(len - i, s->size - s->cur_addr);
+
+            trace_m25p80_read_bulk(s, n, s->cur_addr);
+            if (rx) {
+                memcpy(rx + i, s->storage + s->cur_addr, n);
+            }
+            s->cur_addr = (s->cur_addr + n) & (s->size - 1);
+            i += n;
+        } else {
+            uint8_t r = m25p80_transfer8(ss, tx ? tx[i] : 0);
+
+            if (rx) {
+                rx[i] = r;
+            }
+            i++;
+        }
+    }
+}
+
 static void m25p80_write_protect_pin_irq_handler(void *opaque, int n, int level)
 {
     Flash *s = M25P80(opaque);
@@ -1606,6 +1643,40 @@ static void m25p80_write_protect_pin_irq_handler(void *opaque, int n, int level)
     s->wp_level = !!level;
 }
 
+static bool m25p80_map_image(Flash *s)
+{
+#ifdef CONFIG_POSIX
+    g_autofree char *path = blk_get_mappable_filename(s->blk);
+    void *storage;
+    int fd;
+
+    if (!path || blk_getlength(s->blk) != s->size) {
+        warn_report("M25P80: flash image is not a raw file of %" PRIu32
+                    " bytes, it cannot be mapped", s->size);
+        return false;
+    }
+
+    fd = qemu_open_old(path, O_RDONLY);
+    if (fd < 0) {
+        warn_report("M25P80: cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    storage = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (storage == MAP_FAILED) {
+        warn_report("M25P80: cannot map %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    s->storage = storage;
+    s->storage_mapped = true;
+    return true;
+#else
+    warn_report("M25P80: mapping the flash image is not supported on this host");
+    return false;
+#endif
+}
+
 static void m25p80_realize(SSIPeripheral *ss, Error **errp)
 {
     Flash *s = M25P80(ss);
@@ -1626,11 +1697,13 @@ static void m25p80_realize(SSIPeripheral *ss, Error **errp)
         }
 
         trace_m25p80_binding(s);
-        s->storage = blk_blockalign(s->blk, s->size);
+        if (!s->mmap_cow || !m25p80_map_image(s)) {
+            s->storage = blk_blockalign(s->blk, s->size);
 
-        if (!blk_check_size_and_read_all(s->blk, DEVICE(s),
-                                         s->storage, s->size, errp)) {
-            return;
+            if (!blk_check_size_and_read_all(s->blk, DEVICE(s),
+                                             s->storage, s->size, errp)) {
+                return;
+            }
         }
     } else {
         trace_m25p80_binding_no_bdrv(s);
@@ -1673,6 +1746,7 @@ static Property m25p80_properties[] = {
     DEFINE_PROP_UINT8("spansion-cr3nv", Flash, spansion_cr3nv, 0x2),
     DEFINE_PROP_UINT8("spansion-cr4nv", Flash, spansion_cr4nv, 0x10),
     DEFINE_PROP_DRIVE("drive", Flash, blk),
+    DEFINE_PROP_BOOL("mmap-cow", Flash, mmap_cow, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -1810,6 +1884,7 @@ static void m25p80_class_init(ObjectClass *klass, void *data)
 
     k->realize = m25p80_realize;
     k->transfer = m25p80_transfer8;
+    k->transfer_bulk = m25p80_transfer_bulk;
     k->set_cs = m25p80_cs;
     k->cs_polarity = SSI_CS_LOW;
     dc->vmsd = &vmstate_m25p80;
@@ -1848,3 +1923,10 @@ BlockBackend *m25p80_get_blk(DeviceState *dev)
 {
     return M25P80(dev)->blk;
 }
+
+uint8_t *m25p80_get_mapped_image(DeviceState *dev)
+{
+    Flash *s = M25P80(dev);
+
+    return s->storage_mapped ? s->storage : NULL;
+}
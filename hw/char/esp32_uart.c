@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
+#include "qemu/main-loop.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "sysemu/sysemu.h"
@@ -27,6 +28,7 @@
 
 
 static gboolean uart_transmit(void *do_not_use, GIOCondition cond, void *opaque);
+static void uart_tx_fifo_to_output(ESP32UARTState *s);
 static void uart_receive(void *opaque, const uint8_t *buf, int size);
 
 
@@ -62,7 +64,7 @@ void esp32_uart_set_rx_timeout(ESP32UARTState *s)
         /* If throttling is done, make sure timeout doesn't happen before more data
          * is allowed to come. Offset it by 1ms.
          */
-        if (rx_timeout_ns <= s->throttle_timer.expire_time) {
+        if (s->throttle_rx && rx_timeout_ns <= s->throttle_timer.expire_time) {
             rx_timeout_ns = s->throttle_timer.expire_time + 10000000;
         }
         timer_mod_ns(&s->rx_timeout_timer, rx_timeout_ns);
@@ -73,15 +75,6 @@ void esp32_uart_set_rx_timeout(ESP32UARTState *s)
 }
 
 
-static uint8_t fifo8_peek(Fifo8 *fifo)
-{
-    if (fifo->num == 0) {
-        abort();
-    }
-    return fifo->data[fifo->head];
-}
-
-
 static uint64_t uart_read(void *opaque, hwaddr addr, unsigned int size)
 {
     ESP32UARTState *s = ESP32_UART(opaque);
@@ -93,9 +86,13 @@ static uint64_t uart_read(void *opaque, hwaddr addr, unsigned int size)
             r = 0xEE;
             error_report("esp_uart: read UART FIFO while it is empty");
         } else {
+            const bool was_full = fifo8_is_full(&s->rx_fifo);
             r = fifo8_pop(&s->rx_fifo);
             esp32_uart_update_irq(s);
-            qemu_chr_fe_accept_input(&s->chr);
+            /* The backend only needs to be notified when it stopped sending data */
+            if (was_full && !s->throttle_rx) {
+                qemu_chr_fe_accept_input(&s->chr);
+            }
         }
         break;
 
@@ -145,7 +142,20 @@ static void uart_write(void *opaque, hwaddr addr,
             error_report("esp_uart: write to UART FIFO while it is full");
         } else {
             fifo8_push(&s->tx_fifo, (uint8_t) (value & 0xff));
-            uart_transmit(NULL, G_IO_OUT, s);
+            /* From the guest point of view, the byte is transmitted right away: it is moved to
+             * the output buffer, sent to the backend from a bottom half together with the bytes
+             * written in a row. If the output buffer is full, send it right away. When the
+             * backend is busy, the bytes stay in the FIFO until the watch resumes the
+             * transmission. */
+            if (s->tx_watch_handle == 0) {
+                if (fifo8_is_full(&s->tx_out)) {
+                    uart_transmit(NULL, G_IO_OUT, s);
+                }
+                if (s->tx_watch_handle == 0) {
+                    uart_tx_fifo_to_output(s);
+                    qemu_bh_schedule(s->tx_bh);
+                }
+            }
         }
         break;
 
@@ -219,6 +229,14 @@ static void uart_write(void *opaque, hwaddr addr,
 }
 
 
+static void uart_tx_fifo_to_output(ESP32UARTState *s)
+{
+    while (!fifo8_is_empty(&s->tx_fifo) && !fifo8_is_full(&s->tx_out)) {
+        fifo8_push(&s->tx_out, fifo8_pop(&s->tx_fifo));
+    }
+}
+
+
 static gboolean uart_transmit(void *do_not_use, GIOCondition cond, void *opaque)
 {
     ESP32UARTState *s = ESP32_UART(opaque);
@@ -227,27 +245,45 @@ static gboolean uart_transmit(void *do_not_use, GIOCondition cond, void *opaque)
 
     /* drain the fifo instantly, if the char device backend is not connected */
     if (!qemu_chr_fe_backend_open(&s->chr)) {
+        fifo8_reset(&s->tx_out);
         fifo8_reset(&s->tx_fifo);
+        esp32_uart_update_irq(s);
         return FALSE;
     }
 
-    while (fifo8_num_used(&s->tx_fifo) > 0) {
-        uint8_t b = fifo8_peek(&s->tx_fifo);
-        int r = qemu_chr_fe_write(&s->chr, &b, 1);
-        if (r == 1) {
-            fifo8_pop(&s->tx_fifo);
-        } else {
+    /* The buffer content is at most two contiguous spans, write each of them at once */
+    while (!fifo8_is_empty(&s->tx_out)) {
+        uint32_t len = 0;
+        const uint8_t *buf = fifo8_peek_buf(&s->tx_out, fifo8_num_used(&s->tx_out), &len);
+        int r = qemu_chr_fe_write(&s->chr, buf, len);
+        if (r > 0) {
+            fifo8_pop_buf(&s->tx_out, r, NULL);
+        }
+        if (r < (int) len) {
             s->tx_watch_handle = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
                                                        uart_transmit, s);
             break;
         }
+        /* Bytes held in the FIFO while the backend was busy */
+        uart_tx_fifo_to_output(s);
     }
 
+    /* Only changes the status if bytes were held in the FIFO by a busy backend */
     esp32_uart_update_irq(s);
 
     return FALSE;
 }
 
+static void uart_tx_bh(void *opaque)
+{
+    ESP32UARTState *s = ESP32_UART(opaque);
+
+    /* The watch may have been added after the bottom half was scheduled */
+    if (s->tx_watch_handle == 0) {
+        uart_transmit(NULL, G_IO_OUT, s);
+    }
+}
+
 static void uart_receive(void *opaque, const uint8_t *buf, int size)
 {
     ESP32UARTState *s = ESP32_UART(opaque);
@@ -264,10 +300,8 @@ static void uart_receive(void *opaque, const uint8_t *buf, int size)
         s->rxfifo_tout = false;
     }
 
-    /* Move the data into the FIFO */
-    for (int i = 0; i < size && fifo8_num_free(&s->rx_fifo) > 0; i++) {
-        fifo8_push(&s->rx_fifo, buf[i]);
-    }
+    /* Move the data into the FIFO, can_receive made sure it fits */
+    fifo8_push_all(&s->rx_fifo, buf, MIN((uint32_t) size, fifo8_num_free(&s->rx_fifo)));
 
     /* Receive throttling: some applications (in particular the ESP32 ROM bootloader)
      * may work incorrectly if the data comes in much faster than what UART baud rate
@@ -275,8 +309,10 @@ static void uart_receive(void *opaque, const uint8_t *buf, int size)
      * average data rate match the configured baud rate.
      * This doesn't need to be very precise, so only add the delay if the FIFO is full
      * (which most likely means that more data will come).
+     * In unthrottled mode, the data is delivered as fast as the guest consumes it, the baud rate
+     * is only used for the RX timeout interrupt.
      */
-    if (fifo8_is_full(&s->rx_fifo)) {
+    if (!s->unthrottled && fifo8_is_full(&s->rx_fifo)) {
         s->throttle_rx = true;
         const int bits_per_symbol = 10;
         int64_t throttle_time_ns = (int64_t) UART_FIFO_LENGTH * bits_per_symbol * NANOSECONDS_PER_SECOND / s->baud_rate;
@@ -332,7 +368,9 @@ static void esp32_uart_reset(DeviceState *dev)
     s->reg[R_UART_CLKDIV] = FIELD_DP32(0, UART_CLKDIV, CLKDIV, 0x2B6);
     s->baud_rate = 115200;
     fifo8_reset(&s->tx_fifo);
+    fifo8_reset(&s->tx_out);
     fifo8_reset(&s->rx_fifo);
+    qemu_bh_cancel(s->tx_bh);
     if (s->tx_watch_handle) {
         g_source_remove(s->tx_watch_handle);
         s->tx_watch_handle = 0;
@@ -373,14 +411,17 @@ static void esp32_uart_init(Object *obj)
     sysbus_init_mmio(sbd, &s->iomem);
     sysbus_init_irq(sbd, &s->irq);
     fifo8_create(&s->tx_fifo, UART_FIFO_LENGTH);
+    fifo8_create(&s->tx_out, UART_FIFO_LENGTH);
     fifo8_create(&s->rx_fifo, UART_FIFO_LENGTH);
     timer_init_ns(&s->throttle_timer, QEMU_CLOCK_VIRTUAL, uart_throttle_timer_cb, s);
     timer_init_ns(&s->rx_timeout_timer, QEMU_CLOCK_VIRTUAL, uart_rx_timeout_timer_cb, s);
+    s->tx_bh = qemu_bh_new_guarded(uart_tx_bh, s, &DEVICE(obj)->mem_reentrancy_guard);
 }
 
 
 static Property esp32_uart_properties[] = {
     DEFINE_PROP_CHR("chardev", ESP32UARTState, chr),
+    DEFINE_PROP_BOOL("unthrottled", ESP32UARTState, unthrottled, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
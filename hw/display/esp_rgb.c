@@ -19,39 +19,67 @@
 #include "hw/display/esp_rgb.h"
 #include "ui/console.h"
 #include "qemu/error-report.h"
+#include "qemu/crc32c.h"
+#include "hw/qdev-properties.h"
 #include "sysemu/dma.h"
 
 #define RGB_WARNING 1
 #define RGB_DEBUG   0
 
 #define RGB_VERSION_MAJOR 0
-#define RGB_VERSION_MINOR 2
+#define RGB_VERSION_MINOR 3
 
 static void update_rgb_surface(ESPRgbState* s){
     DisplaySurface *surface;
+    pixman_format_code_t format;
+
     switch (s->bpp){
         case BPP_32:
-            surface = qemu_create_displaysurface_from(
-                s->width, s->height,
-                PIXMAN_x8r8g8b8,
-                s->width * 4, NULL
-            );
+            format = PIXMAN_x8r8g8b8;
             break;
         case BPP_16:
-            surface= qemu_create_displaysurface_from(
-                s->width, s->height,
-                PIXMAN_r5g6b5,
-                s->width * 2, NULL
-            );
+            format = PIXMAN_r5g6b5;
             break;
         default:
             warn_report("[ESP RGB] Invalid %d bpp value", s->bpp);
             return;
     }
-    surface->flags = QEMU_ALLOCATED_FLAG;
+
+    if (s->direct) {
+        /* Share the guest VRAM with the console, the window is bounded so that it always fits in it */
+        surface = qemu_create_displaysurface_from(
+            s->width, s->height, format,
+            s->width * (s->bpp / 8), memory_region_get_ram_ptr(&s->vram)
+        );
+        s->full_update = true;
+    } else {
+        surface = qemu_create_displaysurface_from(
+            s->width, s->height, format,
+            s->width * (s->bpp / 8), NULL
+        );
+        surface->flags = QEMU_ALLOCATED_FLAG;
+    }
     dpy_gfx_replace_surface(s->con, surface);
+    s->frame_dirty = true;
 };
 
+
+/**
+ * @brief Switch between the update area protocol and the VRAM backed framebuffer
+ */
+static void rgb_set_direct(ESPRgbState* s, bool direct)
+{
+    if (direct == s->direct) {
+        return;
+    }
+
+    s->direct = direct;
+    s->update_area = false;
+    /* Only track the writes to the VRAM when it is shown on the console */
+    memory_region_set_log(&s->vram, direct, DIRTY_MEMORY_VGA);
+    s->do_update_surface = true;
+}
+
 static uint64_t esp_rgb_read(void *opaque, hwaddr addr, unsigned int size)
 {
     ESPRgbState *s = ESP_RGB(opaque);
@@ -95,6 +123,10 @@ static uint64_t esp_rgb_read(void *opaque, hwaddr addr, unsigned int size)
             r = s->bpp;
             break;
 
+        case A_RGB_FB_CONFIG:
+            r = FIELD_DP32(r, RGB_FB_CONFIG, DIRECT, s->direct);
+            break;
+
         default:
 #if RGB_WARNING
             warn_report("[ESP RGB] Unsupported read to 0x%lx", (unsigned long) addr);
@@ -165,6 +197,10 @@ static void esp_rgb_write(void *opaque, hwaddr addr,
             s->do_update_surface = true;
             break;
 
+        case A_RGB_FB_CONFIG:
+            rgb_set_direct(s, FIELD_EX32(value, RGB_FB_CONFIG, DIRECT) != 0);
+            break;
+
         default:
 #if RGB_WARNING
             warn_report("[ESP RGB] Unsupported write to 0x%lx (%08lx)", (unsigned long) addr, (unsigned long) value);
@@ -175,6 +211,38 @@ static void esp_rgb_write(void *opaque, hwaddr addr,
 }
 
 
+/**
+ * @brief Push the scanlines of the VRAM written since the last update to the console
+ */
+static void rgb_update_direct(ESPRgbState* s)
+{
+    DisplaySurface *surface = qemu_console_surface(s->con);
+    const int stride = surface_stride(surface);
+    const int height = surface_height(surface);
+    DirtyBitmapSnapshot *snap;
+    int first = -1;
+
+    snap = memory_region_snapshot_and_clear_dirty(&s->vram, 0, (hwaddr) stride * height, DIRTY_MEMORY_VGA);
+
+    /* Group the consecutive dirty lines to limit the number of updates sent to the UI */
+    for (int y = 0; y <= height; y++) {
+        const bool dirty = y < height &&
+            (s->full_update || memory_region_snapshot_get_dirty(&s->vram, snap, (hwaddr) y * stride, stride));
+
+        if (dirty && first < 0) {
+            first = y;
+        } else if (!dirty && first >= 0) {
+            dpy_gfx_update(s->con, 0, first, surface_width(surface), y - first);
+            s->frame_dirty = true;
+            first = -1;
+        }
+    }
+
+    s->full_update = false;
+    g_free(snap);
+}
+
+
 static void rgb_update(void* opaque)
 {
     ESPRgbState* s = (ESPRgbState*) opaque;
@@ -184,7 +252,9 @@ static void rgb_update(void* opaque)
         s->do_update_surface = false;
     }
 
-    if (s->con && s->update_area) {
+    if (s->con && s->direct) {
+        rgb_update_direct(s);
+    } else if (s->con && s->update_area) {
         uint32_t src = s->color_content;
         AddressSpace* src_as = NULL;
 
@@ -227,6 +297,7 @@ static void rgb_update(void* opaque)
             }
 
             dpy_gfx_update(s->con, s->from_x, s->from_y, width, height);
+            s->frame_dirty = true;
         }
 #if RGB_WARNING
         else {
@@ -245,15 +316,54 @@ static void rgb_invalidate(void *opaque)
 {
     ESPRgbState* s = (ESPRgbState*) opaque;
 
-    if (s->con) {
-        uint32_t* data = surface_data(qemu_console_surface(s->con));
+    if (s->con && s->direct) {
+        /* The content belongs to the guest, redraw it entirely instead */
+        s->full_update = true;
+    } else if (s->con) {
+        DisplaySurface *surface = qemu_console_surface(s->con);
 
         /* On invalidate, reset the display */
-        memset(data, 0, s->width * s->height * 4);
+        memset(surface_data(surface), 0, surface_stride(surface) * surface_height(surface));
+        s->frame_dirty = true;
     }
 }
 
 
+/**
+ * @brief Headless mode: refresh the surface and log a hash of the window each time its content
+ * changes, so that the rendered frames can be compared without a display backend.
+ */
+static void rgb_hash_timer_cb(void* opaque)
+{
+    ESPRgbState* s = (ESPRgbState*) opaque;
+
+    /* Without a display listener, nothing else refreshes the console */
+    rgb_update(s);
+
+    if (s->frame_dirty) {
+        DisplaySurface *surface = qemu_console_surface(s->con);
+        const uint8_t *data = surface_data(surface);
+        const int line_size = surface_width(surface) * surface_bytes_per_pixel(surface);
+        uint32_t crc = 0xffffffff;
+
+        for (int y = 0; y < surface_height(surface); y++) {
+            crc = crc32c(crc, data + y * surface_stride(surface), line_size);
+        }
+        crc = ~crc;
+        s->frame_dirty = false;
+
+        if (s->frame_count == 0 || crc != s->frame_hash) {
+            s->frame_hash = crc;
+            s->frame_count++;
+            info_report("[ESP RGB] Frame %u: %dx%d, %d bpp, hash %08x", s->frame_count,
+                        surface_width(surface), surface_height(surface), s->bpp, crc);
+        }
+    }
+
+    timer_mod_ns(&s->hash_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + (int64_t) s->hash_interval_ms * SCALE_MS);
+}
+
+
 static const GraphicHwOps fb_ops = {
     .invalidate = rgb_invalidate,
     .gfx_update  = rgb_update
@@ -267,6 +377,10 @@ static void esp_rgb_realize(DeviceState *dev, Error **errp)
     assert(s->intram != NULL);
     /* Create an address space for internal RAM so that we can read data from it on GUI update */
     address_space_init(&s->intram_as, s->intram, "esp.rgb.intram_as");
+
+    if (s->hash_interval_ms != 0) {
+        timer_mod_ns(&s->hash_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + (int64_t) s->hash_interval_ms * SCALE_MS);
+    }
 }
 
 
@@ -306,6 +420,11 @@ static void esp_rgb_init(Object *obj)
 
     /* Create an AddressSpace out of the MemoryRegion to be able to perform DMA */
     address_space_init(&s->vram_as, &s->vram, "esp.rgb.vram_as");
+
+    timer_init_ns(&s->hash_timer, QEMU_CLOCK_VIRTUAL, rgb_hash_timer_cb, s);
+    /* Let the tests retrieve the hash of the last frame through QOM */
+    object_property_add_uint32_ptr(obj, "frame-hash", &s->frame_hash, OBJ_PROP_FLAG_READ);
+    object_property_add_uint32_ptr(obj, "frame-count", &s->frame_count, OBJ_PROP_FLAG_READ);
 }
 
 
@@ -321,15 +440,24 @@ static void esp_rgb_reset(DeviceState *dev)
     s->from_y = 0;
     s->to_x = 0;
     s->to_y = 0;
+    rgb_set_direct(s, false);
 }
 
 
+static Property esp_rgb_properties[] = {
+    /* Period, in virtual milliseconds, at which the window is checked for changes in headless mode */
+    DEFINE_PROP_UINT32("frame-hash-interval", ESPRgbState, hash_interval_ms, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+
 static void esp_rgb_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->reset = esp_rgb_reset;
     dc->realize = esp_rgb_realize;
+    device_class_set_props(dc, esp_rgb_properties);
 }
 
 static const TypeInfo esp_rgb_info = {
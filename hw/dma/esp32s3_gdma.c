@@ -10,41 +10,19 @@
 
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
-#include "sysemu/dma.h"
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/dma/esp32s3_gdma.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/qdev-properties-system.h"
 #include "qemu/error-report.h"
 
 #define GDMA_WARNING 0
 #define GDMA_DEBUG   0
 
-
-/**
- * @brief Structure defining how linked lists are represented in hardware for the GDMA module
- */
-typedef struct GdmaLinkedList {
-    union {
-        struct {
-            uint32_t size: 12;   // Size of the buffer (mainly used in a receive transaction)
-            uint32_t length: 12; // Number of valid bytes in the buffer. In a transmit, written by software.
-                                 // In receive, written by hardware.
-            uint32_t rsvd_24: 4; // Reserved
-            uint32_t err_eof: 1; // Set if received data has errors. Used with UHCI0 only.
-            uint32_t rsvd_29: 1; // Reserved
-            uint32_t suc_eof: 1; // Set if curent node is the last one (of the list). Set by software in a transmit transaction,
-                                 // Set by the hardware in case of a receive transaction.
-            uint32_t owner: 1;   // 0: CPU can access the buffer, 1: GDMA can access the buffer. Cleared automatically
-                                 // by hardware in a transmit descriptor. In a receive descriptor, cleared by hardware
-                                 // only if GDMA_OUT_AUTO_WRBACK_CHn is set to 1.
-        };
-        uint32_t val;
-    } config;
-    uint32_t buf_addr;
-    uint32_t next_addr;
-} GdmaLinkedList;
+QEMU_BUILD_BUG_ON(ESP32S3_GDMA_IN_IDX != ESP_GDMA_IN_IDX || ESP32S3_GDMA_OUT_IDX != ESP_GDMA_OUT_IDX);
+QEMU_BUILD_BUG_ON(ESP32S3_GDMA_CHANNEL_COUNT > ESP_GDMA_MAX_CHANNEL_COUNT);
 
 
 static uint32_t read_addr_word(uint32_t* ptr, uint32_t offset) {
@@ -249,68 +227,61 @@ static void esp32s3_gdma_reset_fifo(ESP32S3GdmaState *s, uint32_t chan, uint32_t
 
 
 /**
- * @brief Read a descriptor from the guest machine
- *
- * @param s GDMA state structure
- * @param addr Guest machine address
- *
- * @returns true if the transfer was a success, false else
- */
-static bool esp32s3_gdma_read_descr(ESP32S3GdmaState *s, uint32_t addr, GdmaLinkedList* out)
-{
-    MemTxResult res = dma_memory_read(&s->dma_as, addr, out, sizeof(GdmaLinkedList), MEMTXATTRS_UNSPECIFIED);
-    return res == MEMTX_OK;
-}
-
-/**
- * @brief Write a descriptor to the guest machine
- *
- * @param s GDMA state structure
- * @param addr Guest machine address
- *
- * @returns true if the transfer was a success, false else
+ * @brief Engine callback, convert the events to interrupt bits and set them.
+ * IN and OUT directions have their own interrupt registers.
  */
-static bool esp32s3_gdma_write_descr(ESP32S3GdmaState *s, uint32_t addr, GdmaLinkedList* in)
+static void esp32s3_gdma_set_events(void *opaque, uint32_t chan, uint32_t events)
 {
-    MemTxResult res = dma_memory_write(&s->dma_as, addr, in, sizeof(GdmaLinkedList), MEMTXATTRS_UNSPECIFIED);
-    return res == MEMTX_OK;
-}
-
-
+    ESP32S3GdmaState *s = ESP32S3_GDMA(opaque);
+    uint32_t in_mask = 0;
+    uint32_t out_mask = 0;
 
-/**
- * @brief Read and write arbitrary data from and to the guest machine
- *
- * @param s GDMA state structure
- * @param addr Guest machine address
- *
- * @returns true if the transfer was a success, false else
- */
-static bool esp32s3_gdma_read_guest(ESP32S3GdmaState *s, uint32_t addr, void* data, uint32_t len)
-{
-    MemTxResult res = dma_memory_read(&s->dma_as, addr, data, len, MEMTXATTRS_UNSPECIFIED);
-    return res == MEMTX_OK;
-}
+    if (events & ESP_GDMA_EVT_IN_DONE) {
+        in_mask |= R_DMA_IN_INT_RAW_CH0_IN_DONE_CH0_INT_RAW_MASK;
+    }
+    if (events & ESP_GDMA_EVT_IN_SUC_EOF) {
+        in_mask |= R_DMA_IN_INT_RAW_CH0_IN_SUC_EOF_CH0_INT_RAW_MASK;
+    }
+    if (events & ESP_GDMA_EVT_IN_DSCR_ERR) {
+        in_mask |= R_DMA_IN_INT_RAW_CH0_IN_DSCR_ERR_CH0_INT_RAW_MASK;
+    }
+    if (events & ESP_GDMA_EVT_IN_DSCR_EMPTY) {
+        in_mask |= R_DMA_IN_INT_RAW_CH0_IN_DSCR_EMPTY_CH0_INT_RAW_MASK;
+    }
+    if (events & ESP_GDMA_EVT_OUT_DONE) {
+        out_mask |= R_DMA_IN_INT_RAW_CH0_OUT_DONE_CH0_INT_RAW_MASK;
+    }
+    if (events & ESP_GDMA_EVT_OUT_EOF) {
+        out_mask |= R_DMA_IN_INT_RAW_CH0_OUT_EOF_CH0_INT_RAW_MASK;
+    }
+    if (events & ESP_GDMA_EVT_OUT_DSCR_ERR) {
+        out_mask |= R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK;
+    }
+    if (events & ESP_GDMA_EVT_OUT_TOTAL_EOF) {
+        out_mask |= R_DMA_IN_INT_RAW_CH0_OUT_TOTAL_EOF_CH0_INT_RAW_MASK;
+    }
 
-static bool esp32s3_gdma_write_guest(ESP32S3GdmaState *s, uint32_t addr, void* data, uint32_t len)
-{
-    MemTxResult res = dma_memory_write(&s->dma_as, addr, data, len, MEMTXATTRS_UNSPECIFIED);
-    return res == MEMTX_OK;
+    if (in_mask) {
+        esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), in_mask);
+    }
+    if (out_mask) {
+        esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), out_mask);
+    }
 }
 
 
 /**
- * @brief Push current node (guest) address in the list of descriptors registers
+ * @brief Engine callback, push current node (guest) address in the list of descriptors registers
  *
- * @param s GDMA state structure
+ * @param opaque GDMA state structure
  * @param chan Channel to update
- * @param chan Direction to update
+ * @param dir Direction to update
  * @param current New node (guest) address to set as the current
+ * @param next Address of the node following `current`
  */
-static void esp32s3_gdma_push_descriptor(ESP32S3GdmaState *s, uint32_t chan, uint32_t dir, uint32_t current)
+static void esp32s3_gdma_push_descriptor(void *opaque, uint32_t chan, uint32_t dir, uint32_t current, uint32_t next)
 {
-    GdmaLinkedList next_node;
-    uint32_t next = 0;
+    ESP32S3GdmaState *s = ESP32S3_GDMA(opaque);
     DmaConfigState* state = &s->ch_conf[chan][dir];
 
     /* Assign the current descriptor address to the state register */
@@ -321,33 +292,27 @@ static void esp32s3_gdma_push_descriptor(ESP32S3GdmaState *s, uint32_t chan, uin
     state->bfr_bfr_desc_addr = state->bfr_desc_addr;
     /* On real hardware, state->bfr_desc_addr is taken from state->desc_addr, even is `current` is valid */
     state->bfr_desc_addr = state->desc_addr;
-
-    /* Get the next address out of the guest RAM */
-    const bool valid = esp32s3_gdma_read_descr(s, current, &next_node);
-    if (valid) {
-        next = next_node.next_addr;
-    }
     state->desc_addr = next;
 }
 
 
-
 /**
- * @brief Jump to the next node list and assign it to the given node
- *
- * @param s GDMA state structure
- * @param node Node to get the next neighbor of
- *
- * @returns true if the next node is valid, false else
+ * @brief Engine callback, store the EOF RX descriptor guest address in the correct register.
  */
-static inline bool esp32s3_gdma_next_list_node(ESP32S3GdmaState *s, uint32_t chan, uint32_t dir, GdmaLinkedList* node)
+static void esp32s3_gdma_in_suc_eof(void *opaque, uint32_t chan, uint32_t addr)
 {
-    const uint32_t current = node->next_addr;
-    esp32s3_gdma_push_descriptor(s, chan, dir, current);
-    return esp32s3_gdma_read_descr(s, current, node);
+    ESP32S3GdmaState *s = ESP32S3_GDMA(opaque);
+    s->ch_conf[chan][ESP32S3_GDMA_IN_IDX].suc_eof_desc_addr = addr;
 }
 
 
+static const EspGdmaOps esp32s3_gdma_engine_ops = {
+    .set_events = esp32s3_gdma_set_events,
+    .push_descriptor = esp32s3_gdma_push_descriptor,
+    .in_suc_eof = esp32s3_gdma_in_suc_eof,
+};
+
+
 /**
  * @brief Get the first descriptor to process when a restart is requested.
  * We need to get the "next" node of the last one processed, which is in `desc_addr` register
@@ -360,7 +325,6 @@ static inline bool esp32s3_gdma_next_list_node(ESP32S3GdmaState *s, uint32_t cha
 static void esp32s3_gdma_get_restart_buffer(ESP32S3GdmaState *s, uint32_t chan, uint32_t dir, uint32_t* out)
 {
     DmaConfigState* state = &s->ch_conf[chan][dir];
-    // GdmaLinkedList* list = NULL;
     /* The next node to use is taken from state->state's lowest 18 bit. Append it to the DRAM address */
     const uint32_t dram_upper_bits = ESP32S3_GDMA_RAM_ADDR & (~R_DMA_OUT_STATE_CH0_OUTLINK_DSCR_ADDR_CH0_MASK);
     const uint32_t guest_addr = dram_upper_bits | FIELD_EX32(state->state, DMA_OUT_STATE_CH0, OUTLINK_DSCR_ADDR_CH0);
@@ -409,104 +373,19 @@ bool esp32s3_gdma_read_channel(ESP32S3GdmaState *s, uint32_t chan, uint8_t* buff
     state->link &= R_DMA_OUT_LINK_CH0_OUTLINK_ADDR_CH0_MASK;
 
     /* Same goes for the status */
-    esp32s3_gdma_clear_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT),   R_DMA_IN_INT_RAW_CH0_OUT_DONE_CH0_INT_RAW_MASK |
-                                                                    R_DMA_IN_INT_RAW_CH0_OUT_EOF_CH0_INT_RAW_MASK);
-
-    /* Get the guest DRAM address */
-    uint32_t out_addr = ((ESP32S3_GDMA_RAM_ADDR >> 20) << 20) | FIELD_EX32(state->link, DMA_OUT_LINK_CH0, OUTLINK_ADDR_CH0);
-
-    /* Boolean to mark whether we need to check the owner for in and out buffers */
-    const bool owner_check_out = FIELD_EX32(state[ESP32S3_GDMA_OUT_IDX].conf1, DMA_OUT_CONF1_CH0, OUT_CHECK_OWNER_CH0);
-
-    /* Boolean to mark whether the transmit (out) buffers must have their owner bit cleared here */
-    const bool clear_out = FIELD_EX32(state[ESP32S3_GDMA_OUT_IDX].conf0, DMA_OUT_CONF0_CH0, OUT_AUTO_WRBACK_CH0);
-
-    /* Pointer to the lists that will be browsed by the loop below */
-    GdmaLinkedList out_list;
-
-    /* Boolean to mark whether a descriptor error occurred during the transfer */
-    bool valid = true;
-
-    /* Set the current buffer (guest address) in the `desc_addr` register */
-    valid = esp32s3_gdma_read_descr(s, out_addr, &out_list);
-    esp32s3_gdma_push_descriptor(s, chan, ESP32S3_GDMA_OUT_IDX, out_addr);
-
-    /* Check that the address is valid. If the owner must be checked, make sure owner is the DMA controller.
-     * On the real hardware, both in and out are checked at the same time, so in case of an error, both bits
-     * are set. Replicate the same behavior here. */
-    if ( !valid || (owner_check_out && !out_list.config.owner) ) {
-        esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK);
-        return false;
-    }
-
-    /* Store the current number of bytes written to `buffer` parameter */
-    uint32_t consumed = 0;
-    bool exit_loop = false;
-    bool error = false;
-
-    while (!exit_loop && !error) {
-        /* Calculate the number of bytes to read from the OUT channel */
-        const uint32_t remaining = size - consumed;
-        const uint32_t min = MIN(out_list.config.length, remaining);
-
-        valid = esp32s3_gdma_read_guest(s, out_list.buf_addr, buffer + consumed, min);
-        if (!valid) {
-            esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK);
-            error = true;
-            break;
-        }
-        consumed += min;
-
-        if (consumed == size) {
-            exit_loop = true;
-        }
-
-        /* If we reached the end of the TX descriptor, we can jump to the next buffer */
-        if (min == out_list.config.length) {
-
-            /* Before jumping to the next node, clear the owner bit if needed */
-            if (clear_out) {
-                out_list.config.owner = 0;
-
-                /* Write back the modified descriptor, should always be valid */
-                valid = esp32s3_gdma_read_descr(s, out_addr, &out_list);
-                assert(valid);
-            }
-
-            const bool eof_bit = out_list.config.suc_eof;
-
-            /* Retrieve the next node  while updating the virtual guest address */
-            out_addr = out_list.next_addr;
-            valid = esp32s3_gdma_next_list_node(s, chan, ESP32S3_GDMA_OUT_IDX, &out_list);
-
-            /* Only check the valid flag and the owner if we don't have to exit the loop*/
-            if ( !exit_loop && (!valid || (owner_check_out && !out_list.config.owner)) ) {
-                esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK);
-                error = true;
-            }
-
-            /* If the EOF bit was set, the real controller doesn't stop the transfer, it simply
-             * sets the status accordingly (and generates an interrupt if enabled) */
-            if (eof_bit) {
-                esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_EOF_CH0_INT_RAW_MASK |
-                                                 R_DMA_IN_INT_RAW_CH0_OUT_TOTAL_EOF_CH0_INT_RAW_MASK);
-            }
-        }
-    }
-
-    /* Check if all the bytes were sent successfully */
-    if (exit_loop && consumed != size) {
-        /* TODO: which error should be triggered ?*/
-        esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK);
-        error = true;
-    }
-
-    if (!error) {
-        /* Set the transfer as completed. EOF should have already been triggered within the loop */
-        esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DONE_CH0_INT_RAW_MASK);
-    }
+    esp32s3_gdma_clear_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DONE_CH0_INT_RAW_MASK |
+                                                                  R_DMA_IN_INT_RAW_CH0_OUT_EOF_CH0_INT_RAW_MASK);
+
+    const EspGdmaLinkConfig conf = {
+        /* Get the guest DRAM address */
+        .out_addr = ((ESP32S3_GDMA_RAM_ADDR >> 20) << 20) | FIELD_EX32(state->link, DMA_OUT_LINK_CH0, OUTLINK_ADDR_CH0),
+        /* Boolean to mark whether we need to check the owner for out buffers */
+        .owner_check_out = FIELD_EX32(state->conf1, DMA_OUT_CONF1_CH0, OUT_CHECK_OWNER_CH0),
+        /* Boolean to mark whether the transmit (out) buffers must have their owner bit cleared here */
+        .clear_out = FIELD_EX32(state->conf0, DMA_OUT_CONF0_CH0, OUT_AUTO_WRBACK_CH0),
+    };
 
-    return !error;
+    return esp_gdma_read_channel(&s->engine, chan, &conf, buffer, size);
 }
 
 
@@ -523,118 +402,16 @@ bool esp32s3_gdma_write_channel(ESP32S3GdmaState *s, uint32_t chan, uint8_t* buf
 
     /* Same goes for the status */
     esp32s3_gdma_clear_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DONE_CH0_INT_RAW_MASK  |
-                                       R_DMA_IN_INT_RAW_CH0_IN_SUC_EOF_CH0_INT_RAW_MASK);
-
-    /* Get highest 12 bits of the DRAM address */
-    uint32_t in_addr = ((ESP32S3_GDMA_RAM_ADDR >> 20) << 20) | FIELD_EX32(state->link, DMA_IN_LINK_CH0, INLINK_ADDR_CH0);
-
-    /* Boolean to mark whether we need to check the owner for in buffers */
-    const bool owner_check_in = FIELD_EX32(state->conf1, DMA_IN_CONF1_CH0, IN_CHECK_OWNER_CH0);
-
-    /* Pointer to the lists that will be browsed by the loop below */
-    GdmaLinkedList in_list = { 0 };
-    /* Boolean to mark whether a descriptor error occurred during the transfer */
-    bool valid = true;
-
-    valid = esp32s3_gdma_read_descr(s, in_addr, &in_list);
-    esp32s3_gdma_push_descriptor(s, chan, ESP32S3_GDMA_IN_IDX, in_addr);
-
-    if ( !valid || (owner_check_in && !in_list.config.owner) ) {
-        esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DSCR_ERR_CH0_INT_RAW_MASK);
-        return false;
-    }
-
-    /* Clear the number of bytes written to the "in" buffer and the owner */
-    in_list.config.length = 0;
-
-    uint32_t consumed = 0;
-    bool exit_loop = false;
-    bool error = false;
-
-    while (!exit_loop && !error) {
-
-        /* Calculate the number of bytes to write to the in channel */
-        const uint32_t remaining = size - consumed;
-        const uint32_t min = MIN(in_list.config.size, remaining);
-
-        /* Perform the actual copy, the in buffer address will always be at the beginning because the data
-         * to write to it are contiguous (`buffer` parameter) */
-        valid = esp32s3_gdma_write_guest(s, in_list.buf_addr, buffer + consumed, min);
-        if (!valid) {
-            esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DSCR_ERR_CH0_INT_RAW_MASK);
-            error = true;
-        }
-
-        /* Update the number of bytes written to the "in" buffer */
-        in_list.config.length += min;
-        consumed += min;
-
-        if (size == consumed) {
-            exit_loop = true;
-        }
-
-        /* If we reached the end of the "node", go to the next one */
-        if (in_list.config.size == in_list.config.length) {
-            /* Clear the owner bit, set the length to the maximum bytes readable */
-            in_list.config.owner = 0;
-
-            /* During peripheral-to-memory transfers, the eof bit is only used to set a status bit, and generate
-             * an interrupt if enabled. If we still have bytes to send, we won't stop the transfer.
-             * In all cases, reset this bit as it must be only set at the end of the buffer. */
-            if (in_list.config.suc_eof) {
-                in_list.config.suc_eof = 0;
-                esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_SUC_EOF_CH0_INT_RAW_MASK);
-            }
-
-            /* Write back the IN node to guest RAM */
-            valid = esp32s3_gdma_write_descr(s, in_addr, &in_list);
-            assert(valid);
-
-            /* Get the next virtual address before replacing the current list node content */
-            const uint32_t next_addr = in_list.next_addr;
-
-            /* Even if we have to exit the loop, we still have to push the next address to the descriptors stack */
-            if (exit_loop) {
-                esp32s3_gdma_push_descriptor(s, chan, ESP32S3_GDMA_IN_IDX, next_addr);
-                break;
-            }
-
-            /* In the case where the transfer is finished, we should still fetch the next node,
-             * but we should not override the current in_list variable as it is used outside the loop
-             * to reset the owner and update the suc_eof flag */
-            valid = esp32s3_gdma_next_list_node(s, chan, ESP32S3_GDMA_IN_IDX, &in_list);
-
-            if (!valid || (owner_check_in && !in_list.config.owner)) {
-                /* Check the validity of the next node if we have to continue the loop (transfer finished) */
-                esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DSCR_ERR_CH0_INT_RAW_MASK);
-                error = true;
-            } else {
-                /* Continue the loop normally, next RX descriptor set to current */
-                in_list.config.length = 0;
-
-                /* Update the current in guest address */
-                in_addr = next_addr;
-            }
-        }
-    }
-
-    if (!error) {
-        /* In all cases (error or not), let's set the End-of-list in the receiver */
-        in_list.config.suc_eof = 1;
-        in_list.config.owner = 0;
+                                                                 R_DMA_IN_INT_RAW_CH0_IN_SUC_EOF_CH0_INT_RAW_MASK);
 
-        valid = esp32s3_gdma_write_descr(s, in_addr, &in_list);
-        assert(valid);
-
-        /* And store the EOF RX descriptor GUEST address in the correct register.
-         * This can be used in the ISR to know which buffer has just been processed. */
-        state->suc_eof_desc_addr = in_addr;
-
-        /* Set the transfer as completed for both the IN and OUT link */
-        esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DONE_CH0_INT_RAW_MASK);
-    }
+    const EspGdmaLinkConfig conf = {
+        /* Get highest 12 bits of the DRAM address */
+        .in_addr = ((ESP32S3_GDMA_RAM_ADDR >> 20) << 20) | FIELD_EX32(state->link, DMA_IN_LINK_CH0, INLINK_ADDR_CH0),
+        /* Boolean to mark whether we need to check the owner for in buffers */
+        .owner_check_in = FIELD_EX32(state->conf1, DMA_IN_CONF1_CH0, IN_CHECK_OWNER_CH0),
+    };
 
-    return !error;
+    return esp_gdma_write_channel(&s->engine, chan, &conf, buffer, size);
 }
 
 
@@ -691,181 +468,18 @@ static void esp32s3_gdma_check_and_start_mem_transfer(ESP32S3GdmaState *s, uint3
             esp32s3_gdma_get_restart_buffer(s, chan, ESP32S3_GDMA_IN_IDX, &in_addr);
         }
 
-        /* Boolean to mark whether we need to check the owner for in and out buffers */
-        const bool owner_check_out = FIELD_EX32(state[ESP32S3_GDMA_OUT_IDX].conf1, DMA_OUT_CONF1_CH0, OUT_CHECK_OWNER_CH0);
-        const bool owner_check_in = FIELD_EX32(state[ESP32S3_GDMA_IN_IDX].conf1, DMA_IN_CONF1_CH0, IN_CHECK_OWNER_CH0);
-        /* Boolean to mark whether the transmit (out) buffers must have their owner bit cleared here */
-        const bool clear_out = FIELD_EX32(state[ESP32S3_GDMA_OUT_IDX].conf0, DMA_OUT_CONF0_CH0, OUT_AUTO_WRBACK_CH0);
-
-        /* Pointer to the lists that will be browsed by the loop below */
-        GdmaLinkedList out_list = { 0 };
-        GdmaLinkedList in_list = { 0 };
-        /* Boolean to mark whether a descriptor error occurred during the transfer */
-        bool valid = true;
-        bool error = false;
-
-        /* Get the content of the descriptor located at guest address out_addr */
-        valid = esp32s3_gdma_read_descr(s, out_addr, &out_list);
-        esp32s3_gdma_push_descriptor(s, chan, ESP32S3_GDMA_OUT_IDX, out_addr);
-
-        /* Check that the address is valid. If the owner must be checked, make sure owner is the DMA controller.
-         * On the real hardware, both in and out are checked at the same time, so in case of an error, both bits
-         * are set. Replicate the same behavior here. */
-        if ( !valid || (owner_check_out && !out_list.config.owner) ) {
-            /* In case of an error, go directly to the next node (as the C3 hardware does) */
-            esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK);
-            error = true;
-        }
-
-        valid = esp32s3_gdma_read_descr(s, in_addr, &in_list);
-        esp32s3_gdma_push_descriptor(s, chan, ESP32S3_GDMA_IN_IDX, in_addr);
-
-        if ( !valid || (owner_check_in && !in_list.config.owner) ) {
-            esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DSCR_ERR_CH0_INT_RAW_MASK);
-            error = true;
-        }
-
-        /* If any of the error bit has been set, return directly */
-        if (error) {
-            return;
-        }
-
-        /* Clear the number of bytes written to the "in" buffer and the owner */
-        in_list.config.length = 0;
-
-        /* Number of bytes remaining in the current "out" buffer */
-        uint32_t remaining = out_list.config.length;
-        /* Store the current number of bytes consumed in the "out" buffer */
-        uint32_t consumed = 0;
-
-        bool exit_loop = false;
-
-        /* Allocate a temporary buffer big enough to store any descriptor data */
-        void* tmp_buffer = g_malloc(4096 * sizeof(uint8_t));
-        if (tmp_buffer == NULL) {
-            error_report("[GDMA] No more memory in host\n");
-            return;
-        }
-
-        while (!exit_loop && !error) {
-
-            /* Calculate the number of bytes to send to the in channel */
-            const uint32_t min = MIN(in_list.config.size, out_list.config.length);
-
-            /* Perform the actual copy, for the same reasons as stated above, use the error boolean */
-            valid = esp32s3_gdma_read_guest(s, out_list.buf_addr + consumed, tmp_buffer, min);
-            if (!valid) {
-                esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK);
-                error = true;
-            }
-            valid = esp32s3_gdma_write_guest(s, in_list.buf_addr + in_list.config.length, tmp_buffer, min);
-            if (!valid) {
-                esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DSCR_ERR_CH0_INT_RAW_MASK);
-                error = true;
-            }
-
-            /* Update the number of bytes written to the "in" buffer */
-            in_list.config.length += min;
-            consumed += min;
-
-            /* Even if we reached the end of the TX descriptor, we still have to update RX descriptors
-             * and registers, use `exit_loop` instead of break or return */
-            /* If we don't have any more bytes in the "out" buffer, we can skip to the next buffer */
-            if (remaining == consumed) {
-                /* Before jumping to the next node, clear the owner bit */
-                if (clear_out) {
-                    out_list.config.owner = 0;
-                    /* Write back the modified descriptor, should always be valid */
-                    valid = esp32s3_gdma_write_descr(s, out_addr, &out_list);
-                    assert(valid);
-                }
-                exit_loop = out_list.config.suc_eof ? true : false;
-
-                const uint32_t next_addr = out_list.next_addr;
-                valid = esp32s3_gdma_next_list_node(s, chan, ESP32S3_GDMA_OUT_IDX, &out_list);
-
-                /* Only check the valid flag and the owner if we don't have to exit the loop*/
-                if ( !exit_loop && (!valid || (owner_check_out && !out_list.config.owner)) ) {
-                    esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_OUT_DSCR_ERR_CH0_INT_RAW_MASK);
-                    error = true;
-                } else {
-                    /* Update "remaining" with the number of bytes to transfer from the new buffer */
-                    out_addr = next_addr;
-                    remaining = out_list.config.length;
-                    consumed = 0;
-                }
-            }
-
-
-            /* If we reached the end of the "node", go to the next one */
-            if (in_list.config.size == in_list.config.length) {
-
-                in_list.config.owner = 0;
-
-                /* Write back the IN node to guest RAM */
-                valid = esp32s3_gdma_write_descr(s, in_addr, &in_list);
-                assert(valid);
-
-                /* Check that we do have more "in" buffers, if that's not the case, raise an error..
-                 * TODO: Check if the behavior is the same as Peripheral-to-Memory transfers, where
-                 * this bit is only used to generate and interrupt. */
-                if (!exit_loop && in_list.config.suc_eof) {
-                    esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DSCR_EMPTY_CH0_INT_RAW_MASK);
-                    error = true;
-                    break;
-                }
-
-                const uint32_t next_addr = in_list.next_addr;
-
-                /* In the case where the transfer is finished, we should still "push" the next node
-                 * to our descriptors stack, but we should not modify the structure itself as we will
-                 * reset the owner and update the suc_eof flag */
-                if (exit_loop) {
-                    esp32s3_gdma_push_descriptor(s, chan, ESP32S3_GDMA_IN_IDX, next_addr);
-                    break;
-                }
-
-                /* We have to continue the loop, so fetch the next node, it will also update the descriptors stack */
-                valid = esp32s3_gdma_next_list_node(s, chan, ESP32S3_GDMA_IN_IDX, &in_list);
-
-                /* Check the validity of the next node if we have to continue the loop (transfer finished) */
-                if (!valid || (owner_check_in && !in_list.config.owner)) {
-                    esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), R_DMA_IN_INT_RAW_CH0_IN_DSCR_ERR_CH0_INT_RAW_MASK);
-                    error = true;
-                } else {
-                    /* Continue the loop normally, next RX descriptor set to current */
-                    in_list.config.length = 0;
-
-                    /* Update the current in guest address */
-                    in_addr = next_addr;
-                }
-            }
-
-        }
-
-        if (!error) {
-            /* In all cases (error or not), let's set the End-of-list in the receiver */
-            in_list.config.suc_eof = 1;
-            in_list.config.owner = 0;
-
-            /* Write back the previous changes */
-            valid = esp32s3_gdma_write_descr(s, in_addr, &in_list);
-            assert(valid);
-
-            /* And store the EOF RX descriptor GUEST address in the correct register.
-             * This can be used in the ISR to know which buffer has just been processed. */
-            state[ESP32S3_GDMA_IN_IDX].suc_eof_desc_addr = in_addr;
-
-            /* Set the transfer as completed for both the IN and OUT link */
-            esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_IN_IDX*ESP32S3_GDMA_CHANNEL_COUNT), 
-                                             R_DMA_IN_INT_RAW_CH0_IN_DONE_CH0_INT_RAW_MASK  |
-                                             R_DMA_IN_INT_RAW_CH0_IN_SUC_EOF_CH0_INT_RAW_MASK);
-            esp32s3_gdma_set_status(s, (chan + ESP32S3_GDMA_OUT_IDX*ESP32S3_GDMA_CHANNEL_COUNT), 
-                                             R_DMA_IN_INT_RAW_CH0_OUT_DONE_CH0_INT_RAW_MASK |
-                                             R_DMA_IN_INT_RAW_CH0_OUT_EOF_CH0_INT_RAW_MASK);
-        }
+        const EspGdmaLinkConfig conf = {
+            .in_addr = in_addr,
+            .out_addr = out_addr,
+            /* Boolean to mark whether we need to check the owner for in and out buffers */
+            .owner_check_out = FIELD_EX32(state[ESP32S3_GDMA_OUT_IDX].conf1, DMA_OUT_CONF1_CH0, OUT_CHECK_OWNER_CH0),
+            .owner_check_in = FIELD_EX32(state[ESP32S3_GDMA_IN_IDX].conf1, DMA_IN_CONF1_CH0, IN_CHECK_OWNER_CH0),
+            /* Boolean to mark whether the transmit (out) buffers must have their owner bit cleared here */
+            .clear_out = FIELD_EX32(state[ESP32S3_GDMA_OUT_IDX].conf0, DMA_OUT_CONF0_CH0, OUT_AUTO_WRBACK_CH0),
+        };
 
-        g_free(tmp_buffer);
+        /* The descriptors are processed in the background, the interrupts will be triggered by the engine */
+        esp_gdma_start_mem_transfer(&s->engine, chan, &conf);
     }
 }
 
@@ -1082,8 +696,58 @@ static const MemoryRegionOps esp32s3_gdma_ops = {
 };
 
 
+static const VMStateDescription vmstate_esp32s3_gdma_int = {
+    .name = "esp32s3_gdma/int",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(raw, DmaIntState),
+        VMSTATE_UINT32(st, DmaIntState),
+        VMSTATE_UINT32(ena, DmaIntState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32s3_gdma_conf = {
+    .name = "esp32s3_gdma/conf",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(conf0, DmaConfigState),
+        VMSTATE_UINT32(conf1, DmaConfigState),
+        VMSTATE_UINT32(status, DmaConfigState),
+        VMSTATE_UINT32(push_pop, DmaConfigState),
+        VMSTATE_UINT32(link, DmaConfigState),
+        VMSTATE_UINT32(state, DmaConfigState),
+        VMSTATE_UINT32(suc_eof_desc_addr, DmaConfigState),
+        VMSTATE_UINT32(err_eof_desc_addr, DmaConfigState),
+        VMSTATE_UINT32(desc_addr, DmaConfigState),
+        VMSTATE_UINT32(bfr_desc_addr, DmaConfigState),
+        VMSTATE_UINT32(bfr_bfr_desc_addr, DmaConfigState),
+        VMSTATE_UINT32(priority, DmaConfigState),
+        VMSTATE_UINT32(peripheral, DmaConfigState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32s3_gdma = {
+    .name = "esp32s3_gdma",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(ch_int, ESP32S3GdmaState, ESP32S3_GDMA_CHANNEL_COUNT * 2, 1,
+                             vmstate_esp32s3_gdma_int, DmaIntState),
+        VMSTATE_STRUCT_2DARRAY(ch_conf, ESP32S3GdmaState, ESP32S3_GDMA_CHANNEL_COUNT, ESP32S3_GDMA_CONF_COUNT, 1,
+                               vmstate_esp32s3_gdma_conf, DmaConfigState),
+        VMSTATE_UINT32(misc_conf, ESP32S3GdmaState),
+        VMSTATE_ESP_GDMA(engine, ESP32S3GdmaState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32s3_gdma_properties[] = {
     DEFINE_PROP_LINK("soc_mr", ESP32S3GdmaState, soc_mr, TYPE_MEMORY_REGION, MemoryRegion*),
+    DEFINE_PROP_UINT64("bandwidth", ESP32S3GdmaState, engine.bandwidth, ESP_GDMA_DEFAULT_BANDWIDTH),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -1091,6 +755,7 @@ static Property esp32s3_gdma_properties[] = {
 static void esp32s3_gdma_reset(DeviceState *dev)
 {
     ESP32S3GdmaState *s = ESP32S3_GDMA(dev);
+    esp_gdma_reset(&s->engine);
     memset(s->ch_int, 0, sizeof(s->ch_int));
     memset(s->ch_conf, 0, sizeof(s->ch_conf));
     s->misc_conf = 0;
@@ -1116,6 +781,16 @@ static void esp32s3_gdma_realize(DeviceState *dev, Error **errp)
     assert(s->soc_mr != NULL);
 
     address_space_init(&s->dma_as, s->soc_mr, "esp32s3.gdma");
+    esp_gdma_realize(&s->engine);
+}
+
+
+static void esp32s3_gdma_unrealize(DeviceState *dev)
+{
+    ESP32S3GdmaState *s = ESP32S3_GDMA(dev);
+
+    esp_gdma_unrealize(&s->engine);
+    address_space_destroy(&s->dma_as);
 }
 
 
@@ -1132,6 +807,8 @@ static void esp32s3_gdma_init(Object *obj)
         sysbus_init_irq(sbd, &s->irq[i]);
     }
 
+    esp_gdma_init(&s->engine, ESP32S3_GDMA_CHANNEL_COUNT, &s->dma_as, &esp32s3_gdma_engine_ops, s);
+
     esp32s3_gdma_reset((DeviceState*) s);
 }
 
@@ -1142,6 +819,8 @@ static void esp32s3_gdma_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32s3_gdma_reset;
     dc->realize = esp32s3_gdma_realize;
+    dc->unrealize = esp32s3_gdma_unrealize;
+    dc->vmsd = &vmstate_esp32s3_gdma;
     device_class_set_props(dc, esp32s3_gdma_properties);
 }
 
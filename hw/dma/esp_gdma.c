@@ -0,0 +1,764 @@
+/*
+ * GDMA engine shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "sysemu/dma.h"
+#include "migration/vmstate.h"
+#include "hw/dma/esp_gdma.h"
+
+#define GDMA_DEBUG   0
+
+
+/**
+ * @brief Get the cache entry a descriptor address maps to. Descriptors are word-aligned and 12-byte long,
+ * so consecutive descriptors of a chain land in different entries.
+ */
+static EspGdmaDescrCacheEntry *esp_gdma_descr_cache_entry(EspGdmaChannel *ch, uint32_t addr)
+{
+    return &ch->descr_cache[(addr >> 2) % ESP_GDMA_DESCR_CACHE_SIZE];
+}
+
+
+static void esp_gdma_descr_cache_flush(EspGdma *g)
+{
+    for (uint32_t chan = 0; chan < g->channel_count; chan++) {
+        for (int i = 0; i < ESP_GDMA_DESCR_CACHE_SIZE; i++) {
+            EspGdmaDescrCacheEntry *entry = &g->channels[chan].descr_cache[i];
+            if (entry->valid) {
+                address_space_cache_destroy(&entry->mrc);
+                entry->valid = false;
+            }
+        }
+    }
+    g->descr_cache_stale = false;
+}
+
+
+/**
+ * @brief The memory map changed, the cached translations may refer to regions that moved or vanished.
+ * They are only dropped on the next descriptor access, to keep the memory transaction cheap.
+ */
+static void esp_gdma_memory_commit(MemoryListener *listener)
+{
+    EspGdma *g = container_of(listener, EspGdma, listener);
+    g->descr_cache_stale = true;
+}
+
+
+/**
+ * @brief Get the translation of the descriptor at the given guest address, creating it if needed
+ *
+ * @returns the region cache covering the whole descriptor, NULL if the descriptor crosses a region boundary
+ */
+static MemoryRegionCache *esp_gdma_descr_cache_lookup(EspGdma *g, uint32_t chan, uint32_t addr)
+{
+    EspGdmaDescrCacheEntry *entry = esp_gdma_descr_cache_entry(&g->channels[chan], addr);
+
+    if (g->descr_cache_stale) {
+        esp_gdma_descr_cache_flush(g);
+    }
+
+    if (entry->valid) {
+        if (entry->addr == addr) {
+            return &entry->mrc;
+        }
+        address_space_cache_destroy(&entry->mrc);
+        entry->valid = false;
+    }
+
+    /* Descriptors are written back by the engine, prepare the cache for both directions */
+    if (address_space_cache_init(&entry->mrc, g->as, addr, sizeof(EspGdmaDescriptor), true)
+        < (int64_t) sizeof(EspGdmaDescriptor)) {
+        address_space_cache_destroy(&entry->mrc);
+        return NULL;
+    }
+
+    entry->valid = true;
+    entry->addr = addr;
+    return &entry->mrc;
+}
+
+
+/**
+ * @brief Read a descriptor from the guest machine, through its cached translation when possible
+ *
+ * @param g GDMA engine
+ * @param chan Channel accessing the descriptor, each channel has its own translations
+ * @param addr Guest machine address
+ *
+ * @returns true if the transfer was a success, false else
+ */
+static bool esp_gdma_read_descr(EspGdma *g, uint32_t chan, uint32_t addr, EspGdmaDescriptor *out)
+{
+    MemoryRegionCache *mrc = esp_gdma_descr_cache_lookup(g, chan, addr);
+    MemTxResult res;
+
+    if (mrc != NULL) {
+        res = address_space_read_cached(mrc, 0, out, sizeof(EspGdmaDescriptor));
+    } else {
+        res = dma_memory_read(g->as, addr, out, sizeof(EspGdmaDescriptor), MEMTXATTRS_UNSPECIFIED);
+    }
+    return res == MEMTX_OK;
+}
+
+
+/**
+ * @brief Write a descriptor to the guest machine, through its cached translation when possible
+ *
+ * @param g GDMA engine
+ * @param chan Channel accessing the descriptor, each channel has its own translations
+ * @param addr Guest machine address
+ *
+ * @returns true if the transfer was a success, false else
+ */
+static bool esp_gdma_write_descr(EspGdma *g, uint32_t chan, uint32_t addr, EspGdmaDescriptor *in)
+{
+    MemoryRegionCache *mrc = esp_gdma_descr_cache_lookup(g, chan, addr);
+    MemTxResult res;
+
+    if (mrc != NULL) {
+        res = address_space_write_cached(mrc, 0, in, sizeof(EspGdmaDescriptor));
+        /* Mark the page dirty and drop any translated code it contains */
+        address_space_cache_invalidate(mrc, 0, sizeof(EspGdmaDescriptor));
+    } else {
+        res = dma_memory_write(g->as, addr, in, sizeof(EspGdmaDescriptor), MEMTXATTRS_UNSPECIFIED);
+    }
+    return res == MEMTX_OK;
+}
+
+
+static bool esp_gdma_read_guest(EspGdma *g, uint32_t addr, void *data, uint32_t len)
+{
+    MemTxResult res = dma_memory_read(g->as, addr, data, len, MEMTXATTRS_UNSPECIFIED);
+    return res == MEMTX_OK;
+}
+
+
+static bool esp_gdma_write_guest(EspGdma *g, uint32_t addr, const void *data, uint32_t len)
+{
+    MemTxResult res = dma_memory_write(g->as, addr, data, len, MEMTXATTRS_UNSPECIFIED);
+    return res == MEMTX_OK;
+}
+
+
+/**
+ * @brief Check whether the `len` bytes at guest address `addr` are in a single RAM region that can be
+ * mapped in place
+ */
+static bool esp_gdma_is_ram(EspGdma *g, uint32_t addr, uint32_t len, bool is_write)
+{
+    hwaddr xlat;
+    hwaddr xlat_len = len;
+
+    RCU_READ_LOCK_GUARD();
+    MemoryRegion *mr = address_space_translate(g->as, addr, &xlat, &xlat_len, is_write,
+                                               MEMTXATTRS_UNSPECIFIED);
+    return xlat_len == len && memory_access_is_direct(mr, is_write);
+}
+
+
+/**
+ * @brief Copy `len` bytes from guest address `src` to guest address `dst`. Each buffer that is in RAM
+ * is mapped and accessed directly, the others go through a bounce buffer, so that the source is only
+ * read once, even when it is an MMIO region.
+ *
+ * @returns true if the copy was a success, false else
+ */
+static bool esp_gdma_copy_guest(EspGdma *g, uint32_t dst, uint32_t src, uint32_t len)
+{
+    hwaddr src_len = len;
+    hwaddr dst_len = len;
+    hwaddr src_used = 0;
+    hwaddr dst_used = 0;
+    bool success = true;
+    /* A descriptor buffer is at most 4095 bytes big, a burst is even smaller */
+    uint8_t bounce[ESP_GDMA_BURST_SIZE];
+    const void *data = bounce;
+
+    if (len == 0) {
+        return true;
+    }
+    assert(len <= sizeof(bounce));
+
+    /* Only RAM is mapped in place, anything else would be read (or written) once more by the bounce
+     * buffer of address_space_map() on top of the accesses below */
+    void *src_ptr = NULL;
+    void *dst_ptr = NULL;
+    if (esp_gdma_is_ram(g, src, len, false)) {
+        src_ptr = address_space_map(g->as, src, &src_len, false, MEMTXATTRS_UNSPECIFIED);
+    }
+    if (esp_gdma_is_ram(g, dst, len, true)) {
+        dst_ptr = address_space_map(g->as, dst, &dst_len, true, MEMTXATTRS_UNSPECIFIED);
+    }
+
+    if (src_ptr != NULL && src_len == len) {
+        data = src_ptr;
+        src_used = len;
+    } else {
+        success = esp_gdma_read_guest(g, src, bounce, len);
+    }
+
+    if (success) {
+        if (dst_ptr != NULL && dst_len == len) {
+            memmove(dst_ptr, data, len);
+            dst_used = len;
+        } else {
+            success = esp_gdma_write_guest(g, dst, data, len);
+        }
+    }
+
+    if (dst_ptr != NULL) {
+        address_space_unmap(g->as, dst_ptr, dst_len, true, dst_used);
+    }
+    if (src_ptr != NULL) {
+        address_space_unmap(g->as, src_ptr, src_len, false, src_used);
+    }
+
+    return success;
+}
+
+
+/**
+ * @brief Notify the model that the descriptor at guest address `current` is now the one being processed
+ */
+static void esp_gdma_push_descriptor(EspGdma *g, uint32_t chan, uint32_t dir, uint32_t current)
+{
+    EspGdmaDescriptor node;
+    uint32_t next = 0;
+
+    /* Get the next address out of the guest RAM */
+    if (esp_gdma_read_descr(g, chan, current, &node)) {
+        next = node.next_addr;
+    }
+    g->ops->push_descriptor(g->opaque, chan, dir, current, next);
+}
+
+
+/**
+ * @brief Jump to the next node list and assign it to the given node
+ *
+ * @returns true if the next node is valid, false else
+ */
+static bool esp_gdma_next_list_node(EspGdma *g, uint32_t chan, uint32_t dir, EspGdmaDescriptor *node)
+{
+    const uint32_t current = node->next_addr;
+    esp_gdma_push_descriptor(g, chan, dir, current);
+    return esp_gdma_read_descr(g, chan, current, node);
+}
+
+
+/**
+ * @brief Process up to ESP_GDMA_BURST_SIZE bytes of the memory-to-memory transfer in progress.
+ * The events generated are accumulated in the channel's `pending_events`.
+ *
+ * @returns the number of bytes that went through the bus, including the descriptors
+ */
+static uint32_t esp_gdma_mem_transfer_burst(EspGdmaChannel *ch)
+{
+    EspGdma *g = ch->gdma;
+    const uint32_t chan = ch->index;
+    EspGdmaLinkConfig *conf = &ch->conf;
+    EspGdmaDescriptor *out_list = &ch->out_list;
+    EspGdmaDescriptor *in_list = &ch->in_list;
+    uint32_t bytes = 0;
+    bool exit_loop = false;
+    bool error = false;
+    bool valid;
+
+    while (!exit_loop && !error && bytes < ESP_GDMA_BURST_SIZE) {
+        /* Calculate the number of bytes to send to the in channel */
+        const uint32_t min = MIN(MIN(in_list->config.size - in_list->config.length,
+                                     out_list->config.length - ch->consumed),
+                                 ESP_GDMA_BURST_SIZE - bytes);
+
+        valid = esp_gdma_copy_guest(g, in_list->buf_addr + in_list->config.length,
+                                    out_list->buf_addr + ch->consumed, min);
+        if (!valid) {
+            ch->pending_events |= ESP_GDMA_EVT_OUT_DSCR_ERR | ESP_GDMA_EVT_IN_DSCR_ERR;
+            error = true;
+            break;
+        }
+
+        /* Update the number of bytes written to the "in" buffer */
+        in_list->config.length += min;
+        ch->consumed += min;
+        bytes += min;
+
+        /* Even if we reached the end of the TX descriptor, we still have to update RX descriptors
+         * and registers, use `exit_loop` instead of break or return */
+        /* If we don't have any more bytes in the "out" buffer, we can skip to the next buffer */
+        if (ch->consumed == out_list->config.length) {
+            /* Before jumping to the next node, clear the owner bit */
+            if (conf->clear_out) {
+                out_list->config.owner = 0;
+                /* Write back the modified descriptor, should always be valid */
+                valid = esp_gdma_write_descr(g, chan, conf->out_addr, out_list);
+                assert(valid);
+            }
+            exit_loop = out_list->config.suc_eof ? true : false;
+
+            const uint32_t next_addr = out_list->next_addr;
+            valid = esp_gdma_next_list_node(g, chan, ESP_GDMA_OUT_IDX, out_list);
+            bytes += sizeof(EspGdmaDescriptor);
+
+            /* Only check the valid flag and the owner if we don't have to exit the loop */
+            if (!exit_loop && (!valid || (conf->owner_check_out && !out_list->config.owner))) {
+                ch->pending_events |= ESP_GDMA_EVT_OUT_DSCR_ERR;
+                error = true;
+                break;
+            }
+
+            conf->out_addr = next_addr;
+            ch->consumed = 0;
+        }
+
+        /* If we reached the end of the "node", go to the next one */
+        if (in_list->config.size == in_list->config.length) {
+            in_list->config.owner = 0;
+
+            /* Write back the IN node to guest RAM */
+            valid = esp_gdma_write_descr(g, chan, conf->in_addr, in_list);
+            assert(valid);
+
+            /* Check that we do have more "in" buffers, if that's not the case, raise an error..
+             * TODO: Check if the behavior is the same as Peripheral-to-Memory transfers, where
+             * this bit is only used to generate and interrupt. */
+            if (!exit_loop && in_list->config.suc_eof) {
+                ch->pending_events |= ESP_GDMA_EVT_IN_DSCR_EMPTY;
+                error = true;
+                break;
+            }
+
+            const uint32_t next_addr = in_list->next_addr;
+
+            /* In the case where the transfer is finished, we should still "push" the next node
+             * to our descriptors stack, but we should not modify the structure itself as we will
+             * reset the owner and update the suc_eof flag */
+            if (exit_loop) {
+                esp_gdma_push_descriptor(g, chan, ESP_GDMA_IN_IDX, next_addr);
+                break;
+            }
+
+            /* We have to continue the loop, so fetch the next node, it will also update the descriptors stack */
+            valid = esp_gdma_next_list_node(g, chan, ESP_GDMA_IN_IDX, in_list);
+            bytes += sizeof(EspGdmaDescriptor);
+
+            /* Check the validity of the next node if we have to continue the loop (transfer finished) */
+            if (!valid || (conf->owner_check_in && !in_list->config.owner)) {
+                ch->pending_events |= ESP_GDMA_EVT_IN_DSCR_ERR;
+                error = true;
+                break;
+            }
+
+            /* Continue the loop normally, next RX descriptor set to current */
+            in_list->config.length = 0;
+            /* Update the current in guest address */
+            conf->in_addr = next_addr;
+        }
+    }
+
+    if (exit_loop && !error) {
+        /* Let's set the End-of-list in the receiver */
+        in_list->config.suc_eof = 1;
+        in_list->config.owner = 0;
+
+        /* Write back the previous changes */
+        valid = esp_gdma_write_descr(g, chan, conf->in_addr, in_list);
+        assert(valid);
+
+        /* And store the EOF RX descriptor GUEST address in the correct register.
+         * This can be used in the ISR to know which buffer has just been processed. */
+        g->ops->in_suc_eof(g->opaque, chan, conf->in_addr);
+
+        /* Set the transfer as completed for both the IN and OUT link */
+        ch->pending_events |= ESP_GDMA_EVT_IN_DONE | ESP_GDMA_EVT_OUT_DONE |
+                              ESP_GDMA_EVT_OUT_EOF | ESP_GDMA_EVT_IN_SUC_EOF;
+    }
+
+    if (exit_loop || error) {
+        ch->active = false;
+    }
+
+    return bytes;
+}
+
+
+/**
+ * @brief Timer callback, report the events of the previous burst, whose modelled duration elapsed,
+ * and process the next burst if the transfer is not over.
+ */
+static void esp_gdma_channel_cb(void *opaque)
+{
+    EspGdmaChannel *ch = (EspGdmaChannel *) opaque;
+    EspGdma *g = ch->gdma;
+
+    if (ch->pending_events) {
+        const uint32_t events = ch->pending_events;
+        ch->pending_events = 0;
+        g->ops->set_events(g->opaque, ch->index, events);
+    }
+
+    if (!ch->active) {
+        return;
+    }
+
+    const uint32_t bytes = esp_gdma_mem_transfer_burst(ch);
+    const int64_t duration = g->bandwidth ? muldiv64(bytes, NANOSECONDS_PER_SECOND, g->bandwidth) : 0;
+
+#if GDMA_DEBUG
+    info_report("[GDMA] Channel %d: %u bytes burst, %" PRId64 "ns", ch->index, bytes, duration);
+#endif
+
+    if (ch->active || ch->pending_events) {
+        timer_mod_ns(&ch->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + duration);
+    }
+}
+
+
+bool esp_gdma_start_mem_transfer(EspGdma *g, uint32_t chan, const EspGdmaLinkConfig *conf)
+{
+    EspGdmaChannel *ch = &g->channels[chan];
+    uint32_t errors = 0;
+    bool valid;
+
+    assert(chan < g->channel_count);
+
+    /* A new start on a busy channel aborts the former transfer */
+    timer_del(&ch->timer);
+    ch->active = false;
+    ch->pending_events = 0;
+    ch->conf = *conf;
+
+    /* Get the content of the descriptor located at guest address out_addr */
+    valid = esp_gdma_read_descr(g, chan, conf->out_addr, &ch->out_list);
+    esp_gdma_push_descriptor(g, chan, ESP_GDMA_OUT_IDX, conf->out_addr);
+
+    /* Check that the address is valid. If the owner must be checked, make sure owner is the DMA controller.
+     * On the real hardware, both in and out are checked at the same time, so in case of an error, both bits
+     * are set. Replicate the same behavior here. */
+    if (!valid || (conf->owner_check_out && !ch->out_list.config.owner)) {
+        errors |= ESP_GDMA_EVT_OUT_DSCR_ERR;
+    }
+
+    valid = esp_gdma_read_descr(g, chan, conf->in_addr, &ch->in_list);
+    esp_gdma_push_descriptor(g, chan, ESP_GDMA_IN_IDX, conf->in_addr);
+
+    if (!valid || (conf->owner_check_in && !ch->in_list.config.owner)) {
+        errors |= ESP_GDMA_EVT_IN_DSCR_ERR;
+    }
+
+    /* If any of the error bit has been set, return directly */
+    if (errors) {
+        g->ops->set_events(g->opaque, chan, errors);
+        return false;
+    }
+
+    /* Clear the number of bytes written to the "in" buffer */
+    ch->in_list.config.length = 0;
+    ch->consumed = 0;
+    ch->active = true;
+
+    /* Let the vCPU continue, the transfer itself is done by the timer callback */
+    timer_mod_ns(&ch->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    return true;
+}
+
+
+bool esp_gdma_read_channel(EspGdma *g, uint32_t chan, const EspGdmaLinkConfig *conf, uint8_t *buffer, uint32_t size)
+{
+    uint32_t out_addr = conf->out_addr;
+    EspGdmaDescriptor out_list;
+    bool valid;
+
+    /* Set the current buffer (guest address) in the `desc_addr` register */
+    valid = esp_gdma_read_descr(g, chan, out_addr, &out_list);
+    esp_gdma_push_descriptor(g, chan, ESP_GDMA_OUT_IDX, out_addr);
+
+    /* Check that the address is valid. If the owner must be checked, make sure owner is the DMA controller. */
+    if (!valid || (conf->owner_check_out && !out_list.config.owner)) {
+        g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_OUT_DSCR_ERR);
+        return false;
+    }
+
+    /* Store the current number of bytes written to `buffer` parameter */
+    uint32_t consumed = 0;
+    bool exit_loop = false;
+    bool error = false;
+
+    while (!exit_loop && !error) {
+        /* Calculate the number of bytes to read from the OUT channel */
+        const uint32_t remaining = size - consumed;
+        const uint32_t min = MIN(out_list.config.length, remaining);
+
+        valid = esp_gdma_read_guest(g, out_list.buf_addr, buffer + consumed, min);
+        if (!valid) {
+            g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_OUT_DSCR_ERR);
+            error = true;
+            break;
+        }
+        consumed += min;
+
+        if (consumed == size) {
+            exit_loop = true;
+        }
+
+        /* If we reached the end of the TX descriptor, we can jump to the next buffer */
+        if (min == out_list.config.length) {
+
+            /* Before jumping to the next node, clear the owner bit if needed */
+            if (conf->clear_out) {
+                out_list.config.owner = 0;
+
+                /* Write back the modified descriptor, should always be valid */
+                valid = esp_gdma_write_descr(g, chan, out_addr, &out_list);
+                assert(valid);
+            }
+
+            const bool eof_bit = out_list.config.suc_eof;
+
+            /* Retrieve the next node  while updating the virtual guest address */
+            out_addr = out_list.next_addr;
+            valid = esp_gdma_next_list_node(g, chan, ESP_GDMA_OUT_IDX, &out_list);
+
+            /* Only check the valid flag and the owner if we don't have to exit the loop*/
+            if (!exit_loop && (!valid || (conf->owner_check_out && !out_list.config.owner))) {
+                g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_OUT_DSCR_ERR);
+                error = true;
+            }
+
+            /* If the EOF bit was set, the real controller doesn't stop the transfer, it simply
+             * sets the status accordingly (and generates an interrupt if enabled) */
+            if (eof_bit) {
+                g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_OUT_EOF | ESP_GDMA_EVT_OUT_TOTAL_EOF);
+            }
+        }
+    }
+
+    if (!error) {
+        /* Set the transfer as completed. EOF should have already been triggered within the loop */
+        g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_OUT_DONE);
+    }
+
+    return !error;
+}
+
+
+bool esp_gdma_write_channel(EspGdma *g, uint32_t chan, const EspGdmaLinkConfig *conf, uint8_t *buffer, uint32_t size)
+{
+    uint32_t in_addr = conf->in_addr;
+    EspGdmaDescriptor in_list = { 0 };
+    bool valid;
+
+    valid = esp_gdma_read_descr(g, chan, in_addr, &in_list);
+    esp_gdma_push_descriptor(g, chan, ESP_GDMA_IN_IDX, in_addr);
+
+    if (!valid || (conf->owner_check_in && !in_list.config.owner)) {
+        g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_IN_DSCR_ERR);
+        return false;
+    }
+
+    /* Clear the number of bytes written to the "in" buffer and the owner */
+    in_list.config.length = 0;
+
+    uint32_t consumed = 0;
+    bool exit_loop = false;
+    bool error = false;
+
+    while (!exit_loop && !error) {
+
+        /* Calculate the number of bytes to write to the in channel */
+        const uint32_t remaining = size - consumed;
+        const uint32_t min = MIN(in_list.config.size, remaining);
+
+        /* Perform the actual copy, the in buffer address will always be at the beginning because the data
+         * to write to it are contiguous (`buffer` parameter) */
+        valid = esp_gdma_write_guest(g, in_list.buf_addr, buffer + consumed, min);
+        if (!valid) {
+            g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_IN_DSCR_ERR);
+            error = true;
+        }
+
+        /* Update the number of bytes written to the "in" buffer */
+        in_list.config.length += min;
+        consumed += min;
+
+        if (size == consumed) {
+            exit_loop = true;
+        }
+
+        /* If we reached the end of the "node", go to the next one */
+        if (in_list.config.size == in_list.config.length) {
+            /* Clear the owner bit, set the length to the maximum bytes readable */
+            in_list.config.owner = 0;
+
+            /* During peripheral-to-memory transfers, the eof bit is only used to set a status bit, and generate
+             * an interrupt if enabled. If we still have bytes to send, we won't stop the transfer.
+             * In all cases, reset this bit as it must be only set at the end of the buffer. */
+            if (in_list.config.suc_eof) {
+                in_list.config.suc_eof = 0;
+                g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_IN_SUC_EOF);
+            }
+
+            /* Write back the IN node to guest RAM */
+            valid = esp_gdma_write_descr(g, chan, in_addr, &in_list);
+            assert(valid);
+
+            /* Get the next virtual address before replacing the current list node content */
+            const uint32_t next_addr = in_list.next_addr;
+
+            /* Even if we have to exit the loop, we still have to push the next address to the descriptors stack */
+            if (exit_loop) {
+                esp_gdma_push_descriptor(g, chan, ESP_GDMA_IN_IDX, next_addr);
+                break;
+            }
+
+            /* In the case where the transfer is finished, we should still fetch the next node,
+             * but we should not override the current in_list variable as it is used outside the loop
+             * to reset the owner and update the suc_eof flag */
+            valid = esp_gdma_next_list_node(g, chan, ESP_GDMA_IN_IDX, &in_list);
+
+            if (!valid || (conf->owner_check_in && !in_list.config.owner)) {
+                /* Check the validity of the next node if we have to continue the loop (transfer finished) */
+                g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_IN_DSCR_ERR);
+                error = true;
+            } else {
+                /* Continue the loop normally, next RX descriptor set to current */
+                in_list.config.length = 0;
+
+                /* Update the current in guest address */
+                in_addr = next_addr;
+            }
+        }
+    }
+
+    if (!error) {
+        /* In all cases (error or not), let's set the End-of-list in the receiver */
+        in_list.config.suc_eof = 1;
+        in_list.config.owner = 0;
+
+        valid = esp_gdma_write_descr(g, chan, in_addr, &in_list);
+        assert(valid);
+
+        /* And store the EOF RX descriptor GUEST address in the correct register.
+         * This can be used in the ISR to know which buffer has just been processed. */
+        g->ops->in_suc_eof(g->opaque, chan, in_addr);
+
+        /* Set the transfer as completed */
+        g->ops->set_events(g->opaque, chan, ESP_GDMA_EVT_IN_DONE);
+    }
+
+    return !error;
+}
+
+
+void esp_gdma_reset(EspGdma *g)
+{
+    for (uint32_t i = 0; i < g->channel_count; i++) {
+        EspGdmaChannel *ch = &g->channels[i];
+        timer_del(&ch->timer);
+        ch->active = false;
+        ch->pending_events = 0;
+    }
+
+    esp_gdma_descr_cache_flush(g);
+}
+
+
+void esp_gdma_init(EspGdma *g, uint32_t channel_count, AddressSpace *as, const EspGdmaOps *ops, void *opaque)
+{
+    assert(channel_count <= ESP_GDMA_MAX_CHANNEL_COUNT);
+
+    g->as = as;
+    g->ops = ops;
+    g->opaque = opaque;
+    g->channel_count = channel_count;
+
+    for (uint32_t i = 0; i < channel_count; i++) {
+        EspGdmaChannel *ch = &g->channels[i];
+        ch->gdma = g;
+        ch->index = i;
+        timer_init_ns(&ch->timer, QEMU_CLOCK_VIRTUAL, esp_gdma_channel_cb, ch);
+    }
+}
+
+
+void esp_gdma_realize(EspGdma *g)
+{
+    g->listener.name = "esp-gdma";
+    g->listener.commit = esp_gdma_memory_commit;
+    memory_listener_register(&g->listener, g->as);
+}
+
+
+void esp_gdma_unrealize(EspGdma *g)
+{
+    memory_listener_unregister(&g->listener);
+    esp_gdma_descr_cache_flush(g);
+}
+
+
+static const VMStateDescription vmstate_esp_gdma_descr = {
+    .name = "esp_gdma/descriptor",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(config.val, EspGdmaDescriptor),
+        VMSTATE_UINT32(buf_addr, EspGdmaDescriptor),
+        VMSTATE_UINT32(next_addr, EspGdmaDescriptor),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
+static const VMStateDescription vmstate_esp_gdma_channel = {
+    .name = "esp_gdma/channel",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_TIMER(timer, EspGdmaChannel),
+        VMSTATE_BOOL(active, EspGdmaChannel),
+        VMSTATE_UINT32(pending_events, EspGdmaChannel),
+        VMSTATE_UINT32(conf.in_addr, EspGdmaChannel),
+        VMSTATE_UINT32(conf.out_addr, EspGdmaChannel),
+        VMSTATE_BOOL(conf.owner_check_in, EspGdmaChannel),
+        VMSTATE_BOOL(conf.owner_check_out, EspGdmaChannel),
+        VMSTATE_BOOL(conf.clear_out, EspGdmaChannel),
+        VMSTATE_STRUCT(out_list, EspGdmaChannel, 1, vmstate_esp_gdma_descr, EspGdmaDescriptor),
+        VMSTATE_STRUCT(in_list, EspGdmaChannel, 1, vmstate_esp_gdma_descr, EspGdmaDescriptor),
+        VMSTATE_UINT32(consumed, EspGdmaChannel),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
+static int esp_gdma_post_load(void *opaque, int version_id)
+{
+    EspGdma *g = (EspGdma *) opaque;
+
+    esp_gdma_descr_cache_flush(g);
+    return 0;
+}
+
+
+const VMStateDescription vmstate_esp_gdma = {
+    .name = "esp_gdma",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp_gdma_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_EQUAL(channel_count, EspGdma, NULL),
+        /* Only the first channel_count channels exist, the timers of the others are not initialized */
+        VMSTATE_STRUCT_VARRAY_UINT32(channels, EspGdma, channel_count, 1,
+                                     vmstate_esp_gdma_channel, EspGdmaChannel),
+        VMSTATE_END_OF_LIST()
+    }
+};
@@ -1,7 +1,7 @@
 #include "qemu/osdep.h"
 #include "hw/sysbus.h"
+#include "migration/vmstate.h"
 #include "hw/misc/esp32_aes.h"
-#include "crypto/aes.h"
 
 #define ESP32_AES_REGS_SIZE (A_AES_ENDIAN_REG + 4)
 
@@ -31,16 +31,10 @@ static void esp32_aes_mode(Esp32AesState *s, uint32_t mode_value)
  */
 static void esp32_aes_start(Esp32AesState *s)
 {
-    AES_KEY aes_key;
-    uint32_t full_key[32];
-    memcpy(full_key, s->key, s->mode.bits / 8);
-    if (s->mode.type == ESP32_AES_ENCRYPTION_MODE) {
-        AES_set_encrypt_key((unsigned char *)full_key, s->mode.bits, &aes_key);
-        AES_encrypt((unsigned char *)s->text, (unsigned char *)s->text, &aes_key);
-    } else if (s->mode.type == ESP32_AES_DECRYPTION_MODE) {
-        AES_set_decrypt_key((unsigned char *)full_key, s->mode.bits, &aes_key);
-        AES_decrypt((unsigned char *)s->text, (unsigned char *)s->text, &aes_key);
-    }
+    /* The host cipher is only re-created when the key or its size changed since the previous block */
+    esp_aes_ecb_crypt(&s->cipher, (const uint8_t *)s->key, s->mode.bits / 8,
+                      s->mode.type == ESP32_AES_ENCRYPTION_MODE,
+                      s->text, s->text, sizeof(s->text));
     s->aes_idle_reg = 1;
 }
 
@@ -94,6 +88,8 @@ static void esp32_aes_reset(DeviceState *dev)
 {
     Esp32AesState *s = ESP32_AES(dev);
     s->aes_idle_reg = 0;
+    /* AES_MODE_REG resets to 0: AES-128 encryption */
+    esp32_aes_mode(s, 0);
 }
 
 static void esp32_aes_init(Object *obj)
@@ -106,11 +102,33 @@ static void esp32_aes_init(Object *obj)
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
+static void esp32_aes_finalize(Object *obj)
+{
+    Esp32AesState *s = ESP32_AES(obj);
+    esp_aes_cipher_free(&s->cipher);
+}
+
+static const VMStateDescription vmstate_esp32_aes = {
+    .name = "esp32_aes",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(text, Esp32AesState, ESP32_AES_TEXT_REG_CNT),
+        VMSTATE_UINT32_ARRAY(key, Esp32AesState, ESP32_AES_KEY_REG_CNT),
+        VMSTATE_UINT32(aes_idle_reg, Esp32AesState),
+        VMSTATE_BOOL(mode.type, Esp32AesState),
+        VMSTATE_INT32(mode.bits, Esp32AesState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static void esp32_aes_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->reset = esp32_aes_reset;
+
+    dc->vmsd = &vmstate_esp32_aes;
 }
 
 static const TypeInfo esp32_aes_info = {
@@ -118,6 +136,7 @@ static const TypeInfo esp32_aes_info = {
         .parent = TYPE_SYS_BUS_DEVICE,
         .instance_size = sizeof(Esp32AesState),
         .instance_init = esp32_aes_init,
+        .instance_finalize = esp32_aes_finalize,
         .class_init = esp32_aes_class_init
 };
 
@@ -15,6 +15,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/qdev-properties-system.h"
 #include "hw/registerfields.h"
 #include "hw/boards.h"
@@ -40,9 +41,17 @@
 #define APP_IRAM0_MMU_LAST      (APP_IRAM0_MMU_FIRST + MMU_RANGE_LAST)
 #define MMU_ENTRY_MASK          0x1ff
 
+/* The PSRAM entries follow the flash ones, after the unused IRAM1 and IROM0 entries */
+#define PSRAM_MMU_RANGE_SIZE    (ESP32_CACHE_PSRAM_PAGES * sizeof(uint32_t))
+#define PRO_DRAM1_MMU_FIRST     (DR_REG_FLASH_MMU_TABLE_PRO - DR_REG_DPORT_BASE + 1152 * sizeof(uint32_t))
+#define PRO_DRAM1_MMU_LAST      (PRO_DRAM1_MMU_FIRST + PSRAM_MMU_RANGE_SIZE - sizeof(uint32_t))
+#define APP_DRAM1_MMU_FIRST     (DR_REG_FLASH_MMU_TABLE_APP - DR_REG_DPORT_BASE + 1152 * sizeof(uint32_t))
+#define APP_DRAM1_MMU_LAST      (APP_DRAM1_MMU_FIRST + PSRAM_MMU_RANGE_SIZE - sizeof(uint32_t))
+
 static void esp32_cache_state_update(Esp32CacheState* cs);
 static void esp32_cache_data_sync(Esp32CacheRegionState* crs);
 static void esp32_cache_invalidate_all_entries(Esp32CacheRegionState* crs);
+static void esp32_cache_psram_set_entry(Esp32CacheState* cs, uint32_t page, uint32_t val);
 
 static inline uint32_t get_mmu_entry(Esp32CacheRegionState* crs, hwaddr base, hwaddr addr)
 {
@@ -119,6 +128,12 @@ static uint64_t esp32_dport_read(void *opaque, hwaddr addr, unsigned int size)
     case APP_IRAM0_MMU_FIRST ... APP_IRAM0_MMU_LAST:
         r = get_mmu_entry(&s->cache_state[1].iram0, APP_IRAM0_MMU_FIRST, addr);
         break;
+    case PRO_DRAM1_MMU_FIRST ... PRO_DRAM1_MMU_LAST:
+        r = s->cache_state[0].dram1_mmu_table[(addr - PRO_DRAM1_MMU_FIRST) / sizeof(uint32_t)];
+        break;
+    case APP_DRAM1_MMU_FIRST ... APP_DRAM1_MMU_LAST:
+        r = s->cache_state[1].dram1_mmu_table[(addr - APP_DRAM1_MMU_FIRST) / sizeof(uint32_t)];
+        break;
     case A_DPORT_SLAVE_SPI_CONFIG:
         r = s->slave_spi_config_reg;
         break;
@@ -160,9 +175,8 @@ static void esp32_dport_write(void *opaque, hwaddr addr,
         if (FIELD_EX32(value, DPORT_PRO_CACHE_CTRL, CACHE_FLUSH_ENA)) {
             value |= R_DPORT_PRO_CACHE_CTRL_CACHE_FLUSH_DONE_MASK;
             value &= ~R_DPORT_PRO_CACHE_CTRL_CACHE_FLUSH_ENA_MASK;
-            esp32_cache_invalidate_all_entries(&s->cache_state[0].drom0);
+            /* Only the entries remapped or whose flash page was modified need to be reloaded */
             esp32_cache_data_sync(&s->cache_state[0].drom0);
-            esp32_cache_invalidate_all_entries(&s->cache_state[0].iram0);
             esp32_cache_data_sync(&s->cache_state[0].iram0);
         }
         old_val = s->cache_state[0].cache_ctrl_reg;
@@ -182,9 +196,8 @@ static void esp32_dport_write(void *opaque, hwaddr addr,
         if (FIELD_EX32(value, DPORT_APP_CACHE_CTRL, CACHE_FLUSH_ENA)) {
             value |= R_DPORT_APP_CACHE_CTRL_CACHE_FLUSH_DONE_MASK;
             value &= ~R_DPORT_APP_CACHE_CTRL_CACHE_FLUSH_ENA_MASK;
-            esp32_cache_invalidate_all_entries(&s->cache_state[1].drom0);
+            /* Only the entries remapped or whose flash page was modified need to be reloaded */
             esp32_cache_data_sync(&s->cache_state[1].drom0);
-            esp32_cache_invalidate_all_entries(&s->cache_state[1].iram0);
             esp32_cache_data_sync(&s->cache_state[1].iram0);
         }
         old_val = s->cache_state[1].cache_ctrl_reg;
@@ -221,6 +234,12 @@ static void esp32_dport_write(void *opaque, hwaddr addr,
     case APP_IRAM0_MMU_FIRST ... APP_IRAM0_MMU_LAST:
         set_mmu_entry(&s->cache_state[1].iram0, APP_IRAM0_MMU_FIRST, addr, value);
         break;
+    case PRO_DRAM1_MMU_FIRST ... PRO_DRAM1_MMU_LAST:
+        esp32_cache_psram_set_entry(&s->cache_state[0], (addr - PRO_DRAM1_MMU_FIRST) / sizeof(uint32_t), value);
+        break;
+    case APP_DRAM1_MMU_FIRST ... APP_DRAM1_MMU_LAST:
+        esp32_cache_psram_set_entry(&s->cache_state[1], (addr - APP_DRAM1_MMU_FIRST) / sizeof(uint32_t), value);
+        break;
     case A_DPORT_SLAVE_SPI_CONFIG:
         s->slave_spi_config_reg = value;
         qemu_set_irq(s->flash_enc_en_gpio, FIELD_EX32(value, DPORT_SLAVE_SPI_CONFIG, SLAVE_SPI_ENCRYPT_ENABLE));
@@ -235,38 +254,108 @@ static const MemoryRegionOps esp32_dport_ops = {
     .endianness = DEVICE_LITTLE_ENDIAN,
 };
 
+/* The flash writes land in the flash model mapping first when it maps the image privately,
+ * read from that mapping in that case. The bytes that cannot be read are returned as zeros. */
+static void esp32_dport_flash_read(Esp32DportState *dport, uint32_t addr, void *buf, uint32_t size)
+{
+    const int64_t length = blk_getlength(dport->flash_blk);
+    uint32_t count = 0;
+
+    if (length > addr) {
+        count = MIN(size, length - addr);
+    }
+    if (dport->flash_image != NULL) {
+        memcpy(buf, dport->flash_image + addr, count);
+    } else if (count > 0 && blk_pread(dport->flash_blk, addr, count, buf, 0) < 0) {
+        count = 0;
+    }
+
+    if (count < size) {
+        memset((uint8_t *) buf + count, 0, size - count);
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: cannot read 0x%" PRIx32 " bytes of flash at 0x%08" PRIx32
+                      ", read as zeros\n", __func__, size - count, addr + count);
+    }
+}
+
 static void esp32_cache_data_sync(Esp32CacheRegionState* crs)
 {
-    if (crs->cache->dport->flash_blk == NULL) {
+    Esp32DportState *dport = crs->cache->dport;
+
+    if (dport->flash_blk == NULL) {
         return;
     }
 
     Esp32FlashEncryptionState * flash_enc = esp32_flash_encryption_find();
     bool decrypt = (flash_enc != NULL && esp32_flash_decryption_enabled(flash_enc));
 
+    /* The content of all the pages depends on the decryption */
+    if (decrypt != crs->decrypted) {
+        esp32_cache_invalidate_all_entries(crs);
+        crs->decrypted = decrypt;
+    }
+
     uint8_t* cache_data = (uint8_t*) memory_region_get_ram_ptr(&crs->mem);
     for (int i = 0; i < ESP32_CACHE_PAGES_PER_REGION; ++i) {
         uint32_t* cache_page = (uint32_t*) (cache_data + i * ESP32_CACHE_PAGE_SIZE);
         uint32_t mmu_entry = crs->mmu_table[i];
-        if (!(mmu_entry & ESP32_CACHE_MMU_ENTRY_CHANGED)) {
-            continue;
-        }
+        const bool changed = (mmu_entry & ESP32_CACHE_MMU_ENTRY_CHANGED) != 0;
         mmu_entry &= MMU_ENTRY_MASK;
         if (mmu_entry & ESP32_CACHE_MMU_INVALID_VAL) {
+            if (!changed) {
+                continue;
+            }
             uint32_t fill_val = crs->illegal_access_retval;
             for (int word = 0; word < ESP32_CACHE_PAGE_SIZE / sizeof(uint32_t); ++word) {
                 cache_page[word] = fill_val;
             }
         } else {
+            /* Same mapping as before, only reload the page if the flash was written since */
+            const uint32_t gen = dport->flash_page_gen[mmu_entry];
+            if (!changed && crs->page_gen[i] == gen) {
+                continue;
+            }
             uint32_t phys_addr = mmu_entry * ESP32_CACHE_PAGE_SIZE;
-            blk_pread(crs->cache->dport->flash_blk, phys_addr, ESP32_CACHE_PAGE_SIZE, cache_page, 0);
+            esp32_dport_flash_read(dport, phys_addr, cache_page, ESP32_CACHE_PAGE_SIZE);
             if (decrypt) {
                 esp32_flash_decrypt_inplace(flash_enc, phys_addr, cache_page, ESP32_CACHE_PAGE_SIZE/4);
             }
+            crs->page_gen[i] = gen;
         }
         crs->mmu_table[i] &= ~ESP32_CACHE_MMU_ENTRY_CHANGED;
+        memory_region_flush_rom_device(&crs->mem, i * ESP32_CACHE_PAGE_SIZE, ESP32_CACHE_PAGE_SIZE);
+    }
+}
+
+/**
+ * @brief Update the PSRAM page mapped at the given page of the DRAM1 window.
+ * Unlike the flash pages, nothing needs to be copied: the window page is an alias to the PSRAM,
+ * so the new mapping is visible right away and himem bank switching is a matter of moving aliases.
+ */
+static void esp32_cache_psram_set_entry(Esp32CacheState* cs, uint32_t page, uint32_t val)
+{
+    MemoryRegion *psram = cs->dport->psram;
+    MemoryRegion *page_mr = &cs->dram1_pages[page];
+
+    val &= MMU_ENTRY_MASK;
+    if (val == cs->dram1_mmu_table[page]) {
+        return;
+    }
+    cs->dram1_mmu_table[page] = val;
+
+    if (psram == NULL) {
+        return;
+    }
+
+    if (val & ESP32_CACHE_MMU_INVALID_VAL) {
+        memory_region_set_enabled(page_mr, false);
+    } else {
+        /* The upper address bits are ignored by PSRAM chips smaller than the addressable range */
+        const uint64_t phys_pages = memory_region_size(psram) / ESP32_CACHE_PSRAM_PAGE_SIZE;
+        memory_region_transaction_begin();
+        memory_region_set_alias_offset(page_mr, (val % phys_pages) * ESP32_CACHE_PSRAM_PAGE_SIZE);
+        memory_region_set_enabled(page_mr, true);
+        memory_region_transaction_commit();
     }
-    memory_region_flush_rom_device(&crs->mem, 0, ESP32_CACHE_REGION_SIZE);
 }
 
 static void esp32_cache_invalidate_all_entries(Esp32CacheRegionState* crs)
@@ -313,6 +402,13 @@ static void esp32_cache_reset(Esp32CacheState *cs)
 {
     esp32_cache_region_reset(&cs->drom0);
     esp32_cache_region_reset(&cs->iram0);
+
+    /* Start with an identity mapping of the PSRAM, as the whole window used to be mapped linearly */
+    memory_region_transaction_begin();
+    for (int i = 0; i < ESP32_CACHE_PSRAM_PAGES; ++i) {
+        esp32_cache_psram_set_entry(cs, i, i);
+    }
+    memory_region_transaction_commit();
 }
 
 static uint64_t esp32_cache_ill_read(void *opaque, hwaddr addr, unsigned int size)
@@ -341,6 +437,17 @@ static bool esp32_cache_ill_accepts(void *opaque, hwaddr addr,
 }
 
 
+void esp32_dport_flash_written(Esp32DportState* s, uint32_t addr, uint32_t size)
+{
+    const uint64_t end = MIN((uint64_t) addr + size,
+                             (uint64_t) ESP32_CACHE_MAX_PHYS_PAGES * ESP32_CACHE_PAGE_SIZE);
+
+    for (uint64_t page = addr / ESP32_CACHE_PAGE_SIZE; page * ESP32_CACHE_PAGE_SIZE < end; page++) {
+        s->flash_page_gen[page]++;
+    }
+}
+
+
 void esp32_dport_clear_ill_trap_state(Esp32DportState* s)
 {
     s->cache_state[0].drom0.illegal_access_status = false;
@@ -384,6 +491,31 @@ static void esp32_dport_realize(DeviceState *dev, Error **errp)
     MachineState *ms = MACHINE(qdev_get_machine());
 
     s->cpu_count = ms->smp.cpus;
+    s->has_psram = (s->psram != NULL);
+
+    if (!s->has_psram) {
+        return;
+    }
+
+    if (memory_region_size(s->psram) < ESP32_CACHE_PSRAM_PAGE_SIZE) {
+        error_setg(errp, "[DPORT] PSRAM size must be at least %d bytes", ESP32_CACHE_PSRAM_PAGE_SIZE);
+        return;
+    }
+
+    for (int i = 0; i < ESP32_CPU_COUNT; ++i) {
+        Esp32CacheState* cs = &s->cache_state[i];
+        for (int page = 0; page < ESP32_CACHE_PSRAM_PAGES; ++page) {
+            char desc[24];
+            snprintf(desc, sizeof(desc), "cpu%d-dram1-page%d", i, page);
+            /* Mapped to the first page until the MMU entry is set */
+            memory_region_init_alias(&cs->dram1_pages[page], OBJECT(s), desc,
+                                     s->psram, 0, ESP32_CACHE_PSRAM_PAGE_SIZE);
+            memory_region_set_enabled(&cs->dram1_pages[page], false);
+            memory_region_add_subregion(&cs->dram1.mem, page * ESP32_CACHE_PSRAM_PAGE_SIZE,
+                                        &cs->dram1_pages[page]);
+            cs->dram1_mmu_table[page] = ESP32_CACHE_MMU_INVALID_VAL;
+        }
+    }
 }
 
 static void esp32_cache_init_region(Esp32DportState *ds,
@@ -400,8 +532,8 @@ static void esp32_cache_init_region(Esp32DportState *ds,
     crs->illegal_access_retval = illegal_access_retval;
     snprintf(desc, sizeof(desc), "cpu%d-%s", cs->core_id, name);
     if (type == ESP32_DCACHE_PSRAM) {
-        memory_region_init_alias(&crs->mem, OBJECT(cs->dport), desc,
-                                 &ds->psram, 0, ESP32_CACHE_REGION_SIZE);
+        /* Populated with the PSRAM pages on realize, once the PSRAM is known */
+        memory_region_init(&crs->mem, OBJECT(cs->dport), desc, ESP32_CACHE_REGION_SIZE);
     } else {
         memory_region_init_rom_device(&crs->mem, OBJECT(cs->dport),
                                     &esp32_cache_ops, crs,
@@ -423,8 +555,6 @@ static void esp32_dport_init(Object *obj)
                           TYPE_ESP32_DPORT, ESP32_DPORT_SIZE);
     sysbus_init_mmio(sbd, &s->iomem);
 
-    memory_region_init_ram(&s->psram, obj, "psram", ESP32_CACHE_REGION_SIZE, &error_fatal);
-
     for (int i = 0; i < ESP32_CPU_COUNT; ++i) {
         Esp32CacheState* cs = &s->cache_state[i];
         cs->core_id = i;
@@ -445,9 +575,78 @@ static void esp32_dport_init(Object *obj)
     qdev_init_gpio_out_named(DEVICE(sbd), &s->flash_dec_en_gpio, ESP32_DPORT_FLASH_DEC_EN_GPIO, 1);
 }
 
+static int esp32_dport_post_load(void *opaque, int version_id)
+{
+    Esp32DportState *s = ESP32_DPORT(opaque);
+
+    memory_region_transaction_begin();
+    for (int i = 0; i < ESP32_CPU_COUNT; ++i) {
+        Esp32CacheState *cs = &s->cache_state[i];
+        /* Move the PSRAM page aliases to the restored MMU entries */
+        for (int page = 0; page < ESP32_CACHE_PSRAM_PAGES; ++page) {
+            const uint16_t val = cs->dram1_mmu_table[page];
+            cs->dram1_mmu_table[page] = ~val;
+            esp32_cache_psram_set_entry(cs, page, val);
+        }
+        /* The content of the flash cache regions was migrated as RAM, only their state is applied */
+        esp32_cache_state_update(cs);
+    }
+    memory_region_transaction_commit();
+    return 0;
+}
+
+static const VMStateDescription vmstate_esp32_cache_region = {
+    .name = "esp32_dport/cache_region",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BOOL(illegal_access_trap_en, Esp32CacheRegionState),
+        VMSTATE_BOOL(illegal_access_status, Esp32CacheRegionState),
+        VMSTATE_UINT16_ARRAY(mmu_table, Esp32CacheRegionState, ESP32_CACHE_PAGES_PER_REGION),
+        VMSTATE_UINT32_ARRAY(page_gen, Esp32CacheRegionState, ESP32_CACHE_PAGES_PER_REGION),
+        VMSTATE_BOOL(decrypted, Esp32CacheRegionState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32_cache = {
+    .name = "esp32_dport/cache",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(cache_ctrl_reg, Esp32CacheState),
+        VMSTATE_UINT32(cache_ctrl1_reg, Esp32CacheState),
+        VMSTATE_STRUCT(iram0, Esp32CacheState, 1, vmstate_esp32_cache_region, Esp32CacheRegionState),
+        VMSTATE_STRUCT(drom0, Esp32CacheState, 1, vmstate_esp32_cache_region, Esp32CacheRegionState),
+        VMSTATE_STRUCT(dram1, Esp32CacheState, 1, vmstate_esp32_cache_region, Esp32CacheRegionState),
+        VMSTATE_UINT16_ARRAY(dram1_mmu_table, Esp32CacheState, ESP32_CACHE_PSRAM_PAGES),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32_dport = {
+    .name = "esp32_dport",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp32_dport_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(cache_state, Esp32DportState, ESP32_CPU_COUNT, 1,
+                             vmstate_esp32_cache, Esp32CacheState),
+        VMSTATE_UINT32_ARRAY(flash_page_gen, Esp32DportState, ESP32_CACHE_MAX_PHYS_PAGES),
+        VMSTATE_BOOL(appcpu_reset_state, Esp32DportState),
+        VMSTATE_BOOL(appcpu_stall_state, Esp32DportState),
+        VMSTATE_BOOL(appcpu_clkgate_state, Esp32DportState),
+        VMSTATE_UINT32(appcpu_boot_addr, Esp32DportState),
+        VMSTATE_UINT32(cpuperiod_sel, Esp32DportState),
+        VMSTATE_UINT32(cache_ill_trap_en_reg, Esp32DportState),
+        VMSTATE_UINT32(slave_spi_config_reg, Esp32DportState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32_dport_properties[] = {
     DEFINE_PROP_DRIVE("flash", Esp32DportState, flash_blk),
-    DEFINE_PROP_BOOL("has_psram", Esp32DportState, has_psram, false),
+    DEFINE_PROP_LINK("psram", Esp32DportState, psram, TYPE_MEMORY_REGION, MemoryRegion *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -457,6 +656,7 @@ static void esp32_dport_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32_dport_reset;
     dc->realize = esp32_dport_realize;
+    dc->vmsd = &vmstate_esp32_dport;
     device_class_set_props(dc, esp32_dport_properties);
 }
 
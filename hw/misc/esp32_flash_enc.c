@@ -13,12 +13,12 @@
 #include "hw/sysbus.h"
 #include "qapi/error.h"
 #include "qemu/log.h"
-#include "crypto/cipher.h"
 #include "hw/misc/esp32_flash_enc.h"
 #include "hw/nvram/esp32_efuse.h"
 
 #define FLASH_ENCRYPTION_KEY_WORDS  8
 #define FLASH_ENCRYPTION_DATA_WORDS  4
+#define FLASH_ENCRYPTION_UNIT_WORDS  8
 
 static void esp32_flash_encryption_op(Esp32FlashEncryptionState *s);
 
@@ -114,39 +114,19 @@ static void esp32_flash_encryption_key_tweak(struct Esp32FlashEncryptionState *s
     }
 }
 
-static void reverse_key_byte_order(const uint32_t* src, uint32_t* dst)
-{
-    assert( src != dst );
-    for (size_t i = 0; i < FLASH_ENCRYPTION_KEY_WORDS; ++i) {
-        dst[i] = bswap32(src[FLASH_ENCRYPTION_KEY_WORDS - i - 1]);
-    }
-}
-
-static void reverse_data_byte_order(const uint32_t* src, uint32_t* dst)
-{
-    assert( src != dst );
-    for (size_t i = 0; i < FLASH_ENCRYPTION_DATA_WORDS; ++i) {
-        dst[i] = bswap32(src[FLASH_ENCRYPTION_DATA_WORDS - i - 1]);
-    }
-}
-
 static void esp32_flash_encryption_op(struct Esp32FlashEncryptionState *s)
 {
     uint32_t tweaked_key[FLASH_ENCRYPTION_KEY_WORDS];
     uint32_t reversed_key[FLASH_ENCRYPTION_KEY_WORDS];
-    uint32_t reversed_data[FLASH_ENCRYPTION_DATA_WORDS];
-    uint32_t encrypted_data[FLASH_ENCRYPTION_DATA_WORDS];
+    uint32_t data[ARRAY_SIZE(s->buffer_reg)];
 
-    memset(s->encrypted_buffer, 0, sizeof(s->encrypted_buffer));
-    reverse_key_byte_order(s->efuse_key, reversed_key);
+    esp_aes_reverse_bytes(reversed_key, s->efuse_key, sizeof(reversed_key));
     esp32_flash_encryption_key_tweak(s, s->address_reg, reversed_key, tweaked_key);
-    QCryptoCipher *cipher = qcrypto_cipher_new(QCRYPTO_CIPHER_ALG_AES_256, QCRYPTO_CIPHER_MODE_ECB, (const uint8_t*) tweaked_key, FLASH_ENCRYPTION_KEY_WORDS * 4, &error_abort);
-    for (size_t total_words = 0; total_words < ARRAY_SIZE(s->buffer_reg); total_words += FLASH_ENCRYPTION_DATA_WORDS) {
-        reverse_data_byte_order(s->buffer_reg + total_words, reversed_data);
-        qcrypto_cipher_decrypt(cipher, reversed_data, encrypted_data, sizeof(s->buffer_reg), &error_abort);
-        reverse_data_byte_order(encrypted_data, s->encrypted_buffer + total_words);
-    }
-    qcrypto_cipher_free(cipher);
+    /* Reversing the whole buffer also reverses the order of its two AES blocks, which is harmless in ECB mode */
+    esp_aes_reverse_bytes(data, s->buffer_reg, sizeof(data));
+    esp_aes_ecb_crypt(&s->cipher, (const uint8_t*) tweaked_key, sizeof(tweaked_key), false,
+                      data, data, sizeof(data));
+    esp_aes_reverse_bytes(s->encrypted_buffer, data, sizeof(data));
 }
 
 void esp32_flash_encryption_get_result(struct Esp32FlashEncryptionState* s, uint32_t* dst, size_t dst_words)
@@ -161,18 +141,17 @@ void esp32_flash_decrypt_inplace(struct Esp32FlashEncryptionState* s, size_t fla
     assert(words % FLASH_ENCRYPTION_DATA_WORDS == 0);
     uint32_t tweaked_key[FLASH_ENCRYPTION_KEY_WORDS];
     uint32_t reversed_key[FLASH_ENCRYPTION_KEY_WORDS];
-    uint32_t reversed_data[FLASH_ENCRYPTION_DATA_WORDS];
-    uint32_t decrypted_data[FLASH_ENCRYPTION_DATA_WORDS];
 
-    reverse_key_byte_order(s->efuse_key, reversed_key);
-    for (size_t pos = 0; pos < words; pos += FLASH_ENCRYPTION_DATA_WORDS) {
+    esp_aes_reverse_bytes(reversed_key, s->efuse_key, sizeof(reversed_key));
+    /* The tweaked key only changes every 32 bytes, process both AES blocks of a unit in a single call */
+    for (size_t pos = 0; pos < words; pos += FLASH_ENCRYPTION_UNIT_WORDS) {
+        const size_t unit_size = MIN(FLASH_ENCRYPTION_UNIT_WORDS, words - pos) * 4;
         uint32_t offset = flash_addr + pos * 4;
         esp32_flash_encryption_key_tweak(s, offset, reversed_key, tweaked_key);
-        QCryptoCipher *cipher = qcrypto_cipher_new(QCRYPTO_CIPHER_ALG_AES_256, QCRYPTO_CIPHER_MODE_ECB, (const uint8_t*) tweaked_key, FLASH_ENCRYPTION_KEY_WORDS * 4, &error_abort);
-        reverse_data_byte_order(data + pos, reversed_data);
-        qcrypto_cipher_encrypt(cipher, reversed_data, decrypted_data, sizeof(decrypted_data), &error_abort);
-        reverse_data_byte_order(decrypted_data, data + pos);
-        qcrypto_cipher_free(cipher);
+        esp_aes_reverse_bytes(data + pos, data + pos, unit_size);
+        esp_aes_ecb_crypt(&s->cipher, (const uint8_t*) tweaked_key, sizeof(tweaked_key), true,
+                          data + pos, data + pos, unit_size);
+        esp_aes_reverse_bytes(data + pos, data + pos, unit_size);
     }
 }
 
@@ -242,6 +221,12 @@ static void esp32_flash_encryption_init(Object *obj)
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
+static void esp32_flash_encryption_finalize(Object *obj)
+{
+    Esp32FlashEncryptionState *s = ESP32_FLASH_ENCRYPTION(obj);
+    esp_aes_cipher_free(&s->cipher);
+}
+
 static void esp32_flash_encryption_reset(DeviceState *dev)
 {
     Esp32FlashEncryptionState *s = ESP32_FLASH_ENCRYPTION(dev);
@@ -260,6 +245,7 @@ static const TypeInfo esp32_flash_encryption_info = {
         .parent = TYPE_SYS_BUS_DEVICE,
         .instance_size = sizeof(Esp32FlashEncryptionState),
         .instance_init = esp32_flash_encryption_init,
+        .instance_finalize = esp32_flash_encryption_finalize,
         .class_init = esp32_flash_encryption_class_init
 };
 
@@ -11,109 +11,62 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qapi/error.h"
 #include "hw/hw.h"
 #include "hw/sysbus.h"
 #include "hw/boards.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/misc/esp32_rsa.h"
-#include <gcrypt.h>
 
 
 #define ESP32_RSA_REGS_SIZE (A_RSA_QUERY_CLEAN_REG + 4)
 
-static void copy_reversed(unsigned char* dest, size_t dst_size, const unsigned char* src, size_t src_size);
-static bool mpi_block_to_gcrypt(const uint32_t* mem_block, size_t n_bytes, gcry_mpi_t *out);
-static bool mpi_gcrypt_to_block(gcry_mpi_t in, uint32_t* mem_block);
 static void esp32_rsa_exp_mod(Esp32RsaState *s);
 static void esp32_rsa_mul_start(Esp32RsaState *s);
-static void esp32_rsa_mul_op(Esp32RsaState *s);
-static void esp32_rsa_mod_mul_op(Esp32RsaState *s);
+static bool esp32_rsa_mul_op(Esp32RsaState *s);
+static bool esp32_rsa_mod_mul_op(Esp32RsaState *s);
 
 
 /**
- * Convert between libgcrypt big-endian representation and little-endian hardware, or vice versa.
- * src_size should not exceed dst_size. The remaining part of dst is filled with 0.
+ * @brief Mark the operation that was just performed as completed. If the latency is modelled,
+ * the interrupt flag is only set after the time the real hardware would take to perform it.
  */
-static void copy_reversed(unsigned char* dst, size_t dst_size, const unsigned char* src, size_t src_size)
+static void esp32_rsa_complete(Esp32RsaState *s, uint64_t cycles)
 {
-    assert(src_size <= dst_size);
-    size_t i;
-    for (i = 0; i < src_size; ++i) {
-        dst[i] = src[src_size - i - 1];
-    }
-    for (; i < dst_size; ++i) {
-        dst[i] = 0;
+    if (!s->model_latency) {
+        /* indicate that the operation is complete */
+        s->rsa_q_int_reg = 1;
+        return;
     }
-}
 
-/**
- * Converts the little-endian memory block of the RSA peripheral to a new gcry_mpi_t object.
- * The caller is responsible for freeing the returned object.
- */
-static bool mpi_block_to_gcrypt(const uint32_t* mem_block, size_t n_bytes, gcry_mpi_t *out)
-{
-    size_t scanned;
-    const unsigned char* mem_u8 = (const unsigned char*) mem_block;
-    unsigned char temp_buffer[ESP32_RSA_MEM_BLK_SIZE] = {};
-    copy_reversed(temp_buffer, n_bytes, mem_u8, n_bytes);
-    gcry_error_t err = gcry_mpi_scan(out, GCRYMPI_FMT_USG, temp_buffer, n_bytes, &scanned);
-    if (err) {
-        fprintf(stderr, "%s: gcry_mpi_scan failed with error: %s (%d)", __func__, gcry_strerror(err), err);
-        return false;
-    }
-    if (scanned != n_bytes) {
-        fprintf(stderr, "%s: gcry_mpi_scan scanned %zu, expected %zu", __func__, scanned, n_bytes);
-        return false;
-    }
-    return true;
+    timer_mod_ns(&s->op_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                               muldiv64(cycles, NANOSECONDS_PER_SECOND, ESP_RSA_MPI_CLK_FREQ));
 }
 
-/**
- * Copies an MPI from gcry_mpi_t object to the RSA peripheral memory block.
- */
-static bool mpi_gcrypt_to_block(gcry_mpi_t in, uint32_t* mem_block)
+
+static void esp32_rsa_op_timer_cb(void *opaque)
 {
-    size_t written;
-    unsigned char* mem_u8 = (unsigned char*) mem_block;
-    unsigned char temp_buffer[ESP32_RSA_MEM_BLK_SIZE] = {};
-    gcry_error_t err = gcry_mpi_print(GCRYMPI_FMT_USG, temp_buffer, ESP32_RSA_MEM_BLK_SIZE, &written, in);
-    if (err) {
-        fprintf(stderr, "%s: gcry_mpi_print failed with error: %s (%d)", __func__, gcry_strerror(err), err);
-        return false;
-    }
-    copy_reversed(mem_u8, ESP32_RSA_MEM_BLK_SIZE, temp_buffer, written);
-    return true;
+    Esp32RsaState *s = ESP32_RSA(opaque);
+
+    /* indicate that the operation is complete */
+    s->rsa_q_int_reg = 1;
 }
 
+
 /** Calculates Z_MEM = X_MEM ^ Y_MEM mod M_MEM.
  *  Unlike the real hardware, doesn't use the mprime register.
  */
 static void esp32_rsa_exp_mod(Esp32RsaState *s)
 {
-    gcry_mpi_t x, y, z, m;
-
     size_t n_bytes = (s->rsa_modexp_mode_reg + 1) * 64;
 
-    /* convert inputs to gcry_mpi_t */
-    if (!mpi_block_to_gcrypt(s->rsa_x_mem, n_bytes, &x) ||
-        !mpi_block_to_gcrypt(s->rsa_y_mem, n_bytes, &y) ||
-        !mpi_block_to_gcrypt(s->rsa_m_mem, n_bytes, &m)) {
-        return;
+    if (esp_rsa_mpi_exp_mod(&s->mpi, s->rsa_x_mem, s->rsa_y_mem, s->rsa_m_mem, n_bytes,
+                            s->rsa_z_mem, ESP32_RSA_MEM_BLK_SIZE)) {
+        /* The ESP32 accelerator has no constant-time setting, assume the worst case */
+        esp32_rsa_complete(s, esp_rsa_mpi_exp_mod_cycles(s->rsa_y_mem, n_bytes, true));
     }
-
-    /* calculate the result and write it back */
-    z = gcry_mpi_new(n_bytes);
-    gcry_mpi_powm(z, x, y, m);
-    mpi_gcrypt_to_block(z, s->rsa_z_mem);
-
-    /* clean up */
-    gcry_mpi_release(x);
-    gcry_mpi_release(y);
-    gcry_mpi_release(z);
-    gcry_mpi_release(m);
-
-    /* indicate that the operation is complete */
-    s->rsa_q_int_reg = 1;
 }
 
 
@@ -122,14 +75,18 @@ static void esp32_rsa_mul_start(Esp32RsaState *s)
     /* Hardware does different operations depending on rsa_mult_mode_reg value: */
     bool is_mod_mult = (s->rsa_mult_mode_reg < 8);
     if (is_mod_mult) {
-        esp32_rsa_mod_mul_op(s);
+        if (esp32_rsa_mod_mul_op(s)) {
+            esp32_rsa_complete(s, esp_rsa_mpi_mod_mul_cycles((s->rsa_mult_mode_reg + 1) * 64));
+        }
     } else {
-        esp32_rsa_mul_op(s);
+        if (esp32_rsa_mul_op(s)) {
+            esp32_rsa_complete(s, esp_rsa_mpi_mul_cycles((s->rsa_mult_mode_reg - 8 + 1) * 64));
+        }
     }
 }
 
 /** Calculates Z_MEM = X_MEM * (Z_MEM >> n) */
-static void esp32_rsa_mul_op(Esp32RsaState *s)
+static bool esp32_rsa_mul_op(Esp32RsaState *s)
 {
     assert(s->rsa_mult_mode_reg >= 8 && s->rsa_mult_mode_reg < 16);
     /* In this mode, the output length is set by rsa_mult_mode_reg,
@@ -141,24 +98,8 @@ static void esp32_rsa_mul_op(Esp32RsaState *s)
     size_t n_bytes_input = n_bytes / 2;
     memcpy(s->rsa_z_mem, s->rsa_z_mem + n_bytes_input / sizeof(s->rsa_z_mem[0]), n_bytes_input);
     memset(s->rsa_z_mem + n_bytes_input / sizeof(s->rsa_z_mem[0]), 0, n_bytes_input);
-    /* convert inputs to gcry_mpi_t */
-    gcry_mpi_t x, z, result;
-    if (!mpi_block_to_gcrypt(s->rsa_x_mem, n_bytes, &x) ||
-        !mpi_block_to_gcrypt(s->rsa_z_mem, n_bytes, &z)) {
-        return;
-    }
-    /* multiply */
-    result = gcry_mpi_new(n_bytes * 8);
-    gcry_mpi_mul(result, x, z);
-    mpi_gcrypt_to_block(result, s->rsa_z_mem);
-
-    /* clean up */
-    gcry_mpi_release(x);
-    gcry_mpi_release(z);
-    gcry_mpi_release(result);
 
-    /* indicate that the operation is complete */
-    s->rsa_q_int_reg = 1;
+    return esp_rsa_mpi_mul(&s->mpi, s->rsa_x_mem, s->rsa_z_mem, n_bytes, s->rsa_z_mem, ESP32_RSA_MEM_BLK_SIZE);
 }
 
 /** Calculates Z_MEM = Z_MEM * X_MEM * R^-1 mod M_MEM.
@@ -169,56 +110,14 @@ static void esp32_rsa_mul_op(Esp32RsaState *s)
  *  R^-1 is re-calculated if M_MEM is modified.
  *  M' (mprime) register value is ignored in this simulation.
  */
-static void esp32_rsa_mod_mul_op(Esp32RsaState *s)
+static bool esp32_rsa_mod_mul_op(Esp32RsaState *s)
 {
     assert(s->rsa_mult_mode_reg < 8);
     /* In this mode, the output and input lengths are the same */
     size_t n_bytes = (s->rsa_mult_mode_reg + 1) * 64;
-    gcry_mpi_t m;
-    if (!mpi_block_to_gcrypt(s->rsa_m_mem, n_bytes, &m)) {
-        return;
-    }
-    /* Calculate R^-1 if it hasn't been calculated yet */
-    if (!s->cache.valid) {
-        if (!s->cache.rinv) {
-            s->cache.rinv = gcry_mpi_new(n_bytes * 8);
-        }
-        gcry_mpi_t r = gcry_mpi_new(n_bytes * 8 + 1);
-        gcry_mpi_set_bit(r, n_bytes * 8);
-        if (!gcry_mpi_invm(s->cache.rinv, r, m)) {
-            qemu_log("%s: failed to calculate modulo inverse\n", __func__);
-            return;
-        }
-        s->cache.valid = true;
-    }
 
-    /* convert inputs to gcry_mpi_t */
-    gcry_mpi_t x, z, res1, res2;
-    if (!mpi_block_to_gcrypt(s->rsa_x_mem, n_bytes, &x) ||
-        !mpi_block_to_gcrypt(s->rsa_z_mem, n_bytes, &z)) {
-        gcry_mpi_release(m);
-        return;
-    }
-
-    /* temporaries */
-    res1 = gcry_mpi_new(n_bytes * 8 * 2);
-    res2 = gcry_mpi_new(n_bytes * 8 * 2);
-
-    /* res1 = X * Z mod M */
-    gcry_mpi_mulm(res1, x, z, m);
-    /* res2 = X * Z * Rinv mod M */
-    gcry_mpi_mulm(res2, res1, s->cache.rinv, m);
-
-    /* write back */
-    mpi_gcrypt_to_block(res2, s->rsa_z_mem);
-
-    /* clean up */
-    gcry_mpi_release(x);
-    gcry_mpi_release(z);
-    gcry_mpi_release(res1);
-
-    /* indicate that the operation is complete */
-    s->rsa_q_int_reg = 1;
+    return esp_rsa_mpi_mont_mul(&s->mpi, s->rsa_x_mem, s->rsa_z_mem, s->rsa_m_mem, n_bytes,
+                                s->rsa_z_mem, ESP32_RSA_MEM_BLK_SIZE);
 }
 
 
@@ -228,7 +127,6 @@ static void esp32_rsa_clean_mem(Esp32RsaState *s)
     memset(s->rsa_x_mem, 0, sizeof(s->rsa_x_mem));
     memset(s->rsa_y_mem, 0, sizeof(s->rsa_y_mem));
     memset(s->rsa_z_mem, 0, sizeof(s->rsa_z_mem));
-    s->cache.valid = false;
 }
 
 static uint64_t esp32_rsa_read(void *opaque, hwaddr addr, unsigned int size)
@@ -270,7 +168,6 @@ static void esp32_rsa_write(void *opaque, hwaddr addr,
 
         case A_RSA_MEM_M_BLOCK_BASE ... (A_RSA_MEM_M_BLOCK_BASE + ESP32_RSA_MEM_BLK_SIZE - 1):
             s->rsa_m_mem[(addr - A_RSA_MEM_M_BLOCK_BASE) / sizeof(uint32_t)] = (uint32_t)value;
-            s->cache.valid = false;
             break;
 
         case A_RSA_MEM_RB_BLOCK_BASE ... (A_RSA_MEM_RB_BLOCK_BASE + ESP32_RSA_MEM_BLK_SIZE - 1):
@@ -325,6 +222,9 @@ static void esp32_rsa_reset(DeviceState *dev)
 
     esp32_rsa_clean_mem(s);
 
+    /* Abort any operation in progress */
+    timer_del(&s->op_timer);
+
     /* Clear any spurious interrupt */
     s->rsa_q_int_reg = 0;
 
@@ -340,13 +240,50 @@ static void esp32_rsa_init(Object *obj)
     memory_region_init_io(&s->iomem, obj, &esp32_rsa_ops, s,
                           TYPE_ESP32_RSA, ESP32_RSA_REGS_SIZE);
     sysbus_init_mmio(sbd, &s->iomem);
+
+    timer_init_ns(&s->op_timer, QEMU_CLOCK_VIRTUAL, esp32_rsa_op_timer_cb, s);
+}
+
+static void esp32_rsa_finalize(Object *obj)
+{
+    Esp32RsaState *s = ESP32_RSA(obj);
+
+    timer_del(&s->op_timer);
+    esp_rsa_mpi_free(&s->mpi);
 }
 
+static const VMStateDescription vmstate_esp32_rsa = {
+    .name = "esp32_rsa",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(rsa_m_mem, Esp32RsaState, ESP32_RSA_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(rsa_z_mem, Esp32RsaState, ESP32_RSA_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(rsa_y_mem, Esp32RsaState, ESP32_RSA_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(rsa_x_mem, Esp32RsaState, ESP32_RSA_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32(rsa_mprime_reg, Esp32RsaState),
+        VMSTATE_UINT32(rsa_modexp_mode_reg, Esp32RsaState),
+        VMSTATE_UINT32(rsa_mult_mode_reg, Esp32RsaState),
+        VMSTATE_UINT32(rsa_clean_reg, Esp32RsaState),
+        VMSTATE_UINT32(rsa_q_int_reg, Esp32RsaState),
+        VMSTATE_TIMER(op_timer, Esp32RsaState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property esp32_rsa_properties[] = {
+    DEFINE_PROP_BOOL("model-latency", Esp32RsaState, model_latency, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void esp32_rsa_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->reset = esp32_rsa_reset;
+
+    dc->vmsd = &vmstate_esp32_rsa;
+    device_class_set_props(dc, esp32_rsa_properties);
 }
 
 static const TypeInfo esp32_rsa_info = {
@@ -354,6 +291,7 @@ static const TypeInfo esp32_rsa_info = {
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(Esp32RsaState),
     .instance_init = esp32_rsa_init,
+    .instance_finalize = esp32_rsa_finalize,
     .class_init = esp32_rsa_class_init
 };
 
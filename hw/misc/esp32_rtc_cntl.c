@@ -18,6 +18,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/misc/esp32_reg.h"
 #include "hw/misc/esp32_rtc_cntl.h"
 
@@ -215,6 +216,36 @@ static void esp32_rtc_cntl_init(Object *obj)
     esp32_rtc_update_clk(s);
 }
 
+static int esp32_rtc_cntl_post_load(void *opaque, int version_id)
+{
+    Esp32RtcCntlState *s = ESP32_RTC_CNTL(opaque);
+
+    /* Let the machine apply the restored clock configuration */
+    esp32_rtc_update_clk(s);
+    return 0;
+}
+
+static const VMStateDescription vmstate_esp32_rtc_cntl = {
+    .name = "esp32_rtc_cntl",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp32_rtc_cntl_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BOOL_ARRAY(cpu_stall_state, Esp32RtcCntlState, ESP32_CPU_COUNT),
+        VMSTATE_UINT32(soc_clk, Esp32RtcCntlState),
+        VMSTATE_UINT32(rtc_fastclk, Esp32RtcCntlState),
+        VMSTATE_UINT32(rtc_slowclk, Esp32RtcCntlState),
+        VMSTATE_INT64(time_base_ns, Esp32RtcCntlState),
+        VMSTATE_UINT32(options0_reg, Esp32RtcCntlState),
+        VMSTATE_UINT64(time_reg, Esp32RtcCntlState),
+        VMSTATE_UINT32(sw_cpu_stall_reg, Esp32RtcCntlState),
+        VMSTATE_UINT32_ARRAY(scratch_reg, Esp32RtcCntlState, ESP32_RTC_CNTL_SCRATCH_REG_COUNT),
+        VMSTATE_UINT32_ARRAY(reset_cause, Esp32RtcCntlState, ESP32_CPU_COUNT),
+        VMSTATE_BOOL_ARRAY(stat_vector_sel, Esp32RtcCntlState, ESP32_CPU_COUNT),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32_rtc_cntl_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -225,6 +256,7 @@ static void esp32_rtc_cntl_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32_rtc_cntl_reset;
     dc->realize = esp32_rtc_cntl_realize;
+    dc->vmsd = &vmstate_esp32_rtc_cntl;
     device_class_set_props(dc, esp32_rtc_cntl_properties);
 }
 
@@ -17,6 +17,7 @@
 #include "hw/sysbus.h"
 #include "hw/registerfields.h"
 #include "hw/boards.h"
+#include "migration/vmstate.h"
 #include "hw/misc/esp32_sha.h"
 
 #define ESP32_SHA_REGS_SIZE (A_SHA512_BUSY + 4)
@@ -117,11 +118,34 @@ static void esp32_sha_init(Object *obj)
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
+static const VMStateDescription vmstate_esp32_sha = {
+    .name = "esp32_sha",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(text, Esp32ShaState, ESP32_SHA_TEXT_REG_CNT),
+        /* The hash contexts are plain structures of integers */
+        VMSTATE_BUFFER_UNSAFE(sha512, Esp32ShaState, 1, sizeof(struct sha512_state)),
+        VMSTATE_BUFFER_UNSAFE(sha384, Esp32ShaState, 1, sizeof(struct sha512_state)),
+        VMSTATE_BUFFER_UNSAFE(sha256, Esp32ShaState, 1, sizeof(struct sha256_state)),
+        VMSTATE_BUFFER_UNSAFE(sha1, Esp32ShaState, 1, sizeof(struct sha1_state)),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void esp32_sha_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->vmsd = &vmstate_esp32_sha;
+}
+
 static const TypeInfo esp32_sha_info = {
     .name = TYPE_ESP32_SHA,
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(Esp32ShaState),
     .instance_init = esp32_sha_init,
+    .class_init = esp32_sha_class_init,
 };
 
 static void esp32_sha_register_types(void)
@@ -19,9 +19,13 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/misc/esp32c3_cache.h"
-#include "hw/misc/esp32c3_xts_aes.h"
+#include "hw/misc/esp_xts_aes.h"
 #include "sysemu/block-backend-io.h"
+#include "sysemu/block-backend-global-state.h"
+#include "exec/tb-flush.h"
+#include "hw/core/cpu.h"
 #include "hw/misc/esp32c3_reg.h"
 
 
@@ -56,9 +60,125 @@ static inline uint32_t esp32c3_read_mmu_value(ESP32C3CacheState *s, hwaddr reg_a
 }
 
 
+/**
+ * @brief Read a 64KB page from the flash, at the given physical address, and decrypt it if
+ *        flash encryption is enabled.
+ */
+static void esp32c3_cache_fetch_flash(ESP32C3CacheState *s, uint32_t physical_address, uint8_t *data)
+{
+    ESPXtsAesClass *xts_aes_class = ESP_XTS_AES_GET_CLASS(s->xts_aes);
+    const int64_t length = s->flash_blk != NULL ? blk_getlength(s->flash_blk) : 0;
+    uint32_t count = 0;
+
+    if (length > physical_address) {
+        count = MIN(ESP32C3_PAGE_SIZE, length - physical_address);
+    }
+    if (s->flash_image != NULL) {
+        memcpy(data, s->flash_image + physical_address, count);
+    } else if (count > 0 && blk_pread(s->flash_blk, physical_address, count, data, 0) < 0) {
+        count = 0;
+    }
+
+    /* Don't leave the end of the page uninitialized when it is out of the flash */
+    if (count < ESP32C3_PAGE_SIZE) {
+        memset(data + count, 0, ESP32C3_PAGE_SIZE - count);
+        qemu_log_mask(LOG_GUEST_ERROR, "[CACHE] cannot read 0x%" PRIx32 " bytes of flash at 0x%08" PRIx32
+                      ", read as zeros\n", ESP32C3_PAGE_SIZE - count, physical_address + count);
+    }
+    if (xts_aes_class->is_flash_enc_enabled(s->xts_aes)) {
+        xts_aes_class->decrypt(s->xts_aes, physical_address, data, ESP32C3_PAGE_SIZE);
+    }
+}
+
+
+/**
+ * @brief Drop all the fetched flash pages, the mapped virtual pages will be loaded again on their
+ *        next access.
+ */
+static void esp32c3_cache_invalidate_lazy(ESP32C3CacheState *s)
+{
+    esp_cache_pages_flash_written(&s->pages, 0, UINT32_MAX);
+    esp_cache_pages_reload_all(&s->pages);
+}
+
+
+/**
+ * @brief Try to map the given virtual page directly onto the mmap'ed flash image. This is only
+ *        possible when the flash is not encrypted, returns true on success.
+ */
+static bool esp32c3_cache_map_page(ESP32C3CacheState *s, uint32_t index)
+{
+    ESPXtsAesClass *xts_aes_class = ESP_XTS_AES_GET_CLASS(s->xts_aes);
+    const ESP32C3MMUEntry e = s->mmu[index];
+    const uint64_t physical_address = (uint64_t) e.page_number * ESP32C3_PAGE_SIZE;
+    MemoryRegion *alias = &s->mapped_pages[index];
+
+    if (!s->flash_mapped) {
+        return false;
+    }
+
+    if (e.invalid ||
+        physical_address + ESP32C3_PAGE_SIZE > memory_region_size(&s->flash_mr) ||
+        xts_aes_class->is_flash_enc_enabled(s->xts_aes)) {
+        memory_region_set_enabled(alias, false);
+        return false;
+    }
+
+    memory_region_transaction_begin();
+    memory_region_set_alias_offset(alias, physical_address);
+    memory_region_set_enabled(alias, true);
+    /* Nothing to fetch for this page anymore */
+    esp_cache_pages_set_lazy(&s->pages, index, false);
+    memory_region_transaction_commit();
+    return true;
+}
+
+
+/**
+ * @brief The code translated out of the mmap'ed flash image is not invalidated when the image file
+ *        is written to, discard all of it when the guest expects the cache to be refilled.
+ */
+static void esp32c3_cache_invalidate_mapped(ESP32C3CacheState *s)
+{
+    if (s->flash_mapped && first_cpu != NULL) {
+        tb_flush(first_cpu);
+    }
+}
+
+
+/**
+ * @brief The mapped pages expose the raw flash content, which the guest must not see anymore once
+ *        flash encryption is enabled. Unmap them, they will be loaded (decrypted) on their next
+ *        access.
+ */
+static void esp32c3_cache_flash_enc_changed(Notifier *notifier, void *data)
+{
+    ESP32C3CacheState *s = container_of(notifier, ESP32C3CacheState, flash_enc_notifier);
+    ESPXtsAesClass *xts_aes_class = ESP_XTS_AES_GET_CLASS(s->xts_aes);
+    bool unmapped = false;
+
+    if (!xts_aes_class->is_flash_enc_enabled(s->xts_aes)) {
+        return;
+    }
+
+    memory_region_transaction_begin();
+    for (int i = 0; i < ESP32C3_MMU_TABLE_ENTRY_COUNT; i++) {
+        if (s->mapped_pages[i].enabled) {
+            memory_region_set_enabled(&s->mapped_pages[i], false);
+            esp_cache_pages_set_lazy(&s->pages, i, true);
+            unmapped = true;
+        }
+    }
+    memory_region_transaction_commit();
+
+    if (unmapped) {
+        esp32c3_cache_invalidate_mapped(s);
+    }
+}
+
+
 static inline void esp32c3_write_mmu_value(ESP32C3CacheState *s, hwaddr reg_addr, uint32_t value)
 {
-    ESP32C3XtsAesClass *xts_aes_class = ESP32C3_XTS_AES_GET_CLASS(s->xts_aes);
     /* Make the assumption that the address is aligned on sizeof(uint32_t) */
     const uint32_t index = reg_addr / sizeof(uint32_t);
     /* Reserved bits shall always be 0 */
@@ -66,6 +186,18 @@ static inline void esp32c3_write_mmu_value(ESP32C3CacheState *s, hwaddr reg_addr
     /* Always keep reserved as 0 */
     e.reserved = 0;
     if (s->mmu[index].val != e.val) {
+        s->mmu[index].val = e.val;
+
+        if (esp32c3_cache_map_page(s, index)) {
+            return;
+        }
+
+        if (s->lazy_mmu) {
+            /* Only record the mapping, the page will be loaded on its first access */
+            esp_cache_pages_set_lazy(&s->pages, index, true);
+            return;
+        }
+
         /* Update the cache (MemoryRegion) */
         const uint32_t virtual_address = index * ESP32C3_PAGE_SIZE;
         /* The entry contains the index of the 64KB block from the flash memory */
@@ -73,20 +205,10 @@ static inline void esp32c3_write_mmu_value(ESP32C3CacheState *s, hwaddr reg_addr
         uint8_t* cache_data = ((uint8_t*) memory_region_get_ram_ptr(&s->dcache)) + virtual_address;
 
         if (e.invalid) {
-            const uint32_t invalid_value = 0xdeadbeef;
-            uint32_t* cache_word_data = (uint32_t*) cache_data;
-            for (int i = 0; i < ESP32C3_PAGE_SIZE / sizeof(invalid_value); i++) {
-                cache_word_data[i] = invalid_value;
-            }
+            esp_cache_fill_invalid(cache_data);
         } else {
-            if (s->flash_blk != NULL) {
-                blk_pread(s->flash_blk, physical_address, ESP32C3_PAGE_SIZE, cache_data, 0);
-            }
-            if (xts_aes_class->is_flash_enc_enabled(s->xts_aes)) {
-                xts_aes_class->decrypt(s->xts_aes, physical_address, cache_data, ESP32C3_PAGE_SIZE);
-            }
+            esp32c3_cache_fetch_flash(s, physical_address, cache_data);
         }
-        s->mmu[index].val = e.val;
     }
 }
 
@@ -160,6 +282,15 @@ static void esp32c3_cache_write(void *opaque, hwaddr addr, uint64_t value,
             case A_EXTMEM_ICACHE_CTRL:
                 s->icache_enable = value & 1;
                 break;
+            case A_EXTMEM_ICACHE_SYNC_CTRL:
+                s->regs[index] = value;
+                if (value & R_EXTMEM_ICACHE_SYNC_CTRL_INVALIDATE_ENA_MASK) {
+                    esp32c3_cache_invalidate_mapped(s);
+                    if (s->lazy_mmu) {
+                        esp32c3_cache_invalidate_lazy(s);
+                    }
+                }
+                break;
             case A_EXTMEM_ICACHE_FREEZE:
                 if (value & R_EXTMEM_ICACHE_FREEZE_ICACHE_FREEZE_ENA_MASK) {
                     /* Enable freeze, set DONE bit */
@@ -204,6 +335,36 @@ static const MemoryRegionOps esp32c3_cache_mem_ops = {
     .valid.accepts = esp32c3_cache_mem_accepts,
 };
 
+static void esp32c3_cache_pages_fetch_flash(void *opaque, uint32_t physical_address, uint8_t *data)
+{
+    esp32c3_cache_fetch_flash(opaque, physical_address, data);
+}
+
+static bool esp32c3_cache_pages_is_flash_enc_enabled(void *opaque)
+{
+    ESP32C3CacheState *s = opaque;
+    ESPXtsAesClass *xts_aes_class = ESP_XTS_AES_GET_CLASS(s->xts_aes);
+    return xts_aes_class->is_flash_enc_enabled(s->xts_aes);
+}
+
+static bool esp32c3_cache_pages_get_mmu_entry(void *opaque, uint32_t index, uint32_t *page_number)
+{
+    ESP32C3CacheState *s = opaque;
+    *page_number = s->mmu[index].page_number;
+    return !s->mmu[index].invalid;
+}
+
+static const EspCachePagesOps esp32c3_cache_pages_ops = {
+    .fetch_flash = esp32c3_cache_pages_fetch_flash,
+    .is_flash_enc_enabled = esp32c3_cache_pages_is_flash_enc_enabled,
+    .get_mmu_entry = esp32c3_cache_pages_get_mmu_entry,
+};
+
+void esp32c3_cache_flash_written(ESP32C3CacheState *s, uint32_t address, uint32_t size)
+{
+    esp_cache_pages_flash_written(&s->pages, address, size);
+}
+
 static void esp32c3_cache_reset(DeviceState *dev)
 {
     ESP32C3CacheState *s = ESP32C3_CACHE(dev);
@@ -214,22 +375,92 @@ static void esp32c3_cache_reset(DeviceState *dev)
         s->mmu[i].invalid = 1;
     }
 
+    /* The flash content may have changed, forget about the pages fetched so far */
+    esp_cache_pages_flash_written(&s->pages, 0, UINT32_MAX);
+
+    memory_region_transaction_begin();
+    for (int i = 0; i < ESP32C3_MMU_TABLE_ENTRY_COUNT; i++) {
+        esp_cache_pages_set_lazy(&s->pages, i, false);
+        if (s->flash_mapped) {
+            memory_region_set_enabled(&s->mapped_pages[i], false);
+        }
+    }
+    memory_region_transaction_commit();
+
+    esp32c3_cache_invalidate_mapped(s);
+
     /* On reset, autoload must be set to done (ready) */
     s->regs[ESP32C3_CACHE_REG_IDX(A_EXTMEM_ICACHE_AUTOLOAD_CTRL)] = R_EXTMEM_ICACHE_AUTOLOAD_CTRL_AUTOLOAD_DONE_MASK;
     /* Same goes for the manual preload */
     s->regs[ESP32C3_CACHE_REG_IDX(A_EXTMEM_ICACHE_PRELOAD_CTRL)] = R_EXTMEM_ICACHE_PRELOAD_CTRL_PRELOAD_DONE_MASK;
 }
 
+static void esp32c3_cache_add_mapped_pages(ESP32C3CacheState *s)
+{
+    for (int i = 0; i < ESP32C3_MMU_TABLE_ENTRY_COUNT; i++) {
+        memory_region_init_alias(&s->mapped_pages[i], OBJECT(s), "cpu0-cache-mapped-page",
+                                 &s->flash_mr, 0, ESP32C3_PAGE_SIZE);
+        memory_region_set_enabled(&s->mapped_pages[i], false);
+        memory_region_add_subregion_overlap(&s->dcache, i * ESP32C3_PAGE_SIZE, &s->mapped_pages[i], 2);
+    }
+    s->flash_mapped = true;
+}
+
+
+static void esp32c3_cache_map_flash(ESP32C3CacheState *s)
+{
+    if (s->flash_image != NULL) {
+        /* The flash model already maps the image privately, alias its mapping so that the guest
+         * writes, which land there first, are visible through the cache */
+        memory_region_init_ram_ptr(&s->flash_mr, OBJECT(s), "esp32c3.flash-mmap",
+                                   blk_getlength(s->flash_blk), s->flash_image);
+        memory_region_set_readonly(&s->flash_mr, true);
+        esp32c3_cache_add_mapped_pages(s);
+        return;
+    }
+
+#ifdef CONFIG_POSIX
+    g_autofree char *path = blk_get_mappable_filename(s->flash_blk);
+    Error *err = NULL;
+
+    if (path == NULL) {
+        warn_report("[CACHE] Flash image is not a raw file, it cannot be mapped");
+        return;
+    }
+
+    /* Share the mapping with the image file so that the writes performed by the SPI flash
+     * controller, which end up in the file, are visible through the cache */
+    if (!memory_region_init_ram_from_file(&s->flash_mr, OBJECT(s), "esp32c3.flash-mmap",
+                                          blk_getlength(s->flash_blk), 0,
+                                          RAM_SHARED | RAM_READONLY | RAM_READONLY_FD,
+                                          path, 0, &err)) {
+        warn_report_err(err);
+        return;
+    }
+
+    esp32c3_cache_add_mapped_pages(s);
+#else
+    warn_report("[CACHE] Mapping the flash image is not supported on this host");
+#endif
+}
+
 static void esp32c3_cache_realize(DeviceState *dev, Error **errp)
 {
+    ESP32C3CacheState *s = ESP32C3_CACHE(dev);
+
+    if (s->flash_mmap && s->flash_blk != NULL) {
+        esp32c3_cache_map_flash(s);
+    }
+
     /* Initialize the registers */
     esp32c3_cache_reset(dev);
 
-    ESP32C3CacheState *s = ESP32C3_CACHE(dev);
-
     /* Make sure XTS_AES was set or issue an error */
     if (s->xts_aes == NULL) {
         error_report("[CACHE] XTS_AES controller must be set!");
+    } else if (s->flash_mapped) {
+        s->flash_enc_notifier.notify = esp32c3_cache_flash_enc_changed;
+        notifier_list_add(&s->xts_aes->flash_enc_notifiers, &s->flash_enc_notifier);
     }
 }
 
@@ -253,10 +484,67 @@ static void esp32c3_cache_init(Object *obj)
     s->icache_base = ESP32C3_ICACHE_BASE;
     memory_region_init_alias(&s->icache, OBJECT(s), "cpu0-icache", &s->dcache, 0, ESP32C3_EXTMEM_REGION_SIZE);
 
+    /* Overlays used to detect the first access to a page when MMU entries are lazily loaded, they are
+     * subregions of the data cache so that the instruction cache alias also sees them. */
+    esp_cache_pages_init(&s->pages, OBJECT(s), &s->dcache, ESP32C3_MMU_TABLE_ENTRY_COUNT,
+                         &esp32c3_cache_pages_ops, s);
+
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
+static void esp32c3_cache_finalize(Object *obj)
+{
+    ESP32C3CacheState *s = ESP32C3_CACHE(obj);
+
+    esp_cache_pages_finalize(&s->pages);
+}
+
+static int esp32c3_cache_post_load(void *opaque, int version_id)
+{
+    ESP32C3CacheState *s = ESP32C3_CACHE(opaque);
+
+    /* The fetched flash pages are not part of the migrated state, the flash may have changed */
+    esp_cache_pages_flash_written(&s->pages, 0, UINT32_MAX);
+
+    /* The cache content itself was migrated as RAM, only restore the mappings of the MMU entries */
+    memory_region_transaction_begin();
+    for (int i = 0; i < ESP32C3_MMU_TABLE_ENTRY_COUNT; i++) {
+        esp_cache_pages_set_lazy(&s->pages, i, false);
+        if (!esp32c3_cache_map_page(s, i) && s->lazy_mmu && !s->mmu[i].invalid) {
+            esp_cache_pages_set_lazy(&s->pages, i, true);
+        }
+    }
+    memory_region_transaction_commit();
+    return 0;
+}
+
+static const VMStateDescription vmstate_esp32c3_mmu_entry = {
+    .name = "esp32c3_cache/mmu_entry",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(val, ESP32C3MMUEntry),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32c3_cache = {
+    .name = "esp32c3_cache",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp32c3_cache_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BOOL(icache_enable, ESP32C3CacheState),
+        VMSTATE_UINT32_ARRAY(regs, ESP32C3CacheState, ESP32C3_CACHE_REG_COUNT),
+        VMSTATE_STRUCT_ARRAY(mmu, ESP32C3CacheState, ESP32C3_MMU_TABLE_ENTRY_COUNT, 1,
+                             vmstate_esp32c3_mmu_entry, ESP32C3MMUEntry),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32c3_cache_properties[] = {
+    DEFINE_PROP_BOOL("lazy_mmu", ESP32C3CacheState, lazy_mmu, false),
+    DEFINE_PROP_BOOL("flash_mmap", ESP32C3CacheState, flash_mmap, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -266,6 +554,7 @@ static void esp32c3_cache_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32c3_cache_reset;
     dc->realize = esp32c3_cache_realize;
+    dc->vmsd = &vmstate_esp32c3_cache;
     device_class_set_props(dc, esp32c3_cache_properties);
 }
 
@@ -274,6 +563,7 @@ static const TypeInfo esp32c3_cache_info = {
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(ESP32C3CacheState),
     .instance_init = esp32c3_cache_init,
+    .instance_finalize = esp32c3_cache_finalize,
     .class_init = esp32c3_cache_class_init
 };
 
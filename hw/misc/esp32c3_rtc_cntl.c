@@ -16,6 +16,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/misc/esp32c3_rtc_cntl.h"
 
 
@@ -162,12 +163,25 @@ static void esp32c3_rtc_cntl_init(Object *obj)
 }
 
 
+static const VMStateDescription vmstate_esp32c3_rtc_cntl = {
+    .name = "esp32c3_rtc_cntl",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(options0, ESP32C3RtcCntlState),
+        VMSTATE_UINT32_ARRAY(scratch_reg, ESP32C3RtcCntlState, ESP32C3_RTC_CNTL_SCRATCH_REG_COUNT),
+        VMSTATE_UINT32(reason, ESP32C3RtcCntlState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static void esp32c3_rtc_cntl_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->reset = esp32c3_rtc_cntl_reset;
     dc->realize = esp32c3_rtc_cntl_realize;
+    dc->vmsd = &vmstate_esp32c3_rtc_cntl;
 }
 
 
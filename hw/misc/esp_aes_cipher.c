@@ -0,0 +1,123 @@
+/*
+ * Host AES backend shared by the ESP crypto peripherals
+ *
+ * The ciphers are created through QEMU crypto layer, which relies on the host
+ * library (gcrypt, nettle or gnutls) and thus on AES-NI or equivalent instructions
+ * when the host CPU provides them.
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qapi/error.h"
+#include "hw/misc/esp_aes_cipher.h"
+
+#define ESP_AES_BLOCK_SIZE          16
+#define ESP_AES_XTS_DATA_UNIT_SIZE  128
+
+
+void esp_aes_reverse_bytes(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    assert(size % 8 == 0);
+    /* Swap the 64-bit words from both ends, works in place, the compiler turns this loop into vector shuffles */
+    for (size_t i = 0; i < size / 2; i += 8) {
+        const uint64_t low = ldq_he_p(s + i);
+        const uint64_t high = ldq_he_p(s + size - 8 - i);
+        stq_he_p(d + i, bswap64(high));
+        stq_he_p(d + size - 8 - i, bswap64(low));
+    }
+}
+
+
+static QCryptoCipher *esp_aes_cipher_get(EspAesCipher *c, QCryptoCipherAlgorithm alg, QCryptoCipherMode mode,
+                                         const uint8_t *key, size_t key_size)
+{
+    assert(key_size <= ESP_AES_CIPHER_MAX_KEY_SIZE);
+
+    if (c->cipher != NULL && c->mode == mode && c->key_size == key_size &&
+        memcmp(c->key, key, key_size) == 0) {
+        return c->cipher;
+    }
+
+    esp_aes_cipher_free(c);
+    c->cipher = qcrypto_cipher_new(alg, mode, key, key_size, &error_abort);
+    c->mode = mode;
+    c->key_size = key_size;
+    memcpy(c->key, key, key_size);
+    return c->cipher;
+}
+
+
+void esp_aes_ecb_crypt(EspAesCipher *c, const uint8_t *key, size_t key_size, bool encrypt,
+                       const void *in, void *out, size_t size)
+{
+    QCryptoCipherAlgorithm alg;
+
+    switch (key_size) {
+        case 16:
+            alg = QCRYPTO_CIPHER_ALG_AES_128;
+            break;
+        case 24:
+            alg = QCRYPTO_CIPHER_ALG_AES_192;
+            break;
+        default:
+            assert(key_size == 32);
+            alg = QCRYPTO_CIPHER_ALG_AES_256;
+            break;
+    }
+
+    assert(size % ESP_AES_BLOCK_SIZE == 0);
+    QCryptoCipher *cipher = esp_aes_cipher_get(c, alg, QCRYPTO_CIPHER_MODE_ECB, key, key_size);
+    if (encrypt) {
+        qcrypto_cipher_encrypt(cipher, in, out, size, &error_abort);
+    } else {
+        qcrypto_cipher_decrypt(cipher, in, out, size, &error_abort);
+    }
+}
+
+
+void esp_aes_xts_crypt(EspAesCipher *c, const uint8_t *key, size_t key_size, bool encrypt,
+                       uint32_t physical_address, uint32_t tweak_mask, uint32_t tweak_extra,
+                       uint8_t *data, size_t size)
+{
+    uint8_t tweak[ESP_AES_BLOCK_SIZE] = { 0 };
+
+    assert(key_size == 32 || key_size == 64);
+    assert(size % ESP_AES_XTS_DATA_UNIT_SIZE == 0);
+
+    QCryptoCipher *cipher = esp_aes_cipher_get(c,
+                                               key_size == 32 ? QCRYPTO_CIPHER_ALG_AES_128
+                                                              : QCRYPTO_CIPHER_ALG_AES_256,
+                                               QCRYPTO_CIPHER_MODE_XTS, key, key_size);
+
+    for (size_t i = 0; i < size; i += ESP_AES_XTS_DATA_UNIT_SIZE) {
+        uint8_t *unit = data + i;
+
+        stl_le_p(tweak, ((physical_address + i) & tweak_mask) + tweak_extra);
+        qcrypto_cipher_setiv(cipher, tweak, sizeof(tweak), &error_abort);
+
+        esp_aes_reverse_bytes(unit, unit, ESP_AES_XTS_DATA_UNIT_SIZE);
+        if (encrypt) {
+            qcrypto_cipher_encrypt(cipher, unit, unit, ESP_AES_XTS_DATA_UNIT_SIZE, &error_abort);
+        } else {
+            qcrypto_cipher_decrypt(cipher, unit, unit, ESP_AES_XTS_DATA_UNIT_SIZE, &error_abort);
+        }
+        esp_aes_reverse_bytes(unit, unit, ESP_AES_XTS_DATA_UNIT_SIZE);
+    }
+}
+
+
+void esp_aes_cipher_free(EspAesCipher *c)
+{
+    qcrypto_cipher_free(c->cipher);
+    c->cipher = NULL;
+    c->key_size = 0;
+}
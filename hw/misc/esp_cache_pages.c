@@ -0,0 +1,167 @@
+/*
+ * Lazily loaded cache pages shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "hw/misc/esp_cache_pages.h"
+
+
+static uint8_t *esp_cache_pages_ram(EspCachePages *p, uint32_t index)
+{
+    return ((uint8_t *) memory_region_get_ram_ptr(p->cache_mr)) + index * ESP_CACHE_PAGE_SIZE;
+}
+
+
+void esp_cache_fill_invalid(uint8_t *data)
+{
+    const uint32_t invalid_value = 0xdeadbeef;
+    uint32_t* cache_word_data = (uint32_t*) data;
+    for (int i = 0; i < ESP_CACHE_PAGE_SIZE / sizeof(invalid_value); i++) {
+        cache_word_data[i] = invalid_value;
+    }
+}
+
+
+/**
+ * @brief Get the content of the given flash page, fetching it from the flash only if it has not
+ *        been fetched yet (or if the flash encryption state changed since then).
+ */
+static const uint8_t *esp_cache_pages_get_flash(EspCachePages *p, uint32_t page_number)
+{
+    EspFlashPage *page = &p->flash[page_number];
+    const bool encrypted = p->ops->is_flash_enc_enabled(p->opaque);
+
+    if (page->data == NULL) {
+        page->data = g_malloc0(ESP_CACHE_PAGE_SIZE);
+    }
+    if (!page->valid || page->encrypted != encrypted) {
+        p->ops->fetch_flash(p->opaque, page_number * ESP_CACHE_PAGE_SIZE, page->data);
+        page->valid = true;
+        page->encrypted = encrypted;
+    }
+    return page->data;
+}
+
+
+void esp_cache_pages_load(EspCachePages *p, uint32_t index)
+{
+    uint8_t *cache_data = esp_cache_pages_ram(p, index);
+    uint32_t page_number;
+
+    if (!p->ops->get_mmu_entry(p->opaque, index, &page_number)) {
+        esp_cache_fill_invalid(cache_data);
+    } else {
+        const uint8_t *flash_data = esp_cache_pages_get_flash(p, page_number);
+        /* Avoid invalidating the translated blocks if the page content didn't change */
+        if (memcmp(cache_data, flash_data, ESP_CACHE_PAGE_SIZE) == 0) {
+            return;
+        }
+        memcpy(cache_data, flash_data, ESP_CACHE_PAGE_SIZE);
+    }
+    memory_region_flush_rom_device(p->cache_mr, index * ESP_CACHE_PAGE_SIZE, ESP_CACHE_PAGE_SIZE);
+}
+
+
+void esp_cache_pages_set_lazy(EspCachePages *p, uint32_t index, bool enabled)
+{
+    memory_region_set_enabled(&p->lazy[index].mr, enabled);
+}
+
+
+void esp_cache_pages_reload_all(EspCachePages *p)
+{
+    uint32_t page_number;
+
+    memory_region_transaction_begin();
+    for (uint32_t i = 0; i < p->lazy_count; i++) {
+        if (p->ops->get_mmu_entry(p->opaque, i, &page_number)) {
+            memory_region_set_enabled(&p->lazy[i].mr, true);
+        }
+    }
+    memory_region_transaction_commit();
+}
+
+
+void esp_cache_pages_flash_written(EspCachePages *p, uint32_t address, uint32_t size)
+{
+    const uint64_t end = (uint64_t) address + size;
+
+    for (uint32_t i = address / ESP_CACHE_PAGE_SIZE; i < ESP_CACHE_FLASH_PAGE_COUNT; i++) {
+        if ((uint64_t) i * ESP_CACHE_PAGE_SIZE >= end) {
+            break;
+        }
+        p->flash[i].valid = false;
+    }
+}
+
+
+static uint64_t esp_cache_pages_lazy_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    EspLazyPage *page = opaque;
+    EspCachePages *p = page->pages;
+
+    /* First access to the page, fetch its content and let the next accesses go to RAM directly */
+    esp_cache_pages_load(p, page->index);
+    memory_region_set_enabled(&page->mr, false);
+
+    return ldn_le_p(esp_cache_pages_ram(p, page->index) + addr, size);
+}
+
+
+static bool esp_cache_pages_lazy_accepts(void *opaque, hwaddr addr,
+                                         unsigned size, bool is_write,
+                                         MemTxAttrs attrs)
+{
+    /* Same as the cache itself, only read accesses are accepted */
+    return !is_write;
+}
+
+
+static const MemoryRegionOps esp_cache_pages_lazy_ops = {
+    .read = esp_cache_pages_lazy_read,
+    .write = NULL,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid.accepts = esp_cache_pages_lazy_accepts,
+    .valid.max_access_size = 8,
+    .impl.max_access_size = 8,
+};
+
+
+void esp_cache_pages_init(EspCachePages *p, Object *owner, MemoryRegion *cache_mr, uint32_t count,
+                          const EspCachePagesOps *ops, void *opaque)
+{
+    p->ops = ops;
+    p->opaque = opaque;
+    p->cache_mr = cache_mr;
+    p->lazy_count = count;
+    p->lazy = g_new0(EspLazyPage, count);
+
+    /* The overlays are subregions of the cache memory so that any alias of it also sees them */
+    for (uint32_t i = 0; i < count; i++) {
+        EspLazyPage *page = &p->lazy[i];
+        page->pages = p;
+        page->index = i;
+        memory_region_init_io(&page->mr, owner, &esp_cache_pages_lazy_ops, page,
+                              "cpu0-cache-lazy-page", ESP_CACHE_PAGE_SIZE);
+        memory_region_set_enabled(&page->mr, false);
+        memory_region_add_subregion_overlap(cache_mr, i * ESP_CACHE_PAGE_SIZE, &page->mr, 1);
+    }
+}
+
+
+void esp_cache_pages_finalize(EspCachePages *p)
+{
+    for (int i = 0; i < ESP_CACHE_FLASH_PAGE_COUNT; i++) {
+        g_free(p->flash[i].data);
+        p->flash[i].data = NULL;
+    }
+    g_free(p->lazy);
+    p->lazy = NULL;
+}
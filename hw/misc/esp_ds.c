@@ -0,0 +1,484 @@
+/*
+ * Digital Signature accelerator shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2023 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/sysbus.h"
+#include "migration/vmstate.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "hw/misc/esp_ds.h"
+
+#define DS_WARNING 0
+#define DS_DEBUG   0
+
+static void write_and_padd(uint8_t *block, const uint8_t *data, uint16_t data_len)
+{
+    memcpy(block, data, data_len);
+    // Apply a one bit, followed by zero bits (refer to the TRM of respective target).
+    block[data_len] = 0x80;
+    memset(block + data_len + 1, 0, SHA256_BLOCK_SIZE - data_len - 1);
+}
+
+
+static void esp_ds_generate_ds_key(ESPDsState *s)
+{
+    uint8_t ones[ESP_DS_KEY_SIZE];
+    memset(ones, 0xFF, ESP_DS_KEY_SIZE);
+
+    uint8_t block[SHA256_BLOCK_SIZE];
+    uint64_t bit_len = be64_to_cpu(sizeof(ones) * 8 + 512);
+
+    write_and_padd(block, ones, sizeof(ones));
+    memcpy(block + SHA256_BLOCK_SIZE - sizeof(bit_len), &bit_len, sizeof(bit_len));
+
+    ESPHmacClass *hmac_class = ESP_HMAC_GET_CLASS(s->hmac);
+
+    hmac_class->hmac_update(s->hmac, (uint32_t*) block);
+    hmac_class->hmac_finish(s->hmac, s->ds_key);
+
+    for(int i = 0; i < ESP_DS_KEY_SIZE / 4; i++) {
+        s->ds_key[i] = be32_to_cpu(s->ds_key[i]);
+    }
+
+    // The DS peripheral resets the HMAC peripheral once it has completed the respective operation.
+    DeviceClass *hmac_dc = DEVICE_CLASS(hmac_class);
+    hmac_dc->reset((DeviceState*)(s->hmac));
+}
+
+
+static void esp_ds_decrypt_ciphertext(ESPDsState *s, uint8_t *buffer)
+{
+    ESPDsClass *class = ESP_DS_GET_CLASS(s);
+    ESPAesClass *aes_class = ESP_AES_GET_CLASS(s->aes);
+
+    uint32_t *output_words = (uint32_t *)buffer;
+    const uint32_t *input_words = (const uint32_t *)buffer;
+
+    uint32_t iv_words[ESP_DS_IV_SIZE / 4];
+    memcpy(iv_words, s->iv, ESP_DS_IV_SIZE);
+
+    unsigned char temp[16];
+    uint32_t length = ESP_DS_CIPHERTEXT_SIZE(class->mem_blk_size);
+
+    while ( length > 0 ) {
+        memcpy(temp, input_words, 16);
+
+        aes_class->aes_block_start(s->aes, s->ds_key, input_words, output_words, ESP_AES_MODE_256_DEC);
+
+        output_words[0] = output_words[0] ^ iv_words[0];
+        output_words[1] = output_words[1] ^ iv_words[1];
+        output_words[2] = output_words[2] ^ iv_words[2];
+        output_words[3] = output_words[3] ^ iv_words[3];
+
+        memcpy( iv_words, temp, 16 );
+
+        input_words += 4;
+        output_words += 4;
+        length -= 16;
+    }
+
+    // The DS peripheral resets the AES peripheral once it has completed the respective operation.
+    DeviceClass *aes_dc = DEVICE_CLASS(aes_class);
+    aes_dc->reset((DeviceState*)(s->aes));
+}
+
+
+static bool md_and_pad_check(ESPDsState *s)
+{
+    ESPDsClass *class = ESP_DS_GET_CLASS(s);
+    const uint32_t blk_size = class->mem_blk_size;
+    const uint32_t calc_md_size = ESP_DS_CALC_MD_SIZE(blk_size);
+    /* parse box */
+    int index = 0;
+    bool ret = false;
+
+    /* md */
+    uint8_t md[ESP_DS_MD_SIZE];
+    memcpy(md, s->box_mem + index, ESP_DS_MD_SIZE);
+    index += ESP_DS_MD_SIZE / 4;
+
+    /* mprime */
+    uint8_t mprime[ESP_DS_MPRIME_SIZE];
+    memcpy(mprime, s->box_mem + index, ESP_DS_MPRIME_SIZE);
+    index += ESP_DS_MPRIME_SIZE / 4;
+
+    /* l */
+    uint8_t l[ESP_DS_L_SIZE];
+    memcpy(l, s->box_mem + index, ESP_DS_L_SIZE);
+    index += ESP_DS_L_SIZE / 4;
+
+    /* beta */
+    uint8_t beta[8];
+    memcpy(beta, s->box_mem + index, 8);
+
+    /* Padding check */
+    uint8_t beta_pkcs7[8];
+    memset(beta_pkcs7, 8, sizeof(beta_pkcs7));
+
+    s->ds_signature_check = DS_SIGNATURE_PADDING_AND_MD_FAIL;
+
+    if (memcmp(beta_pkcs7, beta, sizeof(beta_pkcs7)) == 0) {
+        s->ds_signature_check ^= DS_SIGNATURE_PADDING_FAIL;
+    } else {
+        error_report("[Digital Signature] Invalid padding");
+    }
+
+    /* MD check */
+    uint32_t md_check[ESP_DS_MD_SIZE / 4];
+    ESPShaClass *sha_class = ESP_SHA_GET_CLASS(s->sha);
+
+    uint8_t buffer[ESP_DS_CALC_MD_SIZE(ESP_DS_MAX_MEM_BLK_SIZE)];
+    index = 0;
+
+    memcpy(buffer + index, s->y_mem, blk_size);
+    index += blk_size;
+
+    memcpy(buffer + index, s->m_mem, blk_size);
+    index += blk_size;
+
+    memcpy(buffer + index, s->rb_mem, blk_size);
+    index += blk_size;
+
+    memcpy(buffer + index, mprime, ESP_DS_MPRIME_SIZE);
+    index += ESP_DS_MPRIME_SIZE;
+
+    memcpy(buffer + index, l, ESP_DS_L_SIZE);
+    index += ESP_DS_L_SIZE;
+
+    memcpy(buffer + index, s->iv, ESP_DS_IV_SIZE);
+
+    size_t remaining_blocks = calc_md_size / SHA256_BLOCK_SIZE;
+
+    for (int i = 0; i < remaining_blocks; i++) {
+        if (i == 0) {
+            sha_class->sha_start(s->sha, OP_START, ESP_SHA_256_MODE, (uint32_t*) (buffer + i * SHA256_BLOCK_SIZE), md_check);
+        } else {
+            sha_class->sha_start(s->sha, OP_CONTINUE, ESP_SHA_256_MODE, (uint32_t*) (buffer + i * SHA256_BLOCK_SIZE), md_check);
+        }
+    }
+
+    size_t remaining = calc_md_size % SHA256_BLOCK_SIZE;
+    if (remaining != 0) {
+        uint8_t block[SHA256_BLOCK_SIZE];
+        uint64_t bit_len = be64_to_cpu(calc_md_size * 8);
+        write_and_padd(block, buffer + calc_md_size - remaining, remaining);
+        memcpy(block + SHA256_BLOCK_SIZE - sizeof(bit_len), &bit_len, sizeof(bit_len));
+        sha_class->sha_start(s->sha, OP_CONTINUE, ESP_SHA_256_MODE, (uint32_t*) block, md_check);
+    }
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE / 4; i++) {
+        md_check[i] = be32_to_cpu(md_check[i]);
+    }
+
+    // The DS peripheral resets the SHA peripheral once it has completed the respective operation.
+    DeviceClass *sha_dc = DEVICE_CLASS(sha_class);
+    sha_dc->reset((DeviceState*)(s->sha));
+
+    if (memcmp(md, md_check, SHA256_DIGEST_SIZE) == 0) {
+        s->ds_signature_check ^= DS_SIGNATURE_MD_FAIL;
+        ret = true;
+    } else {
+        error_report("[Digital Signature] Invalid digest");
+    }
+    return ret;
+}
+
+
+static void esp_ds_generate_signature(ESPDsState *s)
+{
+    uint32_t mode = ESP_DS_GET_CLASS(s)->mem_blk_size / 4 - 1;
+
+    ESPRsaClass *rsa_class = ESP_RSA_GET_CLASS(s->rsa);
+    if (!rsa_class->rsa_exp_mod(s->rsa, mode, s->x_mem, s->y_mem, s->m_mem, s->z_mem, 0)) {
+        error_report("[Digital Signature] Signature calculation failed");
+    }
+
+    // The DS peripheral resets the RSA peripheral once it has completed the respective operation.
+    DeviceClass *rsa_dc = DEVICE_CLASS(rsa_class);
+    rsa_dc->reset((DeviceState*)(s->rsa));
+}
+
+
+static void esp_ds_calculate(ESPDsState *s)
+{
+    const uint32_t blk_size = ESP_DS_GET_CLASS(s)->mem_blk_size;
+    /* Re-Generate the plaintext from the ciphertext */
+    uint8_t buffer[ESP_DS_CIPHERTEXT_SIZE(ESP_DS_MAX_MEM_BLK_SIZE)];
+    int index = 0;
+    /* Y */
+    memcpy(buffer + index, s->y_mem, blk_size);
+    index += blk_size;
+
+    /* M */
+    memcpy(buffer + index, s->m_mem, blk_size);
+    index += blk_size;
+
+    /* rb */
+    memcpy(buffer + index, s->rb_mem, blk_size);
+    index += blk_size;
+
+    /* box */
+    memcpy(buffer + index, s->box_mem, ESP_DS_BOX_MEM_BLK_SIZE);
+
+    /* Decrypt ciphertext */
+    esp_ds_decrypt_ciphertext(s, buffer);
+
+    /* Parse params */
+    /* Y */
+    index = 0;
+    memcpy(s->y_mem, buffer + index, blk_size);
+    index += blk_size;
+
+    /* M */
+    memcpy(s->m_mem, buffer + index, blk_size);
+    index += blk_size;
+
+    /* rb */
+    memcpy(s->rb_mem, buffer + index, blk_size);
+    index += blk_size;
+
+    /* box */
+    memcpy(s->box_mem, buffer + index, ESP_DS_BOX_MEM_BLK_SIZE);
+
+    if (!md_and_pad_check(s)) {
+        return;
+    }
+
+    /* Generate signature */
+    esp_ds_generate_signature(s);
+}
+
+
+static void esp_ds_clear_buffers(ESPDsState *s)
+{
+    memset(s->y_mem, 0, sizeof(s->y_mem));
+    memset(s->m_mem, 0, sizeof(s->m_mem));
+    memset(s->rb_mem, 0, sizeof(s->rb_mem));
+    memset(s->box_mem, 0, sizeof(s->box_mem));
+    memset(s->x_mem, 0, sizeof(s->x_mem));
+    memset(s->z_mem, 0, sizeof(s->z_mem));
+    memset(s->iv, 0, sizeof(s->iv));
+    memset(s->ds_key, 0, sizeof(s->ds_key));
+}
+
+
+/**
+ * @brief Access a word of the given memory block. The block is mapped in a window bigger
+ * than the actual memory of some targets, the words beyond it are ignored.
+ */
+static uint32_t esp_ds_mem_read(ESPDsState *s, const uint32_t *mem, hwaddr offset)
+{
+    ESPDsClass *class = ESP_DS_GET_CLASS(s);
+    return offset < class->mem_blk_size ? mem[offset / sizeof(uint32_t)] : 0;
+}
+
+
+static void esp_ds_mem_write(ESPDsState *s, uint32_t *mem, hwaddr offset, uint32_t value)
+{
+    ESPDsClass *class = ESP_DS_GET_CLASS(s);
+    if (offset < class->mem_blk_size) {
+        mem[offset / sizeof(uint32_t)] = value;
+    }
+}
+
+
+static uint64_t esp_ds_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    ESPDsState *s = ESP_DS(opaque);
+
+    uint64_t r = 0;
+    switch (addr) {
+        case A_DS_QUERY_BUSY_REG:
+            r = 0;
+            break;
+
+        case A_DS_QUERY_CHECK_REG:
+            r = s->ds_signature_check;
+            break;
+
+        case A_DS_DATE_REG:
+            r = 0x20200618;
+            break;
+
+        case A_DS_MEM_Z_BLOCK_BASE ... (A_DS_MEM_Z_BLOCK_BASE + ESP_DS_MAX_MEM_BLK_SIZE - 1):
+            r = esp_ds_mem_read(s, s->z_mem, addr - A_DS_MEM_Z_BLOCK_BASE);
+            break;
+
+        case A_DS_QUERY_KEY_WRONG_REG:
+        default:
+#if DS_WARNING
+            /* Other registers are not supported yet */
+            warn_report("[Digital Signature] Unsupported read to %08lx\n", addr);
+#endif
+            break;
+    }
+
+#if DS_DEBUG
+    info_report("[Digital Signature] Reading from %08lx (%08lx)\n", addr, r);
+#endif
+
+    return r;
+}
+
+
+static void esp_ds_write(void *opaque, hwaddr addr,
+                       uint64_t value, unsigned int size)
+{
+    ESPDsState *s = ESP_DS(opaque);
+
+    /* Only support word aligned access for the moment */
+    if (size != sizeof(uint32_t)) {
+        error_report("[Digital Signature] Only 32-bit word access supported at the moment");
+    }
+
+    switch (addr) {
+        case A_DS_MEM_Y_BLOCK_BASE ... (A_DS_MEM_Y_BLOCK_BASE + ESP_DS_MAX_MEM_BLK_SIZE - 1):
+            esp_ds_mem_write(s, s->y_mem, addr - A_DS_MEM_Y_BLOCK_BASE, value);
+            break;
+
+        case A_DS_MEM_M_BLOCK_BASE ... (A_DS_MEM_M_BLOCK_BASE + ESP_DS_MAX_MEM_BLK_SIZE - 1):
+            esp_ds_mem_write(s, s->m_mem, addr - A_DS_MEM_M_BLOCK_BASE, value);
+            break;
+
+        case A_DS_MEM_RB_BLOCK_BASE ... (A_DS_MEM_RB_BLOCK_BASE + ESP_DS_MAX_MEM_BLK_SIZE - 1):
+            esp_ds_mem_write(s, s->rb_mem, addr - A_DS_MEM_RB_BLOCK_BASE, value);
+            break;
+
+        case A_DS_MEM_BOX_BLOCK_BASE ... (A_DS_MEM_BOX_BLOCK_BASE + ESP_DS_BOX_MEM_BLK_SIZE - 1):
+            s->box_mem[(addr - A_DS_MEM_BOX_BLOCK_BASE) / sizeof(uint32_t)] = (uint32_t) value;
+            break;
+
+        case A_DS_MEM_X_BLOCK_BASE ... (A_DS_MEM_X_BLOCK_BASE + ESP_DS_MAX_MEM_BLK_SIZE - 1):
+            esp_ds_mem_write(s, s->x_mem, addr - A_DS_MEM_X_BLOCK_BASE, value);
+            break;
+
+        case A_DS_IV_0_REG...A_DS_IV_3_REG:
+            s->iv[(addr - A_DS_IV_0_REG) / sizeof(uint32_t)] = (uint32_t) value;
+            break;
+
+        case A_DS_SET_START_REG:
+            esp_ds_generate_ds_key(s);
+            break;
+
+        case A_DS_SET_ME_REG:
+            esp_ds_calculate(s);
+            break;
+
+        case A_DS_SET_FINISH_REG:
+            esp_ds_clear_buffers(s);
+            break;
+
+        case A_DS_DATE_REG:
+        default:
+#if DS_WARNING
+            /* Other registers are not supported yet */
+            warn_report("[Digital Signature] Unsupported write to %08lx (%08lx)\n", addr, value);
+#endif
+            break;
+    }
+
+#if DS_DEBUG
+    info_report("[Digital Signature] Writing to %08lx (%08lx)\n", addr, value);
+#endif
+
+}
+
+static const MemoryRegionOps esp_ds_ops = {
+    .read =  esp_ds_read,
+    .write = esp_ds_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+};
+
+static void esp_ds_reset(DeviceState *dev)
+{
+    ESPDsState *s = ESP_DS(dev);
+    esp_ds_clear_buffers(s);
+    s->ds_signature_check = DS_SIGNATURE_PADDING_AND_MD_FAIL;
+}
+
+static void esp_ds_realize(DeviceState *dev, Error **errp)
+{
+    ESPDsState *s = ESP_DS(dev);
+
+    /* Make sure HMAC was set or issue an error */
+    if (s->hmac == NULL) {
+        error_report("[Digital Signature] HMAC controller must be set!");
+    }
+
+    /* Make sure AES was set or issue an error */
+    if (s->aes == NULL) {
+        error_report("[Digital Signature] AES controller must be set!");
+    }
+
+    /* Make sure RSA was set or issue an error */
+    if (s->rsa == NULL) {
+        error_report("[Digital Signature] RSA controller must be set!");
+    }
+
+    /* Make sure SHA was set or issue an error */
+    if (s->sha == NULL) {
+        error_report("[Digital Signature] SHA controller must be set!");
+    }
+}
+
+static void esp_ds_init(Object *obj)
+{
+    ESPDsState *s = ESP_DS(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    memory_region_init_io(&s->iomem, obj, &esp_ds_ops, s,
+                          object_get_typename(obj), ESP_DS_REGS_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+}
+
+static const VMStateDescription vmstate_esp_ds = {
+    .name = "esp_ds",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(y_mem, ESPDsState, ESP_DS_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(m_mem, ESPDsState, ESP_DS_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(rb_mem, ESPDsState, ESP_DS_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(box_mem, ESPDsState, ESP_DS_BOX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(x_mem, ESPDsState, ESP_DS_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(z_mem, ESPDsState, ESP_DS_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(iv, ESPDsState, ESP_DS_IV_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(ds_key, ESPDsState, ESP_DS_KEY_SIZE / 4),
+        VMSTATE_UINT32(ds_signature_check, ESPDsState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void esp_ds_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = esp_ds_realize;
+
+    dc->vmsd = &vmstate_esp_ds;
+    dc->reset = esp_ds_reset;
+}
+
+static const TypeInfo esp_ds_info = {
+    .name = TYPE_ESP_DS,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(ESPDsState),
+    .abstract = true,
+    .instance_init = esp_ds_init,
+    .class_init = esp_ds_class_init,
+    .class_size = sizeof(ESPDsClass)
+};
+
+static void esp_ds_register_types(void)
+{
+    type_register_static(&esp_ds_info);
+}
+
+type_init(esp_ds_register_types)
@@ -0,0 +1,388 @@
+/*
+ * RSA accelerator shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2023 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qapi/error.h"
+#include "hw/hw.h"
+#include "hw/sysbus.h"
+#include "hw/boards.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "hw/misc/esp_rsa.h"
+#include "hw/irq.h"
+
+#define ESP_RSA_REGS_SIZE (A_RSA_DATE_REG + 4)
+
+#define RSA_WARNING 0
+
+/** Calculates Z_MEM = X_MEM ^ Y_MEM mod M_MEM.
+ *  Unlike the real hardware, doesn't use the mprime register.
+ */
+static bool esp_rsa_exp_mod(ESPRsaState *s, uint32_t mode_reg, uint32_t *x_mem, uint32_t *y_mem, uint32_t *m_mem, uint32_t *z_mem, uint32_t int_ena)
+{
+    /* Get the length of the operands in bytes. Register mode_reg designates the length
+     * in 32-bit words. */
+    size_t n_bytes = (mode_reg + 1) * 4;
+
+    if (!esp_rsa_mpi_exp_mod(&s->mpi, x_mem, y_mem, m_mem, n_bytes, z_mem, ESP_RSA_GET_CLASS(s)->mem_blk_size)) {
+        return false;
+    }
+
+    /* Trigger an interrupt on completion */
+    if (int_ena) {
+        qemu_set_irq(s->irq, 1);
+    }
+    return true;
+}
+
+
+/* Calculates Z_MEM = X_MEM * Y_MEM mod M_MEM. */
+static bool esp_rsa_modmul_start(ESPRsaState *s)
+{
+    assert(s->mode_reg < (1 << 7));
+
+    /* In this mode, the output and input lengths are the same, mode_reg represents the length of
+     * the operands in 32-bit word. Multiply by 4 to get the size in bytes. */
+    const size_t n_bytes = (s->mode_reg + 1) * 4;
+
+    return esp_rsa_mpi_mod_mul(&s->mpi, s->x_mem, s->y_mem, s->m_mem, n_bytes, s->z_mem, ESP_RSA_GET_CLASS(s)->mem_blk_size);
+}
+
+
+/** Calculates Z_MEM = X_MEM * Z_MEM */
+static bool esp_rsa_mul_start(ESPRsaState *s)
+{
+    /* In this mode, the output length, in 32-bit word, is set by mode_reg. The input is length / 2.
+     * Thus, multiply mode_reg by 4 to get the number of bytes. */
+    size_t n_bytes = (s->mode_reg + 1) * 4;
+    size_t n_bytes_input = n_bytes / 2;
+
+    memcpy(s->z_mem, s->z_mem + n_bytes_input / sizeof(uint32_t), n_bytes_input);
+    memset(s->z_mem + n_bytes_input / sizeof(uint32_t), 0, n_bytes_input);
+
+    return esp_rsa_mpi_mul(&s->mpi, s->x_mem, s->z_mem, n_bytes, s->z_mem, ESP_RSA_GET_CLASS(s)->mem_blk_size);
+}
+
+
+/**
+ * @brief Mark the operation that was just performed as completed. If the latency is modelled,
+ * the peripheral stays busy for the duration the real hardware would take to perform it.
+ */
+static void esp_rsa_complete(ESPRsaState *s, uint64_t cycles)
+{
+    if (!s->model_latency) {
+        /* Trigger an interrupt on completion */
+        if (s->int_ena) {
+            qemu_set_irq(s->irq, 1);
+        }
+        return;
+    }
+
+    s->busy = true;
+    timer_mod_ns(&s->op_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                               muldiv64(cycles, NANOSECONDS_PER_SECOND, ESP_RSA_MPI_CLK_FREQ));
+}
+
+
+static void esp_rsa_op_timer_cb(void *opaque)
+{
+    ESPRsaState *s = ESP_RSA(opaque);
+
+    s->busy = false;
+    if (s->int_ena) {
+        qemu_set_irq(s->irq, 1);
+    }
+}
+
+
+static void esp_rsa_clean_mem(ESPRsaState *s)
+{
+    memset(s->m_mem, 0, sizeof(s->m_mem));
+    memset(s->x_mem, 0, sizeof(s->x_mem));
+    memset(s->y_mem, 0, sizeof(s->y_mem));
+    memset(s->z_mem, 0, sizeof(s->z_mem));
+}
+
+/**
+ * @brief Access a word of the given memory block. The block is mapped in a window bigger
+ * than the actual memory of some targets, the words beyond it are ignored.
+ */
+static uint32_t esp_rsa_mem_read(ESPRsaState *s, const uint32_t *mem, hwaddr offset)
+{
+    ESPRsaClass *class = ESP_RSA_GET_CLASS(s);
+    return offset < class->mem_blk_size ? mem[offset / sizeof(uint32_t)] : 0;
+}
+
+
+static void esp_rsa_mem_write(ESPRsaState *s, uint32_t *mem, hwaddr offset, uint32_t value)
+{
+    ESPRsaClass *class = ESP_RSA_GET_CLASS(s);
+    if (offset < class->mem_blk_size) {
+        mem[offset / sizeof(uint32_t)] = value;
+    }
+}
+
+static uint64_t esp_rsa_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    ESPRsaState *s = ESP_RSA(opaque);
+    uint64_t r = 0;
+
+    switch (addr) {
+        case A_RSA_MEM_M_BLOCK_BASE ... (A_RSA_MEM_M_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            r = esp_rsa_mem_read(s, s->m_mem, addr - A_RSA_MEM_M_BLOCK_BASE);
+            break;
+
+        case A_RSA_MEM_Z_BLOCK_BASE ... (A_RSA_MEM_Z_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            r = esp_rsa_mem_read(s, s->z_mem, addr - A_RSA_MEM_Z_BLOCK_BASE);
+            break;
+
+        case A_RSA_MEM_Y_BLOCK_BASE ... (A_RSA_MEM_Y_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            r = esp_rsa_mem_read(s, s->y_mem, addr - A_RSA_MEM_Y_BLOCK_BASE);
+            break;
+
+        case A_RSA_MEM_X_BLOCK_BASE ... (A_RSA_MEM_X_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            r = esp_rsa_mem_read(s, s->x_mem, addr - A_RSA_MEM_X_BLOCK_BASE);
+            break;
+
+        case A_RSA_M_PRIME_REG:
+            r = s->mprime_reg;
+            break;
+
+        case A_RSA_MODE_REG:
+            r = s->mode_reg;
+            break;
+
+        case A_RSA_CONSTANT_TIME_REG:
+            r = s->const_time_reg;
+            break;
+
+        case A_RSA_SEARCH_ENABLE_REG:
+            r = s->search_ena_reg;
+            break;
+
+        case A_RSA_SEARCH_POS_REG:
+            r = s->search_pos_reg;
+            break;
+
+        case A_RSA_CLEAN_REG:
+            esp_rsa_clean_mem(s);
+            r = 1;
+            break;
+
+        case A_RSA_IDLE_REG:
+            r = s->busy ? 0 : 1;
+            break;
+
+        case A_RSA_INTERRUPT_ENA_REG:
+            r = s->int_ena;
+            break;
+
+        default:
+#if RSA_WARNING
+            warn_report("[RSA] Unsupported read to register %08" HWADDR_PRIx, addr);
+#endif
+            break;
+
+    }
+
+    return r;
+}
+
+
+static void esp_rsa_write(void *opaque, hwaddr addr,
+                       uint64_t value, unsigned int size)
+{
+    ESPRsaClass *class = ESP_RSA_GET_CLASS(opaque);
+    ESPRsaState *s = ESP_RSA(opaque);
+
+    switch (addr) {
+
+        case A_RSA_MEM_M_BLOCK_BASE ... (A_RSA_MEM_M_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            esp_rsa_mem_write(s, s->m_mem, addr - A_RSA_MEM_M_BLOCK_BASE, value);
+            break;
+
+        case A_RSA_MEM_Z_BLOCK_BASE ... (A_RSA_MEM_Z_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            esp_rsa_mem_write(s, s->z_mem, addr - A_RSA_MEM_Z_BLOCK_BASE, value);
+            break;
+
+        case A_RSA_MEM_Y_BLOCK_BASE ... (A_RSA_MEM_Y_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            esp_rsa_mem_write(s, s->y_mem, addr - A_RSA_MEM_Y_BLOCK_BASE, value);
+            break;
+
+        case A_RSA_MEM_X_BLOCK_BASE ... (A_RSA_MEM_X_BLOCK_BASE + ESP_RSA_MAX_MEM_BLK_SIZE - 1):
+            esp_rsa_mem_write(s, s->x_mem, addr - A_RSA_MEM_X_BLOCK_BASE, value);
+            break;
+
+        case A_RSA_M_PRIME_REG:
+            s->mprime_reg = value;
+            break;
+
+        case A_RSA_MODE_REG:
+            s->mode_reg = FIELD_EX32(value, RSA_MODE_REG, RSA_MODE);
+            break;
+
+        case A_RSA_CONSTANT_TIME_REG:
+            s->const_time_reg = FIELD_EX32(value, RSA_CONSTANT_TIME_REG, RSA_CONSTANT_TIME);
+            break;
+
+        case A_RSA_SEARCH_ENABLE_REG:
+            s->search_ena_reg = FIELD_EX32(value, RSA_SEARCH_ENABLE_REG, RSA_SEARCH_ENABLE);
+            break;
+
+        case A_RSA_SEARCH_POS_REG:
+            s->search_pos_reg = FIELD_EX32(value, RSA_SEARCH_POS_REG, RSA_SEARCH_POS);
+            break;
+
+        case A_RSA_MODEXP_START_REG:
+            if (FIELD_EX32(value, RSA_MODEXP_START_REG, RSA_MODEXP_START)) {
+                const size_t n_bytes = (s->mode_reg + 1) * 4;
+                /* Like the other operations, a failed one is never reported as completed */
+                if (class->rsa_exp_mod(s, s->mode_reg, s->x_mem, s->y_mem, s->m_mem, s->z_mem, 0)) {
+                    esp_rsa_complete(s, esp_rsa_mpi_exp_mod_cycles(s->y_mem, n_bytes, s->const_time_reg));
+                }
+            }
+            break;
+
+        case A_RSA_MODMULT_START_REG:
+            if (FIELD_EX32(value, RSA_MODMULT_START_REG, RSA_MODMULT_START) && esp_rsa_modmul_start(s)) {
+                esp_rsa_complete(s, esp_rsa_mpi_mod_mul_cycles((s->mode_reg + 1) * 4));
+            }
+            break;
+
+        case A_RSA_MULT_START_REG:
+            if (FIELD_EX32(value, RSA_MULT_START_REG, RSA_MULT_START) && esp_rsa_mul_start(s)) {
+                esp_rsa_complete(s, esp_rsa_mpi_mul_cycles((s->mode_reg + 1) * 4));
+            }
+            break;
+
+        case A_RSA_CLEAR_INTERRUPT_REG:
+            if (FIELD_EX32(value, RSA_CLEAR_INTERRUPT_REG, RSA_CLEAR_INTERRUPT)) {
+                qemu_irq_lower(s->irq);
+            }
+            break;
+
+        case A_RSA_INTERRUPT_ENA_REG:
+            s->int_ena = FIELD_EX32(value, RSA_INTERRUPT_ENA_REG, RSA_INTERRUPT_ENA);
+            break;
+
+        default:
+#if RSA_WARNING
+            warn_report("[RSA] Unsupported write to register %08" HWADDR_PRIx, addr);
+#endif
+            break;
+    }
+
+}
+
+static const MemoryRegionOps esp_rsa_ops = {
+    .read =  esp_rsa_read,
+    .write = esp_rsa_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+};
+
+static void esp_rsa_reset(DeviceState *dev)
+{
+    ESPRsaState *s = ESP_RSA(dev);
+
+    esp_rsa_clean_mem(s);
+
+    /* Abort any operation in progress */
+    timer_del(&s->op_timer);
+    s->busy = false;
+
+    /* Clear any spurious interrupt */
+    s->int_ena = 0;
+    qemu_irq_lower(s->irq);
+}
+
+static void esp_rsa_init(Object *obj)
+{
+    ESPRsaState *s = ESP_RSA(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    memory_region_init_io(&s->iomem, obj, &esp_rsa_ops, s,
+                          object_get_typename(obj), ESP_RSA_REGS_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+
+    sysbus_init_irq(sbd, &s->irq);
+
+    timer_init_ns(&s->op_timer, QEMU_CLOCK_VIRTUAL, esp_rsa_op_timer_cb, s);
+}
+
+
+static void esp_rsa_finalize(Object *obj)
+{
+    ESPRsaState *s = ESP_RSA(obj);
+
+    timer_del(&s->op_timer);
+    esp_rsa_mpi_free(&s->mpi);
+}
+
+
+static const VMStateDescription vmstate_esp_rsa = {
+    .name = "esp_rsa",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(m_mem, ESPRsaState, ESP_RSA_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(z_mem, ESPRsaState, ESP_RSA_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(y_mem, ESPRsaState, ESP_RSA_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32_ARRAY(x_mem, ESPRsaState, ESP_RSA_MAX_MEM_BLK_SIZE / 4),
+        VMSTATE_UINT32(mprime_reg, ESPRsaState),
+        VMSTATE_UINT32(mode_reg, ESPRsaState),
+        VMSTATE_UINT32(const_time_reg, ESPRsaState),
+        VMSTATE_UINT32(search_ena_reg, ESPRsaState),
+        VMSTATE_UINT32(search_pos_reg, ESPRsaState),
+        VMSTATE_UINT32(int_ena, ESPRsaState),
+        VMSTATE_BOOL(busy, ESPRsaState),
+        VMSTATE_TIMER(op_timer, ESPRsaState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property esp_rsa_properties[] = {
+    DEFINE_PROP_BOOL("model-latency", ESPRsaState, model_latency, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+
+static void esp_rsa_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ESPRsaClass* esp_rsa = ESP_RSA_CLASS(klass);
+
+    dc->reset = esp_rsa_reset;
+
+    dc->vmsd = &vmstate_esp_rsa;
+    device_class_set_props(dc, esp_rsa_properties);
+
+    esp_rsa->rsa_exp_mod = esp_rsa_exp_mod;
+}
+
+static const TypeInfo esp_rsa_info = {
+    .name = TYPE_ESP_RSA,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .abstract = true,
+    .instance_size = sizeof(ESPRsaState),
+    .instance_init = esp_rsa_init,
+    .instance_finalize = esp_rsa_finalize,
+    .class_init = esp_rsa_class_init,
+    .class_size = sizeof(ESPRsaClass)
+};
+
+static void esp_rsa_register_types(void)
+{
+    type_register_static(&esp_rsa_info);
+}
+
+type_init(esp_rsa_register_types)
@@ -0,0 +1,272 @@
+/*
+ * Big number backend shared by the ESP RSA accelerators
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "hw/misc/esp_rsa_mpi.h"
+#include <gcrypt.h>
+
+
+/**
+ * Convert between libgcrypt big-endian representation and little-endian hardware, or vice versa.
+ * src_size should not exceed dst_size. The remaining part of dst is filled with 0.
+ */
+static void copy_reversed(unsigned char* dst, size_t dst_size, const unsigned char* src, size_t src_size)
+{
+    assert(src_size <= dst_size);
+    size_t i;
+    for (i = 0; i < src_size; ++i) {
+        dst[i] = src[src_size - i - 1];
+    }
+    for (; i < dst_size; ++i) {
+        dst[i] = 0;
+    }
+}
+
+
+/**
+ * Get the gcry_mpi_t object of the given little-endian memory block of the RSA peripheral.
+ * The memory block is only parsed if its content changed since the last call.
+ */
+static gcry_mpi_t esp_rsa_mpi_operand(EspRsaMpiOperand *op, const uint32_t *mem_block, size_t n_bytes, bool *parsed)
+{
+    size_t scanned;
+    unsigned char temp_buffer[ESP_RSA_MPI_MAX_SIZE];
+
+    assert(n_bytes <= ESP_RSA_MPI_MAX_SIZE);
+
+    if (parsed) {
+        *parsed = false;
+    }
+
+    if (op->mpi != NULL && op->size == n_bytes && memcmp(op->block, mem_block, n_bytes) == 0) {
+        return op->mpi;
+    }
+
+    gcry_mpi_release(op->mpi);
+    op->mpi = NULL;
+    op->size = 0;
+
+    copy_reversed(temp_buffer, n_bytes, (const unsigned char*) mem_block, n_bytes);
+    gcry_error_t err = gcry_mpi_scan(&op->mpi, GCRYMPI_FMT_USG, temp_buffer, n_bytes, &scanned);
+    if (err) {
+        error_report("%s: gcry_mpi_scan failed with error: %s (%d)", __func__, gcry_strerror(err), err);
+        return NULL;
+    }
+    if (scanned != n_bytes) {
+        error_report("%s: gcry_mpi_scan scanned %zu, expected %zu", __func__, scanned, n_bytes);
+        gcry_mpi_release(op->mpi);
+        op->mpi = NULL;
+        return NULL;
+    }
+
+    memcpy(op->block, mem_block, n_bytes);
+    op->size = n_bytes;
+    if (parsed) {
+        *parsed = true;
+    }
+    return op->mpi;
+}
+
+
+/**
+ * Copies an MPI from gcry_mpi_t object to the RSA peripheral memory block.
+ */
+static bool mpi_gcrypt_to_block(gcry_mpi_t in, uint32_t *mem_block, size_t block_size)
+{
+    size_t written;
+    unsigned char temp_buffer[ESP_RSA_MPI_MAX_SIZE];
+    assert(block_size <= ESP_RSA_MPI_MAX_SIZE);
+    gcry_error_t err = gcry_mpi_print(GCRYMPI_FMT_USG, temp_buffer, block_size, &written, in);
+    if (err) {
+        error_report("%s: gcry_mpi_print failed with error: %s (%d)", __func__, gcry_strerror(err), err);
+        return false;
+    }
+    copy_reversed((unsigned char*) mem_block, block_size, temp_buffer, written);
+    return true;
+}
+
+
+/**
+ * Get the preallocated result objects
+ */
+static gcry_mpi_t esp_rsa_mpi_result(EspRsaMpi *c)
+{
+    if (c->result == NULL) {
+        c->result = gcry_mpi_new(ESP_RSA_MPI_MAX_SIZE * 8 * 2);
+    }
+    return c->result;
+}
+
+
+static gcry_mpi_t esp_rsa_mpi_tmp(EspRsaMpi *c)
+{
+    if (c->tmp == NULL) {
+        c->tmp = gcry_mpi_new(ESP_RSA_MPI_MAX_SIZE * 8 * 2);
+    }
+    return c->tmp;
+}
+
+
+/**
+ * Get the modulus, invalidate R^-1 if it had to be parsed again
+ */
+static gcry_mpi_t esp_rsa_mpi_modulus(EspRsaMpi *c, const uint32_t *m, size_t n_bytes)
+{
+    bool parsed;
+    gcry_mpi_t mod = esp_rsa_mpi_operand(&c->m, m, n_bytes, &parsed);
+    if (mod == NULL || parsed) {
+        c->rinv_valid = false;
+    }
+    return mod;
+}
+
+
+bool esp_rsa_mpi_exp_mod(EspRsaMpi *c, const uint32_t *x, const uint32_t *y, const uint32_t *m,
+                         size_t n_bytes, uint32_t *z, size_t z_size)
+{
+    gcry_mpi_t mx = esp_rsa_mpi_operand(&c->x, x, n_bytes, NULL);
+    gcry_mpi_t my = esp_rsa_mpi_operand(&c->y, y, n_bytes, NULL);
+    gcry_mpi_t mm = esp_rsa_mpi_modulus(c, m, n_bytes);
+
+    if (mx == NULL || my == NULL || mm == NULL) {
+        return false;
+    }
+
+    gcry_mpi_t res = esp_rsa_mpi_result(c);
+    gcry_mpi_powm(res, mx, my, mm);
+    return mpi_gcrypt_to_block(res, z, z_size);
+}
+
+
+bool esp_rsa_mpi_mod_mul(EspRsaMpi *c, const uint32_t *x, const uint32_t *y, const uint32_t *m,
+                         size_t n_bytes, uint32_t *z, size_t z_size)
+{
+    gcry_mpi_t mx = esp_rsa_mpi_operand(&c->x, x, n_bytes, NULL);
+    gcry_mpi_t my = esp_rsa_mpi_operand(&c->y, y, n_bytes, NULL);
+    gcry_mpi_t mm = esp_rsa_mpi_modulus(c, m, n_bytes);
+
+    if (mx == NULL || my == NULL || mm == NULL) {
+        return false;
+    }
+
+    gcry_mpi_t res = esp_rsa_mpi_result(c);
+    gcry_mpi_mulm(res, mx, my, mm);
+    return mpi_gcrypt_to_block(res, z, z_size);
+}
+
+
+bool esp_rsa_mpi_mont_mul(EspRsaMpi *c, const uint32_t *x, const uint32_t *y, const uint32_t *m,
+                          size_t n_bytes, uint32_t *z, size_t z_size)
+{
+    gcry_mpi_t mx = esp_rsa_mpi_operand(&c->x, x, n_bytes, NULL);
+    gcry_mpi_t my = esp_rsa_mpi_operand(&c->y, y, n_bytes, NULL);
+    gcry_mpi_t mm = esp_rsa_mpi_modulus(c, m, n_bytes);
+
+    if (mx == NULL || my == NULL || mm == NULL) {
+        return false;
+    }
+
+    /* Calculate R^-1 if it hasn't been calculated yet for this modulus */
+    if (!c->rinv_valid) {
+        if (c->rinv == NULL) {
+            c->rinv = gcry_mpi_new(n_bytes * 8);
+        }
+        gcry_mpi_t r = esp_rsa_mpi_tmp(c);
+        gcry_mpi_set_ui(r, 0);
+        gcry_mpi_set_bit(r, n_bytes * 8);
+        if (!gcry_mpi_invm(c->rinv, r, mm)) {
+            error_report("%s: failed to calculate modulo inverse", __func__);
+            return false;
+        }
+        c->rinv_valid = true;
+    }
+
+    /* The real hardware uses the Montgomery multiplication algorithm, here simply call the
+     * modular multiplication function twice */
+    gcry_mpi_t res = esp_rsa_mpi_result(c);
+    gcry_mpi_t tmp = esp_rsa_mpi_tmp(c);
+    gcry_mpi_mulm(tmp, mx, my, mm);
+    gcry_mpi_mulm(res, tmp, c->rinv, mm);
+    return mpi_gcrypt_to_block(res, z, z_size);
+}
+
+
+bool esp_rsa_mpi_mul(EspRsaMpi *c, const uint32_t *x, const uint32_t *y,
+                     size_t n_bytes, uint32_t *z, size_t z_size)
+{
+    gcry_mpi_t mx = esp_rsa_mpi_operand(&c->x, x, n_bytes, NULL);
+    gcry_mpi_t my = esp_rsa_mpi_operand(&c->y, y, n_bytes, NULL);
+
+    if (mx == NULL || my == NULL) {
+        return false;
+    }
+
+    gcry_mpi_t res = esp_rsa_mpi_result(c);
+    gcry_mpi_mul(res, mx, my);
+    return mpi_gcrypt_to_block(res, z, z_size);
+}
+
+
+/**
+ * Number of cycles of a single Montgomery multiplication: the multiplier processes one 32-bit
+ * word of an operand per cycle, for each word of the other operand.
+ */
+static uint64_t esp_rsa_mpi_mont_cycles(size_t n_bytes)
+{
+    const uint64_t words = DIV_ROUND_UP(n_bytes, 4);
+    return words * (words + 3);
+}
+
+
+uint64_t esp_rsa_mpi_exp_mod_cycles(const uint32_t *y, size_t n_bytes, bool const_time)
+{
+    const size_t words = DIV_ROUND_UP(n_bytes, 4);
+    uint64_t bits = 0;
+    uint64_t set_bits = 0;
+
+    for (size_t i = 0; i < words; i++) {
+        if (y[i] != 0) {
+            bits = i * 32 + 32 - clz32(y[i]);
+            set_bits += ctpop32(y[i]);
+        }
+    }
+
+    /* One squaring per bit of the exponent, one multiplication per bit set.
+     * Plus the conversions into and out of the Montgomery domain */
+    const uint64_t mults = bits + (const_time ? bits : set_bits) + 2;
+    return mults * esp_rsa_mpi_mont_cycles(n_bytes);
+}
+
+
+uint64_t esp_rsa_mpi_mod_mul_cycles(size_t n_bytes)
+{
+    return 2 * esp_rsa_mpi_mont_cycles(n_bytes);
+}
+
+
+uint64_t esp_rsa_mpi_mul_cycles(size_t n_bytes)
+{
+    /* Operands are half the size of the result */
+    return esp_rsa_mpi_mont_cycles(n_bytes / 2);
+}
+
+
+void esp_rsa_mpi_free(EspRsaMpi *c)
+{
+    gcry_mpi_release(c->x.mpi);
+    gcry_mpi_release(c->y.mpi);
+    gcry_mpi_release(c->m.mpi);
+    gcry_mpi_release(c->rinv);
+    gcry_mpi_release(c->result);
+    gcry_mpi_release(c->tmp);
+    memset(c, 0, sizeof(EspRsaMpi));
+}
@@ -0,0 +1,470 @@
+/*
+ * XTS-AES flash encryption shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2023 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/sysbus.h"
+#include "migration/vmstate.h"
+#include "qemu/error-report.h"
+#include "hw/misc/esp_xts_aes.h"
+
+#define XTS_AES_WARNING 0
+#define XTS_AES_DEBUG   0
+
+#define EFUSE_KEY_PURPOSE_XTS_AES_256_KEY_1     2
+#define EFUSE_KEY_PURPOSE_XTS_AES_256_KEY_2     3
+#define EFUSE_KEY_PURPOSE_XTS_AES_128_KEY       4
+
+#define XTS_AES_KEY_SIZE_128                    32
+#define XTS_AES_KEY_SIZE_256                    64
+#define ESP_XTS_AES_DATA_UNIT_SIZE              128
+
+static bool esp_xts_aes_is_ciphertext_spi_visible(ESPXtsAesState *s)
+{
+    return (s->state == XTS_AES_RELEASE);
+}
+
+static bool esp_xts_aes_is_manual_enc_enabled(ESPXtsAesState *s)
+{
+    ESPXtsAesClass *class = ESP_XTS_AES_GET_CLASS(s);
+    ESP32C3EfuseClass *efuse_class = ESP32C3_EFUSE_GET_CLASS(s->efuse);
+    uint32_t ext_dev_enc_dec_ctrl_reg = class->get_ext_dev_enc_dec_ctrl(s);
+    return ((ext_dev_enc_dec_ctrl_reg & 1) || ((ext_dev_enc_dec_ctrl_reg & 8) && (efuse_class->get_dis_downlaod_man_encrypt == 0)));
+}
+
+static bool esp_xts_aes_is_flash_enc_enabled(ESPXtsAesState *s)
+{
+    ESP32C3EfuseClass *efuse_class = ESP32C3_EFUSE_GET_CLASS(s->efuse);
+    uint32_t spi_boot_crypt_cnt = efuse_class->get_spi_boot_crypt_cnt(s->efuse);
+    return (ctpop32(spi_boot_crypt_cnt) & 1);
+}
+
+static uint32_t esp_xts_aes_get_linesize(ESPXtsAesState *s)
+{
+    ESPXtsAesClass *class = ESP_XTS_AES_GET_CLASS(s);
+    const uint32_t linesize = 16 << s->linesize;
+
+    if (linesize <= class->plain_reg_cnt * sizeof(uint32_t)) {
+        return linesize;
+    } else {
+        error_report("[XTS-AES] Incorrect value of linesize");
+        return 0;
+    }
+}
+
+static uint32_t esp_xts_aes_get_key_size(ESPXtsAesState *s)
+{
+    if (ESP_XTS_AES_GET_CLASS(s)->max_key_size < XTS_AES_KEY_SIZE_256) {
+        return XTS_AES_KEY_SIZE_128;
+    }
+
+    for (int i = EFUSE_BLOCK_KEY0; i < EFUSE_BLOCK_KEY6; i++) {
+        if (esp32c3_efuse_get_key_purpose(s->efuse, i) == EFUSE_KEY_PURPOSE_XTS_AES_256_KEY_1
+            || esp32c3_efuse_get_key_purpose(s->efuse, i) == EFUSE_KEY_PURPOSE_XTS_AES_256_KEY_2) {
+            return XTS_AES_KEY_SIZE_256;
+        }
+    }
+    // A key of 128 bits seem to be present
+    return XTS_AES_KEY_SIZE_128;
+}
+
+static void reverse_xts_aes_key(uint8_t *key)
+{
+    uint8_t temp;
+    for (int j = 0; j < XTS_AES_KEY_SIZE_128 / 2; j++) {
+        temp = key[j];
+        key[j] = key[XTS_AES_KEY_SIZE_128 - j - 1];
+        key[XTS_AES_KEY_SIZE_128 - j - 1] = temp;
+    }
+}
+
+static void esp_xts_aes_get_key(ESPXtsAesState *s, uint8_t *key, uint32_t key_size)
+{
+    memset(key, 0, key_size);
+
+    if (key_size == XTS_AES_KEY_SIZE_128) {
+        for (int i = EFUSE_BLOCK_KEY0; i < EFUSE_BLOCK_KEY6; i++) {
+            if (esp32c3_efuse_get_key_purpose(s->efuse, i) == EFUSE_KEY_PURPOSE_XTS_AES_128_KEY) {
+                esp32c3_efuse_get_key(s->efuse, i, key);
+                // flash encryption key is stored in reverse byte order in the efuse block, correct it
+                reverse_xts_aes_key(key);
+                return;
+            }
+        }
+    } else {
+        // key_size == XTS_AES_KEY_SIZE_256
+        for (int i = EFUSE_BLOCK_KEY0; i < EFUSE_BLOCK_KEY6; i++) {
+            if (esp32c3_efuse_get_key_purpose(s->efuse, i) == EFUSE_KEY_PURPOSE_XTS_AES_256_KEY_1) {
+                esp32c3_efuse_get_key(s->efuse, i, key);
+                reverse_xts_aes_key(key);
+            } else if (esp32c3_efuse_get_key_purpose(s->efuse, i) == EFUSE_KEY_PURPOSE_XTS_AES_256_KEY_2) {
+                esp32c3_efuse_get_key(s->efuse, i, key + XTS_AES_KEY_SIZE_128);
+                reverse_xts_aes_key(key + XTS_AES_KEY_SIZE_128);
+            }
+        }
+    }
+}
+
+static void esp_xts_aes_read_ciphertext(ESPXtsAesState *s, uint32_t* spi_data_regs, uint32_t* spi_data_size, uint32_t* spi_addr, uint32_t* spi_addr_size)
+{
+    *spi_data_size = esp_xts_aes_get_linesize(s);
+    memcpy(spi_data_regs, s->ciphertext, *spi_data_size);
+    /* Right shift address by 8 as the target memory space is a 24-bit address */
+    *spi_addr = (cpu_to_be32(s->physical_addr)) >> 8;
+    *spi_addr_size = 24 / 8;
+}
+
+static uint32_t esp_xts_aes_tweak_extra(ESPXtsAesState *s)
+{
+    return ESP_XTS_AES_GET_CLASS(s)->has_destination ? s->destination << 30 : 0;
+}
+
+static void esp_xts_aes_encrypt(ESPXtsAesState *s)
+{
+    ESPXtsAesClass *class = ESP_XTS_AES_GET_CLASS(s);
+    uint8_t efuse_key[ESP_XTS_AES_MAX_KEY_SIZE];
+    uint8_t data_unit[ESP_XTS_AES_DATA_UNIT_SIZE] = { 0 };
+    uint32_t linesize = esp_xts_aes_get_linesize(s);
+    uint32_t efuse_key_size = esp_xts_aes_get_key_size(s);
+
+    esp_xts_aes_get_key(s, efuse_key, efuse_key_size);
+
+    uint32_t plaintext_offs = (s->physical_addr % (class->plain_reg_cnt * 4));
+    uint32_t pad_left = s->physical_addr % ESP_XTS_AES_DATA_UNIT_SIZE;
+    memcpy(data_unit + pad_left, ((uint8_t*)s->plaintext) + plaintext_offs, linesize);
+
+    esp_aes_xts_crypt(&s->cipher, efuse_key, efuse_key_size, true,
+                      s->physical_addr, class->tweak_mask, esp_xts_aes_tweak_extra(s),
+                      data_unit, ESP_XTS_AES_DATA_UNIT_SIZE);
+
+    memset(s->ciphertext, 0, sizeof(s->ciphertext));
+    memcpy(s->ciphertext, data_unit + pad_left, linesize);
+}
+
+static void esp_xts_aes_decrypt_data(ESPXtsAesState *s, const uint8_t *efuse_key, uint32_t efuse_key_size,
+                                         uint32_t physical_address, uint8_t *data, uint32_t size)
+{
+    ESPXtsAesClass *class = ESP_XTS_AES_GET_CLASS(s);
+
+    esp_aes_xts_crypt(&s->cipher, efuse_key, efuse_key_size, false,
+                      physical_address, class->tweak_mask, esp_xts_aes_tweak_extra(s),
+                      data, size);
+}
+
+static void esp_xts_aes_invalidate(ESPXtsAesState *s, uint32_t physical_address, uint32_t size)
+{
+    const uint64_t end = (uint64_t) physical_address + size;
+
+    for (int i = 0; i < ESP_XTS_AES_CACHE_ENTRIES; i++) {
+        ESPXtsAesCacheEntry *entry = &s->cache[i];
+        if (entry->valid && entry->physical_address < end &&
+            physical_address < (uint64_t) entry->physical_address + entry->size) {
+            entry->valid = false;
+        }
+    }
+}
+
+static ESPXtsAesCacheEntry *esp_xts_aes_cache_lookup(ESPXtsAesState *s, uint32_t physical_address, uint32_t size)
+{
+    for (int i = 0; i < ESP_XTS_AES_CACHE_ENTRIES; i++) {
+        ESPXtsAesCacheEntry *entry = &s->cache[i];
+        if (entry->valid && entry->physical_address == physical_address && entry->size == size
+            && entry->destination == s->destination) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void esp_xts_aes_cache_insert(ESPXtsAesState *s, uint32_t physical_address, const uint8_t *data, uint32_t size)
+{
+    /* Take a free entry if any, else evict the least recently used one */
+    ESPXtsAesCacheEntry *entry = &s->cache[0];
+    for (int i = 0; i < ESP_XTS_AES_CACHE_ENTRIES && entry->valid; i++) {
+        if (!s->cache[i].valid || s->cache[i].last_use < entry->last_use) {
+            entry = &s->cache[i];
+        }
+    }
+
+    if (entry->size != size) {
+        g_free(entry->data);
+        entry->data = g_malloc(size);
+        entry->size = size;
+    }
+    memcpy(entry->data, data, size);
+    entry->physical_address = physical_address;
+    entry->destination = s->destination;
+    entry->last_use = ++s->cache_clock;
+    entry->valid = true;
+}
+
+static void esp_xts_aes_decrypt(ESPXtsAesState *s, uint32_t physical_address, uint8_t *data, uint32_t size)
+{
+    uint8_t efuse_key[ESP_XTS_AES_MAX_KEY_SIZE];
+    uint32_t efuse_key_size = esp_xts_aes_get_key_size(s);
+
+    esp_xts_aes_get_key(s, efuse_key, efuse_key_size);
+
+    /* All the areas decrypted so far are obsolete if the key changed */
+    if (efuse_key_size != s->cache_key_size || memcmp(efuse_key, s->cache_key, efuse_key_size) != 0) {
+        memcpy(s->cache_key, efuse_key, efuse_key_size);
+        s->cache_key_size = efuse_key_size;
+        esp_xts_aes_invalidate(s, 0, UINT32_MAX);
+    }
+
+    ESPXtsAesCacheEntry *entry = esp_xts_aes_cache_lookup(s, physical_address, size);
+    if (entry != NULL) {
+        memcpy(data, entry->data, size);
+        entry->last_use = ++s->cache_clock;
+        s->cache_hits++;
+        return;
+    }
+
+    s->cache_misses++;
+    esp_xts_aes_decrypt_data(s, efuse_key, efuse_key_size, physical_address, data, size);
+    esp_xts_aes_cache_insert(s, physical_address, data, size);
+}
+
+static uint64_t esp_xts_aes_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    ESPXtsAesClass *class = ESP_XTS_AES_GET_CLASS(opaque);
+    ESPXtsAesState *s = ESP_XTS_AES(opaque);
+
+    uint64_t r = 0;
+    switch (addr) {
+        case A_XTS_AES_DATE_REG:
+            r = 0x20200111;
+            break;
+
+        case A_XTS_AES_PLAIN_0_REG ... A_XTS_AES_PLAIN_15_REG:
+            /* The registers past the ones of the target are reserved */
+            if (addr - A_XTS_AES_PLAIN_0_REG < class->plain_reg_cnt * sizeof(uint32_t)) {
+                r = s->plaintext[(addr - A_XTS_AES_PLAIN_0_REG) / sizeof(uint32_t)];
+            }
+            break;
+
+        case A_XTS_AES_LINESIZE_REG:
+            r = s->linesize;
+            break;
+
+        case A_XTS_AES_DESTINATION_REG:
+            r = s->destination;
+            break;
+
+        case A_XTS_AES_PHYSICAL_ADDRESS_REG:
+            r = s->physical_addr;
+            break;
+
+        case A_XTS_AES_STATE_REG:
+            r = s->state;
+            break;
+
+        default:
+#if XTS_AES_WARNING
+            /* Other registers are not supported yet */
+            warn_report("[XTS_AES] Unsupported read to %08lx\n", addr);
+#endif
+            break;
+    }
+
+#if XTS_AES_DEBUG
+    info_report("[XTS_AES] Reading from %08lx (%08lx)\n", addr, r);
+#endif
+
+    return r;
+}
+
+
+static void esp_xts_aes_write(void *opaque, hwaddr addr,
+                       uint64_t value, unsigned int size)
+{
+    ESPXtsAesClass *class = ESP_XTS_AES_GET_CLASS(opaque);
+    ESPXtsAesState *s = ESP_XTS_AES(opaque);
+
+    switch (addr) {
+        case A_XTS_AES_LINESIZE_REG:
+            /* The field is narrower on the targets that have less PLAIN registers */
+            s->linesize = extract32(value, R_XTS_AES_LINESIZE_REG_XTS_AES_LINESIZE_SHIFT, class->linesize_bits);
+            break;
+
+        case A_XTS_AES_DESTINATION_REG:
+            s->destination = FIELD_EX32(value, XTS_AES_DESTINATION_REG, XTS_AES_DESTINATION);
+            break;
+
+        case A_XTS_AES_PHYSICAL_ADDRESS_REG:
+            s->physical_addr = FIELD_EX32(value, XTS_AES_PHYSICAL_ADDRESS_REG, XTS_AES_PHYSICAL_ADDRESS);
+            if (s->physical_addr > 0x00FFFFFF) {
+                error_report("[XTS-AES] Physical Adress greater than 0x00FFFFFF");
+            }
+            break;
+
+        case A_XTS_AES_PLAIN_0_REG ... A_XTS_AES_PLAIN_15_REG:
+            if (addr - A_XTS_AES_PLAIN_0_REG < class->plain_reg_cnt * sizeof(uint32_t)) {
+                s->plaintext[(addr - A_XTS_AES_PLAIN_0_REG) / sizeof(uint32_t)] = value;
+            }
+            break;
+
+        case A_XTS_AES_TRIGGER_REG:
+            if (FIELD_EX32(value, XTS_AES_TRIGGER_REG, XTS_AES_TRIGGER) == 1) {
+                s->state = XTS_AES_BUSY;
+                esp_xts_aes_encrypt(s);
+                s->state= XTS_AES_DONE;
+            }
+            break;
+
+        case A_XTS_AES_RELEASE_REG:
+            if (FIELD_EX32(value, XTS_AES_RELEASE_REG, XTS_AES_RELEASE) == 1) {
+                // "Grant SPI1 access for the ciphertext"
+                s->state = XTS_AES_RELEASE;
+            }
+            break;
+
+        case A_XTS_AES_DESTROY_REG:
+            FIELD_EX32(value, XTS_AES_DESTROY_REG, XTS_AES_DESTROY);
+            s->state = XTS_AES_IDLE;
+            memset(s->ciphertext, 0, sizeof(s->ciphertext));
+            break;
+
+        default:
+#if XTS_AES_WARNING
+            /* Other registers are not supported yet */
+            warn_report("[XTS_AES] Unsupported write to %08lx (%08lx)\n", addr, value);
+#endif
+            break;
+    }
+
+#if XTS_AES_DEBUG
+    info_report("[XTS_AES] Writing to %08lx (%08lx)\n", addr, value);
+#endif
+
+}
+
+static const MemoryRegionOps esp_xts_aes_ops = {
+    .read =  esp_xts_aes_read,
+    .write = esp_xts_aes_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+};
+
+static void esp_xts_aes_reset(DeviceState *dev)
+{
+    ESPXtsAesState *s = ESP_XTS_AES(dev);
+    memset(s->plaintext, 0, sizeof(s->plaintext));
+    memset(s->ciphertext, 0, sizeof(s->ciphertext));
+    s->state = XTS_AES_IDLE;
+    s->linesize = 0;
+    s->destination = 0;
+    s->physical_addr = 0;
+}
+
+static void esp_xts_aes_efuse_reloaded(Notifier *notifier, void *data)
+{
+    ESPXtsAesState *s = container_of(notifier, ESPXtsAesState, efuse_reload);
+
+    /* The flash encryption state comes from SPI_BOOT_CRYPT_CNT efuse */
+    notifier_list_notify(&s->flash_enc_notifiers, s);
+}
+
+static void esp_xts_aes_realize(DeviceState *dev, Error **errp)
+{
+    ESPXtsAesState *s = ESP_XTS_AES(dev);
+
+    /* Make sure Efuse was set or issue an error */
+    if (s->efuse == NULL) {
+        error_report("[XTS_AES] Efuse controller must be set!");
+    } else {
+        s->efuse_reload.notify = esp_xts_aes_efuse_reloaded;
+        notifier_list_add(&s->efuse->reload_notifiers, &s->efuse_reload);
+    }
+}
+
+static void esp_xts_aes_init(Object *obj)
+{
+    ESPXtsAesState *s = ESP_XTS_AES(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    notifier_list_init(&s->flash_enc_notifiers);
+
+    memory_region_init_io(&s->iomem, obj, &esp_xts_aes_ops, s,
+                          object_get_typename(obj), ESP_XTS_AES_REGS_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+
+    object_property_add_uint64_ptr(obj, "decrypt_cache_hits", &s->cache_hits, OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "decrypt_cache_misses", &s->cache_misses, OBJ_PROP_FLAG_READ);
+}
+
+static void esp_xts_aes_finalize(Object *obj)
+{
+    ESPXtsAesState *s = ESP_XTS_AES(obj);
+
+    for (int i = 0; i < ESP_XTS_AES_CACHE_ENTRIES; i++) {
+        g_free(s->cache[i].data);
+    }
+    esp_aes_cipher_free(&s->cipher);
+}
+
+static int esp_xts_aes_post_load(void *opaque, int version_id)
+{
+    ESPXtsAesState *s = ESP_XTS_AES(opaque);
+
+    /* The decrypted areas are not part of the migrated state */
+    esp_xts_aes_invalidate(s, 0, UINT32_MAX);
+    return 0;
+}
+
+static const VMStateDescription vmstate_esp_xts_aes = {
+    .name = "esp_xts_aes",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp_xts_aes_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(plaintext, ESPXtsAesState, ESP_XTS_AES_MAX_PLAIN_REG_CNT),
+        VMSTATE_UINT32_ARRAY(ciphertext, ESPXtsAesState, ESP_XTS_AES_MAX_PLAIN_REG_CNT),
+        VMSTATE_UINT32(linesize, ESPXtsAesState),
+        VMSTATE_UINT32(destination, ESPXtsAesState),
+        VMSTATE_UINT64(physical_addr, ESPXtsAesState),
+        VMSTATE_UINT32(state, ESPXtsAesState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void esp_xts_aes_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ESPXtsAesClass* esp_xts_aes = ESP_XTS_AES_CLASS(klass);
+
+    dc->realize = esp_xts_aes_realize;
+    dc->vmsd = &vmstate_esp_xts_aes;
+    dc->reset = esp_xts_aes_reset;
+
+    esp_xts_aes->is_ciphertext_spi_visible = esp_xts_aes_is_ciphertext_spi_visible;
+    esp_xts_aes->is_flash_enc_enabled = esp_xts_aes_is_flash_enc_enabled;
+    esp_xts_aes->is_manual_enc_enabled = esp_xts_aes_is_manual_enc_enabled;
+    esp_xts_aes->decrypt = esp_xts_aes_decrypt;
+    esp_xts_aes->invalidate = esp_xts_aes_invalidate;
+    esp_xts_aes->read_ciphertext = esp_xts_aes_read_ciphertext;
+}
+
+static const TypeInfo esp_xts_aes_info = {
+    .name = TYPE_ESP_XTS_AES,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .abstract = true,
+    .instance_size = sizeof(ESPXtsAesState),
+    .instance_init = esp_xts_aes_init,
+    .instance_finalize = esp_xts_aes_finalize,
+    .class_init = esp_xts_aes_class_init,
+    .class_size = sizeof(ESPXtsAesClass)
+};
+
+static void esp_xts_aes_register_types(void)
+{
+    type_register_static(&esp_xts_aes_info);
+}
+
+type_init(esp_xts_aes_register_types)
+
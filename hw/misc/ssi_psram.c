@@ -68,6 +68,19 @@ static uint32_t psram_transfer(SSIPeripheral *dev, uint32_t value)
     return psram_read(s);
 }
 
+static void psram_transfer_bulk(SSIPeripheral *dev, const uint8_t *tx,
+                                uint8_t *rx, size_t len)
+{
+    SsiPsramState *s = SSI_PSRAM(dev);
+
+    for (size_t i = 0; i < len; i++) {
+        psram_write(s, tx ? tx[i] : 0);
+        if (rx) {
+            rx[i] = psram_read(s);
+        }
+    }
+}
+
 static int psram_cs(SSIPeripheral *ss, bool select)
 {
     SsiPsramState *s = SSI_PSRAM(ss);
@@ -97,6 +110,7 @@ static void psram_class_init(ObjectClass *klass, void *data)
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     k->transfer = psram_transfer;
+    k->transfer_bulk = psram_transfer_bulk;
     k->set_cs = psram_cs;
     k->cs_polarity = SSI_CS_LOW;
     k->realize = psram_realize;
@@ -38,6 +38,8 @@
 #include "hw/sysbus.h"
 #include "net/net.h"
 #include "qemu/module.h"
+#include "qemu/iov.h"
+#include "qemu/timer.h"
 #include "net/eth.h"
 #include "trace.h"
 #include "qom/object.h"
@@ -304,6 +306,15 @@ struct OpenEthState {
     unsigned tx_desc;
     unsigned rx_desc;
     desc desc[128];
+    /* A frame was queued by the net layer, wait for it before sending more */
+    bool tx_busy;
+
+    /* Interrupt coalescing, see open_eth_irq_raise() */
+    uint32_t coalesce_frames;
+    uint32_t coalesce_us;
+    uint32_t irq_pending;
+    uint32_t irq_frames;
+    QEMUTimer *coalesce_timer;
 };
 
 static desc *rx_desc(OpenEthState *s)
@@ -361,6 +372,11 @@ static void open_eth_reset(void *opaque)
 
     s->tx_desc = 0;
     s->rx_desc = 0x40;
+    s->tx_busy = false;
+
+    s->irq_pending = 0;
+    s->irq_frames = 0;
+    timer_del(s->coalesce_timer);
 
     mii_reset(&s->mii);
     open_eth_set_link_status(qemu_get_queue(s->nic));
@@ -373,10 +389,80 @@ static bool open_eth_can_receive(NetClientState *nc)
     return GET_REGBIT(s, MODER, RXEN) && (s->regs[TX_BD_NUM] < 0x80);
 }
 
-static ssize_t open_eth_receive(NetClientState *nc,
-        const uint8_t *buf, size_t size)
+static void open_eth_irq_flush(OpenEthState *s)
+{
+    uint32_t pending = s->irq_pending;
+
+    s->irq_pending = 0;
+    s->irq_frames = 0;
+    timer_del(s->coalesce_timer);
+    if (pending) {
+        open_eth_int_source_write(s, s->regs[INT_SOURCE] | pending);
+    }
+}
+
+static void open_eth_coalesce_timer_cb(void *opaque)
+{
+    open_eth_irq_flush(opaque);
+}
+
+/* A frame asking for an interrupt is done. With coalescing the interrupt
+ * is raised once irq-coalesce-frames frames are done, or irq-coalesce-us
+ * after the first of them, whichever comes first.
+ */
+static void open_eth_irq_raise(OpenEthState *s, uint32_t source)
+{
+    s->irq_pending |= source;
+    if (++s->irq_frames >= s->coalesce_frames) {
+        open_eth_irq_flush(s);
+    } else if (s->irq_frames == 1) {
+        timer_mod(s->coalesce_timer,
+                qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                (int64_t)s->coalesce_us * SCALE_US);
+    }
+}
+
+/* Write the first `size` bytes of iov followed by `pad` zero bytes to the
+ * guest memory, straight into the mapped buffer when possible.
+ */
+static void open_eth_write_frame(hwaddr addr,
+        const struct iovec *iov, int iovcnt, size_t size, size_t pad)
+{
+    static const uint8_t zero[64] = {0};
+    hwaddr len = size + pad;
+    uint8_t *p = cpu_physical_memory_map(addr, &len, true);
+    size_t done;
+
+    if (p && len == size + pad) {
+        iov_to_buf(iov, iovcnt, 0, p, size);
+        memset(p + size, 0, pad);
+        cpu_physical_memory_unmap(p, len, true, len);
+        return;
+    }
+    if (p) {
+        cpu_physical_memory_unmap(p, len, true, 0);
+    }
+
+    for (done = 0; iovcnt > 0 && done < size; ++iov, --iovcnt) {
+        size_t n = MIN(iov->iov_len, size - done);
+
+        cpu_physical_memory_write(addr + done, iov->iov_base, n);
+        done += n;
+    }
+    while (pad) {
+        size_t n = MIN(pad, sizeof(zero));
+
+        cpu_physical_memory_write(addr + done, zero, n);
+        done += n;
+        pad -= n;
+    }
+}
+
+static ssize_t open_eth_receive_iov(NetClientState *nc,
+        const struct iovec *iov, int iovcnt)
 {
     OpenEthState *s = qemu_get_nic_opaque(nc);
+    size_t size = iov_size(iov, iovcnt);
     size_t maxfl = GET_REGFIELD(s, PACKETLEN, MAXFL);
     size_t minfl = GET_REGFIELD(s, PACKETLEN, MINFL);
     size_t fcsl = 4;
@@ -388,6 +474,9 @@ static ssize_t open_eth_receive(NetClientState *nc,
         static const uint8_t bcast_addr[] = {
             0xff, 0xff, 0xff, 0xff, 0xff, 0xff
         };
+        uint8_t buf[ETH_ALEN];
+
+        iov_to_buf(iov, iovcnt, 0, buf, sizeof(buf));
         if (memcmp(buf, bcast_addr, sizeof(bcast_addr)) == 0) {
             miss = GET_REGBIT(s, MODER, BRO);
         } else if ((buf[0] & 0x1) || GET_REGBIT(s, MODER, IAM)) {
@@ -416,11 +505,13 @@ static ssize_t open_eth_receive(NetClientState *nc,
 #else
     {
 #endif
-        static const uint8_t zero[64] = {0};
         desc *desc = rx_desc(s);
         size_t copy_size = GET_REGBIT(s, MODER, HUGEN) ? 65536 : maxfl;
+        size_t pad = 0;
 
         if (!(desc->len_flags & RXD_E)) {
+            /* Let the guest see the frames it hasn't been told about yet */
+            open_eth_irq_flush(s);
             open_eth_int_source_write(s,
                     s->regs[INT_SOURCE] | INT_SOURCE_BUSY);
             return size;
@@ -446,21 +537,12 @@ static ssize_t open_eth_receive(NetClientState *nc,
         }
 #endif
 
-        cpu_physical_memory_write(desc->buf_ptr, buf, copy_size);
-
         if (GET_REGBIT(s, MODER, PAD) && copy_size < minfl) {
-            if (minfl - copy_size > fcsl) {
+            pad = minfl - copy_size;
+            if (pad > fcsl) {
                 fcsl = 0;
             } else {
-                fcsl -= minfl - copy_size;
-            }
-            while (copy_size < minfl) {
-                size_t zero_sz = minfl - copy_size < sizeof(zero) ?
-                    minfl - copy_size : sizeof(zero);
-
-                cpu_physical_memory_write(desc->buf_ptr + copy_size,
-                        zero, zero_sz);
-                copy_size += zero_sz;
+                fcsl -= pad;
             }
         }
 
@@ -468,8 +550,9 @@ static ssize_t open_eth_receive(NetClientState *nc,
          * Don't do it if the frame is cut at the MAXFL or padded with 4 or
          * more bytes to the MINFL.
          */
-        cpu_physical_memory_write(desc->buf_ptr + copy_size, zero, fcsl);
-        copy_size += fcsl;
+        open_eth_write_frame(desc->buf_ptr, iov, iovcnt, copy_size,
+                pad + fcsl);
+        copy_size += pad + fcsl;
 
         SET_FIELD(desc->len_flags, RXD_LEN, copy_size);
 
@@ -483,27 +566,52 @@ static ssize_t open_eth_receive(NetClientState *nc,
         trace_open_eth_receive_desc(desc->buf_ptr, desc->len_flags);
 
         if (desc->len_flags & RXD_IRQ) {
-            open_eth_int_source_write(s,
-                    s->regs[INT_SOURCE] | INT_SOURCE_RXB);
+            open_eth_irq_raise(s, INT_SOURCE_RXB);
         }
     }
     return size;
 }
 
+static ssize_t open_eth_receive(NetClientState *nc,
+        const uint8_t *buf, size_t size)
+{
+    const struct iovec iov = {
+        .iov_base = (uint8_t *)buf,
+        .iov_len = size,
+    };
+
+    return open_eth_receive_iov(nc, &iov, 1);
+}
+
 static NetClientInfo net_open_eth_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
     .can_receive = open_eth_can_receive,
     .receive = open_eth_receive,
+    .receive_iov = open_eth_receive_iov,
     .link_status_changed = open_eth_set_link_status,
 };
 
+static void open_eth_check_start_xmit(OpenEthState *s);
+
+static void open_eth_tx_sent(NetClientState *nc, ssize_t len)
+{
+    OpenEthState *s = qemu_get_nic_opaque(nc);
+
+    s->tx_busy = false;
+    open_eth_check_start_xmit(s);
+}
+
 static void open_eth_start_xmit(OpenEthState *s, desc *tx)
 {
+    static const uint8_t zero[64] = {0};
+    NetClientState *nc = qemu_get_queue(s->nic);
     uint8_t *buf = NULL;
     uint8_t buffer[0x600];
     unsigned len = GET_FIELD(tx->len_flags, TXD_LEN);
     unsigned tx_len = len;
+    hwaddr map_len;
+    ssize_t ret;
 
     if ((tx->len_flags & TXD_PAD) &&
             tx_len < GET_REGFIELD(s, PACKETLEN, MINFL)) {
@@ -516,21 +624,51 @@ static void open_eth_start_xmit(OpenEthState *s, desc *tx)
 
     trace_open_eth_start_xmit(tx->buf_ptr, len, tx_len);
 
-    if (tx_len > sizeof(buffer)) {
-        buf = g_new(uint8_t, tx_len);
-    } else {
-        buf = buffer;
-    }
     if (len > tx_len) {
         len = tx_len;
     }
-    cpu_physical_memory_read(tx->buf_ptr, buf, len);
-    if (tx_len > len) {
-        memset(buf + len, 0, tx_len - len);
+
+    /* Send the frame from the guest buffer when it can be mapped whole.
+     * The net layer copies the frames it has to queue, so the mapping
+     * doesn't need to outlive the call.
+     */
+    map_len = len;
+    buf = tx_len - len <= sizeof(zero) ?
+        cpu_physical_memory_map(tx->buf_ptr, &map_len, false) : NULL;
+    if (buf && map_len == len) {
+        const struct iovec iov[] = {
+            { .iov_base = buf, .iov_len = len },
+            { .iov_base = (uint8_t *)zero, .iov_len = tx_len - len },
+        };
+
+        ret = qemu_sendv_packet_async(nc, iov, tx_len > len ? 2 : 1,
+                open_eth_tx_sent);
+        cpu_physical_memory_unmap(buf, map_len, false, len);
+    } else {
+        struct iovec iov;
+
+        if (buf) {
+            cpu_physical_memory_unmap(buf, map_len, false, 0);
+        }
+        if (tx_len > sizeof(buffer)) {
+            buf = g_new(uint8_t, tx_len);
+        } else {
+            buf = buffer;
+        }
+        cpu_physical_memory_read(tx->buf_ptr, buf, len);
+        if (tx_len > len) {
+            memset(buf + len, 0, tx_len - len);
+        }
+        iov.iov_base = buf;
+        iov.iov_len = tx_len;
+        ret = qemu_sendv_packet_async(nc, &iov, 1, open_eth_tx_sent);
+        if (tx_len > sizeof(buffer)) {
+            g_free(buf);
+        }
     }
-    qemu_send_packet(qemu_get_queue(s->nic), buf, tx_len);
-    if (tx_len > sizeof(buffer)) {
-        g_free(buf);
+    /* The peer is busy, the frame has been queued: wait for it to go */
+    if (ret == 0) {
+        s->tx_busy = true;
     }
 
     if (tx->len_flags & TXD_WR) {
@@ -544,17 +682,24 @@ static void open_eth_start_xmit(OpenEthState *s, desc *tx)
     tx->len_flags &= ~(TXD_RD | TXD_UR |
             TXD_RTRY | TXD_RL | TXD_LC | TXD_DF | TXD_CS);
     if (tx->len_flags & TXD_IRQ) {
-        open_eth_int_source_write(s, s->regs[INT_SOURCE] | INT_SOURCE_TXB);
+        open_eth_irq_raise(s, INT_SOURCE_TXB);
     }
 
 }
 
+/* Send all the ready descriptors in one go, at most a full ring of them */
 static void open_eth_check_start_xmit(OpenEthState *s)
 {
-    desc *tx = tx_desc(s);
-    if (GET_REGBIT(s, MODER, TXEN) && s->regs[TX_BD_NUM] > 0 &&
-            (tx->len_flags & TXD_RD) &&
-            GET_FIELD(tx->len_flags, TXD_LEN) > 4) {
+    unsigned i;
+
+    for (i = 0; i < s->regs[TX_BD_NUM] && !s->tx_busy; ++i) {
+        desc *tx = tx_desc(s);
+
+        if (!GET_REGBIT(s, MODER, TXEN) ||
+                !(tx->len_flags & TXD_RD) ||
+                GET_FIELD(tx->len_flags, TXD_LEN) <= 4) {
+            break;
+        }
         open_eth_start_xmit(s, tx);
     }
 }
@@ -747,6 +892,9 @@ static void sysbus_open_eth_realize(DeviceState *dev, Error **errp)
 
     sysbus_init_irq(sbd, &s->irq);
 
+    s->coalesce_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+            open_eth_coalesce_timer_cb, s);
+
     s->nic = qemu_new_nic(&net_open_eth_info, &s->conf,
                           object_get_typename(OBJECT(s)), dev->id,
                           &dev->mem_reentrancy_guard, s);
@@ -761,6 +909,10 @@ static void qdev_open_eth_reset(DeviceState *dev)
 
 static Property open_eth_properties[] = {
     DEFINE_NIC_PROPERTIES(OpenEthState, conf),
+    /* 1 raises an interrupt for each frame, as the hardware does */
+    DEFINE_PROP_UINT32("irq-coalesce-frames", OpenEthState,
+            coalesce_frames, 1),
+    DEFINE_PROP_UINT32("irq-coalesce-us", OpenEthState, coalesce_us, 100),
     DEFINE_PROP_END_OF_LIST(),
 };
 
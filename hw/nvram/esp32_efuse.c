@@ -19,6 +19,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/qdev-properties-system.h"
 #include "hw/nvram/esp32_efuse.h"
 
@@ -277,6 +278,28 @@ static void esp32_efuse_init(Object *obj)
     memset(&s->efuse_wr, 0, sizeof(s->efuse_wr));
 }
 
+static const VMStateDescription vmstate_esp32_efuse = {
+    .name = "esp32_efuse",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_TIMER(op_timer, Esp32EfuseState),
+        VMSTATE_BUFFER_UNSAFE(efuse_wr, Esp32EfuseState, 1, sizeof(Esp32EfuseRegs)),
+        VMSTATE_BUFFER_UNSAFE(efuse_wr_dis, Esp32EfuseState, 1, sizeof(Esp32EfuseRegs)),
+        VMSTATE_BUFFER_UNSAFE(efuse_rd, Esp32EfuseState, 1, sizeof(Esp32EfuseRegs)),
+        VMSTATE_BUFFER_UNSAFE(efuse_rd_dis, Esp32EfuseState, 1, sizeof(Esp32EfuseRegs)),
+        VMSTATE_UINT32(clk_reg, Esp32EfuseState),
+        VMSTATE_UINT32(conf_reg, Esp32EfuseState),
+        VMSTATE_UINT32(status_reg, Esp32EfuseState),
+        VMSTATE_UINT32(cmd_reg, Esp32EfuseState),
+        VMSTATE_UINT32(int_raw_reg, Esp32EfuseState),
+        VMSTATE_UINT32(int_st_reg, Esp32EfuseState),
+        VMSTATE_UINT32(int_ena_reg, Esp32EfuseState),
+        VMSTATE_UINT32(dac_conf_reg, Esp32EfuseState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32_efuse_properties[] = {
     DEFINE_PROP_DRIVE("drive", Esp32EfuseState, blk),
     DEFINE_PROP_END_OF_LIST(),
@@ -288,6 +311,7 @@ static void esp32_efuse_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32_efuse_reset;
     dc->realize = esp32_efuse_realize;
+    dc->vmsd = &vmstate_esp32_efuse;
     device_class_set_props(dc, esp32_efuse_properties);
 }
 
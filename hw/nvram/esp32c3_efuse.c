@@ -20,6 +20,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/qdev-properties-system.h"
 #include "hw/nvram/esp32c3_efuse.h"
 
@@ -273,6 +274,7 @@ static void esp32c3_efuse_timer_cb(void *opaque)
         esp32c3_efuse_reload_from_blk(s);
         esp32c3_hide_protected_block(s);
         s->efuses.int_raw.read_done = 1;
+        notifier_list_notify(&s->reload_notifiers, s);
     } else {
         assert(s->efuses.cmd.pgm_cmd);
         s->efuses.int_raw.pgm_done = 1;
@@ -510,8 +512,44 @@ static void esp32c3_efuse_init(Object *obj)
     sysbus_init_irq(sbd, &s->irq);
 
     timer_init_ns(&s->op_timer, QEMU_CLOCK_VIRTUAL, esp32c3_efuse_timer_cb, s);
+    notifier_list_init(&s->reload_notifiers);
 }
 
+static bool esp32c3_efuse_mirror_needed(void *opaque)
+{
+    ESP32C3EfuseState *s = ESP32C3_EFUSE(opaque);
+    return s->mirror != NULL;
+}
+
+/* Without a block device, the programmed efuses only exist in the mirror */
+static const VMStateDescription vmstate_esp32c3_efuse_mirror = {
+    .name = "esp32c3_efuse/mirror",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = esp32c3_efuse_mirror_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BUFFER_POINTER_UNSAFE(mirror, ESP32C3EfuseState, 0, ESP32C3_EFUSE_BYTE_COUNT),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32c3_efuse = {
+    .name = "esp32c3_efuse",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(op_cmd_mirror, ESP32C3EfuseState),
+        VMSTATE_TIMER(op_timer, ESP32C3EfuseState),
+        VMSTATE_BUFFER_UNSAFE(efuses, ESP32C3EfuseState, 1, sizeof(ESP32C3EfuseRegs)),
+        VMSTATE_BUFFER_UNSAFE(efuses_internal, ESP32C3EfuseState, 1, sizeof(ESP32C3EfuseRegs)),
+        VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_esp32c3_efuse_mirror,
+        NULL
+    }
+};
+
 static Property esp32c3_efuse_properties[] = {
     DEFINE_PROP_DRIVE("drive", ESP32C3EfuseState, blk),
     DEFINE_PROP_END_OF_LIST(),
@@ -524,6 +562,7 @@ static void esp32c3_efuse_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32c3_efuse_reset;
     dc->realize = esp32c3_efuse_realize;
+    dc->vmsd = &vmstate_esp32c3_efuse;
     device_class_set_props(dc, esp32c3_efuse_properties);
 
     esp32c3_efuse->get_spi_boot_crypt_cnt = esp32c3_efuse_get_spi_boot_crypt_cnt;
@@ -16,6 +16,7 @@
 #include "qapi/error.h"
 #include "hw/hw.h"
 #include "hw/boards.h"
+#include "hw/misc/esp_machine.h"
 #include "hw/loader.h"
 #include "hw/riscv/riscv_hart.h"
 #include "target/riscv/esp_cpu.h"
@@ -40,6 +41,7 @@
 #include "hw/timer/esp32c3_timg.h"
 #include "hw/timer/esp32c3_systimer.h"
 #include "hw/ssi/esp32c3_spi.h"
+#include "hw/block/flash.h"
 #include "hw/misc/esp32c3_rtc_cntl.h"
 #include "hw/misc/esp32c3_aes.h"
 #include "hw/misc/esp32c3_rsa.h"
@@ -224,8 +226,13 @@ static void esp32c3_init_spi_flash(Esp32C3MachineState *ms, BlockBackend* blk)
     qdev_prop_set_drive(flash_dev, "drive", blk);
     qdev_prop_set_uint8(flash_dev, "cs", 1);
 
+    /* Share the unwritten pages of the image between the instances and keep the written ones
+     * private, the writes are still saved to a writable image */
+    qdev_prop_set_bit(flash_dev, "mmap-cow", true);
+
     /* Realize the SPI flash, its "drive" (blk) property must already be set! */
     qdev_realize(flash_dev, spi_bus, &error_fatal);
+    ms->cache.flash_image = m25p80_get_mapped_image(flash_dev);
     qdev_connect_gpio_out_named(spi_master, SSI_GPIO_CS, 0,
                                 qdev_get_gpio_in_named(flash_dev, SSI_GPIO_CS, 0));
 }
@@ -347,6 +354,10 @@ static void esp32c3_machine_init(MachineState *machine)
     const struct MemmapEntry *memmap = esp32c3_memmap;
     MemoryRegion *sys_mem = get_system_memory();
 
+    /* Only the code fetched through the instruction cache pays the cache misses of the cycle model */
+    qdev_prop_set_uint32(DEVICE(&ms->soc), "cycles-flash-base", memmap[ESP32C3_MEMREGION_ICACHE].base);
+    qdev_prop_set_uint32(DEVICE(&ms->soc), "cycles-flash-size", memmap[ESP32C3_MEMREGION_ICACHE].size);
+
     /* Initialize the IROM */
     MemoryRegion *irom = g_new(MemoryRegion, 1);
     memory_region_init_rom(irom, NULL, "esp32c3.irom", memmap[ESP32C3_MEMREGION_IROM].size, &error_fatal);
@@ -464,7 +475,8 @@ static void esp32c3_machine_init(MachineState *machine)
 
     /* SPI1 controller (SPI Flash) */
     {
-        ms->spi1.xts_aes = &ms->xts_aes;
+        ms->spi1.xts_aes = &ms->xts_aes.parent;
+        ms->spi1.cache = &ms->cache;
         sysbus_realize(SYS_BUS_DEVICE(&ms->spi1), &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ms->spi1), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_SPI1_BASE, mr, 0);
@@ -494,7 +506,7 @@ static void esp32c3_machine_init(MachineState *machine)
         if (blk) {
             ms->cache.flash_blk = blk;
         }
-        ms->cache.xts_aes = &ms->xts_aes;
+        ms->cache.xts_aes = &ms->xts_aes.parent;
         sysbus_realize(SYS_BUS_DEVICE(&ms->cache), &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ms->cache), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_EXTMEM_BASE, mr, 0);
@@ -609,7 +621,7 @@ static void esp32c3_machine_init(MachineState *machine)
 
     /* HMAC realization */
     {
-        ms->hmac.efuse = &ms->efuse;
+        ms->hmac.parent.efuse = &ms->efuse;
         qdev_realize(DEVICE(&ms->hmac), &ms->periph_bus, &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ms->hmac), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_HMAC_BASE, mr, 0);
@@ -617,10 +629,10 @@ static void esp32c3_machine_init(MachineState *machine)
 
     /* Digital Signature realization */
     {
-        ms->ds.hmac = &ms->hmac;
-        ms->ds.aes = &ms->aes;
-        ms->ds.rsa = &ms->rsa;
-        ms->ds.sha = &ms->sha;
+        ms->ds.parent.hmac = &ms->hmac.parent;
+        ms->ds.parent.aes = &ms->aes.parent;
+        ms->ds.parent.rsa = &ms->rsa.parent;
+        ms->ds.parent.sha = &ms->sha.parent;
         qdev_realize(DEVICE(&ms->ds), &ms->periph_bus, &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ms->ds), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_DIGITAL_SIGNATURE_BASE, mr, 0);
@@ -628,7 +640,7 @@ static void esp32c3_machine_init(MachineState *machine)
 
     /* XTS-AES realization */
     {
-        ms->xts_aes.efuse = &ms->efuse;
+        ms->xts_aes.parent.efuse = &ms->efuse;
         ms->xts_aes.clock = &ms->clock;
         qdev_realize(DEVICE(&ms->xts_aes), &ms->periph_bus, &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ms->xts_aes), 0);
@@ -658,6 +670,7 @@ static void esp32c3_machine_class_init(ObjectClass *oc, void *data)
     mc->default_cpus = 1;
     // 0x4f600
     mc->default_ram_size = 400 * 1024;
+    esp_machine_class_add_compat_props(mc);
 }
 
 /* Create a new type of machine ("child class") */
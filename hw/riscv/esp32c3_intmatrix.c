@@ -11,12 +11,14 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qemu/queue.h"
+#include "qemu/host-utils.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "hw/hw.h"
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/riscv/riscv_hart.h"
 #include "hw/riscv/esp32c3_intmatrix.h"
 #include "esp_cpu.h"
@@ -44,17 +46,7 @@ static void esp32c3_do_int(ESP32C3IntMatrixState *s, int line)
 
 static int esp32c3_get_output_line_level(ESP32C3IntMatrixState *s, int line)
 {
-    int level_shared = 0;
-
-    for (int i = 0; level_shared == 0 && i < ESP32C3_INT_MATRIX_INPUTS; i++) {
-        const uint_fast8_t mapped = s->irq_map[i];
-        if (mapped == line && (s->irq_levels & BIT(i)))
-        {
-            level_shared |= 1;
-        }
-    }
-
-    return level_shared;
+    return (s->line_sources[line] & s->irq_levels) != 0;
 }
 
 /**
@@ -153,42 +145,20 @@ static void esp32c3_intmatrix_irq_prio_changed(ESP32C3IntMatrixState* s, uint32_
 
 static void esp32c3_intmatrix_core_prio_changed(ESP32C3IntMatrixState* s, uint64_t new_cpu_priority)
 {
-    uint64_t pending = s->irq_pending;
     const bool accept = esp32c3_intmatrix_can_trigger(s);
 
-    if (pending && accept) {
-        int64_t priority = -1;
-        uint_fast32_t line = 0;
-
-        /* Clear all the interrupts that have a lower priority than the new CPU threshold */
-        for (uint_fast32_t i = 1; i <= ESP32C3_CPU_INT_COUNT; i++) {
-
-            const uint64_t line_prio = s->irq_prio[i];
-            if (line_prio < new_cpu_priority) {
-                CLEAR_BIT(pending, i);
+    if (s->irq_pending && accept) {
+        /* Look for the highest priority pending interrupt, lines with a priority lower than the new
+         * CPU threshold are ignored. Among the lines of the same priority, the lowest one wins. */
+        for (int64_t prio = ESP32C3_INTMATRIX_PRIO_COUNT - 1; prio >= (int64_t) new_cpu_priority; prio--) {
+            const uint64_t pending = s->irq_pending & s->prio_lines[prio];
+            if (pending != 0) {
+                /* No need to clear the pending bit here. As soon as the interrupt source will be ACK by the
+                 * software, its level will be update, as well as its pending state. */
+                esp32c3_do_int(s, ctz64(pending));
+                return;
             }
         }
-
-        /* No high level interrupt pending? */
-        if (pending == 0) {
-            return;
-        }
-
-        /* Look for the highest priority pending interrupt */
-        for (uint_fast32_t i = 1; i <= ESP32C3_CPU_INT_COUNT; i++) {
-            const int64_t line_prio = (int64_t) s->irq_prio[i];
-            if (BIT_SET(pending, i) && line_prio > priority) {
-                priority = line_prio;
-                line = i;
-            }
-        }
-
-        /* Make sure a line was selected with its new priority */
-        assert(line != 0);
-        assert(priority >= new_cpu_priority);
-        /* No need to clear the pending bit here. As soon as the interrupt source will be ACK by the
-         * software, its level will be update, as well as its pending state. */
-        esp32c3_do_int(s, line);
     }
 }
 
@@ -269,7 +239,9 @@ static void esp32c3_intmatrix_write(void* opaque, hwaddr addr, uint64_t value, u
 
     if (index < ESP32C3_INT_MATRIX_INPUTS) {
 
+        CLEAR_BIT(s->line_sources[s->irq_map[index]], index);
         s->irq_map[index] = (value & 0x1f);
+        SET_BIT(s->line_sources[s->irq_map[index]], index);
 #if INTMATRIX_DEBUG
         info_report("\x1b[31m[INTMATRIX] Mapping interrupt %d to CPU line %d\x1b[0m\n", index, s->irq_map[index]);
 #endif
@@ -278,7 +250,9 @@ static void esp32c3_intmatrix_write(void* opaque, hwaddr addr, uint64_t value, u
 
         const uint8_t priority = value & 0xf;
         const uint32_t line = (index - ESP32C3_INTMATRIX_IO_PRIO_START) + 1;
+        CLEAR_BIT(s->prio_lines[s->irq_prio[line]], line);
         s->irq_prio[line] = priority;
+        SET_BIT(s->prio_lines[priority], line);
 #if INTMATRIX_DEBUG
         info_report("\x1b[31m[INTMATRIX] Priority of line %d set to %d\x1b[0m\n", line, priority);
 #endif
@@ -349,7 +323,12 @@ static void esp32c3_intmatrix_reset(DeviceState *dev)
     RISCVCPU *cpu = &s->cpu->parent_obj;
 
     memset(s->irq_map, 0, sizeof(s->irq_map));
+    memset(s->line_sources, 0, sizeof(s->line_sources));
+    s->line_sources[0] = MAKE_64BIT_MASK(0, ESP32C3_INT_MATRIX_INPUTS);
     memset(s->irq_prio, 0, sizeof(s->irq_prio));
+    memset(s->prio_lines, 0, sizeof(s->prio_lines));
+    /* Lines start at 1 */
+    s->prio_lines[0] = MAKE_64BIT_MASK(1, ESP32C3_CPU_INT_COUNT);
     s->irq_thres = 0;
     s->irq_pending = 0;
     s->irq_levels = 0;
@@ -392,6 +371,42 @@ static void esp32c3_intmatrix_init(Object *obj)
 }
 
 
+static int esp32c3_intmatrix_post_load(void *opaque, int version_id)
+{
+    ESP32C3IntMatrixState *s = ESP32C3_INTMATRIX(opaque);
+
+    /* The routing and priority bitmaps are derived from the registers, rebuild them */
+    memset(s->line_sources, 0, sizeof(s->line_sources));
+    for (int i = 0; i < ESP32C3_INT_MATRIX_INPUTS; i++) {
+        s->irq_map[i] &= 0x1f;
+        SET_BIT(s->line_sources[s->irq_map[i]], i);
+    }
+
+    memset(s->prio_lines, 0, sizeof(s->prio_lines));
+    for (int line = 1; line <= ESP32C3_CPU_INT_COUNT; line++) {
+        s->irq_prio[line] &= ESP32C3_INTMATRIX_PRIO_COUNT - 1;
+        SET_BIT(s->prio_lines[s->irq_prio[line]], line);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_esp32c3_intmatrix = {
+    .name = "esp32c3_intmatrix",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp32c3_intmatrix_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT8_ARRAY(irq_map, ESP32C3IntMatrixState, ESP32C3_INT_MATRIX_INPUTS),
+        VMSTATE_UINT8_ARRAY(irq_prio, ESP32C3IntMatrixState, ESP32C3_CPU_INT_COUNT + 1),
+        VMSTATE_UINT8(irq_thres, ESP32C3IntMatrixState),
+        VMSTATE_UINT64(irq_pending, ESP32C3IntMatrixState),
+        VMSTATE_UINT64(irq_enabled, ESP32C3IntMatrixState),
+        VMSTATE_UINT64(irq_trigger, ESP32C3IntMatrixState),
+        VMSTATE_UINT64(irq_levels, ESP32C3IntMatrixState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32c3_intmatrix_properties[] = {
     DEFINE_PROP_LINK("cpu", ESP32C3IntMatrixState, cpu, TYPE_ESP_RISCV_CPU, EspRISCVCPU*),
     DEFINE_PROP_END_OF_LIST(),
@@ -404,6 +419,7 @@ static void esp32c3_intmatrix_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32c3_intmatrix_reset;
     dc->realize = esp32c3_intmatrix_realize;
+    dc->vmsd = &vmstate_esp32c3_intmatrix;
     device_class_set_props(dc, esp32c3_intmatrix_properties);
 }
 
@@ -122,8 +122,13 @@ void sdbus_write_data(SDBus *sdbus, const void *buf, size_t length)
 
     if (card) {
         SDCardClass *sc = SD_CARD_GET_CLASS(card);
+        size_t i = 0;
 
-        for (size_t i = 0; i < length; i++) {
+        /* Whole blocks first, the remainder goes byte by byte */
+        if (sc->write_data) {
+            i = sc->write_data(card, data, length);
+        }
+        for (; i < length; i++) {
             trace_sdbus_write(sdbus_name(sdbus), data[i]);
             sc->write_byte(card, data[i]);
         }
@@ -152,8 +157,12 @@ void sdbus_read_data(SDBus *sdbus, void *buf, size_t length)
 
     if (card) {
         SDCardClass *sc = SD_CARD_GET_CLASS(card);
+        size_t i = 0;
 
-        for (size_t i = 0; i < length; i++) {
+        if (sc->read_data) {
+            i = sc->read_data(card, data, length);
+        }
+        for (; i < length; i++) {
             data[i] = sc->read_byte(card);
             trace_sdbus_read(sdbus_name(sdbus), data[i]);
         }
@@ -286,66 +286,63 @@ static void dwc_sdmmc_update_bytes_left(DWCSDMMCState *s, size_t bytes_done)
     }
 }
 
-static size_t dwc_sdmmc_handle_one_desc(DWCSDMMCState *s, hwaddr desc_addr, sdmmc_desc_t *desc, bool is_write, size_t max_bytes)
+/* Maximum number of descriptors merged into a single transfer */
+#define SDMMC_DMA_MAX_RUN   32
+
+static void dwc_sdmmc_transfer(DWCSDMMCState *s, hwaddr addr, size_t len, bool is_write)
 {
-    uint32_t num_done = 0;
-    uint32_t num_bytes = max_bytes;
+    const DMADirection dir = is_write ? DMA_DIRECTION_TO_DEVICE : DMA_DIRECTION_FROM_DEVICE;
+    dma_addr_t map_len = len;
+    size_t num_done = 0;
     uint8_t buf[4096];
+    void *mem;
 
-    /* Read descriptor */
-    dma_memory_read(&address_space_memory, desc_addr, desc, sizeof(*desc), MEMTXATTRS_UNSPECIFIED);
-    if (desc->buffer1_size < num_bytes) {
-        num_bytes = desc->buffer1_size;
+    if (len == 0) {
+        return;
     }
 
-    if (desc->owned_by_idmac == 0) {
-        /* ran into a descriptor owned by software */
-        return 0;
+    /* Guest RAM can be handed to the card as is, a single block request covers the whole buffer */
+    mem = dma_memory_map(&address_space_memory, addr, &map_len, dir, MEMTXATTRS_UNSPECIFIED);
+    if (mem != NULL && map_len == len) {
+        DEBUG("%s: %sing %d bytes at 0x%08x (mapped)\n", __func__, is_write?"write":"read", (unsigned) len, (uint32_t) addr);
+        if (is_write) {
+            sdbus_write_data(&s->sdbus, mem, len);
+        } else {
+            sdbus_read_data(&s->sdbus, mem, len);
+        }
+        dma_memory_unmap(&address_space_memory, mem, map_len, dir, len);
+        return;
+    }
+    if (mem != NULL) {
+        dma_memory_unmap(&address_space_memory, mem, map_len, dir, 0);
     }
 
-    while (num_done < num_bytes) {
+    /* Not RAM (or not contiguous on the host side), go through a bounce buffer */
+    while (num_done < len) {
         /* Try to completely fill the local buffer */
-        uint32_t buf_bytes = num_bytes - num_done;
-        if (buf_bytes > sizeof(buf)) {
-            buf_bytes = sizeof(buf);
-        }
-        DEBUG("%s: %sing %d bytes from descr 0x%08x\n", __func__, is_write?"write":"read", buf_bytes, (uint32_t) desc_addr);
+        uint32_t buf_bytes = MIN(len - num_done, sizeof(buf));
+        DEBUG("%s: %sing %d bytes at 0x%08x\n", __func__, is_write?"write":"read", buf_bytes, (uint32_t) (addr + num_done));
         /* Write to SD bus */
         if (is_write) {
-            dma_memory_read(&address_space_memory,
-                            desc->buffer1_ptr + num_done,
+            dma_memory_read(&address_space_memory, addr + num_done,
                             buf, buf_bytes, MEMTXATTRS_UNSPECIFIED);
             sdbus_write_data(&s->sdbus, buf, buf_bytes);
 
             /* Read from SD bus */
         } else {
             sdbus_read_data(&s->sdbus, buf, buf_bytes);
-            dma_memory_write(&address_space_memory,
-                             desc->buffer1_ptr + num_done,
+            dma_memory_write(&address_space_memory, addr + num_done,
                              buf, buf_bytes, MEMTXATTRS_UNSPECIFIED);
         }
         num_done += buf_bytes;
     }
-
-    /* Clear hold flag and flush descriptor */
-    sdmmc_desc_t new_desc = *desc;
-    new_desc.owned_by_idmac = 0;
-    dma_memory_write(&address_space_memory, desc_addr, &new_desc, sizeof(new_desc), MEMTXATTRS_UNSPECIFIED);
-
-    /* Update DMAC bits */
-    s->idsts |= is_write ? SDMMC_IDMAC_INTMASK_TI : SDMMC_IDMAC_INTMASK_RI;
-
-    return num_done;
-
 }
 
 static void dwc_sdmmc_handle_dma(DWCSDMMCState *s)
 {
-    sdmmc_desc_t desc;
     hwaddr desc_addr = s->dscaddr;
     sdmmc_hw_cmd_t hw_cmd = dwc_sdmmc_get_hw_cmd(s);
     bool is_write = hw_cmd.rw == 1;
-    uint32_t bytes_done = 0;
 
     if (s->bytcnt == 0 || s->blksiz == 0 ||
         !FIELD_EX32(s->ctrl, SDMMC_CTRL, DMAEN)) {
@@ -358,21 +355,59 @@ static void dwc_sdmmc_handle_dma(DWCSDMMCState *s)
     }
 
     while (s->bytcnt > 0) {
-        DEBUG("%s: handling descriptor @0x%0x, bytcnt=%d\n", __func__, (uint32_t) desc_addr, s->bytcnt);
-        bytes_done = dwc_sdmmc_handle_one_desc(s, desc_addr, &desc, is_write, s->bytcnt);
-        dwc_sdmmc_update_bytes_left(s, bytes_done);
+        sdmmc_desc_t descs[SDMMC_DMA_MAX_RUN];
+        hwaddr descs_addr[SDMMC_DMA_MAX_RUN];
+        unsigned count = 0;
+        size_t bytes = 0;
+        bool stop = false;
+
+        /* Drivers usually split a large buffer over several descriptors pointing to consecutive
+         * memory, gather them so that the card sees a single multi-block transfer */
+        while (count < SDMMC_DMA_MAX_RUN && bytes < s->bytcnt) {
+            sdmmc_desc_t *desc = &descs[count];
+
+            DEBUG("%s: handling descriptor @0x%0x, bytcnt=%d\n", __func__, (uint32_t) desc_addr, s->bytcnt);
+            dma_memory_read(&address_space_memory, desc_addr, desc, sizeof(*desc), MEMTXATTRS_UNSPECIFIED);
+            if (desc->owned_by_idmac == 0) {
+                /* ran into a descriptor owned by software */
+                stop = true;
+                break;
+            }
+            if (count > 0 && desc->buffer1_ptr != descs[0].buffer1_ptr + bytes) {
+                /* Processed on the next iteration */
+                break;
+            }
 
-        if (bytes_done <= s->bytcnt) {
-            s->bytcnt -= bytes_done;
-        } else {
-            s->bytcnt = 0;
+            descs_addr[count++] = desc_addr;
+            bytes += MIN(desc->buffer1_size, s->bytcnt - bytes);
+            if (desc->last_descriptor) {
+                stop = true;
+                break;
+            }
+            desc_addr = desc->next_desc_ptr;
         }
 
-        if (desc.last_descriptor || desc.owned_by_idmac == 0) {
+        if (count == 0) {
+            break;
+        }
+
+        dwc_sdmmc_transfer(s, descs[0].buffer1_ptr, bytes, is_write);
+
+        /* Clear hold flag and flush descriptors */
+        for (unsigned i = 0; i < count; i++) {
+            descs[i].owned_by_idmac = 0;
+            dma_memory_write(&address_space_memory, descs_addr[i], &descs[i], sizeof(descs[i]), MEMTXATTRS_UNSPECIFIED);
+        }
+
+        /* Update DMAC bits */
+        s->idsts |= is_write ? SDMMC_IDMAC_INTMASK_TI : SDMMC_IDMAC_INTMASK_RI;
+
+        dwc_sdmmc_update_bytes_left(s, bytes);
+        s->bytcnt -= bytes;
+        s->dscaddr = desc_addr;
+
+        if (stop) {
             break;
-        } else {
-            desc_addr = desc.next_desc_ptr;
-            s->dscaddr = desc_addr;
         }
     }
     DEBUG("%s: finished with bytcnt=%d at dscaddr=0x%08x\n", __func__, s->bytcnt, s->dscaddr);
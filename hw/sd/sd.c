@@ -1986,6 +1986,62 @@ void sd_write_byte(SDState *sd, uint8_t value)
     }
 }
 
+/*
+ * Bulk variant of sd_write_byte() for CMD25, the counterpart of
+ * sd_read_data(). On SDSC cards the write protect groups are checked
+ * for every block, the transfer stops before the first protected one.
+ */
+static size_t sd_write_data(SDState *sd, const void *buf, size_t length)
+{
+    uint64_t blocks;
+    size_t len;
+
+    if (!sd->blk || !blk_is_inserted(sd->blk) || !sd->enable ||
+        sd->state != sd_receivingdata_state || sd->current_cmd != 25 ||
+        sd->data_offset != 0 ||
+        (sd->card_status & (ADDRESS_ERROR | WP_VIOLATION))) {
+        return 0;
+    }
+
+    blocks = length / sd->blk_len;
+    if (sd->multi_blk_cnt != 0) {
+        blocks = MIN(blocks, sd->multi_blk_cnt);
+    }
+    if (sd->size <= SDSC_MAX_CAPACITY) {
+        for (uint64_t i = 0; i < blocks; i++) {
+            if (sd_wp_addr(sd, sd->data_start + i * sd->blk_len)) {
+                blocks = i;
+                break;
+            }
+        }
+    }
+    if (blocks == 0) {
+        return 0;
+    }
+    len = blocks * sd->blk_len;
+
+    if (sd->data_start + len > sd->size) {
+        return 0;
+    }
+
+    trace_sdcard_write_block(sd->data_start, len);
+    if (blk_pwrite(sd->blk, sd->data_start, len, buf, 0) < 0) {
+        fprintf(stderr, "sd_write_data: write error on host side\n");
+    }
+    sd->blk_written += blocks;
+    sd->data_start += len;
+    sd->csd[14] |= 0x40;
+
+    if (sd->multi_blk_cnt != 0) {
+        sd->multi_blk_cnt -= blocks;
+        if (sd->multi_blk_cnt == 0) {
+            sd->state = sd_transfer_state;
+        }
+    }
+
+    return len;
+}
+
 #define SD_TUNING_BLOCK_SIZE    64
 
 static const uint8_t sd_tuning_block_pattern[SD_TUNING_BLOCK_SIZE] = {
@@ -2124,6 +2180,59 @@ uint8_t sd_read_byte(SDState *sd)
     return ret;
 }
 
+/*
+ * Bulk variant of sd_read_byte() for CMD18: whole blocks are read from the
+ * backend straight into @buf, with a single request for all of them.
+ * Returns the number of bytes transferred, the caller falls back to
+ * sd_read_byte() for the rest (partial block, other commands, errors).
+ */
+static size_t sd_read_data(SDState *sd, void *buf, size_t length)
+{
+    uint32_t io_len;
+    uint64_t blocks;
+    size_t len;
+
+    if (!sd->blk || !blk_is_inserted(sd->blk) || !sd->enable ||
+        sd->state != sd_sendingdata_state || sd->current_cmd != 18 ||
+        sd->data_offset != 0 ||
+        (sd->card_status & (ADDRESS_ERROR | WP_VIOLATION))) {
+        return 0;
+    }
+
+    io_len = (sd->ocr & (1 << 30)) ? 512 : sd->blk_len;
+    blocks = length / io_len;
+    if (sd->multi_blk_cnt != 0) {
+        blocks = MIN(blocks, sd->multi_blk_cnt);
+    }
+    if (blocks == 0) {
+        return 0;
+    }
+    len = blocks * io_len;
+
+    if (sd->data_start + len > sd->size) {
+        /* Let sd_read_byte() report the error on the faulty block */
+        return 0;
+    }
+
+    trace_sdcard_read_data(sd_proto(sd)->name,
+                           sd_acmd_name(sd->current_cmd),
+                           sd->current_cmd, len);
+    trace_sdcard_read_block(sd->data_start, len);
+    if (blk_pread(sd->blk, sd->data_start, len, buf, 0) < 0) {
+        fprintf(stderr, "sd_read_data: read error on host side\n");
+    }
+
+    sd->data_start += len;
+    if (sd->multi_blk_cnt != 0) {
+        sd->multi_blk_cnt -= blocks;
+        if (sd->multi_blk_cnt == 0) {
+            sd->state = sd_transfer_state;
+        }
+    }
+
+    return len;
+}
+
 static bool sd_receive_ready(SDState *sd)
 {
     return sd->state == sd_receivingdata_state;
@@ -2270,6 +2379,8 @@ static void sd_class_init(ObjectClass *klass, void *data)
     sc->do_command = sd_do_command;
     sc->write_byte = sd_write_byte;
     sc->read_byte = sd_read_byte;
+    sc->read_data = sd_read_data;
+    sc->write_data = sd_write_data;
     sc->receive_ready = sd_receive_ready;
     sc->data_ready = sd_data_ready;
     sc->enable = sd_enable;
@@ -11,6 +11,7 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
+#include "qemu/units.h"
 #include "sysemu/sysemu.h"
 #include "hw/hw.h"
 #include "hw/sysbus.h"
@@ -20,6 +21,8 @@
 #include "hw/ssi/ssi.h"
 #include "hw/ssi/esp32_spi.h"
 #include "hw/misc/esp32_flash_enc.h"
+#include "hw/misc/esp32_reg.h"
+#include "hw/misc/esp32_dport.h"
 
 
 
@@ -27,9 +30,12 @@ enum {
     CMD_RES = 0xab,
     CMD_DP = 0xb9,
     CMD_CE = 0x60,
+    CMD_CE2 = 0xC7,
     CMD_BE = 0xD8,
+    CMD_BE32K = 0x52,
     CMD_SE = 0x20,
     CMD_PP = 0x02,
+    CMD_QPP = 0x32,
     CMD_WRSR = 0x1,
     CMD_RDSR = 0x5,
     CMD_RDID = 0x9f,
@@ -153,17 +159,14 @@ typedef struct Esp32SpiTransaction {
 
 static void esp32_spi_txrx_buffer(Esp32SpiState *s, void *buf, int tx_bytes, int rx_bytes)
 {
-    int bytes = MAX(tx_bytes, rx_bytes);
+    /* Zeros are sent once the TX bytes are exhausted, extra received bytes are discarded */
     uint8_t *c_buf = (uint8_t*) buf;
-    for (int i = 0; i < bytes; ++i) {
-        uint8_t byte = 0;
-        if (byte < tx_bytes) {
-            memcpy(&byte, c_buf + i, 1);
-        }
-        uint32_t res = ssi_transfer(s->spi, byte);
-        if (byte < rx_bytes) {
-            memcpy(c_buf + i, &res, 1);
-        }
+    const int common = MIN(tx_bytes, rx_bytes);
+    ssi_transfer_bulk(s->spi, c_buf, c_buf, common);
+    if (tx_bytes > common) {
+        ssi_transfer_bulk(s->spi, c_buf + common, NULL, tx_bytes - common);
+    } else if (rx_bytes > common) {
+        ssi_transfer_bulk(s->spi, NULL, c_buf + common, rx_bytes - common);
     }
 }
 
@@ -197,6 +200,51 @@ static void maybe_encrypt_data(Esp32SpiState *s)
     }
 }
 
+/**
+ * @brief Let the cache know about the flash area a transaction programmed or erased, if any.
+ * The commands may be sent directly or through the user mode, so look at the bytes on the bus.
+ */
+static void esp32_spi_notify_flash_write(Esp32SpiState *s, const Esp32SpiTransaction *t)
+{
+    const uint8_t *addr_bytes = (const uint8_t*) &t->addr;
+    uint32_t addr = 0;
+    uint32_t size;
+
+    if (s->dport == NULL || t->cmd_bytes == 0) {
+        return;
+    }
+
+    /* The address is sent most significant byte first */
+    for (int i = 0; i < t->addr_bytes && i < sizeof(t->addr); i++) {
+        addr = (addr << 8) | addr_bytes[i];
+    }
+
+    switch (t->cmd & 0xff) {
+    case CMD_PP:
+    case CMD_QPP:
+        size = t->data_tx_bytes;
+        break;
+    case CMD_SE:
+        size = 4 * KiB;
+        break;
+    case CMD_BE32K:
+        size = 32 * KiB;
+        break;
+    case CMD_BE:
+        size = 64 * KiB;
+        break;
+    case CMD_CE:
+    case CMD_CE2:
+        addr = 0;
+        size = UINT32_MAX;
+        break;
+    default:
+        return;
+    }
+
+    esp32_dport_flash_written(s->dport, addr, size);
+}
+
 static void esp32_spi_do_command(Esp32SpiState* s, uint32_t cmd_reg)
 {
     Esp32SpiTransaction t = {
@@ -298,6 +346,7 @@ static void esp32_spi_do_command(Esp32SpiState* s, uint32_t cmd_reg)
         return;
     }
     esp32_spi_transaction(s, &t);
+    esp32_spi_notify_flash_write(s, &t);
 }
 
 
@@ -30,6 +30,7 @@ enum {
     CMD_DP = 0xb9,
     CMD_CE = 0x60,
     CMD_BE = 0xd8,
+    CMD_BE32K = 0x52,
     CMD_SE = 0x20,
     CMD_PP = 0x02,
     CMD_WRSR = 0x1,
@@ -124,30 +125,64 @@ static void esp32s3_spi_txrx_buffer(ESP32S3SpiState *s,
                                     const void *tx, int tx_bytes,
                                     void *rx, int rx_bytes)
 {
-    int bytes = MAX(tx_bytes, rx_bytes);
-    for (int i = 0; i < bytes; ++i) {
-        uint8_t byte = 0;
-        if (byte < tx_bytes) {
-            memcpy(&byte, tx + i, 1);
-        }
-        uint32_t res = ssi_transfer(s->spi, byte);
-        if (byte < rx_bytes) {
-            memcpy(rx + i, &res, 1);
-        }
+    /* Zeros are sent once the TX bytes are exhausted, extra received bytes are discarded */
+    const int common = MIN(tx_bytes, rx_bytes);
+    ssi_transfer_bulk(s->spi, tx, rx, common);
+    if (tx_bytes > common) {
+        ssi_transfer_bulk(s->spi, tx + common, NULL, tx_bytes - common);
+    } else if (rx_bytes > common) {
+        ssi_transfer_bulk(s->spi, NULL, rx + common, rx_bytes - common);
     }
 }
 
 static void esp32s3_spi_dummy_cycles(ESP32S3SpiState *s, uint32_t dummy_bytes) {
-    for (int i = 0; i < dummy_bytes; i++) {
-        ssi_transfer(s->spi, 0);
+    ssi_transfer_bulk(s->spi, NULL, NULL, dummy_bytes);
+}
+
+/**
+ * @brief Get the flash area modified by the given transaction. Returns false if the transaction
+ *        doesn't modify the flash content.
+ */
+static bool esp32s3_spi_get_written_area(ESP32S3SpiTransaction *t, uint32_t *address, uint32_t *size)
+{
+    /* The address bytes are sent in memory order, MSB first */
+    const uint8_t *addr_bytes = (const uint8_t *) &t->addr;
+    *address = 0;
+    for (int i = 0; i < t->addr_bytes; i++) {
+        *address = (*address << 8) | addr_bytes[i];
     }
+
+    switch (t->cmd) {
+        case CMD_PP:
+            *size = t->tx_bytes;
+            return true;
+        case CMD_SE:
+            *size = 4 * 1024;
+            break;
+        case CMD_BE32K:
+            *size = 32 * 1024;
+            break;
+        case CMD_BE:
+            *size = 64 * 1024;
+            break;
+        case CMD_CE:
+            *address = 0;
+            *size = UINT32_MAX;
+            return true;
+        default:
+            return false;
+    }
+
+    /* Erase commands operate on whole sectors/blocks */
+    *address &= ~(*size - 1);
+    return true;
 }
 
 static void esp32s3_spi_perform_transaction(ESP32S3SpiState *s, ESP32S3SpiTransaction *t)
 {
     if (s->xts_aes != NULL)
     {
-        ESP32S3XtsAesClass *xts_aes_class = ESP32S3_XTS_AES_GET_CLASS(s->xts_aes);
+        ESPXtsAesClass *xts_aes_class = ESP_XTS_AES_GET_CLASS(s->xts_aes);
         bool man_enc_enabled = xts_aes_class->is_manual_enc_enabled(s->xts_aes);
 
         if (man_enc_enabled && xts_aes_class->is_ciphertext_spi_visible(s->xts_aes) && (t->cmd == CMD_PP)) {
@@ -161,6 +196,19 @@ static void esp32s3_spi_perform_transaction(ESP32S3SpiState *s, ESP32S3SpiTransa
     esp32s3_spi_dummy_cycles(s, t->dummy_bytes);
     esp32s3_spi_txrx_buffer(s, t->data, t->tx_bytes, t->data, t->rx_bytes);
     qemu_set_irq(s->cs_gpio[0], 1);
+
+    /* Data previously fetched or decrypted from the modified area is now obsolete */
+    uint32_t written_addr;
+    uint32_t written_size;
+    if (esp32s3_spi_get_written_area(t, &written_addr, &written_size)) {
+        if (s->xts_aes != NULL) {
+            ESPXtsAesClass *xts_aes_class = ESP_XTS_AES_GET_CLASS(s->xts_aes);
+            xts_aes_class->invalidate(s->xts_aes, written_addr, written_size);
+        }
+        if (s->cache != NULL) {
+            esp32s3_cache_flash_written(s->cache, written_addr, written_size);
+        }
+    }
 }
 
 
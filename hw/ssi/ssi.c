@@ -82,13 +82,20 @@ static void ssi_cs_default(void *opaque, int n, int level)
     s->cs = cs;
 }
 
+static bool ssi_peripheral_selected(SSIPeripheral *dev)
+{
+    SSIPeripheralClass *ssc = dev->spc;
+
+    return (dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
+           (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
+           ssc->cs_polarity == SSI_CS_NONE;
+}
+
 static uint32_t ssi_transfer_raw_default(SSIPeripheral *dev, uint32_t val)
 {
     SSIPeripheralClass *ssc = dev->spc;
 
-    if ((dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
-        (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
-        ssc->cs_polarity == SSI_CS_NONE) {
+    if (ssi_peripheral_selected(dev)) {
         return ssc->transfer(dev, val);
     }
     return 0;
@@ -168,6 +175,47 @@ uint32_t ssi_transfer(SSIBus *bus, uint32_t val)
     return r;
 }
 
+void ssi_transfer_bulk(SSIBus *bus, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    BusState *b = BUS(bus);
+    BusChild *kid;
+    uint8_t chunk[SSI_BULK_CHUNK_SIZE];
+    uint8_t r[SSI_BULK_CHUNK_SIZE];
+    size_t done, n, i;
+
+    /* rx is only written once all the peripherals consumed the chunk, so tx and
+     * rx can point to the same buffer */
+    for (done = 0; done < len; done += n) {
+        n = MIN(len - done, SSI_BULK_CHUNK_SIZE);
+        memset(r, 0, n);
+
+        QTAILQ_FOREACH(kid, &b->children, sibling) {
+            SSIPeripheral *p = SSI_PERIPHERAL(kid->child);
+            SSIPeripheralClass *ssc = p->spc;
+
+            if (ssc->transfer_bulk &&
+                    ssc->transfer_raw == ssi_transfer_raw_default) {
+                if (!ssi_peripheral_selected(p)) {
+                    continue;
+                }
+                ssc->transfer_bulk(p, tx ? tx + done : NULL,
+                                   rx ? chunk : NULL, n);
+                for (i = 0; rx && i < n; i++) {
+                    r[i] |= chunk[i];
+                }
+            } else {
+                for (i = 0; i < n; i++) {
+                    r[i] |= p->spc->transfer_raw(p, tx ? tx[done + i] : 0);
+                }
+            }
+        }
+
+        if (rx) {
+            memcpy(rx + done, r, n);
+        }
+    }
+}
+
 const VMStateDescription vmstate_ssi_peripheral = {
     .name = "SSISlave",
     .version_id = 1,
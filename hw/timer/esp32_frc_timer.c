@@ -18,24 +18,14 @@
 #include "hw/registerfields.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/boards.h"
 #include "hw/timer/esp32_frc_timer.h"
 #include "trace.h"
 
 static uint64_t esp32_frc_timer_get_count(Esp32FrcTimerState *s, uint64_t ns_now)
 {
-    if (!s->enable) {
-        return s->count_base;
-    }
-    uint64_t ns_from_base = ns_now - s->ns_base;
-    uint64_t ticks_from_base = muldiv64(ns_from_base, s->apb_freq, NANOSECONDS_PER_SECOND * s->prescaler);
-    uint64_t count = (ticks_from_base + s->count_base) & s->count_mask;
-    return count;
-}
-
-static uint64_t esp32_frc_timer_count_to_ns(Esp32FrcTimerState *s, uint64_t count)
-{
-    return muldiv64(count, NANOSECONDS_PER_SECOND * s->prescaler, s->apb_freq);
+    return esp_timer_counter_get(&s->counter, ns_now) & s->count_mask;
 }
 
 static void esp32_frc_timer_update_alarm(Esp32FrcTimerState *s, uint64_t ticks_alarm, uint32_t ticks_now, uint64_t ns_now)
@@ -44,9 +34,10 @@ static void esp32_frc_timer_update_alarm(Esp32FrcTimerState *s, uint64_t ticks_a
         ticks_alarm += (1ULL << 32);
     }
     uint64_t ticks_to_alarm = ticks_alarm - ticks_now;
-    uint64_t ns_to_alarm = esp32_frc_timer_count_to_ns(s, ticks_to_alarm);
-    trace_esp32_frc_timer_update_alarm(ns_now, ticks_now, ticks_alarm, ns_to_alarm);
-    timer_mod_anticipate_ns(&s->alarm_timer, ns_now + ns_to_alarm);
+    /* Deadline of the exact tick the alarm matches, so that an autoloaded alarm never drifts */
+    int64_t ns_alarm = esp_timer_counter_expiry(&s->counter, ns_now, ticks_to_alarm);
+    trace_esp32_frc_timer_update_alarm(ns_now, ticks_now, ticks_alarm, ns_alarm - ns_now);
+    esp_timer_sched_arm(&s->sched, s->alarm, ns_alarm);
 }
 
 static void esp32_frc_timer_cb(void *opaque)
@@ -75,19 +66,19 @@ static void esp32_frc_timer_update_config(Esp32FrcTimerState *s,
     uint32_t count_now = esp32_frc_timer_get_count(s, ns_now);
     trace_esp32_frc_timer_update_config(ns_now, count_now, enable, level_int, autoload, prescaler);
 
-    s->count_base = count_now;
-    s->ns_base = ns_now;
-
-    if (!enable) {
-        timer_del(&s->alarm_timer);
-    } else {
-        esp32_frc_timer_update_alarm(s, s->alarm_reg, count_now, ns_now);
-    }
+    esp_timer_counter_run(&s->counter, ns_now, enable);
+    esp_timer_counter_set_rate(&s->counter, ns_now, s->apb_freq, NANOSECONDS_PER_SECOND * (uint64_t) prescaler);
 
     s->enable = enable;
     s->level_int = level_int;
     s->autoload = autoload;
     s->prescaler = prescaler;
+
+    if (!enable) {
+        esp_timer_sched_disarm(&s->sched, s->alarm);
+    } else {
+        esp32_frc_timer_update_alarm(s, s->alarm_reg, count_now, ns_now);
+    }
 }
 
 
@@ -136,11 +127,15 @@ static void esp32_frc_timer_write(void *opaque, hwaddr addr,
             s->level_int_status = false;
         }
         break;
-    case A_FRC_TIMER_LOAD:
+    case A_FRC_TIMER_LOAD: {
+        uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
         s->load_reg = value;
-        s->ns_base = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-        s->count_base = value;
+        esp_timer_counter_load(&s->counter, ns_now, value);
+        if (s->enable) {
+            esp32_frc_timer_update_alarm(s, s->alarm_reg, value, ns_now);
+        }
         break;
+    }
     case A_FRC_TIMER_CTRL: {
         bool level_int = FIELD_EX32(value, FRC_TIMER_CTRL, LEVEL_INT);
         int prescaler = FIELD_EX32(value, FRC_TIMER_CTRL, PRESCALER);
@@ -171,8 +166,10 @@ static void esp32_frc_timer_set_apb_freq(Object *obj, Visitor *v,
                                   Error **errp)
 {
     Esp32FrcTimerState *s = ESP32_FRC_TIMER(opaque);
-    visit_type_uint32(v, name, &s->apb_freq, errp);
-
+    if (visit_type_uint32(v, name, &s->apb_freq, errp)) {
+        uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        esp_timer_counter_set_rate(&s->counter, ns_now, s->apb_freq, NANOSECONDS_PER_SECOND * (uint64_t) s->prescaler);
+    }
 }
 
 static const MemoryRegionOps esp32_frc_timer_ops = {
@@ -184,8 +181,10 @@ static const MemoryRegionOps esp32_frc_timer_ops = {
 static void esp32_frc_timer_reset(DeviceState *dev)
 {
     Esp32FrcTimerState *s = ESP32_FRC_TIMER(dev);
+    uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 
     s->prescaler = 1;
+    esp_timer_counter_set_rate(&s->counter, ns_now, s->apb_freq, NANOSECONDS_PER_SECOND);
 }
 
 static void esp32_frc_timer_realize(DeviceState *dev, Error **errp)
@@ -209,13 +208,35 @@ static void esp32_frc_timer_init(Object *obj)
                         obj);
 
 
-    timer_init_ns(&s->alarm_timer, QEMU_CLOCK_VIRTUAL, esp32_frc_timer_cb, s);
+    esp_timer_sched_init(&s->sched);
+    s->alarm = esp_timer_sched_add(&s->sched, esp32_frc_timer_cb, s);
 
     s->apb_freq = 80000000;
+    s->prescaler = 1;
+    esp_timer_counter_init(&s->counter, s->apb_freq, NANOSECONDS_PER_SECOND);
     s->count_mask = UINT32_MAX;
     s->has_alarm = true;
 }
 
+static const VMStateDescription vmstate_esp32_frc_timer = {
+    .name = TYPE_ESP32_FRC_TIMER,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(apb_freq, Esp32FrcTimerState),
+        VMSTATE_ESP_TIMER_COUNTER(counter, Esp32FrcTimerState),
+        VMSTATE_BOOL(level_int_status, Esp32FrcTimerState),
+        VMSTATE_UINT32(load_reg, Esp32FrcTimerState),
+        VMSTATE_BOOL(enable, Esp32FrcTimerState),
+        VMSTATE_BOOL(autoload, Esp32FrcTimerState),
+        VMSTATE_UINT32(prescaler, Esp32FrcTimerState),
+        VMSTATE_BOOL(level_int, Esp32FrcTimerState),
+        VMSTATE_UINT32(alarm_reg, Esp32FrcTimerState),
+        VMSTATE_ESP_TIMER_SCHED(sched, Esp32FrcTimerState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32_frc_timer_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -226,6 +247,7 @@ static void esp32_frc_timer_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32_frc_timer_reset;
     dc->realize = esp32_frc_timer_realize;
+    dc->vmsd = &vmstate_esp32_frc_timer;
     device_class_set_props(dc, esp32_frc_timer_properties);
 }
 
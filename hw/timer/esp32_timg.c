@@ -17,6 +17,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/registerfields.h"
 #include "hw/boards.h"
 #include "hw/timer/esp32_timg.h"
@@ -25,7 +26,6 @@
 #define TIMG_REGFILE_SIZE 0x100
 
 static uint64_t esp32_timg_timer_get_count(Esp32TimgTimerState *s, uint64_t ns_now);
-static uint64_t esp32_timg_timer_count_to_ns(Esp32TimgTimerState *s, uint64_t count);
 static void esp32_timg_timer_update_config(Esp32TimgTimerState *ts);
 static void esp32_timg_timer_update_alarm(Esp32TimgTimerState *ts, uint64_t ns_now);
 static void esp32_timg_timer_reload(Esp32TimgTimerState *ts, uint64_t ns_now);
@@ -35,6 +35,8 @@ static bool esp32_timg_wdt_protected(Esp32TimgWdtState *ws);
 static void esp32_timg_wdt_update_config(Esp32TimgWdtState *ws);
 static void esp32_timg_wdt_feed(Esp32TimgWdtState *ws);
 static void esp32_timg_wdt_arm(Esp32TimgWdtState *ws, uint64_t ns_now);
+static void esp32_timg_timer_set_rate(Esp32TimgTimerState *s, uint64_t ns_now);
+static void esp32_timg_wdt_set_rate(Esp32TimgWdtState *ws, uint64_t ns_now);
 
 
 #define TIMG_DEBUG_LOG(...) // qemu_log(__VA_ARGS__)
@@ -266,20 +268,23 @@ static const MemoryRegionOps esp32_timg_ops = {
 
 static void esp32_timg_timer_reset(Esp32TimgTimerState* ts)
 {
-    timer_del(&ts->alarm_timer);
+    uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    esp_timer_sched_disarm(&ts->parent->sched, ts->sched_alarm);
+    esp_timer_counter_load(&ts->counter, ns_now, 0);
     ts->config_reg = R_TIMG_T0CONFIG_INCREASE_MASK
         | R_TIMG_T0CONFIG_AUTORELOAD_MASK
         | (1 << R_TIMG_T0CONFIG_DIVIDER_SHIFT);
     ts->alarm_val = 0;
     ts->load_val = 0;
     ts->count_base = 0;
-    ts->ns_base = 0;
     esp32_timg_timer_update_config(ts);
 }
 
 static void esp32_timg_wdt_reset(Esp32TimgWdtState* ws)
 {
-    timer_del(&ws->stage_timer);
+    esp_timer_sched_disarm(&ws->parent->sched, ws->sched_alarm);
+    esp_timer_counter_load(&ws->counter, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), 0);
+    ws->cur_stage = 0;
 
     ws->config0_reg = 0x0004c000;
     ws->config1_reg = 0x00010000;
@@ -321,8 +326,17 @@ static void esp32_timg_set_apb_freq(Object *obj, Visitor *v,
                                   Error **errp)
 {
     Esp32TimgState *s = ESP32_TIMG(opaque);
-    visit_type_uint32(v, name, &s->apb_freq_hz, errp);
+    if (!visit_type_uint32(v, name, &s->apb_freq_hz, errp)) {
+        return;
+    }
     TIMG_DEBUG_LOG("%s: TG%d apb_freq_hz=%d\n", __func__, s->id, s->apb_freq_hz);
+
+    /* The counters keep the ticks elapsed so far, only the following ones are affected */
+    uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    esp32_timg_timer_set_rate(&s->t0, ns_now);
+    esp32_timg_timer_set_rate(&s->t1, ns_now);
+    esp32_timg_timer_set_rate(&s->lact, ns_now);
+    esp32_timg_wdt_set_rate(&s->wdt, ns_now);
 }
 
 static void esp32_timg_do_calibration(Esp32TimgState* s)
@@ -344,7 +358,8 @@ static void esp32_timg_timer_cb(void *opaque)
 {
     Esp32TimgTimerState *ts = (Esp32TimgTimerState*) opaque;
     Esp32TimgState *s = ts->parent;
-    uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    /* Instant of the alarm tick, the QEMU timer may have expired a bit later */
+    uint64_t ns_now = esp_timer_sched_expired(&s->sched);
 
     TIMG_DEBUG_LOG("%s: TG%d ns=0x%llx\n", __func__, s->id, ns_now);
     uint32_t int_mask = 1 << (ts->int_type);
@@ -366,10 +381,8 @@ static void esp32_timg_timer_cb(void *opaque)
 
     if (ts->autoreload) {
         esp32_timg_timer_reload(ts, ns_now);
-    } else {
-        /* ignore overflow modulo 64 bits */
-        timer_del(&ts->alarm_timer);
     }
+    /* else, ignore overflow modulo 64 bits, the alarm is not rearmed */
 }
 
 static void esp32_timg_int_update_inttype(Esp32TimgState *s, uint32_t int_st, Esp32TimgInterruptType it)
@@ -404,18 +417,24 @@ static int esp32_timg_timer_direction(Esp32TimgTimerState *s)
 
 static uint64_t esp32_timg_timer_get_count(Esp32TimgTimerState *s, uint64_t ns_now)
 {
-    if (!s->en) {
-        return s->count_base;
-    }
-    uint64_t ns_from_base = ns_now - s->ns_base;
-    uint64_t ticks_from_base = muldiv64(ns_from_base, s->parent->apb_freq_hz / 1000000, 1000 * s->divider);
-    uint64_t count = esp32_timg_timer_direction(s) * ticks_from_base + s->count_base;
-    return count;
+    /* The tick counter is stopped while the timer is disabled */
+    uint64_t ticks = esp_timer_counter_get(&s->counter, ns_now);
+    return s->inc ? s->count_base + ticks : s->count_base - ticks;
+}
+
+/**
+ * @brief Make the timer value equal to `count` at `ns_now`, without changing the phase of its ticks
+ */
+static void esp32_timg_timer_set_count(Esp32TimgTimerState *s, uint64_t count, uint64_t ns_now)
+{
+    uint64_t ticks = esp_timer_counter_get(&s->counter, ns_now);
+    s->count_base = s->inc ? count - ticks : count + ticks;
 }
 
-static uint64_t esp32_timg_timer_count_to_ns(Esp32TimgTimerState *s, uint64_t count)
+static void esp32_timg_timer_set_rate(Esp32TimgTimerState *s, uint64_t ns_now)
 {
-    return muldiv64(count, 1000 * s->divider, s->parent->apb_freq_hz / 1000000);
+    esp_timer_counter_set_rate(&s->counter, ns_now, s->parent->apb_freq_hz,
+                               NANOSECONDS_PER_SECOND * (uint64_t) MAX(s->divider, 1));
 }
 
 static uint32_t esp32_timg_timer_div_from_reg(uint32_t reg_val)
@@ -432,8 +451,7 @@ static uint32_t esp32_timg_timer_div_from_reg(uint32_t reg_val)
 static void esp32_timg_timer_update_config(Esp32TimgTimerState *ts)
 {
     uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    ts->count_base = esp32_timg_timer_get_count(ts, ns_now);
-    ts->ns_base = ns_now;
+    uint64_t count = esp32_timg_timer_get_count(ts, ns_now);
 
     ts->en = FIELD_EX32(ts->config_reg, TIMG_T0CONFIG, EN);
     ts->inc = FIELD_EX32(ts->config_reg, TIMG_T0CONFIG, INCREASE);
@@ -443,8 +461,12 @@ static void esp32_timg_timer_update_config(Esp32TimgTimerState *ts)
     ts->level_int_en = FIELD_EX32(ts->config_reg, TIMG_T0CONFIG, LEVEL_INT);
     ts->alarm = FIELD_EX32(ts->config_reg, TIMG_T0CONFIG, ALARM);
 
-    TIMG_DEBUG_LOG("%s: TG%d base=0x%llx ns=0x%llx en=%d inc=%d autoreload=%d div=%d li=%d ei=%d alarm=%d\n", __func__, ts->parent->id,
-             ts->count_base, ts->ns_base, ts->en, ts->inc, ts->autoreload, ts->divider,
+    esp_timer_counter_run(&ts->counter, ns_now, ts->en);
+    esp32_timg_timer_set_rate(ts, ns_now);
+    esp32_timg_timer_set_count(ts, count, ns_now);
+
+    TIMG_DEBUG_LOG("%s: TG%d count=0x%llx ns=0x%llx en=%d inc=%d autoreload=%d div=%d li=%d ei=%d alarm=%d\n", __func__, ts->parent->id,
+             count, ns_now, ts->en, ts->inc, ts->autoreload, ts->divider,
              ts->level_int_en, ts->edge_int_en, ts->alarm);
 
     esp32_timg_timer_update_alarm(ts, ns_now);
@@ -452,38 +474,40 @@ static void esp32_timg_timer_update_config(Esp32TimgTimerState *ts)
 
 static void esp32_timg_timer_reload(Esp32TimgTimerState *ts, uint64_t ns_now)
 {
-    timer_del(&ts->alarm_timer);
-
-    ts->ns_base = ns_now;
-    ts->count_base = ts->load_val;
+    /* When called from the alarm callback, ns_now is the instant of the alarm tick, keeping the
+     * phase of the ticks makes auto-reloaded alarms periodic without any drift */
+    esp32_timg_timer_set_count(ts, ts->load_val, ns_now);
 
-    TIMG_DEBUG_LOG("%s: TG%d base=0x%llx ns=0x%llx\n", __func__, ts->parent->id,
-             ts->count_base, ts->ns_base);
+    TIMG_DEBUG_LOG("%s: TG%d count=0x%llx ns=0x%llx\n", __func__, ts->parent->id,
+             ts->load_val, ns_now);
 
     esp32_timg_timer_update_alarm(ts, ns_now);
 }
 
 static void esp32_timg_timer_update_alarm(Esp32TimgTimerState *ts, uint64_t ns_now)
 {
+    EspTimerSched *sched = &ts->parent->sched;
+
     if (!ts->en || !ts->alarm) {
-        timer_del(&ts->alarm_timer);
+        esp_timer_sched_disarm(sched, ts->sched_alarm);
         return;
     }
 
-    int64_t count_to_alarm = ((int64_t) ts->alarm_val - (int64_t) ts->count_base)
+    uint64_t count = esp32_timg_timer_get_count(ts, ns_now);
+    int64_t count_to_alarm = ((int64_t) ts->alarm_val - (int64_t) count)
                                 * esp32_timg_timer_direction(ts);
     if (count_to_alarm <= 0) {
         /* ignore overflow modulo 64 bits */
-        timer_del(&ts->alarm_timer);
+        esp_timer_sched_disarm(sched, ts->sched_alarm);
         return;
     }
 
-    uint64_t ns_to_alarm = esp32_timg_timer_count_to_ns(ts, count_to_alarm);
+    int64_t ns_alarm = esp_timer_counter_expiry(&ts->counter, ns_now, count_to_alarm);
 
-    TIMG_DEBUG_LOG("%s: TG%d count_to_alarm=0x%llx ns_to_alarm=0x%llx\n", __func__, ts->parent->id,
-                 count_to_alarm, ns_to_alarm);
+    TIMG_DEBUG_LOG("%s: TG%d count_to_alarm=0x%llx ns_alarm=0x%llx\n", __func__, ts->parent->id,
+                 count_to_alarm, ns_alarm);
 
-    timer_mod_anticipate_ns(&ts->alarm_timer, ns_now + ns_to_alarm);
+    esp_timer_sched_arm(sched, ts->sched_alarm, ns_alarm);
 }
 
 static bool esp32_timg_wdt_protected(Esp32TimgWdtState *ws)
@@ -491,15 +515,15 @@ static bool esp32_timg_wdt_protected(Esp32TimgWdtState *ws)
     return ws->protect_reg != ESP32_TIMG_WDT_PROTECT_WORD;
 }
 
-static uint64_t esp32_timg_wdt_get_count(Esp32TimgWdtState *ws, uint64_t ns_now)
+static bool esp32_timg_wdt_active(Esp32TimgWdtState *ws)
 {
-    if (!ws->en) {
-        return ws->count_base;
-    }
-    uint64_t ns_from_base = ns_now - ws->ns_base;
-    uint64_t ticks_from_base = muldiv64(ns_from_base, ws->parent->apb_freq_hz / 1000000, 1000 * MAX(ws->prescale, 1));
-    uint64_t count = ticks_from_base + ws->count_base;
-    return count;
+    return !ws->parent->wdt_disable && (ws->en || (ws->flashboot_en && ws->parent->flash_boot_mode));
+}
+
+static void esp32_timg_wdt_set_rate(Esp32TimgWdtState *ws, uint64_t ns_now)
+{
+    esp_timer_counter_set_rate(&ws->counter, ns_now, ws->parent->apb_freq_hz,
+                               NANOSECONDS_PER_SECOND * (uint64_t) MAX(ws->prescale, 1));
 }
 
 static void esp32_timg_wdt_update_config(Esp32TimgWdtState *ws)
@@ -507,8 +531,6 @@ static void esp32_timg_wdt_update_config(Esp32TimgWdtState *ws)
     Esp32TimgState *s = ws->parent;
 
     uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    ws->count_base = esp32_timg_wdt_get_count(ws, ns_now);
-    ws->ns_base = ns_now;
 
     bool old_en = ws->en;
     ws->en = FIELD_EX32(ws->config0_reg, TIMG_WDTCONFIG0, EN);
@@ -522,9 +544,12 @@ static void esp32_timg_wdt_update_config(Esp32TimgWdtState *ws)
 
     ws->prescale = FIELD_EX32(ws->config1_reg, TIMG_WDTCONFIG1, PRESCALE);
 
+    esp_timer_counter_run(&ws->counter, ns_now, esp32_timg_wdt_active(ws));
+    esp32_timg_wdt_set_rate(ws, ns_now);
+
     if (ws->en && !old_en) {
         ws->cur_stage = 0;
-        ws->count_base = 0;
+        esp_timer_counter_load(&ws->counter, ns_now, 0);
     } else if (!ws->en && old_en) {
         qemu_irq_lower(get_level_irq(s, TIMG_WDT_INT));
     }
@@ -539,26 +564,26 @@ static void esp32_timg_wdt_feed(Esp32TimgWdtState *ws)
     TIMG_DEBUG_LOG("%s TG%d\n", __func__, ws->parent->id);
     uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
     ws->cur_stage = 0;
-    ws->ns_base = ns_now;
-    ws->count_base = 0;
+    esp_timer_counter_load(&ws->counter, ns_now, 0);
     esp32_timg_wdt_arm(ws, ns_now);
 }
 
 static void esp32_timg_wdt_arm(Esp32TimgWdtState *ws, uint64_t ns_now)
 {
-    timer_del(&ws->stage_timer);
+    EspTimerSched *sched = &ws->parent->sched;
 
-    if (ws->parent->wdt_disable || !(ws->en || (ws->flashboot_en && ws->parent->flash_boot_mode))) {
+    if (!esp32_timg_wdt_active(ws)) {
+        esp_timer_sched_disarm(sched, ws->sched_alarm);
         return;
     }
 
     uint32_t stage_timeout = ws->timeout[ws->cur_stage];
-    uint32_t cur_count = esp32_timg_wdt_get_count(ws, ns_now);
+    uint32_t cur_count = esp_timer_counter_get(&ws->counter, ns_now);
     uint32_t count_to_timeout = stage_timeout - cur_count;
-    uint64_t ns_to_timeout = muldiv64(count_to_timeout, 1000 * ws->prescale, ws->parent->apb_freq_hz / 1000000);
-    TIMG_DEBUG_LOG("%s: TG%d ns=0x%08llx stage %d count=0x%08x count_to_timeout=0x%08x ns_to_timeout=0x%08llx\n",
-                   __func__, ws->parent->id, ns_now, ws->cur_stage, cur_count, count_to_timeout, ns_to_timeout);
-    timer_mod_anticipate_ns(&ws->stage_timer, ns_now + ns_to_timeout);
+    int64_t ns_timeout = esp_timer_counter_expiry(&ws->counter, ns_now, count_to_timeout);
+    TIMG_DEBUG_LOG("%s: TG%d ns=0x%08llx stage %d count=0x%08x count_to_timeout=0x%08x ns_timeout=0x%08llx\n",
+                   __func__, ws->parent->id, ns_now, ws->cur_stage, cur_count, count_to_timeout, ns_timeout);
+    esp_timer_sched_arm(sched, ws->sched_alarm, ns_timeout);
 }
 
 static void esp32_timg_wdt_cb(void *opaque)
@@ -588,9 +613,8 @@ static void esp32_timg_wdt_cb(void *opaque)
 
     int next_stage = (ws->cur_stage + 1) % ESP32_TIMG_WDT_STAGE_COUNT;
     uint64_t ns_now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    ws->count_base = 0;
     ws->cur_stage = next_stage;
-    ws->ns_base = ns_now;
+    esp_timer_counter_load(&ws->counter, ns_now, 0);
     esp32_timg_wdt_arm(ws, ns_now);
 }
 
@@ -600,7 +624,8 @@ static void esp32_timg_realize(DeviceState *dev, Error **errp)
 
 static void esp32_timg_timer_init(Esp32TimgState *s, Esp32TimgTimerState *ts, Esp32TimgInterruptType int_type) {
     ts->parent = s;
-    timer_init_ns(&ts->alarm_timer, QEMU_CLOCK_VIRTUAL, esp32_timg_timer_cb, ts);
+    esp_timer_counter_init(&ts->counter, s->apb_freq_hz, NANOSECONDS_PER_SECOND);
+    ts->sched_alarm = esp_timer_sched_add(&s->sched, esp32_timg_timer_cb, ts);
     ts->int_type = int_type;
 }
 
@@ -624,16 +649,86 @@ static void esp32_timg_init(Object *obj)
     s->xtal_freq_hz = 40000000;
     s->apb_freq_hz = 40000000;
 
+    esp_timer_sched_init(&s->sched);
     esp32_timg_timer_init(s, &s->t0, TIMG_T0_INT);
     esp32_timg_timer_init(s, &s->t1, TIMG_T1_INT);
     esp32_timg_timer_init(s, &s->lact, TIMG_LACT_INT);
 
     s->wdt.parent = s;
-    timer_init_ns(&s->wdt.stage_timer, QEMU_CLOCK_VIRTUAL, esp32_timg_wdt_cb, &s->wdt);
+    esp_timer_counter_init(&s->wdt.counter, s->apb_freq_hz, NANOSECONDS_PER_SECOND);
+    s->wdt.sched_alarm = esp_timer_sched_add(&s->sched, esp32_timg_wdt_cb, &s->wdt);
     qdev_init_gpio_out_named(DEVICE(sbd), &s->wdt_cpu_reset_req, ESP32_TIMG_WDT_CPU_RESET_GPIO, 1);
     qdev_init_gpio_out_named(DEVICE(sbd), &s->wdt_sys_reset_req, ESP32_TIMG_WDT_SYS_RESET_GPIO, 1);
 }
 
+static const VMStateDescription vmstate_esp32_timg_timer = {
+    .name = "esp32.timg/timer",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(config_reg, Esp32TimgTimerState),
+        VMSTATE_INT32(divider, Esp32TimgTimerState),
+        VMSTATE_BOOL(en, Esp32TimgTimerState),
+        VMSTATE_BOOL(autoreload, Esp32TimgTimerState),
+        VMSTATE_BOOL(inc, Esp32TimgTimerState),
+        VMSTATE_BOOL(edge_int_en, Esp32TimgTimerState),
+        VMSTATE_BOOL(level_int_en, Esp32TimgTimerState),
+        VMSTATE_BOOL(alarm, Esp32TimgTimerState),
+        VMSTATE_UINT64(alarm_val, Esp32TimgTimerState),
+        VMSTATE_UINT64(load_val, Esp32TimgTimerState),
+        VMSTATE_UINT64(count_base, Esp32TimgTimerState),
+        VMSTATE_UINT64(last_val, Esp32TimgTimerState),
+        VMSTATE_ESP_TIMER_COUNTER(counter, Esp32TimgTimerState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32_timg_wdt = {
+    .name = "esp32.timg/wdt",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(config0_reg, Esp32TimgWdtState),
+        VMSTATE_UINT32(config1_reg, Esp32TimgWdtState),
+        VMSTATE_BOOL(en, Esp32TimgWdtState),
+        VMSTATE_BOOL(flashboot_en, Esp32TimgWdtState),
+        VMSTATE_BOOL(level_int_en, Esp32TimgWdtState),
+        VMSTATE_BOOL(edge_int_en, Esp32TimgWdtState),
+        VMSTATE_INT32(prescale, Esp32TimgWdtState),
+        VMSTATE_UINT32_ARRAY(mode, Esp32TimgWdtState, ESP32_TIMG_WDT_STAGE_COUNT),
+        VMSTATE_INT32_ARRAY(timeout, Esp32TimgWdtState, ESP32_TIMG_WDT_STAGE_COUNT),
+        VMSTATE_ESP_TIMER_COUNTER(counter, Esp32TimgWdtState),
+        VMSTATE_INT32(cur_stage, Esp32TimgWdtState),
+        VMSTATE_UINT32(protect_reg, Esp32TimgWdtState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32_timg = {
+    .name = TYPE_ESP32_TIMG,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT(t0, Esp32TimgState, 1, vmstate_esp32_timg_timer, Esp32TimgTimerState),
+        VMSTATE_STRUCT(t1, Esp32TimgState, 1, vmstate_esp32_timg_timer, Esp32TimgTimerState),
+        VMSTATE_STRUCT(lact, Esp32TimgState, 1, vmstate_esp32_timg_timer, Esp32TimgTimerState),
+        VMSTATE_STRUCT(wdt, Esp32TimgState, 1, vmstate_esp32_timg_wdt, Esp32TimgWdtState),
+        VMSTATE_UINT32(int_ena, Esp32TimgState),
+        VMSTATE_UINT32(int_raw, Esp32TimgState),
+        VMSTATE_UINT32(rtc_slow_freq_hz, Esp32TimgState),
+        VMSTATE_UINT32(xtal_freq_hz, Esp32TimgState),
+        VMSTATE_UINT32(apb_freq_hz, Esp32TimgState),
+        VMSTATE_BOOL(flash_boot_mode, Esp32TimgState),
+        VMSTATE_BOOL(rtc_cal_start, Esp32TimgState),
+        VMSTATE_BOOL(rtc_cal_ready, Esp32TimgState),
+        VMSTATE_UINT32(rtc_cal_clk_sel, Esp32TimgState),
+        VMSTATE_UINT32(rtc_cal_max, Esp32TimgState),
+        VMSTATE_UINT32(rtc_cal_value, Esp32TimgState),
+        VMSTATE_ESP_TIMER_SCHED(sched, Esp32TimgState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32_timg_properties[] = {
     DEFINE_PROP_BOOL("wdt_disable", Esp32TimgState, wdt_disable, false),
     DEFINE_PROP_END_OF_LIST(),
@@ -645,6 +740,7 @@ static void esp32_timg_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32_timg_reset;
     dc->realize = esp32_timg_realize;
+    dc->vmsd = &vmstate_esp32_timg;
     device_class_set_props(dc, esp32_timg_properties);
 }
 
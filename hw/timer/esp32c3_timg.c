@@ -16,6 +16,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/registerfields.h"
 #include "hw/boards.h"
 #include "hw/timer/esp32c3_timg.h"
@@ -46,26 +47,44 @@ static inline uint64_t load_high(uint64_t reg, uint32_t high)
 static int64_t esp32c3_virtual_counter_update(ESP32C3VirtualCounter *counter)
 {
     const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    const int64_t elapsed_ns = now - counter->base;
-    const int64_t ticks = (elapsed_ns * (counter->frequency / 1000)) / 1000000;
-    counter->value += ticks;
-    counter->base = now;
+    counter->value = esp_timer_counter_get(&counter->ticks, now);
     return counter->value;
 }
 
-static inline QEMUTimer* esp32c3_virtual_counter_get_timer(ESP32C3VirtualCounter *counter)
+/**
+ * @brief Restart the counter from 0 and schedule the alarm when it reaches `ticks`.
+ */
+static void esp32c3_virtual_counter_alarm_in_ticks(ESP32C3VirtualCounter *counter, int64_t ticks)
 {
-    return &counter->timer;
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    /* This function will reschedule the alarm if it was already scheduled */
+    esp_timer_counter_load(&counter->ticks, now, 0);
+    counter->value = 0;
+    esp_timer_sched_arm(counter->sched, counter->alarm, esp_timer_counter_expiry(&counter->ticks, now, MAX(ticks, 0)));
 }
 
-static void esp32c3_virtual_counter_alarm_in_ticks(ESP32C3VirtualCounter *counter, int64_t ticks)
+/**
+ * @brief Schedule the alarm in `ticks` ticks without restarting the counter, so that the phase of
+ * the ticks is not altered by the time the guest took to program the alarm.
+ */
+static void esp32c3_virtual_counter_alarm_after(ESP32C3VirtualCounter *counter, int64_t ticks)
 {
-    int64_t delay_ns = (ticks * (1000000000UL / counter->frequency));
     const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    /* This function will reschedule the clock if it was already scheduled */
-    counter->base = now;
-    counter->value = 0;
-    timer_mod_ns(&counter->timer, now + delay_ns);
+    esp_timer_sched_arm(counter->sched, counter->alarm, esp_timer_counter_expiry(&counter->ticks, now, ticks));
+}
+
+static void esp32c3_virtual_counter_disarm(ESP32C3VirtualCounter *counter)
+{
+    esp_timer_sched_disarm(counter->sched, counter->alarm);
+}
+
+/**
+ * @brief Set the frequency of the counter to `clk / divider`, the ticks elapsed so far are kept.
+ */
+static void esp32c3_virtual_counter_set_rate(ESP32C3VirtualCounter *counter, uint64_t clk, uint32_t divider)
+{
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    esp_timer_counter_set_rate(&counter->ticks, now, clk, NANOSECONDS_PER_SECOND * (uint64_t) divider);
 }
 
 /**
@@ -75,15 +94,23 @@ static void esp32c3_virtual_counter_alarm_in_ticks(ESP32C3VirtualCounter *counte
  */
 static void esp32c3_virtual_counter_reenabled(ESP32C3VirtualCounter *counter)
 {
-    counter->base = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    esp_timer_counter_load(&counter->ticks, now, counter->value);
 }
 
 static void esp32c3_virtual_counter_reset(ESP32C3VirtualCounter* counter)
 {
-    timer_del(&counter->timer);
-    counter->base = 0;
+    esp32c3_virtual_counter_disarm(counter);
+    esp_timer_counter_init(&counter->ticks, 160000000, NANOSECONDS_PER_SECOND); // Hz
+    esp_timer_counter_run(&counter->ticks, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), true);
     counter->value = 0;
-    counter->frequency = 160000000; // Hz
+}
+
+static void esp32c3_virtual_counter_init(ESP32C3VirtualCounter* counter, EspTimerSched *sched,
+                                         void (*cb)(void *opaque), void *opaque)
+{
+    counter->sched = sched;
+    counter->alarm = esp_timer_sched_add(sched, cb, opaque);
 }
 
 
@@ -214,7 +241,7 @@ static void esp32c3_wdt_update_prescaler(ESP32C3WdtState* wdt, uint32_t value)
     }
 
     /* Recalculate the frequency out of the new prescaler and current clock */
-    wdt->counter.frequency = esp32c3_wdt_ext_clk_frequency(wdt) / wdt->prescaler;
+    esp32c3_virtual_counter_set_rate(&wdt->counter, esp32c3_wdt_ext_clk_frequency(wdt), wdt->prescaler);
 
     /* In theory we should reschedule the timer if it is currently running.
      * In practice, let's say that this behavior is invalid  and do not reschedule it. */
@@ -234,7 +261,7 @@ static void esp32c3_wdt_update_stage(ESP32C3WdtState* wdt, int index, uint32_t v
              * stage is smaller than the current value. It will be restarted (not resumed) when fed.
              * Just like the real hardware, keep the "enable" bit to 1, moreover it is required for feeding.
              */
-            timer_del(&wdt->counter.timer);
+            esp32c3_virtual_counter_disarm(&wdt->counter);
         } else {
             /* The new alarm is set to happen in `diff` ticks, reschedule the alarm */
             esp32c3_virtual_counter_alarm_in_ticks(&wdt->counter, diff);
@@ -294,7 +321,7 @@ static void esp32c3_wdt_update_config(ESP32C3WdtState* wdt, uint32_t value)
         } else {
             wdt->config0 &= ~R_TIMG_WDTCONFIG0_EN_MASK;
             /* Disable the timer! */
-            timer_del(&wdt->counter.timer);
+            esp32c3_virtual_counter_disarm(&wdt->counter);
         }
     }
 }
@@ -320,13 +347,9 @@ static void esp32c3_t0_cb(void* opaque)
 {
     ESP32C3T0State* t = (ESP32C3T0State*) opaque;
 
-    /* Update the value of the counter and disable the alarm timer */
-    esp32c3_virtual_counter_reset(&t->counter);
-    esp32c3_virtual_counter_reenabled(&t->counter);
-
-    /* In practice, the counter is bigger than the requested value, this is due to the fact
-     * that there is a cost of emulation and the (Linux) kernel timer may also be busy
-     * doing something else before scheduling the VM. Adjust the counter to the alarm value. */
+    /* The alarm is triggered on the exact tick the counter reaches the alarm value, consume the ticks
+     * elapsed so far without altering their phase, the counter is now equal to the alarm value. */
+    esp32c3_virtual_counter_update(&t->counter);
     t->value_rel = t->alarm;
 
     /* If the counter is set to auto-reload, set its new value */
@@ -386,7 +409,7 @@ static void esp32c3_t0_alarm_update(ESP32C3T0State* t)
             esp32c3_t0_cb(t);
         } else if ((increase && scenario2) || (decrease && scenario6)) {
             /* The alarm is in range and in the future, program its trigger */
-            esp32c3_virtual_counter_alarm_in_ticks(&t->counter, diff);
+            esp32c3_virtual_counter_alarm_after(&t->counter, diff);
         } else {
             assert(scenario4 || scenario8);
             /* The alarm is in range, in the future, but requires the timer to overflow/underflow */
@@ -394,7 +417,7 @@ static void esp32c3_t0_alarm_update(ESP32C3T0State* t)
             const uint64_t low  = MIN(alarm, value);
             /* Calculate the new (tick) difference between them */
             diff = (ESP32C3_TIMG_T0_MAX_VALUE + 1 - high) + low;
-            esp32c3_virtual_counter_alarm_in_ticks(&t->counter, diff);
+            esp32c3_virtual_counter_alarm_after(&t->counter, diff);
         }
 
     }
@@ -424,16 +447,14 @@ static void esp32c3_t0_config_update(ESP32C3T0State* t0, uint32_t value)
         esp32c3_t0_update_counter(t0);
     }
 
-    /* Calculate the new frequency */
-    const uint32_t new_divider = FIELD_EX32(value, TIMG_T0CONFIG, DIVIDER);
+    /* Calculate the new frequency, a divider of 0 means 65536 */
+    const uint32_t new_divider = FIELD_EX32(value, TIMG_T0CONFIG, DIVIDER) ?: 65536;
     const uint64_t new_clk = FIELD_EX32(value, TIMG_T0CONFIG, USE_XTAL) ? ESP32C3_XTAL_CLK : ESP32C3_APB_CLK;
-    const uint64_t new_freq = new_clk / new_divider;
-    if (new_freq != t0->counter.frequency) {
-        t0->counter.frequency = new_freq;
-    }
+    esp32c3_virtual_counter_set_rate(&t0->counter, new_clk, new_divider);
 
     if (value & R_TIMG_T0CONFIG_DIVCNT_RST_MASK) {
-        esp32c3_virtual_counter_reset(&t0->counter);
+        /* Reset the divider counter, i.e. the phase of the ticks, the counter value is kept */
+        esp32c3_virtual_counter_reenabled(&t0->counter);
         esp32c3_t0_alarm_update(t0);
     }
 
@@ -442,7 +463,7 @@ static void esp32c3_t0_config_update(ESP32C3T0State* t0, uint32_t value)
         if (value & R_TIMG_T0CONFIG_ALARM_EN_MASK) {
             esp32c3_t0_alarm_update(t0);
         } else {
-            timer_del(&t0->counter.timer);
+            esp32c3_virtual_counter_disarm(&t0->counter);
         }
     }
 
@@ -462,7 +483,7 @@ static void esp32c3_t0_config_update(ESP32C3T0State* t0, uint32_t value)
         } else {
             /* In theory, we should update the counter before disabling its timer, but in practice, we
              * already did that at the beginning of this function. Thus, the base time is correct. */
-            timer_del(&t0->counter.timer);
+            esp32c3_virtual_counter_disarm(&t0->counter);
         }
     }
 }
@@ -717,16 +738,80 @@ static void esp32c3_timg_init(Object *obj)
     s->wdt.wkey = ESP32C3_WDT_DEFAULT_WKEY;
     qdev_init_gpio_out_named(DEVICE(sbd), &s->wdt.reset_irq, ESP32C3_WDT_IRQ_RESET, 1);
     qdev_init_gpio_out_named(DEVICE(sbd), &s->wdt.interrupt_irq, ESP32C3_WDT_IRQ_INTERRUPT, 1);
-    timer_init_ns(esp32c3_virtual_counter_get_timer(&s->wdt.counter), QEMU_CLOCK_VIRTUAL, esp32c3_wdt_cb, &s->wdt);
+    esp_timer_sched_init(&s->sched);
+    esp32c3_virtual_counter_init(&s->wdt.counter, &s->sched, esp32c3_wdt_cb, &s->wdt);
 
     /* Timer T0 initialization */
     qdev_init_gpio_out_named(DEVICE(sbd), &s->t0.interrupt_irq, ESP32C3_T0_IRQ_INTERRUPT, 1);
-    timer_init_ns(esp32c3_virtual_counter_get_timer(&s->t0.counter), QEMU_CLOCK_VIRTUAL, esp32c3_t0_cb, &s->t0);
+    esp32c3_virtual_counter_init(&s->t0.counter, &s->sched, esp32c3_t0_cb, &s->t0);
 
     /* Set the initial values for the internal fields */
     esp32c3_timg_reset((DeviceState*) s);
 }
 
+static const VMStateDescription vmstate_esp32c3_virtual_counter = {
+    .name = "esp32c3.timg/counter",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_ESP_TIMER_COUNTER(ticks, ESP32C3VirtualCounter),
+        VMSTATE_UINT64(value, ESP32C3VirtualCounter),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32c3_timg_wdt = {
+    .name = "esp32c3.timg/wdt",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(config0, ESP32C3WdtState),
+        VMSTATE_UINT32(prescaler, ESP32C3WdtState),
+        VMSTATE_UINT32_ARRAY(stage, ESP32C3WdtState, ESP32C3_WDT_STAGE_COUNT),
+        VMSTATE_UINT32(wkey, ESP32C3WdtState),
+        VMSTATE_INT32(raw_st, ESP32C3WdtState),
+        VMSTATE_BOOL(int_enabled, ESP32C3WdtState),
+        VMSTATE_UINT32(prescaler_mirror, ESP32C3WdtState),
+        VMSTATE_UINT32_ARRAY(stage_mirror, ESP32C3WdtState, ESP32C3_WDT_STAGE_COUNT),
+        VMSTATE_UINT32_ARRAY(stage_conf, ESP32C3WdtState, ESP32C3_WDT_STAGE_COUNT),
+        VMSTATE_INT32(current_stage, ESP32C3WdtState),
+        VMSTATE_STRUCT(counter, ESP32C3WdtState, 1, vmstate_esp32c3_virtual_counter, ESP32C3VirtualCounter),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32c3_timg_t0 = {
+    .name = "esp32c3.timg/t0",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(config, ESP32C3T0State),
+        VMSTATE_UINT64(alarm, ESP32C3T0State),
+        VMSTATE_UINT64(value_rel, ESP32C3T0State),
+        VMSTATE_UINT64(value_flushed, ESP32C3T0State),
+        VMSTATE_UINT64(value_toload, ESP32C3T0State),
+        VMSTATE_INT32(raw_st, ESP32C3T0State),
+        VMSTATE_BOOL(int_enabled, ESP32C3T0State),
+        VMSTATE_STRUCT(counter, ESP32C3T0State, 1, vmstate_esp32c3_virtual_counter, ESP32C3VirtualCounter),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32c3_timg = {
+    .name = TYPE_ESP32C3_TIMG,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT(t0, ESP32C3TimgState, 1, vmstate_esp32c3_timg_t0, ESP32C3T0State),
+        VMSTATE_STRUCT(wdt, ESP32C3TimgState, 1, vmstate_esp32c3_timg_wdt, ESP32C3WdtState),
+        VMSTATE_UINT32(rtc.rtc_cali_cfg, ESP32C3TimgState),
+        VMSTATE_UINT32(rtc.rtc_cali_cfg_result, ESP32C3TimgState),
+        VMSTATE_UINT32(rtc.rtc_cali_cfg_timeout, ESP32C3TimgState),
+        VMSTATE_ESP_TIMER_SCHED(sched, ESP32C3TimgState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32c3_timg_properties[] = {
     DEFINE_PROP_BOOL("wdt_disable", ESP32C3TimgState, wdt_disable, false),
     DEFINE_PROP_END_OF_LIST(),
@@ -738,6 +823,7 @@ static void esp32c3_timg_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32c3_timg_reset;
     dc->realize = esp32c3_timg_realize;
+    dc->vmsd = &vmstate_esp32c3_timg;
     device_class_set_props(dc, esp32c3_timg_properties);
 }
 
@@ -16,25 +16,37 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/registerfields.h"
 #include "hw/boards.h"
 #include "hw/timer/esp32s3_systimer.h"
 
 
-#define TICKS_TO_NS(ticks) (((ticks) / ESP32S3_SYSTIMER_CNT_PER_US) * 1000)
-
 #define SYSTIMER_DEBUG      0
 #define SYSTIMER_WARNING    0
 
 /**
- * @brief Update the value of a counter according the QEMU virtual timer.
+ * According to the TRM, if the comparator (alarm) is smaller than the counter value and the
+ * difference is bigger or equal to (2^51) - 1, the alarm is not triggered right now and the counter
+ * will have to overflow first before reached the comparator value.
  */
-static void esp32s3_systimer_update_counter(ESP32S3SysTimerCounter *counter) {
-    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    const int64_t elapsed_ns = now - counter->base;
-    const int64_t ticks = (elapsed_ns * (ESP32S3_SYSTIMER_CNT_CLK / 1000000)) / 1000;
-    counter->value = (counter->value + ticks) & ESP32S3_SYSTIMER_52BIT_MASK;
-    counter->base = now;
+#define ESP32S3_SYSTIMER_OVERFLOW_LIMIT ((1ULL << 51) - 1)
+
+/**
+ * @brief Get the value of a counter according the QEMU virtual timer.
+ */
+static uint64_t esp32s3_systimer_counter_value(ESP32S3SysTimerCounter *counter, int64_t now)
+{
+    return esp_timer_counter_get(&counter->core, now) & ESP32S3_SYSTIMER_52BIT_MASK;
+}
+
+
+/**
+ * @brief Check whether the counter value `count` already reached the given alarm value.
+ */
+static bool esp32s3_systimer_reached(uint64_t count, uint64_t alarm)
+{
+    return alarm <= count && count - alarm < ESP32S3_SYSTIMER_OVERFLOW_LIMIT;
 }
 
 
@@ -56,6 +68,25 @@ static void esp32s3_systimer_set_irqs(ESP32S3SysTimerState *s)
 }
 
 
+/**
+ * @brief Arm the comparator's alarm for the instant its counter reaches `target`.
+ */
+static void esp32s3_systimer_comparator_arm(ESP32S3SysTimerComp* comparator, int64_t now)
+{
+    ESP32S3SysTimerState *s = comparator->systimer;
+    ESP32S3SysTimerCounter* counter = &s->counter[comparator->counter];
+    const uint64_t count = esp32s3_systimer_counter_value(counter, now);
+    /* Number of ticks to reach the target, including an overflow of the counter */
+    const uint64_t diff = (comparator->target - count) & ESP32S3_SYSTIMER_52BIT_MASK;
+    const int64_t target_ns = esp_timer_counter_expiry(&counter->core, now, diff);
+
+    esp_timer_sched_arm(&s->sched, comparator->alarm, target_ns);
+#if SYSTIMER_DEBUG
+    info_report("[SYSTIMER] alarm armed (%d) = %08lx", comparator->number, target_ns);
+#endif // SYSTIMER_DEBUG
+}
+
+
 static void esp32s3_systimer_notify(ESP32S3SysTimerComp* comparator)
 {
     int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
@@ -66,44 +97,38 @@ static void esp32s3_systimer_notify(ESP32S3SysTimerComp* comparator)
     previous = now;
 #endif
 
-    /* Update the counter linked to the comparator */
     const uint32_t counter_idx = comparator->counter;
     ESP32S3SysTimerState *s = comparator->systimer;
     ESP32S3SysTimerCounter* counter = &s->counter[counter_idx];
 
-    if (counter->enabled) {
-        esp32s3_systimer_update_counter(counter);
-    }
-
     /* Set the IRQ line if anything changed */
     comparator->cur_irq_level = 1;
     qemu_irq_raise(comparator->irq);
 
-    /* Check if we have to reload the comparator's timer */
-    if (counter->enabled && comparator->period_mode) {
-        // info_report("[SYSTIMER] esp32s3_systimer_notify");
+    /* Check if we have to reload the comparator's alarm */
+    if (counter->enabled && comparator->period_mode && comparator->period != 0) {
         /**
-         * If the timer is periodic, we have to compensate the delay that may have been taken
-         * by QEMU framework. Indeed, this timer may have been triggered too late (tenth of us)
-         * As such, compensate here by triggering the next timer earlier.
+         * The next target is relative to the previous one, not to the current time, so that the
+         * period doesn't drift even if the alarm was handled late. If more than a period elapsed,
+         * skip the targets that were missed.
          */
-        const int64_t diff_ns = now - comparator->expire_time;
-        const int64_t target_ns = now + TICKS_TO_NS(comparator->period);
-        int64_t adjusted_target_ns = target_ns;
+        const uint64_t count = esp32s3_systimer_counter_value(counter, now);
+        uint64_t target = (comparator->target + comparator->period) & ESP32S3_SYSTIMER_52BIT_MASK;
 
-        if (diff_ns < target_ns) {
-            adjusted_target_ns = target_ns - diff_ns;
+        if (esp32s3_systimer_reached(count, target)) {
+            const uint64_t late = count - target;
+            target += (late / comparator->period + 1) * comparator->period;
         }
 
-        comparator->expire_time = adjusted_target_ns;
-        timer_mod_ns(&comparator->qtimer, adjusted_target_ns);
+        comparator->target = target & ESP32S3_SYSTIMER_52BIT_MASK;
+        esp32s3_systimer_comparator_arm(comparator, now);
     }
 }
 
 
 /**
  * @brief Function called when the configuration of the given comparator changed.
- * It will reprogram the QEMU Timer according to the new parameters. The comparator
+ * It will rearm the comparator's alarm according to the new parameters. The comparator
  * must be enabled when this function is called.
  */
 static void esp32s3_systimer_comparator_reprogram(ESP32S3SysTimerComp* comparator)
@@ -122,57 +147,32 @@ static void esp32s3_systimer_comparator_reprogram(ESP32S3SysTimerComp* comparato
     ESP32S3SysTimerState *s = comparator->systimer;
     ESP32S3SysTimerCounter* counter = &s->counter[counter_idx];
 
-    /* Update the counter to get the latest value */
-    esp32s3_systimer_update_counter(counter);
-
-    /* If the counter we have to compare it to is not enabled, do not program any timer */
+    /* If the counter we have to compare it to is not enabled, do not program any alarm */
     if (!counter->enabled) {
-        /* "Disable" the timer */
-        timer_del(&comparator->qtimer);
+        esp_timer_sched_disarm(&s->sched, comparator->alarm);
 #if SYSTIMER_DEBUG
-        info_report("comparator->qtimer timer_del %d",comparator->number);
+        info_report("alarm disarmed %d",comparator->number);
 #endif //  SYSTIMER_DEBUG
         return;
     }
 
-    /**
-     * According to the TRM, if the comparator (alarm) is smaller than the counter value and the
-     * difference is bigger or equal to (2^51) - 1, the alarm is not triggered right now and the counter
-     * will have to overflow first before reached the comparator value.
-     */
-    const int64_t count_val = counter->value;
-    const int64_t alarm = comparator->value;
-    const bool overflow_valid = alarm < count_val && count_val - alarm >= ((1ULL << 51) - 1);
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    const uint64_t count_val = esp32s3_systimer_counter_value(counter, now);
 
-    if (!comparator->period_mode && !overflow_valid && alarm <= count_val) {
-        timer_del(&comparator->qtimer);
+    if (comparator->period_mode) {
+        comparator->target = (count_val + comparator->period) & ESP32S3_SYSTIMER_52BIT_MASK;
+    } else if (esp32s3_systimer_reached(count_val, comparator->value)) {
+        esp_timer_sched_disarm(&s->sched, comparator->alarm);
 #if SYSTIMER_DEBUG
-        info_report("comparator->qtimer timer_del %d",comparator->number);
+        info_report("alarm disarmed %d",comparator->number);
 #endif// SYSTIMER_DEBUG
         esp32s3_systimer_notify(comparator);
         return;
-    }
-
-    /* Calculate in how many ns the counter would reach the comparator */
-    uint64_t diff = 0;
-
-    if (comparator->period_mode) {
-        diff = comparator->period;
-    } else if (overflow_valid) {
-        diff = ((ESP32S3_SYSTIMER_52BIT_MASK + 1) - count_val) + alarm;
     } else {
-        diff = alarm - count_val;
+        comparator->target = comparator->value;
     }
 
-    /* Calculate the number of ns the counter will take to reach the absolute count */
-    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    const int64_t target_ns = now + TICKS_TO_NS(diff);
-    comparator->expire_time = target_ns;
-    timer_mod_ns(&comparator->qtimer, target_ns);
-#if SYSTIMER_DEBUG
-    info_report("[SYSTIMER] qtimer timer_mod_ns (%d) = %08lx", comparator->number, target_ns);
-#endif // SYSTIMER_DEBUG
-
+    esp32s3_systimer_comparator_arm(comparator, now);
 }
 
 
@@ -303,12 +303,9 @@ static uint64_t esp32s3_systimer_read(void *opaque, hwaddr addr, unsigned int si
  */
 static void esp32s3_systimer_flush_counter(ESP32S3SysTimerCounter *counter)
 {
-    /* If the counter is enabled, get its latest value */
-    if (counter->enabled) {
-        esp32s3_systimer_update_counter(counter);
-    }
-    /* In any case, flush the value to send to the guest program */
-    counter->flushed = counter->value;
+    /* The internal counter only increments while the counter is enabled */
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    counter->flushed = esp32s3_systimer_counter_value(counter, now);
 }
 
 /**
@@ -324,12 +321,9 @@ static void esp32s3_systimer_load_counter(ESP32S3SysTimerState *s, uint32_t inde
    
     ESP32S3SysTimerCounter* counter = &s->counter[index];
 
-    /* If the counter is enabled, update the internal value to the latest count.
-     * Even though the value will be replaced, this will also update the base time. */
-    if (counter->enabled) {
-        esp32s3_systimer_update_counter(counter);
-    }
-    counter->value = counter->toload;
+    /* The next tick will happen one full period after the load */
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    esp_timer_counter_load(&counter->core, now, counter->toload);
 
     /* If one of the comparator is enabled and depends on the current timer, reprogram it */
     for (int i = 0; i < ESP32S3_SYSTIMER_COMP_COUNT; i++) {
@@ -389,6 +383,11 @@ static void esp32s3_systimer_conf_set(ESP32S3SysTimerState *s, uint64_t value)
     s->counter[0].enabled_on_stall = (value & R_SYSTIMER_CONF_TIMER_UNIT0_CORE0_STALL_EN_MASK) ? 1 : 0;
     s->counter[1].enabled_on_stall = (value & R_SYSTIMER_CONF_TIMER_UNIT1_CORE0_STALL_EN_MASK) ? 1 : 0;
 
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    for (int i = 0; i < ESP32S3_SYSTIMER_COUNTER_COUNT; i++) {
+        esp_timer_counter_run(&s->counter[i].core, now, s->counter[i].enabled);
+    }
+
     /* If the state of the counter changed while one of the comparator depends on it, reload it */
     for (int i = 0; i < ESP32S3_SYSTIMER_COMP_COUNT; i++) {
         const int count_idx = s->comparators[i].counter;
@@ -417,13 +416,13 @@ static void esp32s3_systimer_conf_set(ESP32S3SysTimerState *s, uint64_t value)
         }
 
         /* If the comparator has just been enabled, (re)program it.
-         * If it was enabled and it is now disabled, disable the QEMU timer. */
+         * If it was enabled and it is now disabled, disarm its alarm. */
         if (s->comparators[i].enabled) {
             esp32s3_systimer_comparator_reprogram(&s->comparators[i]);
         } else {
-            timer_del(&s->comparators[i].qtimer);
+            esp_timer_sched_disarm(&s->sched, s->comparators[i].alarm);
 #if SYSTIMER_DEBUG
-            info_report("comparator->qtimer timer_del %d",s->comparators[i].number);
+            info_report("alarm disarmed %d",s->comparators[i].number);
 #endif // SYSTIMER_DEBUG
         }
     }
@@ -605,20 +604,20 @@ static void esp32s3_systimer_reset(DeviceState* ts)
 {
     ESP32S3SysTimerState *s = ESP32S3_SYSTIMER(ts);
     s->conf = 0;
+    esp_timer_sched_reset(&s->sched);
     for (int i = 0; i < ESP32S3_SYSTIMER_COMP_COUNT; i++) {
         ESP32S3SysTimerComp* comp = &s->comparators[i];
-        QEMUTimer qtimer = comp->qtimer;
+        const uint32_t alarm = comp->alarm;
         qemu_irq irq = comp->irq;
 
-        /* Disable all the timers/irq first */
-        timer_del(&comp->qtimer);
+        /* Disable the irq first */
         qemu_irq_lower(comp->irq);
 
         /* Reset the data of the comparator */
         memset(comp, 0, sizeof(ESP32S3SysTimerComp));
 
         /* Restore the former fields that were already initialized */
-        comp->qtimer = qtimer;
+        comp->alarm = alarm;
         comp->irq = irq;
         comp->systimer = s;
     }
@@ -639,25 +638,79 @@ static void esp32s3_systimer_init(Object *obj)
                           TYPE_ESP32S3_SYSTIMER, ESP32S3_SYSTIMER_IO_SIZE);
     sysbus_init_mmio(sbd, &s->iomem);
 
+    for (uint64_t i = 0; i < ESP32S3_SYSTIMER_COUNTER_COUNT; i++) {
+        esp_timer_counter_init(&s->counter[i].core, ESP32S3_SYSTIMER_CNT_CLK, NANOSECONDS_PER_SECOND);
+    }
+
+    esp_timer_sched_init(&s->sched);
     for (uint64_t i = 0; i < ESP32S3_SYSTIMER_COMP_COUNT; i++) {
         s->comparators[i].systimer = s;
         sysbus_init_irq(sbd, &s->comparators[i].irq);
         s->comparators[i].number = i;
-        timer_init_ns(&s->comparators[i].qtimer, QEMU_CLOCK_VIRTUAL, esp32s3_systimer_cb, &s->comparators[i]);
+        s->comparators[i].alarm = esp_timer_sched_add(&s->sched, esp32s3_systimer_cb, &s->comparators[i]);
 #if SYSTIMER_DEBUG
         info_report("[SYSTIMER] esp32s3_systimer_init = %ld", i);
-        info_report("comparator->qtimer timer_del %d", s->comparators[i].number);
 #endif 
     }
 }
 
 
+static const VMStateDescription vmstate_esp32s3_systimer_counter = {
+    .name = "esp32s3.systimer/counter",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BOOL(enabled, ESP32S3SysTimerCounter),
+        VMSTATE_BOOL(enabled_on_stall, ESP32S3SysTimerCounter),
+        VMSTATE_UINT64(toload, ESP32S3SysTimerCounter),
+        VMSTATE_UINT64(flushed, ESP32S3SysTimerCounter),
+        VMSTATE_ESP_TIMER_COUNTER(core, ESP32S3SysTimerCounter),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32s3_systimer_comp = {
+    .name = "esp32s3.systimer/comparator",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64(value, ESP32S3SysTimerComp),
+        VMSTATE_UINT64(value_toload, ESP32S3SysTimerComp),
+        VMSTATE_UINT32(period, ESP32S3SysTimerComp),
+        VMSTATE_UINT32(period_toload, ESP32S3SysTimerComp),
+        VMSTATE_BOOL(enabled, ESP32S3SysTimerComp),
+        VMSTATE_BOOL(period_mode, ESP32S3SysTimerComp),
+        VMSTATE_BOOL(raw_st, ESP32S3SysTimerComp),
+        VMSTATE_BOOL(int_enabled, ESP32S3SysTimerComp),
+        VMSTATE_UINT32(counter, ESP32S3SysTimerComp),
+        VMSTATE_UINT64(target, ESP32S3SysTimerComp),
+        VMSTATE_INT32(cur_irq_level, ESP32S3SysTimerComp),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_esp32s3_systimer = {
+    .name = TYPE_ESP32S3_SYSTIMER,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(conf, ESP32S3SysTimerState),
+        VMSTATE_STRUCT_ARRAY(counter, ESP32S3SysTimerState, ESP32S3_SYSTIMER_COUNTER_COUNT, 1,
+                             vmstate_esp32s3_systimer_counter, ESP32S3SysTimerCounter),
+        VMSTATE_STRUCT_ARRAY(comparators, ESP32S3SysTimerState, ESP32S3_SYSTIMER_COMP_COUNT, 1,
+                             vmstate_esp32s3_systimer_comp, ESP32S3SysTimerComp),
+        VMSTATE_ESP_TIMER_SCHED(sched, ESP32S3SysTimerState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static void esp32s3_systimer_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->reset = esp32s3_systimer_reset;
     dc->realize = esp32s3_systimer_realize;
+    dc->vmsd = &vmstate_esp32s3_systimer;
 }
 
 
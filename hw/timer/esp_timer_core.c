@@ -0,0 +1,297 @@
+/*
+ * Counter and alarm scheduling core shared by the ESP timer peripherals
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "migration/vmstate.h"
+#include "hw/timer/esp_timer_core.h"
+
+
+/**
+ * @brief Number of ticks elapsed between the origin of the counter and `now`
+ */
+static uint64_t esp_timer_counter_elapsed(const EspTimerCounter *c, int64_t now)
+{
+    uint64_t lo;
+    uint64_t hi;
+
+    if (!c->running || now <= c->base_ns) {
+        return 0;
+    }
+
+    /* ticks = ((now - base_ns) * num - base_rem) / den, with a 128-bit intermediate result */
+    mulu64(&lo, &hi, now - c->base_ns, c->num);
+    if (hi == 0 && lo < c->base_rem) {
+        return 0;
+    }
+    hi -= (lo < c->base_rem);
+    lo -= c->base_rem;
+    divu128(&lo, &hi, c->den);
+    return lo;
+}
+
+
+/**
+ * @brief Move the origin of the counter to the last tick that happened before `now`
+ */
+static void esp_timer_counter_rebase(EspTimerCounter *c, int64_t now)
+{
+    const uint64_t ticks = esp_timer_counter_elapsed(c, now);
+    uint64_t lo;
+    uint64_t hi;
+
+    if (ticks == 0) {
+        return;
+    }
+
+    /* The tick happened (base_rem + ticks * den) / num ns after base_ns, keep the remainder */
+    mulu64(&lo, &hi, ticks, c->den);
+    lo += c->base_rem;
+    hi += (lo < c->base_rem);
+    c->base_rem = divu128(&lo, &hi, c->num);
+    c->base_ns += lo;
+    c->base_ticks += ticks;
+}
+
+
+void esp_timer_counter_init(EspTimerCounter *c, uint64_t num, uint64_t den)
+{
+    assert(num != 0 && den != 0);
+    memset(c, 0, sizeof(EspTimerCounter));
+    c->num = num;
+    c->den = den;
+}
+
+
+uint64_t esp_timer_counter_get(const EspTimerCounter *c, int64_t now)
+{
+    return c->base_ticks + esp_timer_counter_elapsed(c, now);
+}
+
+
+void esp_timer_counter_load(EspTimerCounter *c, int64_t now, uint64_t value)
+{
+    c->base_ticks = value;
+    c->base_ns = now;
+    c->base_rem = 0;
+}
+
+
+void esp_timer_counter_run(EspTimerCounter *c, int64_t now, bool run)
+{
+    if (run == c->running) {
+        return;
+    }
+
+    if (run) {
+        c->base_ns = now;
+        c->base_rem = 0;
+    } else {
+        c->base_ticks = esp_timer_counter_get(c, now);
+    }
+    c->running = run;
+}
+
+
+void esp_timer_counter_set_rate(EspTimerCounter *c, int64_t now, uint64_t num, uint64_t den)
+{
+    assert(num != 0 && den != 0);
+    if (num == c->num && den == c->den) {
+        return;
+    }
+
+    esp_timer_counter_rebase(c, now);
+
+    /* The remainder is expressed in 1/num ns, convert it to the new unit, rounding up so that
+     * the origin never moves before the tick it stands for */
+    if (c->base_rem != 0) {
+        uint64_t lo;
+        uint64_t hi;
+
+        mulu64(&lo, &hi, c->base_rem, num);
+        lo += c->num - 1;
+        hi += (lo < c->num - 1);
+        divu128(&lo, &hi, c->num);
+        /* base_rem < c->num, so the result is at most num */
+        if (lo == num) {
+            c->base_ns++;
+            lo = 0;
+        }
+        c->base_rem = lo;
+    }
+    c->num = num;
+    c->den = den;
+}
+
+
+int64_t esp_timer_counter_expiry(const EspTimerCounter *c, int64_t now, uint64_t delta)
+{
+    const uint64_t ticks = esp_timer_counter_elapsed(c, now) + delta;
+    const uint64_t round = c->base_rem + c->num - 1;
+    uint64_t lo;
+    uint64_t hi;
+
+    if (!c->running || ticks < delta) {
+        return ESP_TIMER_NEVER;
+    }
+
+    /* ns = ceil((base_rem + ticks * den) / num) */
+    mulu64(&lo, &hi, ticks, c->den);
+    lo += round;
+    hi += (lo < round);
+    divu128(&lo, &hi, c->num);
+
+    if (hi != 0 || lo >= (uint64_t) (ESP_TIMER_NEVER - c->base_ns)) {
+        return ESP_TIMER_NEVER;
+    }
+    return c->base_ns + lo;
+}
+
+
+/**
+ * @brief Arm the QEMU timer for the nearest deadline, if it changed
+ */
+static void esp_timer_sched_update(EspTimerSched *s)
+{
+    int64_t next = ESP_TIMER_NEVER;
+
+    /* The callback will take care of it once all the expired alarms have been processed */
+    if (s->dispatching) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < s->count; i++) {
+        next = MIN(next, s->alarms[i].deadline);
+    }
+
+    if (next == s->armed) {
+        return;
+    }
+    s->armed = next;
+
+    if (next == ESP_TIMER_NEVER) {
+        timer_del(&s->timer);
+    } else {
+        timer_mod_ns(&s->timer, next);
+    }
+}
+
+
+static void esp_timer_sched_cb(void *opaque)
+{
+    EspTimerSched *s = (EspTimerSched *) opaque;
+    const int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    s->armed = ESP_TIMER_NEVER;
+    s->dispatching = true;
+
+    /* Alarms re-armed in the past by their callback will be processed on the next timer expiry,
+     * this gives the main loop a chance to run even if a peripheral is misconfigured */
+    for (uint32_t i = 0; i < s->count; i++) {
+        EspTimerAlarm *alarm = &s->alarms[i];
+        if (alarm->deadline <= now) {
+            s->expired = alarm->deadline;
+            alarm->deadline = ESP_TIMER_NEVER;
+            alarm->cb(alarm->opaque);
+        }
+    }
+
+    s->dispatching = false;
+    esp_timer_sched_update(s);
+}
+
+
+void esp_timer_sched_init(EspTimerSched *s)
+{
+    memset(s, 0, sizeof(EspTimerSched));
+    s->armed = ESP_TIMER_NEVER;
+    timer_init_ns(&s->timer, QEMU_CLOCK_VIRTUAL, esp_timer_sched_cb, s);
+}
+
+
+uint32_t esp_timer_sched_add(EspTimerSched *s, void (*cb)(void *opaque), void *opaque)
+{
+    assert(s->count < ESP_TIMER_SCHED_MAX_ALARMS);
+    s->alarms[s->count] = (EspTimerAlarm) {
+        .deadline = ESP_TIMER_NEVER,
+        .cb = cb,
+        .opaque = opaque,
+    };
+    return s->count++;
+}
+
+
+void esp_timer_sched_arm(EspTimerSched *s, uint32_t alarm, int64_t deadline)
+{
+    assert(alarm < s->count);
+    s->alarms[alarm].deadline = deadline;
+    esp_timer_sched_update(s);
+}
+
+
+void esp_timer_sched_reset(EspTimerSched *s)
+{
+    for (uint32_t i = 0; i < s->count; i++) {
+        s->alarms[i].deadline = ESP_TIMER_NEVER;
+    }
+    esp_timer_sched_update(s);
+}
+
+
+const VMStateDescription vmstate_esp_timer_counter = {
+    .name = "esp_timer_counter",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_INT64(base_ns, EspTimerCounter),
+        VMSTATE_UINT64(base_rem, EspTimerCounter),
+        VMSTATE_UINT64(base_ticks, EspTimerCounter),
+        VMSTATE_UINT64(num, EspTimerCounter),
+        VMSTATE_UINT64(den, EspTimerCounter),
+        VMSTATE_BOOL(running, EspTimerCounter),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
+static const VMStateDescription vmstate_esp_timer_alarm = {
+    .name = "esp_timer_alarm",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_INT64(deadline, EspTimerAlarm),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+
+static int esp_timer_sched_post_load(void *opaque, int version_id)
+{
+    EspTimerSched *s = (EspTimerSched *) opaque;
+
+    /* Force the QEMU timer to be reprogrammed, whatever it was armed for before the load */
+    s->armed = INT64_MIN;
+    s->dispatching = false;
+    esp_timer_sched_update(s);
+    return 0;
+}
+
+
+const VMStateDescription vmstate_esp_timer_sched = {
+    .name = "esp_timer_sched",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp_timer_sched_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_EQUAL(count, EspTimerSched, NULL),
+        VMSTATE_STRUCT_ARRAY(alarms, EspTimerSched, ESP_TIMER_SCHED_MAX_ALARMS, 1,
+                             vmstate_esp_timer_alarm, EspTimerAlarm),
+        VMSTATE_END_OF_LIST()
+    }
+};
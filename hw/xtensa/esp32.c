@@ -15,6 +15,7 @@
 #include "qapi/error.h"
 #include "hw/hw.h"
 #include "hw/boards.h"
+#include "hw/misc/esp_machine.h"
 #include "hw/loader.h"
 #include "hw/sysbus.h"
 #include "hw/i2c/esp32_i2c.h"
@@ -34,6 +35,7 @@
 #include "sysemu/runstate.h"
 #include "sysemu/blockdev.h"
 #include "sysemu/block-backend.h"
+#include "hw/block/flash.h"
 #include "exec/exec-all.h"
 #include "net/net.h"
 #include "elf.h"
@@ -457,6 +459,10 @@ static void esp32_soc_realize(DeviceState *dev, Error **errp)
         const hwaddr spi_base[] = {
             DR_REG_SPI0_BASE, DR_REG_SPI1_BASE, DR_REG_SPI2_BASE, DR_REG_SPI3_BASE
         };
+        /* SPI0 and SPI1 share the flash chip, which is cached by the DPORT */
+        if (i <= 1) {
+            s->spi[i].dport = &s->dport;
+        }
         qdev_realize(DEVICE(&s->spi[i]), &s->periph_bus, &error_fatal);
 
         esp32_soc_add_periph_device(sys_mem, &s->spi[i], spi_base[i]);
@@ -559,6 +565,9 @@ static void esp32_soc_init(Object *obj)
     for (int i = 0; i < ms->smp.cpus; ++i) {
         snprintf(name, sizeof(name), "cpu%d", i);
         object_initialize_child(obj, name, &s->cpu[i], TYPE_ESP32_CPU);
+        /* Cycle model: instructions fetched from the external flash through the IROM0 cache */
+        qdev_prop_set_uint32(DEVICE(&s->cpu[i]), "cycles-flash-base", 0x400C2000);
+        qdev_prop_set_uint32(DEVICE(&s->cpu[i]), "cycles-flash-size", 0x40C00000 - 0x400C2000);
 
         const uint32_t cpuid[ESP32_CPU_COUNT] = { 0xcdcd, 0xabab };
         s->cpu[i].env.sregs[PRID] = cpuid[i];
@@ -709,7 +718,11 @@ static void esp32_machine_init_spi_flash(Esp32SocState *ss, BlockBackend* blk)
     DeviceState *flash_dev = qdev_new(flash_chip_model);
     qdev_prop_set_drive(flash_dev, "drive", blk);
     qdev_prop_set_uint8(flash_dev, "cs", 0);
+    /* Share the unwritten pages of the image between the instances and keep the written ones
+     * private, the writes are still saved to a writable image */
+    qdev_prop_set_bit(flash_dev, "mmap-cow", true);
     qdev_realize_and_unref(flash_dev, spi_bus, &error_fatal);
+    ss->dport.flash_image = m25p80_get_mapped_image(flash_dev);
     qdev_connect_gpio_out_named(spi_master, SSI_GPIO_CS, 0,
                                 qdev_get_gpio_in_named(flash_dev, SSI_GPIO_CS, 0));
 }
@@ -800,8 +813,9 @@ static void esp32_machine_init(MachineState *machine)
     qdev_prop_set_chr(DEVICE(ss), "serial0", serial_hd(0));
     qdev_prop_set_chr(DEVICE(ss), "serial1", serial_hd(1));
     qdev_prop_set_chr(DEVICE(ss), "serial2", serial_hd(2));
-    if (machine->ram_size > 0) {
-        qdev_prop_set_bit(DEVICE(&ss->dport), "has_psram", true);
+    if (machine->ram) {
+        /* PSRAM is the machine RAM, so that it can be backed by any memory backend */
+        object_property_set_link(OBJECT(&ss->dport), "psram", OBJECT(machine->ram), &error_abort);
     }
 
     qdev_realize(DEVICE(ss), NULL, &error_fatal);
@@ -902,9 +916,12 @@ static ram_addr_t esp32_fixup_ram_size(ram_addr_t requested_size)
         size = 2 * MiB;
     } else if (requested_size <= 4 * MiB ) {
         size = 4 * MiB;
+    } else if (requested_size <= 8 * MiB) {
+        /* Only 4 MB can be mapped at once, the rest is reachable through the himem API */
+        size = 8 * MiB;
     } else {
-        qemu_log("RAM size larger than 4 MB not supported\n");
-        size = 4 * MiB;
+        qemu_log("RAM size larger than 8 MB not supported\n");
+        size = 8 * MiB;
     }
     return size;
 }
@@ -918,7 +935,9 @@ static void esp32_machine_class_init(ObjectClass *oc, void *data)
     mc->max_cpus = 2;
     mc->default_cpus = 2;
     mc->default_ram_size = 0;
+    mc->default_ram_id = "esp32.psram";
     mc->fixup_ram_size = esp32_fixup_ram_size;
+    esp_machine_class_add_compat_props(mc);
 }
 
 static const TypeInfo esp32_info = {
@@ -13,9 +13,9 @@
 #include "qemu/error-report.h"
 #include "qemu/units.h"
 #include "qapi/error.h"
-#include "qemu/memalign.h"
 #include "hw/hw.h"
 #include "hw/boards.h"
+#include "hw/misc/esp_machine.h"
 #include "hw/loader.h"
 #include "hw/sysbus.h"
 #include "hw/xtensa/xtensa_memory.h"
@@ -40,6 +40,7 @@
 #include "sysemu/runstate.h"
 #include "sysemu/blockdev.h"
 #include "sysemu/block-backend.h"
+#include "hw/block/flash.h"
 #include "exec/exec-all.h"
 #include "net/net.h"
 #include "elf.h"
@@ -270,8 +271,13 @@ static void esp32s3_init_spi_flash(Esp32s3SocState *ms, BlockBackend* blk)
     DeviceState *flash_dev = qdev_new(flash_model);
     qdev_prop_set_drive(flash_dev, "drive", blk);
 
+    /* Share the unwritten pages of the image between the instances and keep the written ones
+     * private, the writes are still saved to a writable image */
+    qdev_prop_set_bit(flash_dev, "mmap-cow", true);
+
     /* Realize the SPI flash, its "drive" (blk) property must already be set! */
     qdev_realize(flash_dev, spi_bus, &error_fatal);
+    ms->cache.flash_image = m25p80_get_mapped_image(flash_dev);
     qdev_connect_gpio_out_named(spi_master, SSI_GPIO_CS, 0,
                                 qdev_get_gpio_in_named(flash_dev, SSI_GPIO_CS, 0));
 }
@@ -324,21 +330,23 @@ static void esp32s3_soc_realize(DeviceState *dev, Error **errp)
     MemoryRegion *rtcslow = g_new(MemoryRegion, 1);
     MemoryRegion *rtcfast = g_new(MemoryRegion, 1);
 
+    /* Both cores run the same ROM code: a single ROM, visible to each of them through an alias, is loaded
+     * once and the code translated for one core is reused by the other one */
+    MemoryRegion *irom = g_new(MemoryRegion, 1);
+    MemoryRegion *drom = g_new(MemoryRegion, 1);
+    memory_region_init_rom(irom, NULL, "esp32s3.irom", memmap[ESP32S3_MEMREGION_IROM].size, &error_fatal);
+
+    const hwaddr offset_in_orig = 0x40000;
+    memory_region_init_alias(drom, NULL, "esp32s3.drom", irom, offset_in_orig, memmap[ESP32S3_MEMREGION_DROM].size);
+    memory_region_add_subregion(sys_mem, memmap[ESP32S3_MEMREGION_DROM].base, drom);
+
     for (int i = 0; i < ms->smp.cpus; ++i) {
-        MemoryRegion *drom = g_new(MemoryRegion, 1);
-        MemoryRegion *irom = g_new(MemoryRegion, 1);
+        MemoryRegion *irom_cpu = g_new(MemoryRegion, 1);
 
         char name[20];
         snprintf(name, sizeof(name), "esp32s3.irom.cpu%d", i);
-        memory_region_init_rom(irom, NULL, name, memmap[ESP32S3_MEMREGION_IROM].size, &error_fatal);
-        memory_region_add_subregion(&s->cpu_specific_mem[i], memmap[ESP32S3_MEMREGION_IROM].base, irom);
-
-        const hwaddr offset_in_orig = 0x40000;
-        snprintf(name, sizeof(name), "esp32s3.drom.cpu%d", i);
-        memory_region_init_alias(drom, NULL, name, irom, offset_in_orig, memmap[ESP32S3_MEMREGION_DROM].size);
-        memory_region_add_subregion(sys_mem, memmap[ESP32S3_MEMREGION_DROM].base, drom);
-
-
+        memory_region_init_alias(irom_cpu, NULL, name, irom, 0, memmap[ESP32S3_MEMREGION_IROM].size);
+        memory_region_add_subregion(&s->cpu_specific_mem[i], memmap[ESP32S3_MEMREGION_IROM].base, irom_cpu);
     }
 
 
@@ -463,8 +471,9 @@ static void esp32s3_soc_init(Object *obj)
         snprintf(name, sizeof(name), "cpu%d", i);
 
         object_initialize_child(obj, name, &s->cpu[i], TYPE_ESP32S3_CPU);
-        // Allocate memory for TIE registers
-        s->cpu[i].env.ext = qemu_memalign(16, sizeof(CPUXtensaEsp32s3State));
+        /* Code running from the ICache window pays the flash misses of the cycle model */
+        qdev_prop_set_uint32(DEVICE(&s->cpu[i]), "cycles-flash-base", esp32s3_memmap[ESP32S3_MEMREGION_ICACHE].base);
+        qdev_prop_set_uint32(DEVICE(&s->cpu[i]), "cycles-flash-size", esp32s3_memmap[ESP32S3_MEMREGION_ICACHE].size);
 
         if (i == 0)
         {
@@ -634,7 +643,8 @@ static void esp32s3_machine_init(MachineState *machine)
 
     /* SPI1 controller (SPI Flash) */
     {
-        ss->spi1.xts_aes = &ss->xts_aes;
+        ss->spi1.xts_aes = &ss->xts_aes.parent;
+        ss->spi1.cache = &ss->cache;
         sysbus_realize(SYS_BUS_DEVICE(&ss->spi1), &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ss->spi1), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_SPI1_BASE, mr, 0);
@@ -648,7 +658,7 @@ static void esp32s3_machine_init(MachineState *machine)
         if (blk) {
             ss->cache.flash_blk = blk;
         }
-        ss->cache.xts_aes = &ss->xts_aes;
+        ss->cache.xts_aes = &ss->xts_aes.parent;
         sysbus_realize(SYS_BUS_DEVICE(&ss->cache), &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ss->cache), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_EXTMEM_BASE, mr, 0);
@@ -768,7 +778,7 @@ static void esp32s3_machine_init(MachineState *machine)
 
     /* HMAC realization */
     {
-        ss->hmac.efuse = &ss->efuse;
+        ss->hmac.parent.efuse = &ss->efuse;
         qdev_realize(DEVICE(&ss->hmac), &ss->periph_bus, &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ss->hmac), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_HMAC_BASE, mr, 0);
@@ -777,17 +787,17 @@ static void esp32s3_machine_init(MachineState *machine)
 
     /* Digital Signature realization */
     {
-        ss->ds.hmac = &ss->hmac;
-        ss->ds.aes = &ss->aes;
-        ss->ds.rsa = &ss->rsa;
-        ss->ds.sha = &ss->sha;
+        ss->ds.parent.hmac = &ss->hmac.parent;
+        ss->ds.parent.aes = &ss->aes.parent;
+        ss->ds.parent.rsa = &ss->rsa.parent;
+        ss->ds.parent.sha = &ss->sha.parent;
         qdev_realize(DEVICE(&ss->ds), &ss->periph_bus, &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ss->ds), 0);
         memory_region_add_subregion_overlap(sys_mem, DR_REG_DIGITAL_SIGNATURE_BASE, mr, 0);
     }
     /* XTS-AES realization */
     {
-        ss->xts_aes.efuse = &ss->efuse;
+        ss->xts_aes.parent.efuse = &ss->efuse;
         ss->xts_aes.clock = &ss->clock;
         qdev_realize(DEVICE(&ss->xts_aes), &ss->periph_bus, &error_fatal);
         MemoryRegion *mr = sysbus_mmio_get_region(SYS_BUS_DEVICE(&ss->xts_aes), 0);
@@ -863,23 +873,8 @@ static void esp32s3_machine_init(MachineState *machine)
             error_report("Error: could not load ROM binary '%s'", rom_binary);
             exit(1);
         }
+        /* The ROM is shared by both cores, no need to load it for the APP CPU */
         g_free(rom_binary);
-
-        if (ESP32S3_CPU_COUNT > 1)
-        {
-            rom_binary = qemu_find_file(QEMU_FILE_TYPE_BIOS, "esp32s3_rev0_rom.bin");
-            if (rom_binary == NULL) {
-                error_report("Error: -bios argument not set, and ROM code binary not found (2)");
-                exit(1);
-            }
-
-            size = load_image_targphys_as(rom_binary, esp32s3_memmap[ESP32S3_MEMREGION_IROM].base, esp32s3_memmap[ESP32S3_MEMREGION_IROM].size, CPU(&ss->cpu[1])->as);
-            if (size < 0) {
-                error_report("Error: could not load ROM binary '%s'", rom_binary);
-                exit(1);
-            }
-            g_free(rom_binary);
-        }
     }
 }
 
@@ -910,6 +905,7 @@ static void esp32s3_machine_class_init(ObjectClass *oc, void *data)
     mc->default_cpus = 2;
     mc->default_ram_size = 0;
     mc->fixup_ram_size = esp32s3_fixup_ram_size;
+    esp_machine_class_add_compat_props(mc);
 }
 
 static const TypeInfo esp32s3_info = {
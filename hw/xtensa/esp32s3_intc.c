@@ -16,6 +16,7 @@
 #include "hw/sysbus.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
 #include "hw/misc/esp32s3_reg.h"
 #include "hw/xtensa/esp32s3_intc.h"
 
@@ -26,42 +27,71 @@
 
 #define IRQ_MAP(cpu, input) s->irq_map[cpu][input]
 
+#define SOURCE_WORD(source) ((source) / 64)
+#define SOURCE_BIT(source)  BIT_ULL((source) % 64)
+
+
+static bool esp32s3_intmatrix_line_level(Esp32s3IntMatrixState *s, int cpu, int line)
+{
+    for (int w = 0; w < ESP32S3_INT_MATRIX_WORDS; w++) {
+        if (s->line_sources[cpu][line][w] & s->irq_levels[w]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Forward the new level of a source to the CPU interrupt it is routed to. Since several
+ *        sources can share the same CPU interrupt, it is only lowered once all of them are low.
+ */
+static void esp32s3_intmatrix_set_line(Esp32s3IntMatrixState *s, int cpu, int line, int level)
+{
+    const int extint = s->line_extint[cpu][line];
+
+    if (s->outputs[cpu] == NULL || extint < 0) {
+        return;
+    }
+    if (level || !esp32s3_intmatrix_line_level(s, cpu, line)) {
+        qemu_set_irq(s->outputs[cpu][extint], level);
+    }
+}
+
 static void esp32s3_intmatrix_irq_handler(void *opaque, int n, int level)
 {
     Esp32s3IntMatrixState *s = ESP32S3_INTMATRIX(opaque);
+
+    level = level ? 1 : 0;
+    if (level) {
+        s->irq_levels[SOURCE_WORD(n)] |= SOURCE_BIT(n);
+    } else {
+        s->irq_levels[SOURCE_WORD(n)] &= ~SOURCE_BIT(n);
+    }
+
     for (int i = 0; i < ESP32S3_CPU_COUNT; ++i) {
-        if (s->outputs[i] == NULL) {
-            continue;
-        }
-        int out_index = IRQ_MAP(i, n);
-        for (int int_index = 0; int_index < s->cpu[i]->env.config->nextint; ++int_index) {
-            if (s->cpu[i]->env.config->extint[int_index] == out_index) {
-                qemu_set_irq(s->outputs[i][int_index], level);
-                break;
-            }
-        }
+        esp32s3_intmatrix_set_line(s, i, IRQ_MAP(i, n), level);
     }
 }
 
-static inline uint8_t* get_map_entry(Esp32s3IntMatrixState* s, hwaddr addr)
+static bool get_map_index(hwaddr addr, int *cpu_index, int *source_index)
 {
-    int source_index = addr / sizeof(uint32_t);
-    if (source_index > ESP32S3_INT_MATRIX_INPUTS * ESP32S3_CPU_COUNT) {
+    int index = addr / sizeof(uint32_t);
+    if (index >= ESP32S3_INT_MATRIX_INPUTS * ESP32S3_CPU_COUNT) {
 #if INTC_DEBUG
-        info_report("%s: source_index %d out of range", __func__, source_index);
+        info_report("%s: source_index %d out of range", __func__, index);
 #endif // INTC_DEBUG
-        return NULL;
+        return false;
     }
-    int cpu_index = source_index / ESP32S3_INT_MATRIX_INPUTS;
-    source_index = source_index % ESP32S3_INT_MATRIX_INPUTS;
-    return &IRQ_MAP(cpu_index, source_index);
+    *cpu_index = index / ESP32S3_INT_MATRIX_INPUTS;
+    *source_index = index % ESP32S3_INT_MATRIX_INPUTS;
+    return true;
 }
 
 static uint64_t esp32s3_intmatrix_read(void* opaque, hwaddr addr, unsigned int size)
 {
     Esp32s3IntMatrixState *s = ESP32S3_INTMATRIX(opaque);
-    uint8_t* map_entry = get_map_entry(s, addr);
-    return (map_entry != NULL) ? *map_entry : 0;
+    int cpu, source;
+    return get_map_index(addr, &cpu, &source) ? IRQ_MAP(cpu, source) : 0;
 }
 
 static void esp32s3_intmatrix_write(void* opaque, hwaddr addr, uint64_t value, unsigned int size)
@@ -70,9 +100,26 @@ static void esp32s3_intmatrix_write(void* opaque, hwaddr addr, uint64_t value, u
     info_report("\x1b[31m[INTC] esp32s3_intmatrix_write  addr = %ld, value=%ld\x1b[0m", addr, value);
 #endif // INTC_DEBUG
     Esp32s3IntMatrixState *s = ESP32S3_INTMATRIX(opaque);
-    uint8_t* map_entry = get_map_entry(s, addr);
-    if (map_entry != NULL) {
-        *map_entry = value & 0x1f;
+    int cpu, source;
+
+    if (!get_map_index(addr, &cpu, &source)) {
+        return;
+    }
+
+    const int old_line = IRQ_MAP(cpu, source);
+    const int new_line = value & 0x1f;
+    if (old_line == new_line) {
+        return;
+    }
+
+    IRQ_MAP(cpu, source) = new_line;
+    s->line_sources[cpu][old_line][SOURCE_WORD(source)] &= ~SOURCE_BIT(source);
+    s->line_sources[cpu][new_line][SOURCE_WORD(source)] |= SOURCE_BIT(source);
+
+    /* The level of an active source follows it to its new CPU interrupt */
+    if (s->irq_levels[SOURCE_WORD(source)] & SOURCE_BIT(source)) {
+        esp32s3_intmatrix_set_line(s, cpu, new_line, 1);
+        esp32s3_intmatrix_set_line(s, cpu, old_line, 0);
     }
 }
 
@@ -86,7 +133,11 @@ static void esp32s3_intmatrix_reset(DeviceState *dev)
 {
     Esp32s3IntMatrixState *s = ESP32S3_INTMATRIX(dev);
     memset(s->irq_map, INTMATRIX_UNINT_VALUE, sizeof(s->irq_map));
+    memset(s->line_sources, 0, sizeof(s->line_sources));
     for (int i = 0; i < ESP32S3_CPU_COUNT; ++i) {
+        for (int source = 0; source < ESP32S3_INT_MATRIX_INPUTS; ++source) {
+            s->line_sources[i][INTMATRIX_UNINT_VALUE][SOURCE_WORD(source)] |= SOURCE_BIT(source);
+        }
         if (s->outputs[i] == NULL) {
             continue;
         }
@@ -100,9 +151,17 @@ static void esp32s3_intmatrix_realize(DeviceState *dev, Error **errp)
 {
     Esp32s3IntMatrixState *s = ESP32S3_INTMATRIX(dev);
 
+    memset(s->line_extint, -1, sizeof(s->line_extint));
     for (int i = 0; i < ESP32S3_CPU_COUNT; ++i) {
         if (s->cpu[i]) {
+            const XtensaConfig *config = s->cpu[i]->env.config;
             s->outputs[i] = xtensa_get_extints(&s->cpu[i]->env);
+            for (int int_index = 0; int_index < config->nextint; ++int_index) {
+                const unsigned line = config->extint[int_index];
+                if (line < ESP32S3_INT_MATRIX_OUTPUTS && s->line_extint[i][line] < 0) {
+                    s->line_extint[i][line] = int_index;
+                }
+            }
         }
     }
     esp32s3_intmatrix_reset(dev);
@@ -120,6 +179,34 @@ static void esp32s3_intmatrix_init(Object *obj)
     qdev_init_gpio_in(DEVICE(s), esp32s3_intmatrix_irq_handler, ESP32S3_INT_MATRIX_INPUTS);
 }
 
+static int esp32s3_intmatrix_post_load(void *opaque, int version_id)
+{
+    Esp32s3IntMatrixState *s = ESP32S3_INTMATRIX(opaque);
+
+    /* The routing bitmaps are derived from the map, rebuild them */
+    memset(s->line_sources, 0, sizeof(s->line_sources));
+    for (int i = 0; i < ESP32S3_CPU_COUNT; ++i) {
+        for (int source = 0; source < ESP32S3_INT_MATRIX_INPUTS; ++source) {
+            const int line = IRQ_MAP(i, source) & 0x1f;
+            IRQ_MAP(i, source) = line;
+            s->line_sources[i][line][SOURCE_WORD(source)] |= SOURCE_BIT(source);
+        }
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_esp32s3_intmatrix = {
+    .name = "esp32s3_intmatrix",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = esp32s3_intmatrix_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT8_2DARRAY(irq_map, Esp32s3IntMatrixState, ESP32S3_CPU_COUNT, ESP32S3_INT_MATRIX_INPUTS),
+        VMSTATE_UINT64_ARRAY(irq_levels, Esp32s3IntMatrixState, ESP32S3_INT_MATRIX_WORDS),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property esp32s3_intmatrix_properties[] = {
     DEFINE_PROP_LINK("cpu0", Esp32s3IntMatrixState, cpu[0], TYPE_XTENSA_CPU, XtensaCPU *),
     DEFINE_PROP_LINK("cpu1", Esp32s3IntMatrixState, cpu[1], TYPE_XTENSA_CPU, XtensaCPU *),
@@ -132,6 +219,7 @@ static void esp32s3_intmatrix_class_init(ObjectClass *klass, void *data)
 
     dc->reset = esp32s3_intmatrix_reset;
     dc->realize = esp32s3_intmatrix_realize;
+    dc->vmsd = &vmstate_esp32s3_intmatrix;
     device_class_set_props(dc, esp32s3_intmatrix_properties);
 }
 
@@ -0,0 +1,150 @@
+/*
+ * Instruction based cycle counter model of the ESP CPUs
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#pragma once
+
+#include "qemu/timer.h"
+
+/* Geometry of the flash cache model: direct-mapped, 16KB made of 32-byte lines */
+#define ESP_CYCLE_MODEL_LINE_SIZE   32
+#define ESP_CYCLE_MODEL_LINES       512
+
+/* Maximum number of cycle counter reads within a single translation block */
+#define ESP_CYCLE_MODEL_MAX_READS   8
+
+
+/**
+ * @brief Classes of instructions the cost table is made of
+ */
+typedef enum EspCycleClass {
+    ESP_CYCLE_ALU,
+    ESP_CYCLE_LOAD,
+    ESP_CYCLE_STORE,
+    ESP_CYCLE_BRANCH,
+    ESP_CYCLE_MUL,
+    ESP_CYCLE_DIV,
+    ESP_CYCLE_CLASS_COUNT,
+} EspCycleClass;
+
+
+/**
+ * @brief When enabled, the cycle counter of the CPU (MCYCLE, CCOUNT) is derived from the instructions
+ * executed instead of the virtual time, so that firmware measuring itself gets the same result on any host.
+ *
+ * Each instruction costs the cycles of its class, a translation block is charged as a whole when
+ * it is entered. The cycles of the instructions that were not executed because of an exception are
+ * given back when the CPU state is restored, and a counter read discards the cycles of the
+ * instructions following it thanks to `ahead`.
+ * Instructions fetched from the flash-mapped window also go through a model of the cache, each
+ * line missing from it adds `flash_miss` cycles.
+ * A halted CPU (WAITI, WFI) executes no instruction, the counter then follows the virtual time at the
+ * nominal clock, the target converts `halted_ns` to cycles.
+ */
+typedef struct EspCycleModel {
+    /* Configuration, set through the CPU properties */
+    bool enabled;
+    uint32_t cost[ESP_CYCLE_CLASS_COUNT];
+    uint32_t flash_miss;
+    uint32_t flash_base;
+    uint32_t flash_size;
+
+    /* Cycles charged so far */
+    uint64_t cycles;
+    /* Cycles charged for the instructions that follow the counter read being executed, 0 out of it */
+    uint32_t ahead;
+    /* Virtual time spent halted so far, and instant of the current halt, -1 when running */
+    int64_t halted_ns;
+    int64_t halted_since;
+    /* Address of the line cached in each entry, with bit 0 set when valid */
+    uint32_t tags[ESP_CYCLE_MODEL_LINES];
+} EspCycleModel;
+
+
+static inline uint64_t esp_cycle_model_get(const EspCycleModel *m)
+{
+    return m->cycles - m->ahead;
+}
+
+
+static inline bool esp_cycle_model_in_flash(const EspCycleModel *m, uint32_t addr)
+{
+    return addr - m->flash_base < m->flash_size;
+}
+
+
+/**
+ * @brief Fetch the flash line starting at `line` through the cache model, charge the miss penalty if needed
+ */
+static inline void esp_cycle_model_fetch(EspCycleModel *m, uint32_t line)
+{
+    uint32_t *tag = &m->tags[(line / ESP_CYCLE_MODEL_LINE_SIZE) % ESP_CYCLE_MODEL_LINES];
+
+    if (*tag != (line | 1)) {
+        *tag = line | 1;
+        m->cycles += m->flash_miss;
+    }
+}
+
+
+/**
+ * @brief To be called when the CPU halts, with the current virtual time
+ */
+static inline void esp_cycle_model_halt(EspCycleModel *m, int64_t now)
+{
+    if (m->enabled) {
+        m->halted_since = now;
+    }
+}
+
+
+/**
+ * @brief To be called when the CPU resumes the execution, cheap enough for the cpu_exec_enter hook
+ */
+static inline void esp_cycle_model_resume(EspCycleModel *m)
+{
+    if (m->halted_since >= 0) {
+        m->halted_ns += qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - m->halted_since;
+        m->halted_since = -1;
+    }
+}
+
+
+/**
+ * @brief Virtual time spent halted until `now`, including the current halt
+ */
+static inline int64_t esp_cycle_model_halted_ns(const EspCycleModel *m, int64_t now)
+{
+    return m->halted_ns + (m->halted_since >= 0 ? now - m->halted_since : 0);
+}
+
+
+static inline void esp_cycle_model_reset(EspCycleModel *m)
+{
+    m->cycles = 0;
+    m->ahead = 0;
+    m->halted_ns = 0;
+    m->halted_since = -1;
+    memset(m->tags, 0, sizeof(m->tags));
+}
+
+
+/**
+ * @brief Properties of the model, the costs can be tuned with -global. The flash window is set by the machine.
+ */
+#define DEFINE_PROP_ESP_CYCLE_MODEL(_state, _field) \
+    DEFINE_PROP_BOOL("cycle-model", _state, _field.enabled, false), \
+    DEFINE_PROP_UINT32("cycles-alu", _state, _field.cost[ESP_CYCLE_ALU], 1), \
+    DEFINE_PROP_UINT32("cycles-load", _state, _field.cost[ESP_CYCLE_LOAD], 2), \
+    DEFINE_PROP_UINT32("cycles-store", _state, _field.cost[ESP_CYCLE_STORE], 1), \
+    DEFINE_PROP_UINT32("cycles-branch", _state, _field.cost[ESP_CYCLE_BRANCH], 3), \
+    DEFINE_PROP_UINT32("cycles-mul", _state, _field.cost[ESP_CYCLE_MUL], 2), \
+    DEFINE_PROP_UINT32("cycles-div", _state, _field.cost[ESP_CYCLE_DIV], 17), \
+    DEFINE_PROP_UINT32("cycles-flash-miss", _state, _field.flash_miss, 30), \
+    DEFINE_PROP_UINT32("cycles-flash-base", _state, _field.flash_base, 0), \
+    DEFINE_PROP_UINT32("cycles-flash-size", _state, _field.flash_size, 0)
@@ -0,0 +1,189 @@
+/*
+ * Translation side of the ESP cycle counter model
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#pragma once
+
+#include "exec/esp_cycle_model.h"
+#include "tcg/tcg-op.h"
+
+
+/**
+ * @brief Translation time state of the model, part of the target's DisasContext.
+ *
+ * The cost of a translation block is only known once all its instructions have been translated,
+ * so, like icount does, dummy constants are emitted and patched in esp_cycle_model_gen_tb_stop().
+ * The parameter `insn_arg` of each insn_start op holds the cost of the instructions before it until
+ * then, and the cost of the instructions from it to the end of the block afterwards.
+ */
+typedef struct EspCycleModelGen {
+    /* NULL when the model is disabled */
+    const EspCycleModel *model;
+    /* Offset of the model in the CPU env */
+    intptr_t offset;
+    /* Index of the insn_start parameter reserved for the model */
+    int insn_arg;
+    /* Cycles of the instructions translated so far */
+    uint32_t cost;
+    /* Last flash line fetched by the block */
+    uint32_t line;
+    /* Dummy cost of the whole block charged on entry */
+    TCGOp *charge;
+    /* Dummy `ahead` values stored before each counter read and cost until the end of the reading instruction */
+    TCGOp *reads[ESP_CYCLE_MODEL_MAX_READS];
+    uint32_t reads_cost[ESP_CYCLE_MODEL_MAX_READS];
+    unsigned n_reads;
+    unsigned n_reads_done;
+} EspCycleModelGen;
+
+
+static inline void esp_cycle_model_gen_init(EspCycleModelGen *g, const EspCycleModel *m,
+                                            intptr_t offset, int insn_arg)
+{
+    memset(g, 0, sizeof(EspCycleModelGen));
+    g->model = (m != NULL && m->enabled) ? m : NULL;
+    g->offset = offset;
+    g->insn_arg = insn_arg;
+    g->line = UINT32_MAX;
+}
+
+
+/**
+ * @brief Charge the whole block, to be called from the tb_start hook, after the exit request check
+ */
+static inline void esp_cycle_model_gen_tb_start(EspCycleModelGen *g)
+{
+    if (g->model == NULL) {
+        return;
+    }
+
+    TCGv_i32 cost = tcg_temp_new_i32();
+    TCGv_i64 cost64 = tcg_temp_new_i64();
+    TCGv_i64 cycles = tcg_temp_new_i64();
+
+    /* mov_i32 works on any host, unlike a 64-bit immediate which may be split in two */
+    tcg_gen_movi_i32(cost, 0);
+    g->charge = tcg_last_op();
+    tcg_gen_extu_i32_i64(cost64, cost);
+    tcg_gen_ld_i64(cycles, tcg_env, g->offset + offsetof(EspCycleModel, cycles));
+    tcg_gen_add_i64(cycles, cycles, cost64);
+    tcg_gen_st_i64(cycles, tcg_env, g->offset + offsetof(EspCycleModel, cycles));
+}
+
+
+/**
+ * @brief Value of the model's insn_start parameter for the instruction being started
+ */
+static inline uint32_t esp_cycle_model_gen_insn_start_param(const EspCycleModelGen *g)
+{
+    return g->cost;
+}
+
+
+/**
+ * @brief Check whether the fetch of `addr` needs to go through the cache model, returns the line to fetch.
+ * The target emits its fetch helper call when this returns true.
+ */
+static inline bool esp_cycle_model_gen_fetch(EspCycleModelGen *g, uint32_t addr, uint32_t *line)
+{
+    if (g->model == NULL || !esp_cycle_model_in_flash(g->model, addr)) {
+        return false;
+    }
+
+    *line = addr & ~(ESP_CYCLE_MODEL_LINE_SIZE - 1);
+    if (*line == g->line) {
+        return false;
+    }
+    g->line = *line;
+    return true;
+}
+
+
+/**
+ * @brief Most expensive of two classes, for instructions made of several operations
+ */
+static inline EspCycleClass esp_cycle_model_gen_max(const EspCycleModelGen *g, EspCycleClass a, EspCycleClass b)
+{
+    if (g->model == NULL) {
+        return a;
+    }
+    return g->model->cost[b] > g->model->cost[a] ? b : a;
+}
+
+
+/**
+ * @brief To be called before the code of an instruction reading the cycle counter
+ */
+static inline void esp_cycle_model_gen_read(EspCycleModelGen *g)
+{
+    if (g->model == NULL) {
+        return;
+    }
+
+    assert(g->n_reads < ESP_CYCLE_MODEL_MAX_READS);
+    tcg_gen_st_i32(tcg_constant_i32(0), tcg_env, g->offset + offsetof(EspCycleModel, ahead));
+    g->reads[g->n_reads++] = tcg_last_op();
+}
+
+
+/**
+ * @brief Returns true if no more counter read can be translated in this block, the target should end it
+ */
+static inline bool esp_cycle_model_gen_full(const EspCycleModelGen *g)
+{
+    return g->n_reads == ESP_CYCLE_MODEL_MAX_READS;
+}
+
+
+/**
+ * @brief Account for the instruction that has just been translated
+ */
+static inline void esp_cycle_model_gen_insn(EspCycleModelGen *g, EspCycleClass cls)
+{
+    if (g->model == NULL) {
+        return;
+    }
+
+    g->cost += g->model->cost[cls];
+    if (g->n_reads_done == g->n_reads) {
+        return;
+    }
+
+    /* The reads of this instruction see the instruction itself as executed */
+    for (; g->n_reads_done < g->n_reads; g->n_reads_done++) {
+        g->reads_cost[g->n_reads_done] = g->cost;
+    }
+    /* The helpers called out of the counter reads must not see a stale value */
+    tcg_gen_st_i32(tcg_constant_i32(0), tcg_env, g->offset + offsetof(EspCycleModel, ahead));
+}
+
+
+/**
+ * @brief Patch the dummy constants now that the cost of the block is known
+ */
+static inline void esp_cycle_model_gen_tb_stop(EspCycleModelGen *g)
+{
+    TCGOp *op;
+
+    if (g->model == NULL) {
+        return;
+    }
+
+    tcg_set_insn_param(g->charge, 1, tcgv_i32_arg(tcg_constant_i32(g->cost)));
+
+    for (unsigned i = 0; i < g->n_reads_done; i++) {
+        tcg_set_insn_param(g->reads[i], 0, tcgv_i32_arg(tcg_constant_i32(g->cost - g->reads_cost[i])));
+    }
+
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        if (op->opc == INDEX_op_insn_start) {
+            const uint64_t before = tcg_get_insn_start_param(op, g->insn_arg);
+            tcg_set_insn_start_param(op, g->insn_arg, g->cost - before);
+        }
+    }
+}
@@ -81,5 +81,11 @@ extern const VMStateDescription vmstate_ecc_state;
 #define TYPE_M25P80 "m25p80-generic"
 
 BlockBackend *m25p80_get_blk(DeviceState *dev);
+/*
+ * Content of the flash when the "mmap-cow" property is set and the image
+ * could be mapped, NULL otherwise. The guest writes land in this mapping first,
+ * the block backend is only updated asynchronously, if at all.
+ */
+uint8_t *m25p80_get_mapped_image(DeviceState *dev);
 
 #endif
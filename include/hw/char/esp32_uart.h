@@ -91,7 +91,13 @@ typedef struct ESPUARTState {
 
     Fifo8 rx_fifo;
     Fifo8 tx_fifo;
+    /* Bytes already transmitted from the guest point of view, not sent to the backend yet */
+    Fifo8 tx_out;
     guint tx_watch_handle;
+    /* Sends the output bytes written in a row to the backend at once */
+    QEMUBH *tx_bh;
+    /* Don't throttle the received data according to the baud rate */
+    bool unthrottled;
 
     uint32_t reg[UART_REG_CNT];
     MemoryRegionOps uart_ops;
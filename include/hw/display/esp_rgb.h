@@ -2,6 +2,7 @@
 
 #include "hw/hw.h"
 #include "hw/registerfields.h"
+#include "qemu/timer.h"
 
 
 #define TYPE_ESP_RGB "display.esp.rgb"
@@ -47,9 +48,22 @@ typedef struct ESPRgbState {
 
     /* BPP */
     BppEnum bpp;
+
+    /* When set, the VRAM itself is the framebuffer shown on the console */
+    bool direct;
+    /* Redraw the whole window on next update, regardless of the VRAM dirty bitmap */
+    bool full_update;
+
+    /* Headless frame hashing, disabled when the interval is 0 */
+    uint32_t hash_interval_ms;
+    QEMUTimer hash_timer;
+    /* Set when the content of the console surface changed since the last hash */
+    bool frame_dirty;
+    uint32_t frame_hash;
+    uint32_t frame_count;
 } ESPRgbState;
 
-#define ESP_RGB_IO_SIZE (A_RGB_BPP_VALUE + 4)
+#define ESP_RGB_IO_SIZE (A_RGB_FB_CONFIG + 4)
 
 REG32(RGB_VERSION, 0x00)
     FIELD(RGB_VERSION, MAJOR, 16, 16)
@@ -77,4 +91,10 @@ REG32(RGB_UPDATE_STATUS, 0x14)
      * Automatically cleared by the hardware after window update. */
     FIELD(RGB_UPDATE_STATUS, ENA, 0, 1)
 
-REG32(RGB_BPP_VALUE, 0x18)
\ No newline at end of file
+REG32(RGB_BPP_VALUE, 0x18)
+
+/* When DIRECT is set, the VRAM is used as the framebuffer: pixel (x, y) is located at offset
+ * (y * width + x) * bpp / 8 and any write to it is reflected on the window, the update area
+ * registers above are then ignored. */
+REG32(RGB_FB_CONFIG, 0x1c)
+    FIELD(RGB_FB_CONFIG, DIRECT, 0, 1)
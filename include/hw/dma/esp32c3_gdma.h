@@ -13,6 +13,7 @@
 #include "hw/hw.h"
 #include "hw/sysbus.h"
 #include "hw/registerfields.h"
+#include "hw/dma/esp_gdma.h"
 
 #define TYPE_ESP32C3_GDMA "esp32c3.gdma"
 #define ESP32C3_GDMA(obj) OBJECT_CHECK(ESP32C3GdmaState, (obj), TYPE_ESP32C3_GDMA)
@@ -93,6 +94,9 @@ typedef struct ESP32C3GdmaState {
     MemoryRegion* soc_mr;
     AddressSpace dma_as;
 
+    /* Descriptors processing, shared with the ESP32-S3 */
+    EspGdma engine;
+
 } ESP32C3GdmaState;
 
 
@@ -13,6 +13,7 @@
 #include "hw/hw.h"
 #include "hw/sysbus.h"
 #include "hw/registerfields.h"
+#include "hw/dma/esp_gdma.h"
 
 #define TYPE_ESP32S3_GDMA "esp32s3.gdma"
 #define ESP32S3_GDMA(obj) OBJECT_CHECK(ESP32S3GdmaState, (obj), TYPE_ESP32S3_GDMA)
@@ -96,6 +97,9 @@ typedef struct ESP32S3GdmaState {
     MemoryRegion* soc_mr;
     AddressSpace dma_as;
 
+    /* Descriptors processing, shared with the ESP32-C3 */
+    EspGdma engine;
+
 } ESP32S3GdmaState;
 
 
@@ -0,0 +1,197 @@
+/*
+ * GDMA engine shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include "exec/memory.h"
+#include "qemu/timer.h"
+
+/* Biggest number of channels among the supported targets (ESP32-S3) */
+#define ESP_GDMA_MAX_CHANNEL_COUNT  5
+
+#define ESP_GDMA_IN_IDX     0
+#define ESP_GDMA_OUT_IDX    1
+
+/* Number of bytes moved by a memory-to-memory channel before the engine gives the hand back to the vCPU */
+#define ESP_GDMA_BURST_SIZE 4096
+
+/* Default throughput of a memory-to-memory transfer, in bytes per second */
+#define ESP_GDMA_DEFAULT_BANDWIDTH  (80 * 1000 * 1000)
+
+/* Number of descriptor translations kept for each channel, for both its in and out chains */
+#define ESP_GDMA_DESCR_CACHE_SIZE   16
+
+/**
+ * @brief Events reported by the engine to the GDMA model, which converts them to its own interrupt bits
+ */
+#define ESP_GDMA_EVT_IN_DONE        BIT(0)
+#define ESP_GDMA_EVT_IN_SUC_EOF     BIT(1)
+#define ESP_GDMA_EVT_IN_DSCR_ERR    BIT(2)
+#define ESP_GDMA_EVT_IN_DSCR_EMPTY  BIT(3)
+#define ESP_GDMA_EVT_OUT_DONE       BIT(4)
+#define ESP_GDMA_EVT_OUT_EOF        BIT(5)
+#define ESP_GDMA_EVT_OUT_DSCR_ERR   BIT(6)
+#define ESP_GDMA_EVT_OUT_TOTAL_EOF  BIT(7)
+
+
+/**
+ * @brief Structure defining how linked lists are represented in hardware for the GDMA module
+ */
+typedef struct EspGdmaDescriptor {
+    union {
+        struct {
+            uint32_t size: 12;   // Size of the buffer (mainly used in a receive transaction)
+            uint32_t length: 12; // Number of valid bytes in the buffer. In a transmit, written by software.
+                                 // In receive, written by hardware.
+            uint32_t rsvd_24: 4; // Reserved
+            uint32_t err_eof: 1; // Set if received data has errors. Used with UHCI0 only.
+            uint32_t rsvd_29: 1; // Reserved
+            uint32_t suc_eof: 1; // Set if curent node is the last one (of the list). Set by software in a transmit transaction,
+                                 // Set by the hardware in case of a receive transaction.
+            uint32_t owner: 1;   // 0: CPU can access the buffer, 1: GDMA can access the buffer. Cleared automatically
+                                 // by hardware in a transmit descriptor. In a receive descriptor, cleared by hardware
+                                 // only if GDMA_OUT_AUTO_WRBACK_CHn is set to 1.
+        };
+        uint32_t val;
+    } config;
+    uint32_t buf_addr;
+    uint32_t next_addr;
+} EspGdmaDescriptor;
+
+
+/**
+ * @brief Translation of a descriptor address. Only the translation is kept, the descriptor itself is
+ * always accessed in guest memory, so the CPU or another DMA master modifying it needs no tracking.
+ */
+typedef struct EspGdmaDescrCacheEntry {
+    bool valid;
+    uint32_t addr;
+    MemoryRegionCache mrc;
+} EspGdmaDescrCacheEntry;
+
+
+/**
+ * @brief Callbacks the GDMA model must provide to the engine
+ */
+typedef struct EspGdmaOps {
+    /* Set the interrupt bits matching the given ESP_GDMA_EVT_* events on the channel */
+    void (*set_events)(void *opaque, uint32_t chan, uint32_t events);
+    /* The descriptor at guest address `current` became the current one for the given direction,
+     * `next` is its successor (0 if `current` could not be read) */
+    void (*push_descriptor)(void *opaque, uint32_t chan, uint32_t dir, uint32_t current, uint32_t next);
+    /* Called when a memory-to-memory transfer succeeded, `addr` is the guest address of the last IN descriptor */
+    void (*in_suc_eof)(void *opaque, uint32_t chan, uint32_t addr);
+} EspGdmaOps;
+
+
+/**
+ * @brief Configuration of a transfer, extracted by the model from its channel registers
+ */
+typedef struct EspGdmaLinkConfig {
+    uint32_t in_addr;
+    uint32_t out_addr;
+    bool owner_check_in;
+    bool owner_check_out;
+    /* Clear the owner bit of the transmit (out) descriptors once processed */
+    bool clear_out;
+} EspGdmaLinkConfig;
+
+
+typedef struct EspGdma EspGdma;
+
+/**
+ * @brief State of a memory-to-memory transfer running in the background
+ */
+typedef struct EspGdmaChannel {
+    EspGdma *gdma;
+    uint32_t index;
+    QEMUTimer timer;
+
+    /* Set while the descriptors chain is being processed */
+    bool active;
+    /* Events produced by the last burst, reported once its modelled duration elapsed */
+    uint32_t pending_events;
+
+    EspGdmaLinkConfig conf;
+    EspGdmaDescriptor out_list;
+    EspGdmaDescriptor in_list;
+    /* Number of bytes of the current out descriptor already sent */
+    uint32_t consumed;
+
+    /* Descriptors translations, dropped whenever the memory map changes */
+    EspGdmaDescrCacheEntry descr_cache[ESP_GDMA_DESCR_CACHE_SIZE];
+} EspGdmaChannel;
+
+
+struct EspGdma {
+    AddressSpace *as;
+    const EspGdmaOps *ops;
+    void *opaque;
+    uint32_t channel_count;
+    /* Memory-to-memory throughput in bytes per second, 0 to complete the bursts without any delay */
+    uint64_t bandwidth;
+    EspGdmaChannel channels[ESP_GDMA_MAX_CHANNEL_COUNT];
+
+    /* Marks the channels descriptors translations stale when the memory map changes */
+    MemoryListener listener;
+    bool descr_cache_stale;
+};
+
+
+/**
+ * @brief Initialize the engine, to be called from the model's instance_init.
+ *
+ * @param as Address space used for all descriptors and buffers accesses, may not be initialized yet
+ */
+void esp_gdma_init(EspGdma *g, uint32_t channel_count, AddressSpace *as, const EspGdmaOps *ops, void *opaque);
+
+/**
+ * @brief Finish the initialization, to be called from the model's realize once the address space is initialized
+ */
+void esp_gdma_realize(EspGdma *g);
+
+/**
+ * @brief Release what esp_gdma_realize acquired, to be called from the model's unrealize
+ */
+void esp_gdma_unrealize(EspGdma *g);
+
+/**
+ * @brief Abort all the transfers in progress and forget their pending events
+ */
+void esp_gdma_reset(EspGdma *g);
+
+/**
+ * @brief Start a memory-to-memory transfer on the given channel. The first descriptors are checked
+ * right away, the data is then moved in bursts of ESP_GDMA_BURST_SIZE bytes by a timer on
+ * QEMU_CLOCK_VIRTUAL, each burst taking the time given by the engine bandwidth.
+ *
+ * @returns true if the transfer was started, false if any of the first descriptors is invalid
+ */
+bool esp_gdma_start_mem_transfer(EspGdma *g, uint32_t chan, const EspGdmaLinkConfig *conf);
+
+/**
+ * @brief Read `size` bytes from the out link starting at `conf->out_addr` into `buffer`.
+ * Used by the peripherals, the transfer is performed synchronously.
+ */
+bool esp_gdma_read_channel(EspGdma *g, uint32_t chan, const EspGdmaLinkConfig *conf, uint8_t *buffer, uint32_t size);
+
+/**
+ * @brief Write `size` bytes from `buffer` to the in link starting at `conf->in_addr`.
+ * Used by the peripherals, the transfer is performed synchronously.
+ */
+bool esp_gdma_write_channel(EspGdma *g, uint32_t chan, const EspGdmaLinkConfig *conf, uint8_t *buffer, uint32_t size);
+
+/**
+ * @brief Migration state of the engine, the descriptors cache is dropped on load
+ */
+extern const VMStateDescription vmstate_esp_gdma;
+
+#define VMSTATE_ESP_GDMA(_field, _state) \
+    VMSTATE_STRUCT(_field, _state, 1, vmstate_esp_gdma, EspGdma)
@@ -3,6 +3,7 @@
 #include "hw/hw.h"
 #include "hw/sysbus.h"
 #include "hw/registerfields.h"
+#include "hw/misc/esp_aes_cipher.h"
 
 #define TYPE_ESP32_AES "misc.esp32.aes"
 #define ESP32_AES(obj) OBJECT_CHECK(Esp32AesState, (obj), TYPE_ESP32_AES)
@@ -23,6 +24,7 @@ typedef struct Esp32AesState {
         bool type;
         int bits;
     } mode;
+    EspAesCipher cipher;
 } Esp32AesState;
 
 REG32(AES_START_REG, 0x00)
@@ -18,6 +18,9 @@ typedef struct Esp32CacheState Esp32CacheState;
 #define ESP32_CACHE_MMU_INVALID_VAL     0x100
 #define ESP32_CACHE_MMU_ENTRY_CHANGED   0x200     /* not a hardware flag; used here to check if the page data needs to be updated */
 #define ESP32_CACHE_MAX_PHYS_PAGES      0x100
+/* External RAM is mapped with smaller pages than the flash */
+#define ESP32_CACHE_PSRAM_PAGE_SIZE     0x8000
+#define ESP32_CACHE_PSRAM_PAGES         (ESP32_CACHE_REGION_SIZE / ESP32_CACHE_PSRAM_PAGE_SIZE)
 
 typedef enum Esp32CacheRegionType {
     ESP32_DCACHE_FLASH,
@@ -35,6 +38,10 @@ typedef struct Esp32CacheRegionState {
     bool illegal_access_trap_en;
     bool illegal_access_status;
     uint16_t mmu_table[ESP32_CACHE_PAGES_PER_REGION];
+    /* Flash write generation of the physical page each entry was loaded from */
+    uint32_t page_gen[ESP32_CACHE_PAGES_PER_REGION];
+    /* Whether the flash decryption was enabled when the pages were loaded */
+    bool decrypted;
 } Esp32CacheRegionState;
 
 typedef struct Esp32CacheState {
@@ -49,6 +56,10 @@ typedef struct Esp32CacheState {
     Esp32CacheRegionState iram0;
     Esp32CacheRegionState drom0;
     Esp32CacheRegionState dram1;  /* PSRAM */
+    /* Each page of the DRAM1 window is an alias to the PSRAM page selected by its MMU entry,
+     * the page is disabled (and the accesses trapped) when the entry is invalid */
+    uint16_t dram1_mmu_table[ESP32_CACHE_PSRAM_PAGES];
+    MemoryRegion dram1_pages[ESP32_CACHE_PSRAM_PAGES];
 } Esp32CacheState;
 
 typedef struct Esp32DportState {
@@ -58,8 +69,12 @@ typedef struct Esp32DportState {
     bool has_psram;
     int cpu_count;
     Esp32CacheState cache_state[ESP32_CPU_COUNT];
-    MemoryRegion psram;         /* Shared between the CPUs: the actual memory region for PSRAM */
+    MemoryRegion *psram;        /* Shared between the CPUs: the actual memory for PSRAM, provided by the machine */
     BlockBackend *flash_blk;
+    /* Private (copy-on-write) mapping of the image used by the SPI flash model, if any */
+    uint8_t *flash_image;
+    /* Incremented each time a physical page of the flash is programmed or erased */
+    uint32_t flash_page_gen[ESP32_CACHE_MAX_PHYS_PAGES];
     qemu_irq appcpu_stall_req;
     qemu_irq appcpu_reset_req;
     qemu_irq clk_update_req;
@@ -79,6 +94,12 @@ typedef struct Esp32DportState {
 
 void esp32_dport_clear_ill_trap_state(Esp32DportState* s);
 
+/**
+ * @brief Notify the cache that an area of the flash was programmed or erased. The cached
+ * pages overlapping it are reloaded on the next cache flush, the other ones are kept.
+ */
+void esp32_dport_flash_written(Esp32DportState* s, uint32_t addr, uint32_t size);
+
 #define ESP32_DPORT_APPCPU_STALL_GPIO   "appcpu-stall"
 #define ESP32_DPORT_APPCPU_RESET_GPIO   "appcpu-reset"
 #define ESP32_DPORT_CLK_UPDATE_GPIO     "clk-update"
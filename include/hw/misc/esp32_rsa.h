@@ -3,6 +3,8 @@
 #include "hw/hw.h"
 #include "hw/sysbus.h"
 #include "hw/registerfields.h"
+#include "qemu/timer.h"
+#include "hw/misc/esp_rsa_mpi.h"
 
 #define TYPE_ESP32_RSA "misc.esp32.rsa"
 #define ESP32_RSA(obj) OBJECT_CHECK(Esp32RsaState, (obj), TYPE_ESP32_RSA)
@@ -18,16 +20,18 @@ typedef struct Esp32RsaState {
     uint32_t rsa_y_mem[ESP32_RSA_MEM_BLK_SIZE / 4];
     uint32_t rsa_x_mem[ESP32_RSA_MEM_BLK_SIZE / 4];
 
-    struct {
-        void *rinv;
-        bool valid;
-    } cache;
+    /* Operands parsed by the host big number library, kept across operations */
+    EspRsaMpi mpi;
 
     uint32_t rsa_mprime_reg;
     uint32_t rsa_modexp_mode_reg;
     uint32_t rsa_mult_mode_reg;
     uint32_t rsa_clean_reg;
     uint32_t rsa_q_int_reg;
+
+    /* When set, the completion is only reported after the time the real hardware takes to perform an operation */
+    bool model_latency;
+    QEMUTimer op_timer;
 } Esp32RsaState;
 
 REG32(RSA_MEM_M_BLOCK_BASE, 0x000)
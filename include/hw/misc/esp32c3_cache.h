@@ -3,7 +3,8 @@
 #include "hw/sysbus.h"
 #include "hw/hw.h"
 #include "hw/registerfields.h"
-#include "hw/misc/esp32c3_xts_aes.h"
+#include "hw/misc/esp_xts_aes.h"
+#include "hw/misc/esp_cache_pages.h"
 
 #define TYPE_ESP32C3_CACHE "esp32c3.cache"
 #define ESP32C3_CACHE(obj)           OBJECT_CHECK(ESP32C3CacheState, (obj), TYPE_ESP32C3_CACHE)
@@ -66,9 +67,14 @@ _Static_assert(sizeof(ESP32C3MMUEntry) == sizeof(uint32_t), "MMU Entry size must
  */
 #define ESP32C3_CACHE_REG_IDX(addr) ((addr) / sizeof(uint32_t))
 
-typedef struct {
+typedef struct ESP32C3CacheState ESP32C3CacheState;
+
+struct ESP32C3CacheState {
     SysBusDevice parent;
     BlockBackend *flash_blk;
+    /* Private (copy-on-write) mapping of the image used by the SPI flash model, if any. Since the
+     * flash writes may not reach the block backend in that case, the content must be read from it */
+    uint8_t *flash_image;
     MemoryRegion iomem;
 
     bool         icache_enable;
@@ -80,15 +86,35 @@ typedef struct {
     /* Registers for controlling the cache */
     uint32_t regs[ESP32C3_CACHE_REG_COUNT];
 
-    ESP32C3XtsAesState *xts_aes;
+    ESPXtsAesState *xts_aes;
     /* Define the MMU itself as an array, it shall be accessible from address ESP32C3_MMU_TABLE */
     ESP32C3MMUEntry mmu[ESP32C3_MMU_TABLE_ENTRY_COUNT];
-} ESP32C3CacheState;
+
+    /* When set, writing an MMU entry only records the mapping, the page is fetched on first access */
+    bool lazy_mmu;
+    EspCachePages pages;
+
+    /* When set, unencrypted flash pages are mapped as aliases of the mmap'ed flash image file */
+    bool flash_mmap;
+    bool flash_mapped;
+    MemoryRegion flash_mr;
+    MemoryRegion mapped_pages[ESP32C3_MMU_TABLE_ENTRY_COUNT];
+    /* Unmaps the pages when the flash encryption gets enabled */
+    Notifier flash_enc_notifier;
+};
 
 /* Assert that the size of the MMU table in the structure is of size ESP32C3_MMU_SIZE */
 _Static_assert(sizeof(((ESP32C3CacheState*)0)->mmu) == ESP32C3_MMU_SIZE,
                "The size of `mmu` field in structure ESP32C3CacheState must be equal to ESP32C3_MMU_SIZE");
 
+_Static_assert(ESP32C3_PAGE_SIZE == ESP_CACHE_PAGE_SIZE, "MMU pages must be as big as the shared cache pages");
+
+/**
+ * @brief Notify the cache that the given flash area was modified (programmed or erased), the content
+ *        previously fetched out of it will be fetched again.
+ */
+void esp32c3_cache_flash_written(ESP32C3CacheState *s, uint32_t address, uint32_t size);
+
 
 REG32(EXTMEM_ICACHE_CTRL, 0x000)
     FIELD(EXTMEM_ICACHE_CTRL, ENABLE, 0, 1)
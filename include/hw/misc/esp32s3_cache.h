@@ -13,7 +13,8 @@
 #include "hw/sysbus.h"
 #include "hw/hw.h"
 #include "hw/registerfields.h"
-#include "hw/misc/esp32s3_xts_aes.h"
+#include "hw/misc/esp_xts_aes.h"
+#include "hw/misc/esp_cache_pages.h"
 
 #define TYPE_ESP32S3_CACHE "esp32s3.icache"
 #define TYPE_ESP32S3_DCACHE "esp32s3.dcache"
@@ -80,9 +81,14 @@ _Static_assert(sizeof(ESP32S3MMUEntry) == sizeof(uint32_t), "MMU Entry size must
  */
 #define ESP32S3_CACHE_REG_IDX(addr) ((addr) / sizeof(uint32_t))
 
-typedef struct {
+typedef struct ESP32S3CacheState ESP32S3CacheState;
+
+struct ESP32S3CacheState {
     SysBusDevice parent;
     BlockBackend *flash_blk;
+    /* Private (copy-on-write) mapping of the image used by the SPI flash model, if any. Since the
+     * flash writes may not reach the block backend in that case, the content must be read from it */
+    uint8_t *flash_image;
     MemoryRegion iomem;
 
     bool         icache_enable;
@@ -95,15 +101,35 @@ typedef struct {
     /* Registers for controlling the cache */
     uint32_t regs[ESP32S3_CACHE_REG_COUNT];
 
-    ESP32S3XtsAesState *xts_aes;
+    ESPXtsAesState *xts_aes;
     /* Define the MMU itself as an array, it shall be accessible from address ESP32S3_MMU_TABLE */
     ESP32S3MMUEntry mmu[ESP32S3_MMU_TABLE_ENTRY_COUNT];
-} ESP32S3CacheState;
+
+    /* When set, writing an MMU entry only records the mapping, the page is fetched on first access */
+    bool lazy_mmu;
+    EspCachePages pages;
+
+    /* When set, unencrypted flash pages are mapped as aliases of the mmap'ed flash image file */
+    bool flash_mmap;
+    bool flash_mapped;
+    MemoryRegion flash_mr;
+    MemoryRegion mapped_pages[ESP32S3_MMU_TABLE_ENTRY_COUNT];
+    /* Unmaps the pages when the flash encryption gets enabled */
+    Notifier flash_enc_notifier;
+};
 
 /* Assert that the size of the MMU table in the structure is of size ESP32S3_MMU_SIZE */
 _Static_assert(sizeof(((ESP32S3CacheState*)0)->mmu) == ESP32S3_MMU_SIZE,
                "The size of `mmu` field in structure ESP32C3CacheState must be equal to ESP32S3_MMU_SIZE");
 
+_Static_assert(ESP32S3_PAGE_SIZE == ESP_CACHE_PAGE_SIZE, "MMU pages must be as big as the shared cache pages");
+
+/**
+ * @brief Notify the cache that the given flash area was modified (programmed or erased), the content
+ *        previously fetched out of it will be fetched again.
+ */
+void esp32s3_cache_flash_written(ESP32S3CacheState *s, uint32_t address, uint32_t size);
+
 
 REG32(EXTMEM_DCACHE_CTRL, 0x000)
     FIELD(EXTMEM_DCACHE_CTRL, ENABLE, 0, 1)
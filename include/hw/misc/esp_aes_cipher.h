@@ -0,0 +1,60 @@
+/*
+ * Host AES backend shared by the ESP crypto peripherals
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#pragma once
+
+#include "crypto/cipher.h"
+
+/* XTS-AES-256 takes the largest key: a 32-byte data key followed by a 32-byte tweak key */
+#define ESP_AES_CIPHER_MAX_KEY_SIZE     64
+
+/**
+ * @brief Host cipher context, the underlying QCryptoCipher (and thus its key schedule) is
+ * kept across calls and is only re-created when the mode or the key changes.
+ * A zero-initialized structure is a valid, empty, context.
+ */
+typedef struct EspAesCipher {
+    QCryptoCipher *cipher;
+    QCryptoCipherMode mode;
+    uint8_t key[ESP_AES_CIPHER_MAX_KEY_SIZE];
+    size_t key_size;
+} EspAesCipher;
+
+/**
+ * @brief Reverse the byte order of a whole buffer, as done by the ESP hardware on the data
+ * and keys before feeding them to the AES core. `dst` and `src` may be the same buffer.
+ *
+ * @param size Size of the buffer in bytes, must be a multiple of 8
+ */
+void esp_aes_reverse_bytes(void *dst, const void *src, size_t size);
+
+/**
+ * @brief Encrypt or decrypt `size` bytes in ECB mode, `size` must be a multiple of 16.
+ *
+ * @param key_size Size of the key in bytes: 16, 24 or 32
+ */
+void esp_aes_ecb_crypt(EspAesCipher *c, const uint8_t *key, size_t key_size, bool encrypt,
+                       const void *in, void *out, size_t size);
+
+/**
+ * @brief Encrypt or decrypt, in place, a buffer of 128-byte XTS data units, laid out in
+ * the reversed byte order used by the ESP flash encryption.
+ * The tweak of each unit is `((physical_address + offset) & tweak_mask) + tweak_extra`.
+ *
+ * @param key_size Size of the key in bytes, data key and tweak key included: 32 or 64
+ * @param size Size of the buffer, must be a multiple of 128
+ */
+void esp_aes_xts_crypt(EspAesCipher *c, const uint8_t *key, size_t key_size, bool encrypt,
+                       uint32_t physical_address, uint32_t tweak_mask, uint32_t tweak_extra,
+                       uint8_t *data, size_t size);
+
+/**
+ * @brief Release the host cipher of the given context, if any.
+ */
+void esp_aes_cipher_free(EspAesCipher *c);
@@ -0,0 +1,120 @@
+/*
+ * Lazily loaded cache pages shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#pragma once
+
+#include "qemu/units.h"
+#include "exec/memory.h"
+
+/**
+ * Size of an MMU page, on both the ESP32-C3 and the ESP32-S3
+ */
+#define ESP_CACHE_PAGE_SIZE         (64 * KiB)
+
+/**
+ * Number of 64KB flash pages an MMU entry can point to (`page_number` field is 8-bit wide)
+ */
+#define ESP_CACHE_FLASH_PAGE_COUNT  256
+
+typedef struct EspCachePages EspCachePages;
+
+/**
+ * Flash page fetched (and decrypted if needed) from the flash, shared by all the virtual pages
+ * that map it.
+ */
+typedef struct EspFlashPage {
+    uint8_t *data;
+    bool     valid;
+    /* Flash encryption state at the time the page was fetched */
+    bool     encrypted;
+} EspFlashPage;
+
+/**
+ * I/O region overlaid on a virtual page of the cache whose content has not been fetched yet.
+ * The first access to it loads the page and disables the overlay.
+ */
+typedef struct EspLazyPage {
+    MemoryRegion   mr;
+    EspCachePages *pages;
+    uint32_t       index;
+} EspLazyPage;
+
+/**
+ * Operations provided by the cache model
+ */
+typedef struct EspCachePagesOps {
+    /**
+     * @brief Read a whole page out of the flash, decrypted if flash encryption is enabled
+     */
+    void (*fetch_flash)(void *opaque, uint32_t physical_address, uint8_t *data);
+
+    /**
+     * @brief Check whether flash encryption is currently enabled
+     */
+    bool (*is_flash_enc_enabled)(void *opaque);
+
+    /**
+     * @brief Get the flash page number the MMU entry `index` points to
+     *
+     * @returns false if the MMU entry is invalid, true else
+     */
+    bool (*get_mmu_entry)(void *opaque, uint32_t index, uint32_t *page_number);
+} EspCachePagesOps;
+
+struct EspCachePages {
+    const EspCachePagesOps *ops;
+    void *opaque;
+    /* RAM-backed cache memory, the lazy overlays are subregions of it */
+    MemoryRegion *cache_mr;
+    uint32_t lazy_count;
+    EspLazyPage *lazy;
+    EspFlashPage flash[ESP_CACHE_FLASH_PAGE_COUNT];
+};
+
+
+/**
+ * @brief Fill a virtual page mapped by an invalid MMU entry
+ */
+void esp_cache_fill_invalid(uint8_t *data);
+
+/**
+ * @brief Initialize the pages, to be called from the model's instance_init, once `cache_mr` is
+ *        initialized. One lazy overlay is created for each of the `count` MMU entries.
+ */
+void esp_cache_pages_init(EspCachePages *p, Object *owner, MemoryRegion *cache_mr, uint32_t count,
+                          const EspCachePagesOps *ops, void *opaque);
+
+/**
+ * @brief Free the fetched flash pages and the overlays, to be called from the model's finalize
+ */
+void esp_cache_pages_finalize(EspCachePages *p);
+
+/**
+ * @brief Load the content of a virtual page, according to its MMU entry, out of the fetched flash
+ *        pages. Nothing is invalidated if the content didn't change.
+ */
+void esp_cache_pages_load(EspCachePages *p, uint32_t index);
+
+/**
+ * @brief Enable or disable the lazy overlay of the given virtual page
+ */
+void esp_cache_pages_set_lazy(EspCachePages *p, uint32_t index, bool enabled);
+
+/**
+ * @brief Enable the overlay of every valid MMU entry, the virtual pages will be loaded again on
+ *        their next access.
+ */
+void esp_cache_pages_reload_all(EspCachePages *p);
+
+/**
+ * @brief Drop the fetched flash pages overlapping the given flash area, to be called when the
+ *        flash content changes. The virtual pages already loaded are left untouched, as the guest
+ *        is expected to invalidate the cache itself.
+ */
+void esp_cache_pages_flash_written(EspCachePages *p, uint32_t address, uint32_t size);
@@ -0,0 +1,28 @@
+/*
+ * Settings shared by the ESP32, ESP32-C3 and ESP32-S3 machines
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#pragma once
+
+#include "hw/boards.h"
+#include "qemu/accel.h"
+
+/**
+ * @brief Add the default properties shared by all the ESP machines to the given machine class.
+ *
+ * The firmware of these chips is small, a translation buffer of a few tens of MB holds all of its
+ * code. Reserve less than the TCG default so that many instances can run side by side on a host,
+ * -accel tcg,tb-size=<MB> still overrides it.
+ */
+static inline void esp_machine_class_add_compat_props(MachineClass *mc)
+{
+    static GlobalProperty esp_compat_props[] = {
+        { ACCEL_CLASS_NAME("tcg"), "tb-size", "64" },
+    };
+    compat_props_add(mc->compat_props, esp_compat_props, G_N_ELEMENTS(esp_compat_props));
+}
@@ -0,0 +1,83 @@
+/*
+ * Big number backend shared by the ESP RSA accelerators
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#pragma once
+
+/* Biggest memory block among the targets (ESP32), in bytes */
+#define ESP_RSA_MPI_MAX_SIZE    512
+
+/* Frequency used to convert the modelled number of cycles of an operation into a duration */
+#define ESP_RSA_MPI_CLK_FREQ    (80 * 1000 * 1000)
+
+/* Defined by libgcrypt, which must not leak in the machines including the RSA headers */
+struct gcry_mpi;
+
+/**
+ * @brief Operand parsed from a little-endian memory block. The parsed value is kept as long as
+ * the memory block content doesn't change, which is the case of the modulus and the exponent
+ * during TLS handshakes.
+ */
+typedef struct EspRsaMpiOperand {
+    struct gcry_mpi *mpi;
+    /* Memory block content `mpi` was parsed from, valid if size is not 0 */
+    uint32_t block[ESP_RSA_MPI_MAX_SIZE / 4];
+    size_t size;
+} EspRsaMpiOperand;
+
+/**
+ * @brief Big number context of an RSA peripheral.
+ * A zero-initialized structure is a valid, empty, context.
+ */
+typedef struct EspRsaMpi {
+    EspRsaMpiOperand x;
+    EspRsaMpiOperand y;
+    EspRsaMpiOperand m;
+    /* R^-1 mod M, only needed by the Montgomery multiplication, valid until M is parsed again */
+    struct gcry_mpi *rinv;
+    bool rinv_valid;
+    /* Results, allocated once and grown by libgcrypt when needed */
+    struct gcry_mpi *result;
+    struct gcry_mpi *tmp;
+} EspRsaMpi;
+
+/**
+ * @brief All the operations below read `n_bytes` bytes from the input blocks and write the result
+ * to the `z` block, which is `z_size` bytes big. The unused part of `z` is filled with zeros.
+ * They all return false if one of the operands could not be converted.
+ */
+
+/* Z = X ^ Y mod M */
+bool esp_rsa_mpi_exp_mod(EspRsaMpi *c, const uint32_t *x, const uint32_t *y, const uint32_t *m,
+                         size_t n_bytes, uint32_t *z, size_t z_size);
+
+/* Z = X * Y mod M */
+bool esp_rsa_mpi_mod_mul(EspRsaMpi *c, const uint32_t *x, const uint32_t *y, const uint32_t *m,
+                         size_t n_bytes, uint32_t *z, size_t z_size);
+
+/* Z = X * Y * R^-1 mod M, with R = 2 ^ (n_bytes * 8) */
+bool esp_rsa_mpi_mont_mul(EspRsaMpi *c, const uint32_t *x, const uint32_t *y, const uint32_t *m,
+                          size_t n_bytes, uint32_t *z, size_t z_size);
+
+/* Z = X * Y */
+bool esp_rsa_mpi_mul(EspRsaMpi *c, const uint32_t *x, const uint32_t *y,
+                     size_t n_bytes, uint32_t *z, size_t z_size);
+
+/**
+ * @brief Approximate number of cycles the hardware needs to perform each operation, the
+ * accelerators perform a Montgomery multiplication for each bit of the exponent, plus one
+ * for each bit set (or for each bit in constant-time mode).
+ */
+uint64_t esp_rsa_mpi_exp_mod_cycles(const uint32_t *y, size_t n_bytes, bool const_time);
+uint64_t esp_rsa_mpi_mod_mul_cycles(size_t n_bytes);
+uint64_t esp_rsa_mpi_mul_cycles(size_t n_bytes);
+
+/**
+ * @brief Release all the big numbers held by the context
+ */
+void esp_rsa_mpi_free(EspRsaMpi *c);
@@ -0,0 +1,151 @@
+/*
+ * XTS-AES flash encryption shared by the ESP32-C3 and ESP32-S3 emulation
+ *
+ * Copyright (c) 2023 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+
+#pragma once
+
+#include "hw/hw.h"
+#include "hw/sysbus.h"
+#include "hw/registerfields.h"
+#include "hw/nvram/esp32c3_efuse.h"
+#include "hw/misc/esp_aes_cipher.h"
+
+#define TYPE_ESP_XTS_AES "misc.esp.xts_aes"
+#define ESP_XTS_AES(obj) OBJECT_CHECK(ESPXtsAesState, (obj), TYPE_ESP_XTS_AES)
+#define ESP_XTS_AES_GET_CLASS(obj) OBJECT_GET_CLASS(ESPXtsAesClass, obj, TYPE_ESP_XTS_AES)
+#define ESP_XTS_AES_CLASS(klass) OBJECT_CLASS_CHECK(ESPXtsAesClass, klass, TYPE_ESP_XTS_AES)
+
+/* Biggest number of PLAIN registers among the targets (ESP32-S3) */
+#define ESP_XTS_AES_MAX_PLAIN_REG_CNT 16
+#define ESP_XTS_AES_REGS_SIZE (0x60)
+
+/* Size of the biggest key the flash encryption can use (XTS-AES-256), in bytes */
+#define ESP_XTS_AES_MAX_KEY_SIZE 64
+
+/* Number of decrypted flash areas (usually 64KB pages) kept in the cache */
+#define ESP_XTS_AES_CACHE_ENTRIES 64
+
+/**
+ * @brief Status of the Manual Encryption block.
+ */
+typedef enum {
+    XTS_AES_IDLE = 0,
+    XTS_AES_BUSY = 1,
+    XTS_AES_DONE = 2,
+    XTS_AES_RELEASE = 3,
+} ESPXtsAesStatus;
+
+/**
+ * @brief Flash area decrypted with the current key
+ */
+typedef struct ESPXtsAesCacheEntry {
+    uint8_t *data;
+    uint32_t physical_address;
+    uint32_t size;
+    /* The destination is part of the tweak */
+    uint32_t destination;
+    uint64_t last_use;
+    bool valid;
+} ESPXtsAesCacheEntry;
+
+typedef struct ESPXtsAesState {
+    SysBusDevice parent_obj;
+    MemoryRegion iomem;
+
+    uint32_t plaintext[ESP_XTS_AES_MAX_PLAIN_REG_CNT];
+    uint32_t ciphertext[ESP_XTS_AES_MAX_PLAIN_REG_CNT];
+    uint32_t linesize;
+    uint32_t destination;
+    uint64_t physical_addr;
+    uint32_t state;
+
+    /* Public: must be set before realizing instance */
+    ESP32C3EfuseState *efuse;
+
+    /* Public: notified when the flash encryption may have been enabled or disabled */
+    NotifierList flash_enc_notifiers;
+    Notifier efuse_reload;
+
+    /* Host cipher, keeps the key schedule of the current efuse key */
+    EspAesCipher cipher;
+
+    /* LRU cache of the decrypted flash areas, invalidated on key change and on flash write */
+    ESPXtsAesCacheEntry cache[ESP_XTS_AES_CACHE_ENTRIES];
+    uint8_t cache_key[ESP_XTS_AES_MAX_KEY_SIZE];
+    uint32_t cache_key_size;
+    uint64_t cache_clock;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+} ESPXtsAesState;
+
+typedef struct ESPXtsAesClass {
+    SysBusDeviceClass parent_class;
+    /* Set by the targets: number of PLAIN registers, width of the LINESIZE field, size of the biggest
+     * key supported (32 or 64 bytes) and bits of the physical address that are part of the tweak */
+    uint32_t plain_reg_cnt;
+    uint32_t linesize_bits;
+    uint32_t max_key_size;
+    uint32_t tweak_mask;
+    /* The ESP32-S3 also encrypts data for the PSRAM, the destination is then part of the tweak */
+    bool has_destination;
+
+    /* Must be implemented by the targets, which each have their own clock controller.
+     * Get the value of the SYSTEM_EXTERNAL_DEVICE_ENCRYPT_DECRYPT_CONTROL register */
+    uint32_t (*get_ext_dev_enc_dec_ctrl)(ESPXtsAesState *s);
+
+    /* Virtual methods */
+    bool (*is_ciphertext_spi_visible)(ESPXtsAesState *s);
+    bool (*is_flash_enc_enabled)(ESPXtsAesState *s);
+    bool (*is_manual_enc_enabled)(ESPXtsAesState *s);
+    void (*read_ciphertext)(ESPXtsAesState *s, uint32_t* spi_data_regs, uint32_t* spi_data_size, uint32_t* spi_addr, uint32_t* spi_addr_size);
+    void (*decrypt)(ESPXtsAesState *s, uint32_t physical_address, uint8_t * data, uint32_t size);
+    void (*invalidate)(ESPXtsAesState *s, uint32_t physical_address, uint32_t size);
+} ESPXtsAesClass;
+
+REG32(XTS_AES_PLAIN_0_REG, 0x0000)
+REG32(XTS_AES_PLAIN_1_REG, 0x0004)
+REG32(XTS_AES_PLAIN_2_REG, 0x0008)
+REG32(XTS_AES_PLAIN_3_REG, 0x000C)
+REG32(XTS_AES_PLAIN_4_REG, 0x0010)
+REG32(XTS_AES_PLAIN_5_REG, 0x0014)
+REG32(XTS_AES_PLAIN_6_REG, 0x0018)
+REG32(XTS_AES_PLAIN_7_REG, 0x001C)
+REG32(XTS_AES_PLAIN_8_REG, 0x0020)
+REG32(XTS_AES_PLAIN_9_REG, 0x0024)
+REG32(XTS_AES_PLAIN_10_REG, 0x0028)
+REG32(XTS_AES_PLAIN_11_REG, 0x002C)
+REG32(XTS_AES_PLAIN_12_REG, 0x0030)
+REG32(XTS_AES_PLAIN_13_REG, 0x0034)
+REG32(XTS_AES_PLAIN_14_REG, 0x0038)
+REG32(XTS_AES_PLAIN_15_REG, 0x003C)
+
+REG32(XTS_AES_LINESIZE_REG, 0x0040)
+    FIELD(XTS_AES_LINESIZE_REG, XTS_AES_LINESIZE, 0, 2)
+
+REG32(XTS_AES_DESTINATION_REG, 0x0044)
+    FIELD(XTS_AES_DESTINATION_REG, XTS_AES_DESTINATION, 0, 1)
+
+REG32(XTS_AES_PHYSICAL_ADDRESS_REG, 0x0048)
+    FIELD(XTS_AES_PHYSICAL_ADDRESS_REG, XTS_AES_PHYSICAL_ADDRESS, 0, 30)
+
+REG32(XTS_AES_TRIGGER_REG, 0x004C)
+    FIELD(XTS_AES_TRIGGER_REG, XTS_AES_TRIGGER, 0, 1)
+
+REG32(XTS_AES_RELEASE_REG, 0x0050)
+    FIELD(XTS_AES_RELEASE_REG, XTS_AES_RELEASE, 0, 1)
+
+REG32(XTS_AES_DESTROY_REG, 0x0054)
+    FIELD(XTS_AES_DESTROY_REG, XTS_AES_DESTROY, 0, 1)
+
+REG32(XTS_AES_STATE_REG, 0x0058)
+    FIELD(XTS_AES_STATE_REG, XTS_AES_STATE, 0, 2)
+
+REG32(XTS_AES_DATE_REG, 0x005C)
+    FIELD(XTS_AES_DATE_REG, XTS_AES_DATE, 0, 30)
@@ -13,6 +13,7 @@
 #include "hw/registerfields.h"
 #include "hw/sysbus.h"
 #include "sysemu/block-backend.h"
+#include "qemu/notify.h"
 #include "qemu/error-report.h"
 
 #define TYPE_ESP32C3_EFUSE "nvram.esp32c3.efuse"
@@ -537,6 +538,9 @@ typedef struct ESP32C3EfuseState {
     /* Same efuses as the ones above, but protected blocks are not cleared.
      * This will be used by C3 emulated encryption modules */
     ESP32C3EfuseRegs efuses_internal;
+
+    /* Notified each time the efuses are reloaded, their value may have changed */
+    NotifierList reload_notifiers;
 } ESP32C3EfuseState;
 
 typedef struct ESP32C3EfuseClass {
@@ -60,6 +60,12 @@
 #define ESP32C3_INTMATRIX_IO_THRESH_REG (0x194 / sizeof(uint32_t))
 
 
+/**
+ * Number of priority levels of the CPU lines, the priority registers are 4-bit wide
+ */
+#define ESP32C3_INTMATRIX_PRIO_COUNT    16
+
+
 /* Bit value for the type of interrupt trigger  */
 #define ESP322C3_INTMATRIX_TRIG_LEVEL   0
 #define ESP322C3_INTMATRIX_TRIG_EDGE    1
@@ -69,10 +75,14 @@ typedef struct ESP32C3IntMatrixState {
 
     MemoryRegion iomem;
     uint8_t irq_map[ESP32C3_INT_MATRIX_INPUTS];
+    /* Inverse of irq_map: bitmap of the sources routed to each CPU line, updated on matrix writes */
+    uint64_t line_sources[ESP32C3_CPU_INT_COUNT + 1];
     /* In the following fields, "interrupts" refer to the CPU lines (31)
      * and not the peripheral source. */
     /* ESP32-C3 CPU has 31 interrupts numbered from 1 to 31 */
     uint8_t irq_prio[ESP32C3_CPU_INT_COUNT + 1];
+    /* Bitmap of the lines having each priority, updated when a priority register is written */
+    uint64_t prio_lines[ESP32C3_INTMATRIX_PRIO_COUNT];
     /* Current priority threshold of the CPU interrupts */
     uint8_t irq_thres;
     /* Keep a bitmap of the pending interrupts */
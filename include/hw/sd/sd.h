@@ -119,6 +119,29 @@ struct SDCardClass {
      * Return: byte value read
      */
     uint8_t (*read_byte)(SDState *sd);
+    /**
+     * Write whole data blocks to a SD card, optional.
+     * @sd: card
+     * @buf: data to write
+     * @length: number of bytes available in @buf
+     *
+     * Fast path of a multiple block write, the blocks are written to the
+     * backing storage at once instead of going through write_byte().
+     *
+     * Return: number of bytes consumed, possibly 0
+     */
+    size_t (*write_data)(SDState *sd, const void *buf, size_t length);
+    /**
+     * Read whole data blocks from a SD card, optional.
+     * @sd: card
+     * @buf: buffer to fill
+     * @length: size of @buf
+     *
+     * Counterpart of write_data() for multiple block reads.
+     *
+     * Return: number of bytes read, possibly 0
+     */
+    size_t (*read_data)(SDState *sd, void *buf, size_t length);
     bool (*receive_ready)(SDState *sd);
     bool (*data_ready)(SDState *sd);
     void (*set_voltage)(SDState *sd, uint16_t millivolts);
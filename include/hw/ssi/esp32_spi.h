@@ -31,6 +31,10 @@ typedef struct Esp32SpiState {
     uint32_t miso_dlen_reg;
     uint32_t pin_reg;
     uint32_t data_reg[ESP32_SPI_BUF_WORDS];
+
+    /* Optional, set by the machine for the flash controllers: notified of the flash areas
+     * programmed or erased, so that the cache only reloads these */
+    struct Esp32DportState *dport;
 } Esp32SpiState;
 
 
@@ -54,6 +54,14 @@ struct SSIPeripheralClass {
      * always be called for the device for every txrx access to the parent bus
      */
     uint32_t (*transfer_raw)(SSIPeripheral *dev, uint32_t val);
+
+    /* Optional, transfer `len` 8-bit words at once, with the same CS handling
+     * as transfer. `tx` is NULL when the master only sends zeros and `rx` is
+     * NULL when the master discards the received bytes. Devices that don't
+     * implement it get their transfer function called for each byte.
+     */
+    void (*transfer_bulk)(SSIPeripheral *dev, const uint8_t *tx, uint8_t *rx,
+                          size_t len);
 };
 
 struct SSIPeripheral {
@@ -112,6 +120,22 @@ SSIBus *ssi_create_bus(DeviceState *parent, const char *name);
 
 uint32_t ssi_transfer(SSIBus *bus, uint32_t val);
 
+/* Maximum number of bytes given to a peripheral's transfer_bulk at once */
+#define SSI_BULK_CHUNK_SIZE 256
+
+/**
+ * ssi_transfer_bulk: transfer a block of 8-bit words
+ * @bus: SSI bus to transfer on
+ * @tx: bytes to send, or NULL to send zeros
+ * @rx: buffer receiving the bytes, or NULL to discard them
+ * @len: number of bytes to transfer
+ *
+ * Equivalent to calling ssi_transfer() for each byte, but peripherals
+ * implementing transfer_bulk process the whole block in one call.
+ * @tx and @rx may point to the same buffer.
+ */
+void ssi_transfer_bulk(SSIBus *bus, const uint8_t *tx, uint8_t *rx, size_t len);
+
 DeviceState *ssi_get_cs(SSIBus *bus, uint8_t cs_index);
 
 #endif
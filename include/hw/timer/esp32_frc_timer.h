@@ -4,6 +4,7 @@
 #include "hw/registerfields.h"
 #include "hw/sysbus.h"
 #include "hw/misc/esp32_reg.h"
+#include "hw/timer/esp_timer_core.h"
 
 #define TYPE_ESP32_FRC_TIMER "timer.esp32.frc"
 #define ESP32_FRC_TIMER(obj) OBJECT_CHECK(Esp32FrcTimerState, (obj), TYPE_ESP32_FRC_TIMER)
@@ -14,7 +15,8 @@ typedef struct Esp32FrcTimerState {
 
     MemoryRegion iomem;
     qemu_irq irq;
-    QEMUTimer alarm_timer;
+    EspTimerSched sched;
+    uint32_t alarm;
 
     /* properties */
     uint32_t apb_freq;
@@ -22,8 +24,7 @@ typedef struct Esp32FrcTimerState {
     uint32_t count_mask;
 
     /* state */
-    uint32_t count_base;
-    uint64_t ns_base;
+    EspTimerCounter counter;
     bool level_int_status;
 
     /* registers */
@@ -2,6 +2,7 @@
 
 #include "hw/hw.h"
 #include "hw/registerfields.h"
+#include "hw/timer/esp_timer_core.h"
 
 #define TYPE_ESP32_TIMG "timer.esp32.timg"
 #define ESP32_TIMG(obj) OBJECT_CHECK(Esp32TimgState, (obj), TYPE_ESP32_TIMG)
@@ -36,11 +37,13 @@ typedef struct Esp32TimgTimerState {
     bool alarm;
     uint64_t alarm_val;
     uint64_t load_val;
+    /* The timer value is count_base + (or -) the number of ticks of `counter` */
     uint64_t count_base;
     uint64_t last_val;
-    uint64_t ns_base;
+    EspTimerCounter counter;
     Esp32TimgInterruptType int_type;
-    QEMUTimer alarm_timer;
+    /* Index of the timer alarm in the timer group scheduler */
+    uint32_t sched_alarm;
 } Esp32TimgTimerState;
 
 typedef enum Esp32TimgWdtStageMode {
@@ -61,11 +64,11 @@ typedef struct Esp32TimgWdtState {
     int prescale;
     Esp32TimgWdtStageMode mode[ESP32_TIMG_WDT_STAGE_COUNT];
     int timeout[ESP32_TIMG_WDT_STAGE_COUNT];
-    uint32_t count_base;
-    uint64_t ns_base;
+    /* Number of ticks since the beginning of the current stage */
+    EspTimerCounter counter;
     int cur_stage;
     uint32_t protect_reg;
-    QEMUTimer stage_timer;
+    uint32_t sched_alarm;
 } Esp32TimgWdtState;
 
 typedef struct Esp32TimgState {
@@ -81,6 +84,8 @@ typedef struct Esp32TimgState {
     Esp32TimgTimerState t1;
     Esp32TimgTimerState lact;
     Esp32TimgWdtState wdt;
+    /* Single QEMU timer shared by the alarms of the timers and the watchdog stages */
+    EspTimerSched sched;
 
     uint32_t int_ena;
     uint32_t int_raw;
@@ -11,6 +11,7 @@
 
 #include "hw/hw.h"
 #include "hw/registerfields.h"
+#include "hw/timer/esp_timer_core.h"
 
 
 #define TYPE_ESP32C3_SYSTIMER "esp32c3.systimer"
@@ -70,11 +71,10 @@ typedef struct {
     bool enabled;
     /* Enabled on CPU stall */
     bool enabled_on_stall;
-    uint64_t value;   // Internal counter that should be updated as often as possible
     uint64_t toload;  // Counter that can be loaded by the guest program
     uint64_t flushed; // Mirror of the internal counter that can be seen by the guest program
-    /* Absolute time, in ns, when value was updated last */
-    int64_t base;
+    /* Internal counter, derived from the virtual time, only running when the counter is enabled */
+    EspTimerCounter core;
 } ESP32C3SysTimerCounter;
 
 
@@ -94,9 +94,10 @@ typedef struct {
     bool int_enabled;
     /* Index of the counter that is linked to the comparator */
     uint32_t counter;
-    /* The easiest way to implement timeout is by using one timer per comparator */
-    QEMUTimer qtimer;
-    uint64_t expire_time;
+    /* Absolute count the alarm is armed for, incremented by `period` in period mode */
+    uint64_t target;
+    /* Index of the comparator's alarm in the System Timer scheduler */
+    uint32_t alarm;
     qemu_irq irq;
     int cur_irq_level;
     /* Pointer to the owner */
@@ -112,6 +113,8 @@ struct ESP32C3SysTimerState {
     uint32_t conf;
     ESP32C3SysTimerCounter counter[ESP32C3_SYSTIMER_COUNTER_COUNT];
     ESP32C3SysTimerComp comparators[ESP32C3_SYSTIMER_COMP_COUNT];
+    /* Single QEMU timer shared by all the comparators */
+    EspTimerSched sched;
 };
 
 
@@ -2,6 +2,7 @@
 
 #include "hw/hw.h"
 #include "hw/registerfields.h"
+#include "hw/timer/esp_timer_core.h"
 
 
 #define TYPE_ESP32C3_TIMG "timer.esp32c3.timg"
@@ -69,13 +70,13 @@ typedef enum {
 
 
 typedef struct ESP32C3VirtualCounter {
-    QEMUTimer timer;
-    /* Timer current value in ticks */
+    /* Ticks of the timer clock, derived from the virtual time */
+    EspTimerCounter ticks;
+    /* Timer current value in ticks, as returned by the last update */
     uint64_t value;
-    /* Time when the value was last updated */
-    uint64_t base;
-    /* Frequency, in Hz, of the timer */
-    uint64_t frequency;
+    /* Alarm of the counter in the timer group scheduler */
+    EspTimerSched *sched;
+    uint32_t alarm;
 } ESP32C3VirtualCounter;
 
 
@@ -142,6 +143,8 @@ typedef struct ESP32C3TimgState {
     ESP32C3T0State t0;
     ESP32C3WdtState wdt;
     ESP32C3RtcState rtc;
+    /* Single QEMU timer shared by the T0 alarm and the watchdog stages */
+    EspTimerSched sched;
 
     /* Property used to disable the watchdog from command line */
     bool wdt_disable;
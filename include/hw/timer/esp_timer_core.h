@@ -0,0 +1,155 @@
+/*
+ * Counter and alarm scheduling core shared by the ESP timer peripherals
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+#pragma once
+
+#include "qemu/timer.h"
+
+/* Biggest number of alarms a single peripheral needs (ESP32 timer group: T0, T1, LACT and WDT) */
+#define ESP_TIMER_SCHED_MAX_ALARMS  4
+
+/* Deadline of a disarmed alarm */
+#define ESP_TIMER_NEVER             INT64_MAX
+
+
+/**
+ * @brief Free running counter incrementing `num` times every `den` nanoseconds of QEMU_CLOCK_VIRTUAL.
+ *
+ * The counter is never updated in the background, its value is derived from the virtual time
+ * when needed. The origin of the counter is the exact instant of a tick, kept as a whole number
+ * of nanoseconds plus a remainder in 1/num ns, so the ticks never drift from the virtual clock
+ * while the rate stays the same. On a rate change, the remainder is converted to the new unit,
+ * which rounds the origin up by less than 1/num ns of the new rate.
+ */
+typedef struct EspTimerCounter {
+    /* Instant of the tick `base_ticks` was reached at: base_ns + base_rem / num */
+    int64_t base_ns;
+    uint64_t base_rem;
+    uint64_t base_ticks;
+    uint64_t num;
+    uint64_t den;
+    bool running;
+} EspTimerCounter;
+
+
+/**
+ * @brief Initialize a stopped counter at 0, incrementing `num` times every `den` ns once started
+ */
+void esp_timer_counter_init(EspTimerCounter *c, uint64_t num, uint64_t den);
+
+/**
+ * @brief Get the value of the counter at the given virtual time
+ */
+uint64_t esp_timer_counter_get(const EspTimerCounter *c, int64_t now);
+
+/**
+ * @brief Replace the value of the counter, the next tick will happen one full period after `now`
+ */
+void esp_timer_counter_load(EspTimerCounter *c, int64_t now, uint64_t value);
+
+/**
+ * @brief Start or stop the counter, stopping it keeps the value it had at `now`
+ */
+void esp_timer_counter_run(EspTimerCounter *c, int64_t now, bool run);
+
+/**
+ * @brief Change the rate of the counter, the ticks elapsed so far are kept
+ */
+void esp_timer_counter_set_rate(EspTimerCounter *c, int64_t now, uint64_t num, uint64_t den);
+
+/**
+ * @brief Get the virtual time at which the counter will have incremented `delta` times
+ * after `now`, i.e. the exact instant of that tick rounded up to the next nanosecond.
+ *
+ * @returns ESP_TIMER_NEVER if the counter is stopped or if the deadline is out of range
+ */
+int64_t esp_timer_counter_expiry(const EspTimerCounter *c, int64_t now, uint64_t delta);
+
+
+/**
+ * @brief Single alarm of a peripheral, `cb` is called once the virtual time reached `deadline`
+ */
+typedef struct EspTimerAlarm {
+    int64_t deadline;
+    void (*cb)(void *opaque);
+    void *opaque;
+} EspTimerAlarm;
+
+
+/**
+ * @brief Set of alarms sharing a single QEMU timer, always armed for the nearest deadline.
+ * The QEMU timer is only reprogrammed when that deadline changes.
+ */
+typedef struct EspTimerSched {
+    QEMUTimer timer;
+    EspTimerAlarm alarms[ESP_TIMER_SCHED_MAX_ALARMS];
+    uint32_t count;
+    /* Deadline the QEMU timer is currently armed for */
+    int64_t armed;
+    /* Set while the expired alarms callbacks are being called */
+    bool dispatching;
+    /* Deadline of the alarm whose callback is being called */
+    int64_t expired;
+} EspTimerSched;
+
+
+/**
+ * @brief Initialize the scheduler, to be called from the peripheral's instance_init
+ */
+void esp_timer_sched_init(EspTimerSched *s);
+
+/**
+ * @brief Register a new alarm, disarmed, and return its index
+ */
+uint32_t esp_timer_sched_add(EspTimerSched *s, void (*cb)(void *opaque), void *opaque);
+
+/**
+ * @brief Arm the alarm for the given virtual time, ESP_TIMER_NEVER disarms it.
+ * A deadline in the past makes the alarm fire as soon as possible.
+ */
+void esp_timer_sched_arm(EspTimerSched *s, uint32_t alarm, int64_t deadline);
+
+static inline void esp_timer_sched_disarm(EspTimerSched *s, uint32_t alarm)
+{
+    esp_timer_sched_arm(s, alarm, ESP_TIMER_NEVER);
+}
+
+/**
+ * @brief Get the deadline the alarm being dispatched was armed for, which may be earlier than the
+ * current virtual time. Only valid from an alarm callback.
+ */
+static inline int64_t esp_timer_sched_expired(const EspTimerSched *s)
+{
+    assert(s->dispatching);
+    return s->expired;
+}
+
+static inline bool esp_timer_sched_armed(const EspTimerSched *s, uint32_t alarm)
+{
+    return s->alarms[alarm].deadline != ESP_TIMER_NEVER;
+}
+
+/**
+ * @brief Disarm all the alarms
+ */
+void esp_timer_sched_reset(EspTimerSched *s);
+
+
+/**
+ * @brief Migration state of the counter and of the scheduler, the scheduler re-arms its QEMU timer
+ * for the nearest restored deadline on load. The alarms must have been registered beforehand.
+ */
+extern const VMStateDescription vmstate_esp_timer_counter;
+extern const VMStateDescription vmstate_esp_timer_sched;
+
+#define VMSTATE_ESP_TIMER_COUNTER(_field, _state) \
+    VMSTATE_STRUCT(_field, _state, 1, vmstate_esp_timer_counter, EspTimerCounter)
+
+#define VMSTATE_ESP_TIMER_SCHED(_field, _state) \
+    VMSTATE_STRUCT(_field, _state, 1, vmstate_esp_timer_sched, EspTimerSched)
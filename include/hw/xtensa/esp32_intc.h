@@ -23,6 +23,10 @@
 
 #define ESP32_CPU_COUNT 2
 #define ESP32_INT_MATRIX_INPUTS 69
+/* Number of interrupts of each CPU, i.e. outputs of the matrix */
+#define ESP32_INT_MATRIX_OUTPUTS 32
+/* Number of 64-bit words needed to represent a bitmap of all the interrupt sources */
+#define ESP32_INT_MATRIX_WORDS  DIV_ROUND_UP(ESP32_INT_MATRIX_INPUTS, 64)
 
 #define TYPE_ESP32_INTMATRIX "misc.esp32.intmatrix"
 #define ESP32_INTMATRIX(obj) OBJECT_CHECK(Esp32IntMatrixState, (obj), TYPE_ESP32_INTMATRIX)
@@ -35,6 +39,13 @@ typedef struct Esp32IntMatrixState {
     qemu_irq *outputs[ESP32_CPU_COUNT];
     uint8_t irq_map[ESP32_CPU_COUNT][ESP32_INT_MATRIX_INPUTS];
 
+    /* Current level of each interrupt source */
+    uint64_t irq_levels[ESP32_INT_MATRIX_WORDS];
+    /* Inverse of irq_map: bitmap of the sources routed to each CPU interrupt */
+    uint64_t line_sources[ESP32_CPU_COUNT][ESP32_INT_MATRIX_OUTPUTS][ESP32_INT_MATRIX_WORDS];
+    /* Index of each CPU interrupt in the CPU external interrupts, -1 if it is not an external one */
+    int8_t line_extint[ESP32_CPU_COUNT][ESP32_INT_MATRIX_OUTPUTS];
+
     /* properties */
     XtensaCPU *cpu[ESP32_CPU_COUNT];
 } Esp32IntMatrixState;
@@ -128,6 +128,10 @@ typedef enum {
 } periph_interrput_t;
 
 #define ESP32S3_INT_MATRIX_INPUTS (0x800/4)
+/* Number of interrupts of each CPU, i.e. outputs of the matrix */
+#define ESP32S3_INT_MATRIX_OUTPUTS 32
+/* Number of 64-bit words needed to represent a bitmap of all the interrupt sources */
+#define ESP32S3_INT_MATRIX_WORDS  DIV_ROUND_UP(ESP32S3_INT_MATRIX_INPUTS, 64)
 
 #define TYPE_ESP32S3_INTMATRIX "misc.esp32s3.intmatrix"
 #define ESP32S3_INTMATRIX(obj) OBJECT_CHECK(Esp32s3IntMatrixState, (obj), TYPE_ESP32S3_INTMATRIX)
@@ -143,6 +147,13 @@ typedef struct Esp32s3IntMatrixState {
     qemu_irq *outputs[ESP32S3_CPU_COUNT];
     uint8_t irq_map[ESP32S3_CPU_COUNT][ESP32S3_INT_MATRIX_INPUTS];
 
+    /* Current level of each interrupt source */
+    uint64_t irq_levels[ESP32S3_INT_MATRIX_WORDS];
+    /* Inverse of irq_map: bitmap of the sources routed to each CPU interrupt */
+    uint64_t line_sources[ESP32S3_CPU_COUNT][ESP32S3_INT_MATRIX_OUTPUTS][ESP32S3_INT_MATRIX_WORDS];
+    /* Index of each CPU interrupt in the CPU external interrupts, -1 if it is not an external one */
+    int8_t line_extint[ESP32S3_CPU_COUNT][ESP32S3_INT_MATRIX_OUTPUTS];
+
     /* properties */
     XtensaCPU *cpu[ESP32S3_CPU_COUNT];
 } Esp32s3IntMatrixState;
@@ -57,6 +57,9 @@
 #ifndef bit_AVX512DQ
 #define bit_AVX512DQ    (1 << 17)
 #endif
+#ifndef bit_SHA
+#define bit_SHA         (1 << 29)
+#endif
 #ifndef bit_AVX512BW
 #define bit_AVX512BW    (1 << 30)
 #endif
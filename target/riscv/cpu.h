@@ -32,6 +32,12 @@
 #include "cpu_cfg.h"
 #include "qapi/qapi-types-common.h"
 #include "cpu-qom.h"
+#ifndef CONFIG_USER_ONLY
+#include CONFIG_DEVICES /* CONFIG_RISCV_ESP32C3 */
+#endif
+#ifdef CONFIG_RISCV_ESP32C3
+#include "exec/esp_cycle_model.h"
+#endif
 
 typedef struct CPUArchState CPURISCVState;
 
@@ -48,8 +54,14 @@ typedef struct CPUArchState CPURISCVState;
 /*
  * RISC-V-specific extra insn start words:
  * 1: Original instruction opcode
+ * 2: Cycles of the TB from this instruction on, see esp_cycle_model_gen.h,
+ *    only in the binaries that have the ESP32-C3 machine
  */
+#ifdef CONFIG_RISCV_ESP32C3
+#define TARGET_INSN_START_EXTRA_WORDS 2
+#else
 #define TARGET_INSN_START_EXTRA_WORDS 1
+#endif
 
 #define RV(x) ((target_ulong)1 << (x - 'A'))
 
@@ -422,6 +434,11 @@ struct CPUArchState {
     QEMUTimer *vstimer; /* Internal timer for VS-mode interrupt */
     bool vstime_irq;
 
+#ifdef CONFIG_RISCV_ESP32C3
+    /* Instruction based MCYCLE, only enabled on Espressif cores */
+    EspCycleModel cycle_model;
+#endif
+
     hwaddr kernel_addr;
     hwaddr fdt_addr;
 
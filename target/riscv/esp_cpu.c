@@ -18,6 +18,7 @@
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
 #include "sysemu/reset.h"
+#include "migration/vmstate.h"
 #include "esp_cpu.h"
 
 
@@ -50,8 +51,20 @@ static RISCVException esp_cpu_csr_predicate(CPURISCVState *env, int csrno) {
 }
 
 
-static uint64_t esp_cpu_get_cycles(ESPCPUCycleCounter* cc)
+static uint64_t esp_cpu_get_cycles(EspRISCVCPU *s, ESPCPUCycleCounter* cc)
 {
+    const EspCycleModel *model = &s->parent_obj.env.cycle_model;
+
+    if (model->enabled) {
+        /* The cycles come from the instructions executed, and from the time spent in WFI at the nominal clock.
+         * former_time holds the model's value at the previous read */
+        const int64_t halted = esp_cycle_model_halted_ns(model, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+        const uint64_t now = esp_cycle_model_get(model) + halted / cc->divider;
+        cc->cycles += now - cc->former_time;
+        cc->former_time = now;
+        return cc->cycles;
+    }
+
     /* Let's simulate the cycle count between two reads of MCYCLE thanks to the time API. */
     /* Calculate the time elapsed between now and the previous call */
     uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
@@ -86,9 +99,9 @@ static RISCVException esp_cpu_csr_read(CPURISCVState *env, int csrno, target_ulo
     EspRISCVCPU *s = esp_cpu_riscv_to_cpu(env);
 
     if (csrno == ESP_CPU_CSR_MCYCLE_U) {
-        *ret_value = esp_cpu_get_cycles(&s->cc_user);
+        *ret_value = esp_cpu_get_cycles(s, &s->cc_user);
     } else if (csrno == ESP_CPU_CSR_MCYCLE_M) {
-        *ret_value = esp_cpu_get_cycles(&s->cc_machine);
+        *ret_value = esp_cpu_get_cycles(s, &s->cc_machine);
     } else if (csrno >= ESP_CPU_CSR_TSELECT && csrno <= ESP_CPU_CSR_TCONTROL) {
         /* Nothing special to do here */
     } else {
@@ -222,6 +235,10 @@ static void esp_cpu_reset(void *opaque)
     EspRISCVCPU *cpu = opaque;
     cpu->irq_pending = 0;
     qemu_irq_lower(cpu->parent_irq);
+    /* The cycle counters restart from 0, whichever way they are computed */
+    esp_cycle_model_reset(&cpu->parent_obj.env.cycle_model);
+    cpu->cc_user.former_time = cpu->cc_user.cycles = 0;
+    cpu->cc_machine.former_time = cpu->cc_machine.cycles = 0;
     cpu_reset(CPU(cpu));
 }
 
@@ -314,8 +331,61 @@ static void esp_cpu_init(Object *obj)
     };
 }
 
+static const VMStateDescription vmstate_esp_cpu_cycle_counter = {
+    .name = "esp-riscv-cpu/cycle_counter",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64(former_time, ESPCPUCycleCounter),
+        VMSTATE_UINT64(cycles, ESPCPUCycleCounter),
+        VMSTATE_UINT64(divider, ESPCPUCycleCounter),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool esp_cpu_cycle_model_needed(void *opaque)
+{
+    EspRISCVCPU *s = ESP_CPU(opaque);
+    return s->parent_obj.env.cycle_model.enabled;
+}
+
+static const VMStateDescription vmstate_esp_cpu_cycle_model = {
+    .name = "esp-riscv-cpu/cycle_model",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = esp_cpu_cycle_model_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64(parent_obj.env.cycle_model.cycles, EspRISCVCPU),
+        VMSTATE_INT64(parent_obj.env.cycle_model.halted_ns, EspRISCVCPU),
+        VMSTATE_INT64(parent_obj.env.cycle_model.halted_since, EspRISCVCPU),
+        VMSTATE_UINT32_ARRAY(parent_obj.env.cycle_model.tags, EspRISCVCPU, ESP_CYCLE_MODEL_LINES),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+/* Setting dc->vmsd replaces vmstate_cpu_common, the RISC-V registers still go through legacy_vmsd */
+static const VMStateDescription vmstate_esp_cpu = {
+    .name = TYPE_ESP_RISCV_CPU,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_CPU(),
+        VMSTATE_STRUCT(cc_user, EspRISCVCPU, 1, vmstate_esp_cpu_cycle_counter, ESPCPUCycleCounter),
+        VMSTATE_STRUCT(cc_machine, EspRISCVCPU, 1, vmstate_esp_cpu_cycle_counter, ESPCPUCycleCounter),
+        VMSTATE_UINT32(irq_cause, EspRISCVCPU),
+        VMSTATE_BOOL(irq_pending, EspRISCVCPU),
+        VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_esp_cpu_cycle_model,
+        NULL
+    }
+};
+
 static Property riscv_harts_props[] = {
     DEFINE_PROP_UINT32("hartid-base", EspRISCVCPU, hartid_base, 0),
+    /* MCYCLE derived from the instructions executed rather than from the virtual time */
+    DEFINE_PROP_ESP_CYCLE_MODEL(EspRISCVCPU, parent_obj.env.cycle_model),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -326,6 +396,7 @@ static void esp_cpu_class_init(ObjectClass *klass, void *data)
     EspRISCVCPUClass *cpuclass = ESP_CPU_CLASS(klass);
 
     device_class_set_props(dc, riscv_harts_props);
+    dc->vmsd = &vmstate_esp_cpu;
     /* Save the parent realize function in order to be able to call it later */
     device_class_set_parent_realize(dc, esp_cpu_realize,
                                     &cpuclass->parent_realize);
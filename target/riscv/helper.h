@@ -138,6 +138,11 @@ DEF_HELPER_1(tlb_flush_all, void, env)
 DEF_HELPER_1(itrigger_match, void, env)
 #endif
 
+/* Cycle model */
+#ifdef CONFIG_RISCV_ESP32C3
+DEF_HELPER_FLAGS_2(cycle_model_fetch, TCG_CALL_NO_RWG, void, env, i32)
+#endif
+
 /* Hypervisor functions */
 #ifndef CONFIG_USER_ONLY
 DEF_HELPER_1(hyp_tlb_flush, void, env)
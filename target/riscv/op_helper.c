@@ -39,6 +39,13 @@ void helper_raise_exception(CPURISCVState *env, uint32_t exception)
     riscv_raise_exception(env, exception, 0);
 }
 
+#ifdef CONFIG_RISCV_ESP32C3
+void helper_cycle_model_fetch(CPURISCVState *env, uint32_t line)
+{
+    esp_cycle_model_fetch(&env->cycle_model, line);
+}
+#endif
+
 target_ulong helper_csrr(CPURISCVState *env, int csr)
 {
     /*
@@ -374,6 +381,10 @@ void helper_wfi(CPURISCVState *env)
                (prv_u || (prv_s && get_field(env->hstatus, HSTATUS_VTW)))) {
         riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, GETPC());
     } else {
+#ifdef CONFIG_RISCV_ESP32C3
+        esp_cycle_model_halt(&env->cycle_model,
+                             qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+#endif
         cs->halted = 1;
         cs->exception_index = EXCP_HLT;
         cpu_loop_exit(cs);
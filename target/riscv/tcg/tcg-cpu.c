@@ -127,7 +127,19 @@ static void riscv_restore_state_to_opc(CPUState *cs,
         env->pc = pc;
     }
     env->bins = data[1];
+#ifdef CONFIG_RISCV_ESP32C3
+    /* Give back the cycles charged for the instructions that will not be executed, 0 without cycle model */
+    env->cycle_model.cycles -= data[2];
+#endif
+}
+
+#ifdef CONFIG_RISCV_ESP32C3
+static void riscv_cpu_exec_enter(CPUState *cs)
+{
+    /* Back from WFI, MCYCLE followed the virtual time until now */
+    esp_cycle_model_resume(&cpu_env(cs)->cycle_model);
 }
+#endif
 
 static const TCGCPUOps riscv_tcg_ops = {
     .initialize = riscv_translate_init,
@@ -135,6 +147,9 @@ static const TCGCPUOps riscv_tcg_ops = {
     .restore_state_to_opc = riscv_restore_state_to_opc,
 
 #ifndef CONFIG_USER_ONLY
+#ifdef CONFIG_RISCV_ESP32C3
+    .cpu_exec_enter = riscv_cpu_exec_enter,
+#endif
     .tlb_fill = riscv_cpu_tlb_fill,
     .cpu_exec_interrupt = riscv_cpu_exec_interrupt,
     .do_interrupt = riscv_cpu_do_interrupt,
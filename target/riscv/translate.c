@@ -28,6 +28,7 @@
 
 #include "exec/translator.h"
 #include "exec/log.h"
+#include "exec/esp_cycle_model_gen.h"
 #include "semihosting/semihost.h"
 
 #include "instmap.h"
@@ -116,6 +117,8 @@ typedef struct DisasContext {
     /* FRM is known to contain a valid value. */
     bool frm_valid;
     bool insn_start_updated;
+    /* Instruction based MCYCLE */
+    EspCycleModelGen cycles;
 } DisasContext;
 
 static inline bool has_ext(DisasContext *ctx, uint32_t ext)
@@ -1171,6 +1174,79 @@ static void decode_opc(CPURISCVState *env, DisasContext *ctx, uint16_t opcode)
     gen_exception_illegal(ctx);
 }
 
+/*
+ * Class of the instruction that has just been decoded, as seen by the cycle model.
+ * Only the major opcodes are looked at, anything else costs as much as an ALU operation.
+ */
+static EspCycleClass riscv_cycle_class(DisasContext *ctx)
+{
+    const uint32_t opcode = ctx->opcode;
+
+    if (ctx->cur_insn_len == 2) {
+        const uint32_t funct3 = extract32(opcode, 13, 3);
+
+        switch (extract32(opcode, 0, 2)) {
+        case 0:
+        case 2:
+            if (funct3 >= 5) {
+                return ESP_CYCLE_STORE;
+            } else if (funct3 >= 1 && funct3 <= 3) {
+                return ESP_CYCLE_LOAD;
+            }
+            /* c.jr and c.jalr */
+            if (extract32(opcode, 0, 2) == 2 && funct3 == 4 &&
+                extract32(opcode, 2, 5) == 0 && extract32(opcode, 7, 5) != 0) {
+                return ESP_CYCLE_BRANCH;
+            }
+            return ESP_CYCLE_ALU;
+        case 1:
+            /* c.jal, c.j, c.beqz and c.bnez */
+            return (funct3 == 1 || funct3 >= 5) ? ESP_CYCLE_BRANCH : ESP_CYCLE_ALU;
+        default:
+            return ESP_CYCLE_ALU;
+        }
+    }
+
+    switch (MASK_OP_MAJOR(opcode)) {
+    case OPC_RISC_LOAD:
+    case OPC_RISC_FP_LOAD:
+    case OPC_RISC_ATOMIC:
+        return ESP_CYCLE_LOAD;
+    case OPC_RISC_STORE:
+    case OPC_RISC_FP_STORE:
+        return ESP_CYCLE_STORE;
+    case OPC_RISC_BRANCH:
+    case OPC_RISC_JAL:
+    case OPC_RISC_JALR:
+        return ESP_CYCLE_BRANCH;
+    case OPC_RISC_ARITH:
+    case OPC_RISC_ARITH_W:
+        if (GET_FUNCT7(opcode) == 1) {
+            return GET_FUNCT3(opcode) < 4 ? ESP_CYCLE_MUL : ESP_CYCLE_DIV;
+        }
+        return ESP_CYCLE_ALU;
+    default:
+        return ESP_CYCLE_ALU;
+    }
+}
+
+/*
+ * Fetch the flash lines the instruction spans through the cycle model cache
+ */
+static void gen_cycle_model_fetch(DisasContext *ctx, int len)
+{
+#ifdef CONFIG_RISCV_ESP32C3
+    uint32_t line;
+
+    if (esp_cycle_model_gen_fetch(&ctx->cycles, ctx->base.pc_next, &line)) {
+        gen_helper_cycle_model_fetch(tcg_env, tcg_constant_i32(line));
+    }
+    if (esp_cycle_model_gen_fetch(&ctx->cycles, ctx->base.pc_next + len - 1, &line)) {
+        gen_helper_cycle_model_fetch(tcg_env, tcg_constant_i32(line));
+    }
+#endif
+}
+
 static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
 {
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
@@ -1207,10 +1283,19 @@ static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->itrigger = FIELD_EX32(tb_flags, TB_FLAGS, ITRIGGER);
     ctx->zero = tcg_constant_tl(0);
     ctx->virt_inst_excp = false;
+#ifdef CONFIG_RISCV_ESP32C3
+    esp_cycle_model_gen_init(&ctx->cycles, &env->cycle_model,
+                             offsetof(CPURISCVState, cycle_model), 2);
+#else
+    esp_cycle_model_gen_init(&ctx->cycles, NULL, 0, 0);
+#endif
 }
 
 static void riscv_tr_tb_start(DisasContextBase *db, CPUState *cpu)
 {
+    DisasContext *ctx = container_of(db, DisasContext, base);
+
+    esp_cycle_model_gen_tb_start(&ctx->cycles);
 }
 
 static void riscv_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
@@ -1222,7 +1307,12 @@ static void riscv_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
         pc_next &= ~TARGET_PAGE_MASK;
     }
 
+#ifdef CONFIG_RISCV_ESP32C3
+    tcg_gen_insn_start(pc_next, 0,
+                       esp_cycle_model_gen_insn_start_param(&ctx->cycles));
+#else
     tcg_gen_insn_start(pc_next, 0);
+#endif
     ctx->insn_start_updated = false;
 }
 
@@ -1232,13 +1322,22 @@ static void riscv_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
     CPURISCVState *env = cpu_env(cpu);
     uint16_t opcode16 = translator_lduw(env, &ctx->base, ctx->base.pc_next);
 
+    gen_cycle_model_fetch(ctx, insn_len(opcode16));
+    /* CSR accesses may read MCYCLE, the major opcode and funct3 are in the first half */
+    if (insn_len(opcode16) == 4 && MASK_OP_MAJOR(opcode16) == OPC_RISC_SYSTEM &&
+        (GET_FUNCT3(opcode16) & 3) != 0) {
+        esp_cycle_model_gen_read(&ctx->cycles);
+    }
+
     ctx->ol = ctx->xl;
     decode_opc(env, ctx, opcode16);
+    esp_cycle_model_gen_insn(&ctx->cycles, riscv_cycle_class(ctx));
     ctx->base.pc_next += ctx->cur_insn_len;
 
     /* Only the first insn within a TB is allowed to cross a page boundary. */
     if (ctx->base.is_jmp == DISAS_NEXT) {
-        if (ctx->itrigger || !is_same_page(&ctx->base, ctx->base.pc_next)) {
+        if (ctx->itrigger || esp_cycle_model_gen_full(&ctx->cycles) ||
+            !is_same_page(&ctx->base, ctx->base.pc_next)) {
             ctx->base.is_jmp = DISAS_TOO_MANY;
         } else {
             unsigned page_ofs = ctx->base.pc_next & ~TARGET_PAGE_MASK;
@@ -1259,6 +1358,8 @@ static void riscv_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
 
+    esp_cycle_model_gen_tb_stop(&ctx->cycles);
+
     switch (ctx->base.is_jmp) {
     case DISAS_TOO_MANY:
         gen_goto_tb(ctx, 0, 0);
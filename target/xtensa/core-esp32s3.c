@@ -17,8 +17,6 @@
 #define xtensa_modules xtensa_modules_esp32s3
 #include "core-esp32s3/xtensa-modules.inc.c"
 
-extern const XtensaOpcodeTranslators xtensa_tie_opcodes;
-
 static const XtensaOpcodeTranslators* esp32s3_opcode_translators[] = {
     &xtensa_core_opcodes,
     &xtensa_fpu_opcodes,
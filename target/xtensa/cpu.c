@@ -35,6 +35,7 @@
 #include "qemu/module.h"
 #include "migration/vmstate.h"
 #include "hw/qdev-clock.h"
+#include "hw/qdev-properties.h"
 #ifndef CONFIG_USER_ONLY
 #include "exec/memory.h"
 #endif
@@ -61,8 +62,18 @@ static void xtensa_restore_state_to_opc(CPUState *cs,
     XtensaCPU *cpu = XTENSA_CPU(cs);
 
     cpu->env.pc = data[0];
+    /* The rest of the TB was charged on entry but won't be executed */
+    cpu->env.cycle_model.cycles -= data[1];
 }
 
+#ifndef CONFIG_USER_ONLY
+static void xtensa_cpu_exec_enter(CPUState *cs)
+{
+    /* Back from WAITI, CCOUNT followed the virtual time until now */
+    esp_cycle_model_resume(&cpu_env(cs)->cycle_model);
+}
+#endif
+
 static bool xtensa_cpu_has_work(CPUState *cs)
 {
 #ifndef CONFIG_USER_ONLY
@@ -128,6 +139,7 @@ static void xtensa_cpu_reset_hold(Object *obj)
     env->sregs[CONFIGID0] = env->config->configid[0];
     env->sregs[CONFIGID1] = env->config->configid[1];
     env->exclusive_addr = -1;
+    esp_cycle_model_reset(&env->cycle_model);
 
 #ifndef CONFIG_USER_ONLY
     reset_mmu(env);
@@ -188,6 +200,14 @@ static void xtensa_cpu_initfn(Object *obj)
 
     env->config = xcc->config;
 
+    for (const XtensaOpcodeTranslators **t = env->config->opcode_translators;
+         t && *t; ++t) {
+        if (*t == &xtensa_tie_opcodes) {
+            /* The PIE registers are part of the CPU state on that core */
+            env->ext = &env->esp32s3_tie;
+        }
+    }
+
 #ifndef CONFIG_USER_ONLY
     env->address_space_er = g_malloc(sizeof(*env->address_space_er));
     env->system_er = g_malloc(sizeof(*env->system_er));
@@ -212,11 +232,6 @@ XtensaCPU *xtensa_cpu_create_with_clock(const char *cpu_type, Clock *cpu_refclk)
 }
 
 #ifndef CONFIG_USER_ONLY
-static const VMStateDescription vmstate_xtensa_cpu = {
-    .name = "cpu",
-    .unmigratable = 1,
-};
-
 #include "hw/core/sysemu-cpu-ops.h"
 
 static const struct SysemuCPUOps xtensa_sysemu_ops = {
@@ -232,6 +247,7 @@ static const TCGCPUOps xtensa_tcg_ops = {
     .restore_state_to_opc = xtensa_restore_state_to_opc,
 
 #ifndef CONFIG_USER_ONLY
+    .cpu_exec_enter = xtensa_cpu_exec_enter,
     .tlb_fill = xtensa_cpu_tlb_fill,
     .cpu_exec_interrupt = xtensa_cpu_exec_interrupt,
     .do_interrupt = xtensa_cpu_do_interrupt,
@@ -241,6 +257,11 @@ static const TCGCPUOps xtensa_tcg_ops = {
 #endif /* !CONFIG_USER_ONLY */
 };
 
+static Property xtensa_cpu_properties[] = {
+    DEFINE_PROP_ESP_CYCLE_MODEL(XtensaCPU, env.cycle_model),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void xtensa_cpu_class_init(ObjectClass *oc, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(oc);
@@ -250,6 +271,7 @@ static void xtensa_cpu_class_init(ObjectClass *oc, void *data)
 
     device_class_set_parent_realize(dc, xtensa_cpu_realizefn,
                                     &xcc->parent_realize);
+    device_class_set_props(dc, xtensa_cpu_properties);
 
     resettable_class_set_parent_phases(rc, NULL, xtensa_cpu_reset_hold, NULL,
                                        &xcc->parent_phases);
@@ -33,10 +33,18 @@
 #include "exec/cpu-defs.h"
 #include "hw/clock.h"
 #include "xtensa-isa.h"
+#include "exec/esp_cycle_model.h"
+#include "cpu_esp32s3.h"
 
 /* Xtensa processors have a weak memory model */
 #define TCG_GUEST_DEFAULT_MO      (0)
 
+/*
+ * Xtensa-specific extra insn start words:
+ * 1: Cycles of the TB from this instruction on, see esp_cycle_model_gen.h
+ */
+#define TARGET_INSN_START_EXTRA_WORDS 1
+
 enum {
     /* Additional instructions */
     XTENSA_OPTION_CODE_DENSITY,
@@ -426,6 +434,7 @@ typedef struct XtensaOpcodeTranslators {
 extern const XtensaOpcodeTranslators xtensa_core_opcodes;
 extern const XtensaOpcodeTranslators xtensa_fpu2000_opcodes;
 extern const XtensaOpcodeTranslators xtensa_fpu_opcodes;
+extern const XtensaOpcodeTranslators xtensa_tie_opcodes;
 
 typedef struct XtensaConfig {
     const char *name;
@@ -475,6 +484,7 @@ typedef struct XtensaConfig {
     void *isa_internal;
     xtensa_isa isa;
     XtensaOpcodeOps **opcode_ops;
+    EspCycleClass *opcode_cycle_class;
     const XtensaOpcodeTranslators **opcode_translators;
     xtensa_regfile a_regfile;
     void ***regfile;
@@ -542,6 +552,8 @@ struct CPUArchState {
     uint64_t ccount_time;
     uint32_t ccount_base;
 #endif
+    /* CCOUNT derived from the instructions executed, see esp_cycle_model.h */
+    EspCycleModel cycle_model;
 
     int yield_needed;
     unsigned static_vectors;
@@ -552,6 +564,13 @@ struct CPUArchState {
     struct CPUBreakpoint *cpu_breakpoint[MAX_NIBREAK];
     /* Pointer to any kind of extension of basic Xtensa CPU.*/
     void* ext;
+    /*
+     * ESP32-S3 PIE registers, `ext` points to it on that core. They are kept in
+     * the env so that the translator can operate on them with TCG vector ops.
+     */
+    CPUXtensaEsp32s3State esp32s3_tie;
+    /* Scratch vectors used by the translation of the PIE instructions */
+    Q_reg esp32s3_tmp[3];
 };
 
 /**
@@ -627,6 +646,7 @@ void xtensa_breakpoint_handler(CPUState *cs);
 void xtensa_register_core(XtensaConfigList *node);
 void xtensa_sim_open_console(Chardev *chr);
 void check_interrupts(CPUXtensaState *s);
+void xtensa_cycle_model_halt(CPUXtensaState *env);
 void xtensa_irq_init(CPUXtensaState *env);
 qemu_irq *xtensa_get_extints(CPUXtensaState *env);
 qemu_irq xtensa_get_runstall(CPUXtensaState *env);
@@ -644,6 +664,10 @@ static inline void xtensa_select_static_vectors(CPUXtensaState *env,
 }
 void xtensa_runstall(CPUXtensaState *env, bool runstall);
 
+#ifndef CONFIG_USER_ONLY
+extern const VMStateDescription vmstate_xtensa_cpu;
+#endif
+
 #define XTENSA_OPTION_BIT(opt) (((uint64_t)1) << (opt))
 #define XTENSA_OPTION_ALL (~(uint64_t)0)
 
@@ -114,6 +114,7 @@ void HELPER(waiti)(CPUXtensaState *env, uint32_t pc, uint32_t intlevel)
         return;
     }
 
+    xtensa_cycle_model_halt(env);
     cpu->halted = 1;
     HELPER(exception)(env, EXCP_HLT);
 }
@@ -88,6 +88,34 @@ xtensa_find_opcode_ops(const XtensaOpcodeTranslators *t,
     return g_hash_table_lookup(translator, name);
 }
 
+/*
+ * Class of the opcode for the cycle model, classified once per configuration.
+ * Multiplications have no dedicated op_flags, they are told by their name
+ * (mul16s, mull, mul.s, mula.dd.ll, ...).
+ */
+static EspCycleClass xtensa_opcode_cycle_class(xtensa_isa isa,
+                                               xtensa_opcode opc,
+                                               const XtensaOpcodeOps *ops)
+{
+    if (ops == NULL) {
+        return ESP_CYCLE_ALU;
+    } else if (ops->op_flags & XTENSA_OP_DIVIDE_BY_ZERO) {
+        return ESP_CYCLE_DIV;
+    } else if (strncmp(xtensa_opcode_name(isa, opc), "mul", 3) == 0) {
+        return ESP_CYCLE_MUL;
+    } else if (ops->op_flags & XTENSA_OP_LOAD) {
+        return ESP_CYCLE_LOAD;
+    } else if (ops->op_flags & XTENSA_OP_STORE) {
+        return ESP_CYCLE_STORE;
+    } else if (xtensa_opcode_is_branch(isa, opc) ||
+               xtensa_opcode_is_jump(isa, opc) ||
+               xtensa_opcode_is_loop(isa, opc) ||
+               xtensa_opcode_is_call(isa, opc)) {
+        return ESP_CYCLE_BRANCH;
+    }
+    return ESP_CYCLE_ALU;
+}
+
 static void init_libisa(XtensaConfig *config)
 {
     unsigned i, j;
@@ -102,6 +130,7 @@ static void init_libisa(XtensaConfig *config)
     formats = xtensa_isa_num_formats(config->isa);
     regfiles = xtensa_isa_num_regfiles(config->isa);
     config->opcode_ops = g_new(XtensaOpcodeOps *, opcodes);
+    config->opcode_cycle_class = g_new(EspCycleClass, opcodes);
 
     for (i = 0; i < formats; ++i) {
         assert(xtensa_format_num_slots(config->isa, i) <= MAX_INSN_SLOTS);
@@ -128,6 +157,8 @@ static void init_libisa(XtensaConfig *config)
         }
 #endif
         config->opcode_ops[i] = ops;
+        config->opcode_cycle_class[i] =
+            xtensa_opcode_cycle_class(config->isa, i, ops);
     }
     config->a_regfile = xtensa_regfile_lookup(config->isa, "AR");
 
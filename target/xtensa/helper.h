@@ -4,7 +4,6 @@ DEF_HELPER_4(exception_cause_vaddr, noreturn, env, i32, i32, i32)
 DEF_HELPER_3(debug_exception, noreturn, env, i32, i32)
 
 DEF_HELPER_1(sync_windowbase, void, env)
-DEF_HELPER_4(entry, void, env, i32, i32, i32)
 DEF_HELPER_2(test_ill_retw, void, env, i32)
 DEF_HELPER_2(test_underflow_retw, void, env, i32)
 DEF_HELPER_2(retw, void, env, i32)
@@ -18,6 +17,7 @@ DEF_HELPER_1(simcall, void, env)
 #ifndef CONFIG_USER_ONLY
 DEF_HELPER_3(waiti, void, env, i32, i32)
 DEF_HELPER_1(update_ccount, void, env)
+DEF_HELPER_FLAGS_2(cycle_model_fetch, TCG_CALL_NO_RWG, void, env, i32)
 DEF_HELPER_2(wsr_ccount, void, env, i32)
 DEF_HELPER_2(update_ccompare, void, env, i32)
 DEF_HELPER_1(check_interrupts, void, env)
@@ -107,7 +107,6 @@ DEF_HELPER_3(wer, void, env, i32, i32)
 DEF_HELPER_4(vld_64_s3, void, env, i32, i64, i32)
 DEF_HELPER_3(vst_64_s3, i64, env, i32, i32)
 DEF_HELPER_4(fft_vst_64_s3, i64, env, i32, i32, i32)
-DEF_HELPER_4(vldbc_s3, void, env, i32, i32, i32)
 DEF_HELPER_3(vldhbc_16_s3, void, env, i32, i64)
 DEF_HELPER_2(set_sar_byte_s3, void, env, i32)
 DEF_HELPER_4(ldqa_64_s3, void, env, i32, i64, i32)
@@ -118,8 +117,6 @@ DEF_HELPER_2(rur_s3, i32, env, i32)
 DEF_HELPER_3(mov_qacc_s3, void, env, i32, i32)
 DEF_HELPER_3(movi_a_s3, i32, env, i32, i32)
 DEF_HELPER_4(movi_q_s3, void, env, i32, i32, i32)
-DEF_HELPER_4(vzip_s3, void, env, i32, i32, i32)
-DEF_HELPER_4(vunzip_s3, void, env, i32, i32, i32)
 
 DEF_HELPER_5(vadds_s3, void, env, i32, i32, i32, i32)
 DEF_HELPER_5(vsubs_s3, void, env, i32, i32, i32, i32)
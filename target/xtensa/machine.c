@@ -0,0 +1,184 @@
+/*
+ * Xtensa CPU migration state
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "cpu_esp32s3.h"
+#include "fpu/softfloat.h"
+#include "exec/helper-proto.h"
+#include "migration/cpu.h"
+
+/* The FP registers are an anonymous union, only its 64-bit view needs to be migrated */
+typedef typeof(((CPUXtensaState *) 0)->fregs[0]) XtensaFReg;
+
+static const VMStateDescription vmstate_xtensa_freg = {
+    .name = "cpu/freg",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64(f64, XtensaFReg),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_xtensa_tlb_entry = {
+    .name = "cpu/tlb_entry",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(vaddr, xtensa_tlb_entry),
+        VMSTATE_UINT32(paddr, xtensa_tlb_entry),
+        VMSTATE_UINT8(asid, xtensa_tlb_entry),
+        VMSTATE_UINT8(attr, xtensa_tlb_entry),
+        VMSTATE_BOOL(variable, xtensa_tlb_entry),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_xtensa_mpu_entry = {
+    .name = "cpu/mpu_entry",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(vaddr, xtensa_mpu_entry),
+        VMSTATE_UINT32(attr, xtensa_mpu_entry),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+/* Only the configured CCOMPARE timers are allocated */
+static bool xtensa_ccompare0_needed(void *opaque, int version_id)
+{
+    return XTENSA_CPU(opaque)->env.config->nccompare > 0;
+}
+
+static bool xtensa_ccompare1_needed(void *opaque, int version_id)
+{
+    return XTENSA_CPU(opaque)->env.config->nccompare > 1;
+}
+
+static bool xtensa_ccompare2_needed(void *opaque, int version_id)
+{
+    return XTENSA_CPU(opaque)->env.config->nccompare > 2;
+}
+
+static bool xtensa_esp32s3_tie_needed(void *opaque)
+{
+    return XTENSA_CPU(opaque)->env.ext != NULL;
+}
+
+/* Registers of the ESP32-S3 TIE extension (PIE), enabled by the machine */
+static const VMStateDescription vmstate_xtensa_esp32s3_tie = {
+    .name = "cpu/esp32s3_tie",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = xtensa_esp32s3_tie_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BUFFER_POINTER_UNSAFE(env.ext, XtensaCPU, 0, sizeof(CPUXtensaEsp32s3State)),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool xtensa_cycle_model_needed(void *opaque)
+{
+    return XTENSA_CPU(opaque)->env.cycle_model.enabled;
+}
+
+/* Instruction based CCOUNT, its configuration comes from the properties */
+static const VMStateDescription vmstate_xtensa_cycle_model = {
+    .name = "cpu/cycle_model",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = xtensa_cycle_model_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64(env.cycle_model.cycles, XtensaCPU),
+        VMSTATE_INT64(env.cycle_model.halted_ns, XtensaCPU),
+        VMSTATE_INT64(env.cycle_model.halted_since, XtensaCPU),
+        VMSTATE_UINT32_ARRAY(env.cycle_model.tags, XtensaCPU, ESP_CYCLE_MODEL_LINES),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static int xtensa_cpu_post_load(void *opaque, int version_id)
+{
+    XtensaCPU *cpu = opaque;
+    CPUXtensaState *env = &cpu->env;
+    CPUState *cs = CPU(cpu);
+    static const int rounding_mode[] = {
+        float_round_nearest_even,
+        float_round_to_zero,
+        float_round_up,
+        float_round_down,
+    };
+
+    set_float_rounding_mode(rounding_mode[env->uregs[FCR] & 3], &env->fp_status);
+
+    /* Debug breakpoints and watchpoints are QEMU objects, recreate them from the registers */
+    cpu_breakpoint_remove_all(cs, BP_CPU);
+    cpu_watchpoint_remove_all(cs, BP_CPU);
+    memset(env->cpu_breakpoint, 0, sizeof(env->cpu_breakpoint));
+    memset(env->cpu_watchpoint, 0, sizeof(env->cpu_watchpoint));
+
+    if (xtensa_option_enabled(env->config, XTENSA_OPTION_DEBUG)) {
+        const uint32_t ibreakenable = env->sregs[IBREAKENABLE];
+
+        env->sregs[IBREAKENABLE] = 0;
+        HELPER(wsr_ibreakenable)(env, ibreakenable);
+        for (unsigned i = 0; i < env->config->ndbreak; ++i) {
+            const uint32_t dbreakc = env->sregs[DBREAKC + i];
+
+            env->sregs[DBREAKC + i] = 0;
+            HELPER(wsr_dbreakc)(env, i, dbreakc);
+        }
+    }
+    return 0;
+}
+
+const VMStateDescription vmstate_xtensa_cpu = {
+    .name = "cpu",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = xtensa_cpu_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_CPU(),
+        VMSTATE_UINT32_ARRAY(env.regs, XtensaCPU, 16),
+        VMSTATE_UINT32(env.pc, XtensaCPU),
+        VMSTATE_UINT32_ARRAY(env.sregs, XtensaCPU, 256),
+        VMSTATE_UINT32_ARRAY(env.uregs, XtensaCPU, 256),
+        VMSTATE_UINT32_ARRAY(env.phys_regs, XtensaCPU, MAX_NAREG),
+        VMSTATE_STRUCT_ARRAY(env.fregs, XtensaCPU, 16, 1, vmstate_xtensa_freg, XtensaFReg),
+        VMSTATE_UINT16(env.fp_status.float_exception_flags, XtensaCPU),
+        VMSTATE_UINT32(env.windowbase_next, XtensaCPU),
+        VMSTATE_UINT32(env.exclusive_addr, XtensaCPU),
+        VMSTATE_UINT32(env.exclusive_val, XtensaCPU),
+        VMSTATE_STRUCT_2DARRAY(env.itlb, XtensaCPU, 7, MAX_TLB_WAY_SIZE, 1,
+                               vmstate_xtensa_tlb_entry, xtensa_tlb_entry),
+        VMSTATE_STRUCT_2DARRAY(env.dtlb, XtensaCPU, 10, MAX_TLB_WAY_SIZE, 1,
+                               vmstate_xtensa_tlb_entry, xtensa_tlb_entry),
+        VMSTATE_STRUCT_ARRAY(env.mpu_fg, XtensaCPU, MAX_MPU_FOREGROUND_SEGMENTS, 1,
+                             vmstate_xtensa_mpu_entry, xtensa_mpu_entry),
+        VMSTATE_UINT32(env.autorefill_idx, XtensaCPU),
+        VMSTATE_BOOL(env.runstall, XtensaCPU),
+        VMSTATE_INT32(env.pending_irq_level, XtensaCPU),
+        VMSTATE_TIMER_PTR_TEST(env.ccompare[0].timer, XtensaCPU, xtensa_ccompare0_needed),
+        VMSTATE_TIMER_PTR_TEST(env.ccompare[1].timer, XtensaCPU, xtensa_ccompare1_needed),
+        VMSTATE_TIMER_PTR_TEST(env.ccompare[2].timer, XtensaCPU, xtensa_ccompare2_needed),
+        VMSTATE_UINT64(env.time_base, XtensaCPU),
+        VMSTATE_UINT64(env.ccount_time, XtensaCPU),
+        VMSTATE_UINT32(env.ccount_base, XtensaCPU),
+        VMSTATE_INT32(env.yield_needed, XtensaCPU),
+        VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_xtensa_esp32s3_tie,
+        &vmstate_xtensa_cycle_model,
+        NULL
+    }
+};
@@ -41,10 +41,24 @@ void HELPER(update_ccount)(CPUXtensaState *env)
     uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 
     env->ccount_time = now;
+    if (env->cycle_model.enabled) {
+        /* The CPU counts at the nominal clock while halted */
+        int64_t halted = esp_cycle_model_halted_ns(&env->cycle_model, now);
+
+        env->sregs[CCOUNT] = env->ccount_base +
+            (uint32_t)(esp_cycle_model_get(&env->cycle_model) +
+                       clock_ns_to_ticks(cpu->clock, halted));
+        return;
+    }
     env->sregs[CCOUNT] = env->ccount_base +
         (uint32_t)clock_ns_to_ticks(cpu->clock, now - env->time_base);
 }
 
+void HELPER(cycle_model_fetch)(CPUXtensaState *env, uint32_t line)
+{
+    esp_cycle_model_fetch(&env->cycle_model, line);
+}
+
 void HELPER(wsr_ccount)(CPUXtensaState *env, uint32_t v)
 {
     int i;
@@ -56,20 +70,46 @@ void HELPER(wsr_ccount)(CPUXtensaState *env, uint32_t v)
     }
 }
 
-void HELPER(update_ccompare)(CPUXtensaState *env, uint32_t i)
+static void ccompare_timer_mod(CPUXtensaState *env, uint32_t i)
 {
     XtensaCPU *cpu = env_archcpu(env);
     uint64_t dcc;
 
-    qatomic_and(&env->sregs[INTSET],
-               ~(1u << env->config->timerint[i]));
-    HELPER(update_ccount)(env);
     dcc = (uint64_t)(env->sregs[CCOMPARE + i] - env->sregs[CCOUNT] - 1) + 1;
     timer_mod(env->ccompare[i].timer,
               env->ccount_time + clock_ticks_to_ns(cpu->clock, dcc));
+}
+
+void HELPER(update_ccompare)(CPUXtensaState *env, uint32_t i)
+{
+    qatomic_and(&env->sregs[INTSET],
+               ~(1u << env->config->timerint[i]));
+    HELPER(update_ccount)(env);
+    ccompare_timer_mod(env, i);
     env->yield_needed = 1;
 }
 
+void xtensa_cycle_model_halt(CPUXtensaState *env)
+{
+    unsigned i;
+
+    if (!env->cycle_model.enabled) {
+        return;
+    }
+
+    /*
+     * CCOMPARE deadlines are converted to virtual time at the nominal clock,
+     * while the CPU runs the cycle model drifts away from it. From now on
+     * CCOUNT follows the virtual time, so reprogram the timers from its
+     * current value to wake the CPU up when it reaches CCOMPARE.
+     */
+    HELPER(update_ccount)(env);
+    esp_cycle_model_halt(&env->cycle_model, env->ccount_time);
+    for (i = 0; i < env->config->nccompare; ++i) {
+        ccompare_timer_mod(env, i);
+    }
+}
+
 /*!
  * Check vaddr accessibility/cache attributes and raise an exception if
  * specified by the ATOMCTL SR.
@@ -516,6 +516,68 @@ static bool gen_window_check(DisasContext *dc, uint32_t mask)
     return true;
 }
 
+/*
+ * Number of frames retw unwinds, (a0 >> 30), and the WINDOWSTART bits of
+ * the three frames below the current one, a copy of WINDOWSTART shifted
+ * above the original one takes care of the wrap around.
+ */
+static void gen_retw_frames(DisasContext *dc, TCGv_i32 n, TCGv_i32 below)
+{
+    unsigned nwin = dc->config->nareg / 4;
+    TCGv_i32 tmp = tcg_temp_new_i32();
+
+    tcg_gen_extract_i32(n, cpu_R[0], 30, 2);
+    tcg_gen_shli_i32(below, cpu_SR[WINDOW_START], nwin);
+    tcg_gen_or_i32(below, below, cpu_SR[WINDOW_START]);
+    tcg_gen_addi_i32(tmp, cpu_SR[WINDOW_BASE], nwin - 3);
+    tcg_gen_shr_i32(below, below, tmp);
+    tcg_gen_andi_i32(below, below, 0x7);
+}
+
+/*
+ * The retw checks only need a helper when they raise an exception, test
+ * the common case inline. Bits 2..0 of `below` are WINDOW_BASE - 1..3.
+ */
+static void gen_test_ill_retw(DisasContext *dc)
+{
+    TCGLabel *label = gen_new_label();
+    TCGv_i32 n = tcg_temp_new_i32();
+    TCGv_i32 below = tcg_temp_new_i32();
+    TCGv_i32 ok = tcg_temp_new_i32();
+    TCGv_i32 tmp = tcg_temp_new_i32();
+
+    gen_retw_frames(dc, n, below);
+    /* Legal if n != 0 and the nearest live frame below is either none or n */
+    tcg_gen_subfi_i32(tmp, 3, n);
+    tcg_gen_shr_i32(tmp, below, tmp);
+    tcg_gen_setcondi_i32(TCG_COND_EQ, tmp, tmp, 1);
+    tcg_gen_setcondi_i32(TCG_COND_EQ, ok, below, 0);
+    tcg_gen_or_i32(ok, ok, tmp);
+    tcg_gen_setcondi_i32(TCG_COND_NE, tmp, n, 0);
+    tcg_gen_and_i32(ok, ok, tmp);
+    tcg_gen_brcondi_i32(TCG_COND_NE, ok, 0, label);
+    gen_helper_test_ill_retw(tcg_env, tcg_constant_i32(dc->pc));
+    gen_set_label(label);
+}
+
+static void gen_test_underflow_retw(DisasContext *dc)
+{
+    unsigned nwin = dc->config->nareg / 4;
+    TCGLabel *label = gen_new_label();
+    TCGv_i32 n = tcg_temp_new_i32();
+    TCGv_i32 tmp = tcg_temp_new_i32();
+
+    /* Nothing to restore when the frame being returned to is still live */
+    tcg_gen_extract_i32(n, cpu_R[0], 30, 2);
+    tcg_gen_sub_i32(tmp, cpu_SR[WINDOW_BASE], n);
+    tcg_gen_andi_i32(tmp, tmp, nwin - 1);
+    tcg_gen_shr_i32(tmp, cpu_SR[WINDOW_START], tmp);
+    tcg_gen_andi_i32(tmp, tmp, 1);
+    tcg_gen_brcondi_i32(TCG_COND_NE, tmp, 0, label);
+    gen_helper_test_underflow_retw(tcg_env, tcg_constant_i32(dc->pc));
+    gen_set_label(label);
+}
+
 static TCGv_i32 gen_mac16_m(TCGv_i32 v, bool hi, bool is_unsigned)
 {
     TCGv_i32 m = tcg_temp_new_i32();
@@ -808,12 +870,170 @@ static int arg_copy_compare(const void *a, const void *b)
         -1 : (pa->resource > pb->resource ? 1 : 0);
 }
 
+/*
+ * Decoding an instruction with libisa is expensive, especially for FLIX
+ * bundles, and the same code gets translated again after every TB flush or
+ * cache remap. Keep the part of the decoding that only depends on the
+ * instruction bytes: format, opcode of each slot and decoded operand values.
+ * The cache is per translating thread, so it doesn't need any locking.
+ */
+#define XTENSA_DECODE_CACHE_SIZE (1 << 16)
+
+typedef struct XtensaDecodeKey {
+    const XtensaConfig *config;
+    unsigned len;
+    unsigned char bytes[MAX_INSN_LENGTH];
+} XtensaDecodeKey;
+
+typedef struct XtensaDecodedSlot {
+    xtensa_opcode opc;
+    /* Index of the value of the first operand of the slot */
+    unsigned first;
+} XtensaDecodedSlot;
+
+typedef struct XtensaDecodedInsn {
+    XtensaDecodeKey key;
+    xtensa_format fmt;
+    /*
+     * Number of slots decoded, decoding stops at the first
+     * XTENSA_UNDEFINED opcode like disas_xtensa_insn does.
+     */
+    int slots;
+    /*
+     * Decoded value of each operand, before PC-relative relocation,
+     * only valid for the visible and register operands.
+     */
+    uint32_t *values;
+    XtensaDecodedSlot slot[];
+} XtensaDecodedInsn;
+
+static __thread GHashTable *xtensa_decode_cache;
+
+static guint xtensa_decode_key_hash(gconstpointer p)
+{
+    const XtensaDecodeKey *key = p;
+    guint hash = (uintptr_t)key->config ^ key->len;
+    unsigned i;
+
+    for (i = 0; i < key->len; ++i) {
+        hash = hash * 31 + key->bytes[i];
+    }
+    return hash;
+}
+
+static gboolean xtensa_decode_key_equal(gconstpointer a, gconstpointer b)
+{
+    const XtensaDecodeKey *ka = a;
+    const XtensaDecodeKey *kb = b;
+
+    return ka->config == kb->config && ka->len == kb->len &&
+        memcmp(ka->bytes, kb->bytes, ka->len) == 0;
+}
+
+static bool xtensa_decode_operand_needed(xtensa_isa isa, xtensa_opcode opc,
+                                         int opnd)
+{
+    return xtensa_operand_is_register(isa, opc, opnd) ||
+        xtensa_operand_is_visible(isa, opc, opnd);
+}
+
+static XtensaDecodedInsn *xtensa_decode_insn_uncached(DisasContext *dc,
+                                                      const XtensaDecodeKey *key)
+{
+    xtensa_isa isa = dc->config->isa;
+    xtensa_opcode opc[MAX_INSN_SLOTS];
+    XtensaDecodedInsn *d;
+    xtensa_format fmt;
+    int slot, slots = 0;
+    unsigned n_values = 0;
+
+    xtensa_insnbuf_from_chars(isa, dc->insnbuf, key->bytes, key->len);
+    fmt = xtensa_format_decode(isa, dc->insnbuf);
+    if (fmt != XTENSA_UNDEFINED) {
+        int n = xtensa_format_num_slots(isa, fmt);
+
+        while (slots < n) {
+            xtensa_format_get_slot(isa, fmt, slots, dc->insnbuf, dc->slotbuf);
+            opc[slots] = xtensa_opcode_decode(isa, fmt, slots, dc->slotbuf);
+            if (opc[slots++] == XTENSA_UNDEFINED) {
+                break;
+            }
+            n_values += xtensa_opcode_num_operands(isa, opc[slots - 1]);
+        }
+    }
+
+    d = g_malloc0(sizeof(XtensaDecodedInsn) +
+                  slots * sizeof(XtensaDecodedSlot) +
+                  n_values * sizeof(uint32_t));
+    d->key = *key;
+    d->fmt = fmt;
+    d->slots = slots;
+    d->values = (uint32_t *)(d->slot + slots);
+
+    for (slot = 0, n_values = 0; slot < slots; ++slot) {
+        int opnd, opnds;
+
+        d->slot[slot].opc = opc[slot];
+        d->slot[slot].first = n_values;
+        if (opc[slot] == XTENSA_UNDEFINED) {
+            break;
+        }
+        xtensa_format_get_slot(isa, fmt, slot, dc->insnbuf, dc->slotbuf);
+        opnds = xtensa_opcode_num_operands(isa, opc[slot]);
+        for (opnd = 0; opnd < opnds; ++opnd, ++n_values) {
+            uint32_t v = 0;
+
+            if (xtensa_decode_operand_needed(isa, opc[slot], opnd)) {
+                xtensa_operand_get_field(isa, opc[slot], opnd, fmt, slot,
+                                         dc->slotbuf, &v);
+                xtensa_operand_decode(isa, opc[slot], opnd, &v);
+            }
+            d->values[n_values] = v;
+        }
+    }
+    return d;
+}
+
+static const XtensaDecodedInsn *xtensa_decode_insn(DisasContext *dc,
+                                                   const unsigned char *b,
+                                                   unsigned len)
+{
+    XtensaDecodeKey key = {
+        .config = dc->config,
+        .len = len,
+    };
+    XtensaDecodedInsn *d;
+
+    memcpy(key.bytes, b, len);
+
+    if (!xtensa_decode_cache) {
+        xtensa_decode_cache = g_hash_table_new_full(xtensa_decode_key_hash,
+                                                    xtensa_decode_key_equal,
+                                                    NULL, g_free);
+    }
+
+    d = g_hash_table_lookup(xtensa_decode_cache, &key);
+    if (d == NULL) {
+        /* Nothing holds entries across instructions, so starting over is safe */
+        if (g_hash_table_size(xtensa_decode_cache) >= XTENSA_DECODE_CACHE_SIZE) {
+            g_hash_table_remove_all(xtensa_decode_cache);
+        }
+        d = xtensa_decode_insn_uncached(dc, &key);
+        g_hash_table_insert(xtensa_decode_cache, &d->key, d);
+    }
+    return d;
+}
+
+/*
+ * Class of a single operation as seen by the cycle model
+ */
 static void disas_xtensa_insn(CPUXtensaState *env, DisasContext *dc)
 {
     xtensa_isa isa = dc->config->isa;
     unsigned char b[MAX_INSN_LENGTH] = {translator_ldub(env, &dc->base,
                                                         dc->pc)};
     unsigned len = xtensa_op0_insn_len(dc, b[0]);
+    const XtensaDecodedInsn *decoded;
     xtensa_format fmt;
     int slot, slots;
     unsigned i;
@@ -839,8 +1059,8 @@ static void disas_xtensa_insn(CPUXtensaState *env, DisasContext *dc)
     for (i = 1; i < len; ++i) {
         b[i] = translator_ldub(env, &dc->base, dc->pc + i);
     }
-    xtensa_insnbuf_from_chars(isa, dc->insnbuf, b, len);
-    fmt = xtensa_format_decode(isa, dc->insnbuf);
+    decoded = xtensa_decode_insn(dc, b, len);
+    fmt = decoded->fmt;
     if (fmt == XTENSA_UNDEFINED) {
         qemu_log_mask(LOG_GUEST_ERROR,
                       "unrecognized instruction format (pc = %08x)\n",
@@ -854,9 +1074,10 @@ static void disas_xtensa_insn(CPUXtensaState *env, DisasContext *dc)
         int opnd, vopnd, opnds;
         OpcodeArg *arg = slot_prop[slot].arg;
         XtensaOpcodeOps *ops;
+        const uint32_t *values;
 
-        xtensa_format_get_slot(isa, fmt, slot, dc->insnbuf, dc->slotbuf);
-        opc = xtensa_opcode_decode(isa, fmt, slot, dc->slotbuf);
+        opc = decoded->slot[slot].opc;
+        values = decoded->values + decoded->slot[slot].first;
         if (opc == XTENSA_UNDEFINED) {
             qemu_log_mask(LOG_GUEST_ERROR,
                           "unrecognized opcode in slot %d (pc = %08x)\n",
@@ -875,20 +1096,12 @@ static void disas_xtensa_insn(CPUXtensaState *env, DisasContext *dc)
                 register_file = dc->config->regfile[rf];
 
                 if (rf == dc->config->a_regfile) {
-                    uint32_t v;
-
-                    xtensa_operand_get_field(isa, opc, opnd, fmt, slot,
-                                             dc->slotbuf, &v);
-                    xtensa_operand_decode(isa, opc, opnd, &v);
-                    windowed_register |= 1u << v;
+                    windowed_register |= 1u << values[opnd];
                 }
             }
             if (xtensa_operand_is_visible(isa, opc, opnd)) {
-                uint32_t v;
+                uint32_t v = values[opnd];
 
-                xtensa_operand_get_field(isa, opc, opnd, fmt, slot,
-                                         dc->slotbuf, &v);
-                xtensa_operand_decode(isa, opc, opnd, &v);
                 arg[vopnd].raw_imm = v;
                 if (xtensa_operand_is_PCrelative(isa, opc, opnd)) {
                     xtensa_operand_undo_reloc(isa, opc, opnd, &v, dc->pc);
@@ -912,6 +1125,8 @@ static void disas_xtensa_insn(CPUXtensaState *env, DisasContext *dc)
             if (ops->test_exceptions) {
                 op_flags |= ops->test_exceptions(dc, arg, ops->par);
             }
+            dc->cycle_class = esp_cycle_model_gen_max(&dc->cycles, dc->cycle_class,
+                                                      dc->config->opcode_cycle_class[opc]);
         } else {
             qemu_log_mask(LOG_UNIMP,
                           "unimplemented opcode '%s' in slot %d (pc = %08x)\n",
@@ -942,13 +1157,10 @@ static void disas_xtensa_insn(CPUXtensaState *env, DisasContext *dc)
 
                 if (xtensa_operand_is_register(isa, opc, opnd)) {
                     xtensa_regfile rf = xtensa_operand_regfile(isa, opc, opnd);
-                    uint32_t v = 0;
 
-                    xtensa_operand_get_field(isa, opc, opnd, fmt, slot,
-                                             dc->slotbuf, &v);
-                    xtensa_operand_decode(isa, opc, opnd, &v);
                     opcode_add_resource(slot_prop + slot,
-                                        encode_resource(RES_REGFILE, rf, v),
+                                        encode_resource(RES_REGFILE, rf,
+                                                        values[opnd]),
                                         xtensa_operand_inout(isa, opc, opnd),
                                         visible ? vopnd : -1);
                 }
@@ -1013,9 +1225,7 @@ static void disas_xtensa_insn(CPUXtensaState *env, DisasContext *dc)
     }
 
     if (op_flags & XTENSA_OP_UNDERFLOW) {
-        TCGv_i32 pc = tcg_constant_i32(dc->pc);
-
-        gen_helper_test_underflow_retw(tcg_env, pc);
+        gen_test_underflow_retw(dc);
     }
 
     if (op_flags & XTENSA_OP_ALLOCA) {
@@ -1120,6 +1330,8 @@ static void xtensa_tr_init_disas_context(DisasContextBase *dcbase,
     dc->callinc = ((tb_flags & XTENSA_TBFLAG_CALLINC_MASK) >>
                    XTENSA_TBFLAG_CALLINC_SHIFT);
     init_sar_tracker(dc);
+    esp_cycle_model_gen_init(&dc->cycles, &cpu_env(cpu)->cycle_model,
+                             offsetof(CPUXtensaState, cycle_model), 1);
 }
 
 static void xtensa_tr_tb_start(DisasContextBase *dcbase, CPUState *cpu)
@@ -1129,12 +1341,33 @@ static void xtensa_tr_tb_start(DisasContextBase *dcbase, CPUState *cpu)
     if (dc->icount) {
         dc->next_icount = tcg_temp_new_i32();
     }
+    esp_cycle_model_gen_tb_start(&dc->cycles);
 }
 
 static void xtensa_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
 {
-    tcg_gen_insn_start(dcbase->pc_next);
+    DisasContext *dc = container_of(dcbase, DisasContext, base);
+
+    tcg_gen_insn_start(dcbase->pc_next,
+                       esp_cycle_model_gen_insn_start_param(&dc->cycles));
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Fetch the flash lines the instruction spans through the cycle model cache
+ */
+static void gen_cycle_model_fetch(DisasContext *dc, unsigned len)
+{
+    uint32_t line;
+
+    if (esp_cycle_model_gen_fetch(&dc->cycles, dc->pc, &line)) {
+        gen_helper_cycle_model_fetch(tcg_env, tcg_constant_i32(line));
+    }
+    if (esp_cycle_model_gen_fetch(&dc->cycles, dc->pc + len - 1, &line)) {
+        gen_helper_cycle_model_fetch(tcg_env, tcg_constant_i32(line));
+    }
 }
+#endif
 
 static void xtensa_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
 {
@@ -1164,7 +1397,14 @@ static void xtensa_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
         gen_set_label(label);
     }
 
+#ifndef CONFIG_USER_ONLY
+    if (dc->cycles.model) {
+        gen_cycle_model_fetch(dc, xtensa_insn_len(env, dc));
+    }
+#endif
+    dc->cycle_class = ESP_CYCLE_ALU;
     disas_xtensa_insn(env, dc);
+    esp_cycle_model_gen_insn(&dc->cycles, dc->cycle_class);
 
     if (dc->icount) {
         tcg_gen_mov_i32(cpu_SR[ICOUNT], dc->next_icount);
@@ -1173,7 +1413,8 @@ static void xtensa_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
     /* End the TB if the next insn will cross into the next page.  */
     page_start = dc->base.pc_first & TARGET_PAGE_MASK;
     if (dc->base.is_jmp == DISAS_NEXT &&
-        (dc->pc - page_start >= TARGET_PAGE_SIZE ||
+        (esp_cycle_model_gen_full(&dc->cycles) ||
+         dc->pc - page_start >= TARGET_PAGE_SIZE ||
          dc->pc - page_start + xtensa_insn_len(env, dc) > TARGET_PAGE_SIZE)) {
         dc->base.is_jmp = DISAS_TOO_MANY;
     }
@@ -1183,6 +1424,8 @@ static void xtensa_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *dc = container_of(dcbase, DisasContext, base);
 
+    esp_cycle_model_gen_tb_stop(&dc->cycles);
+
     switch (dc->base.is_jmp) {
     case DISAS_NORETURN:
         break;
@@ -1540,10 +1783,19 @@ static uint32_t test_overflow_entry(DisasContext *dc, const OpcodeArg arg[],
 static void translate_entry(DisasContext *dc, const OpcodeArg arg[],
                             const uint32_t par[])
 {
-    TCGv_i32 pc = tcg_constant_i32(dc->pc);
-    TCGv_i32 s = tcg_constant_i32(arg[0].imm);
-    TCGv_i32 imm = tcg_constant_i32(arg[1].imm);
-    gen_helper_entry(tcg_env, pc, s, imm);
+    /*
+     * CALLINC is constant within the TB, the window overflow has been checked
+     * with it, so only the rotation itself (sync_windowbase) needs a helper.
+     */
+    uint32_t s = arg[0].imm;
+    TCGv_i32 tmp = tcg_temp_new_i32();
+
+    tcg_gen_subi_i32(cpu_R[(dc->callinc << 2) | (s & 3)], cpu_R[s],
+                     arg[1].imm);
+    tcg_gen_addi_i32(cpu_windowbase_next, cpu_SR[WINDOW_BASE], dc->callinc);
+    tcg_gen_andi_i32(tmp, cpu_windowbase_next, dc->config->nareg / 4 - 1);
+    tcg_gen_shl_i32(tmp, tcg_constant_i32(1), tmp);
+    tcg_gen_or_i32(cpu_SR[WINDOW_START], cpu_SR[WINDOW_START], tmp);
 }
 
 static void translate_extui(DisasContext *dc, const OpcodeArg arg[],
@@ -1991,9 +2243,7 @@ static uint32_t test_exceptions_retw(DisasContext *dc, const OpcodeArg arg[],
                       "Illegal retw instruction(pc = %08x)\n", dc->pc);
         return XTENSA_OP_ILL;
     } else {
-        TCGv_i32 pc = tcg_constant_i32(dc->pc);
-
-        gen_helper_test_ill_retw(tcg_env, pc);
+        gen_test_ill_retw(dc);
         return 0;
     }
 }
@@ -2080,6 +2330,7 @@ static void translate_rsr_ccount(DisasContext *dc, const OpcodeArg arg[],
 {
 #ifndef CONFIG_USER_ONLY
     translator_io_start(&dc->base);
+    esp_cycle_model_gen_read(&dc->cycles);
     gen_helper_update_ccount(tcg_env);
     tcg_gen_mov_i32(arg[0].out, cpu_SR[par[0]]);
 #endif
@@ -2451,6 +2702,8 @@ static void translate_wsr_ccompare(DisasContext *dc, const OpcodeArg arg[],
 
     assert(id < dc->config->nccompare);
     translator_io_start(&dc->base);
+    /* The helper computes CCOUNT, which must not see the cycles of a former read of this block */
+    esp_cycle_model_gen_read(&dc->cycles);
     tcg_gen_mov_i32(cpu_SR[par[0]], arg[0].in);
     gen_helper_update_ccompare(tcg_env, tcg_constant_i32(id));
 #endif
@@ -2461,6 +2714,7 @@ static void translate_wsr_ccount(DisasContext *dc, const OpcodeArg arg[],
 {
 #ifndef CONFIG_USER_ONLY
     translator_io_start(&dc->base);
+    esp_cycle_model_gen_read(&dc->cycles);
     gen_helper_wsr_ccount(tcg_env, arg[0].in);
 #endif
 }
@@ -2654,6 +2908,7 @@ static void translate_xsr_ccount(DisasContext *dc, const OpcodeArg arg[],
     TCGv_i32 tmp = tcg_temp_new_i32();
 
     translator_io_start(&dc->base);
+    esp_cycle_model_gen_read(&dc->cycles);
     gen_helper_update_ccount(tcg_env);
     tcg_gen_mov_i32(tmp, cpu_SR[par[0]]);
     gen_helper_wsr_ccount(tcg_env, arg[0].in);
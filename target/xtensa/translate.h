@@ -12,6 +12,7 @@
 #include "exec/cpu_ldst.h"
 #include "semihosting/semihost.h"
 #include "exec/translator.h"
+#include "exec/esp_cycle_model_gen.h"
 
 #include "exec/helper-proto.h"
 #include "exec/helper-gen.h"
@@ -44,6 +45,10 @@ struct DisasContext {
     unsigned cpenable;
 
     uint32_t op_flags;
+    /* Instruction based CCOUNT, class of the instruction being translated */
+    EspCycleModelGen cycles;
+    EspCycleClass cycle_class;
+
     xtensa_insnbuf_word insnbuf[MAX_INSNBUF_LENGTH];
     xtensa_insnbuf_word slotbuf[MAX_INSNBUF_LENGTH];
 };
@@ -4,6 +4,7 @@
 #include "exec/exec-all.h"
 #include "disas/disas.h"
 #include "tcg/tcg-op.h"
+#include "tcg/tcg-op-gvec.h"
 #include "tcg/tcg-temp-internal.h"
 #include "qemu/log.h"
 #include "qemu/qemu-print.h"
@@ -230,6 +231,278 @@ static inline ACCQ_reg *cpu_qacc_ptr(CPUXtensaState *env, int a_b)
     return &tie->ACCQ[a_b];
 }
 
+/*
+ * The most common vector operations are expanded inline with the TCG gvec
+ * API, on the registers stored in the CPU env (env->ext points to them), so
+ * that they are run with the host vector instructions. The result must stay
+ * bit-exact with the helpers, which are kept for the remaining variants.
+ */
+#define PIE_VEC_SIZE sizeof(Q_reg)
+
+static inline uint32_t pie_qreg_ofs(uint32_t q)
+{
+    return offsetof(CPUXtensaState, esp32s3_tie.Q[q]);
+}
+
+static inline uint32_t pie_tmp_ofs(int i)
+{
+    return offsetof(CPUXtensaState, esp32s3_tmp[i]);
+}
+
+/**
+ * @brief Lane size and signedness of the ldqa_type operand types
+ */
+static MemOp pie_ldqa_memop(ldqa_type type)
+{
+    switch (type) {
+    case ldqa_u8:
+        return MO_8;
+    case ldqa_s8:
+        return MO_8 | MO_SIGN;
+    case ldqa_u16:
+        return MO_16;
+    case ldqa_s16:
+        return MO_16 | MO_SIGN;
+    case ldqa_u32:
+        return MO_32;
+    case ldqa_s32:
+        return MO_32 | MO_SIGN;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/**
+ * @brief Saturating add/sub. The signed results saturate to [-max, max], and an unsigned subtraction
+ * that underflows gives the maximum value, as the PIE does.
+ */
+static void gen_pie_adds(bool sub, ldqa_type type, uint32_t qz, uint32_t qx, uint32_t qy)
+{
+    const MemOp mop = pie_ldqa_memop(type);
+    const unsigned vece = mop & MO_SIZE;
+    const uint32_t z = pie_qreg_ofs(qz);
+    const uint32_t x = pie_qreg_ofs(qx);
+    const uint32_t y = pie_qreg_ofs(qy);
+    const uint32_t tmp = pie_tmp_ofs(0);
+
+    if (mop & MO_SIGN) {
+        const int64_t min = -(int64_t) MAKE_64BIT_MASK(0, (8 << vece) - 1);
+
+        if (sub) {
+            tcg_gen_gvec_sssub(vece, z, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        } else {
+            tcg_gen_gvec_ssadd(vece, z, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        }
+        tcg_gen_gvec_dup_imm(vece, tmp, PIE_VEC_SIZE, PIE_VEC_SIZE, min);
+        tcg_gen_gvec_smax(vece, z, z, tmp, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    } else if (sub) {
+        /* The lanes that borrow are all ones in tmp */
+        tcg_gen_gvec_cmp(TCG_COND_LTU, vece, tmp, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_sub(vece, z, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_or(vece, z, z, tmp, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    } else {
+        tcg_gen_gvec_usadd(vece, z, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    }
+}
+
+/**
+ * @brief Multiply the lanes and shift the products right by `sar`, keeping the low half of the result.
+ *
+ * There is no widening multiplication in gvec, so the even and the odd lanes are extended to lanes
+ * twice as large, where the products can't overflow, and merged back once shifted.
+ * Returns false if the type is not supported here.
+ */
+static bool gen_pie_mul_shift(vmul_type type, uint32_t qz, uint32_t qx, uint32_t qy, TCGv_i32 sar)
+{
+    const uint32_t z = pie_qreg_ofs(qz);
+    const uint32_t x = pie_qreg_ofs(qx);
+    const uint32_t y = pie_qreg_ofs(qy);
+    const uint32_t even = pie_tmp_ofs(0);
+    const uint32_t odd = pie_tmp_ofs(1);
+    const uint32_t tmp = pie_tmp_ofs(2);
+    TCGv_i32 shift;
+    unsigned vece;
+    unsigned bits;
+    bool sign;
+
+    switch (type) {
+    case vmul_s8:
+    case vmul_u8:
+        vece = MO_16;
+        sign = (type == vmul_s8);
+        break;
+    case vmul_s16:
+    case vmul_u16:
+        vece = MO_32;
+        sign = (type == vmul_s16);
+        break;
+    default:
+        return false;
+    }
+    /* Size of the source lanes, the products are computed on lanes of `vece` */
+    bits = 4 << vece;
+
+    if (sign) {
+        tcg_gen_gvec_shli(vece, even, x, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_sari(vece, even, even, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_shli(vece, tmp, y, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_sari(vece, tmp, tmp, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_mul(vece, even, even, tmp, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_sari(vece, odd, x, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_sari(vece, tmp, y, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_mul(vece, odd, odd, tmp, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    } else {
+        tcg_gen_gvec_andi(vece, even, x, MAKE_64BIT_MASK(0, bits), PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_andi(vece, tmp, y, MAKE_64BIT_MASK(0, bits), PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_mul(vece, even, even, tmp, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_shri(vece, odd, x, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_shri(vece, tmp, y, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_mul(vece, odd, odd, tmp, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    }
+
+    /* The vector shifts are only defined for counts smaller than the lane size */
+    shift = tcg_temp_new_i32();
+    tcg_gen_umin_i32(shift, sar, tcg_constant_i32(2 * bits - 1));
+    if (sign) {
+        tcg_gen_gvec_sars(vece, even, even, shift, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_sars(vece, odd, odd, shift, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    } else {
+        TCGv_i32 keep = tcg_temp_new_i32();
+        TCGv_i64 keep64 = tcg_temp_new_i64();
+
+        tcg_gen_gvec_shrs(vece, even, even, shift, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_shrs(vece, odd, odd, shift, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        /* An unsigned product shifted by the whole lane size or more is 0 */
+        tcg_gen_setcondi_i32(TCG_COND_LTU, keep, sar, 2 * bits);
+        tcg_gen_neg_i32(keep, keep);
+        tcg_gen_ext_i32_i64(keep64, keep);
+        tcg_gen_gvec_ands(MO_64, even, even, keep64, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_gen_gvec_ands(MO_64, odd, odd, keep64, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        tcg_temp_free_i64(keep64);
+        tcg_temp_free_i32(keep);
+    }
+    tcg_temp_free_i32(shift);
+
+    tcg_gen_gvec_andi(vece, even, even, MAKE_64BIT_MASK(0, bits), PIE_VEC_SIZE, PIE_VEC_SIZE);
+    tcg_gen_gvec_shli(vece, odd, odd, bits, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    tcg_gen_gvec_or(MO_64, z, even, odd, PIE_VEC_SIZE, PIE_VEC_SIZE);
+    return true;
+}
+
+/**
+ * @brief Lane size of the signed vmul_type operand types used by max, min and compare
+ */
+static bool pie_vmul_signed_vece(vmul_type type, unsigned *vece)
+{
+    switch (type) {
+    case vmul_s8:
+        *vece = MO_8;
+        return true;
+    case vmul_s16:
+        *vece = MO_16;
+        return true;
+    case vmul_s32:
+        *vece = MO_32;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Lanes are numbered from the least significant bits of each 64-bit half of
+ * a Q register, as the 64-bit load and store helpers already assume.
+ */
+
+/**
+ * @brief Move the lanes of the 32-bit value in `v` to the even lanes of the 64-bit value
+ */
+static void gen_pie_spread(TCGv_i64 v, vldbc_type width)
+{
+    TCGv_i64 t = tcg_temp_new_i64();
+
+    if (width != vldbc_32) {
+        tcg_gen_shli_i64(t, v, 16);
+        tcg_gen_or_i64(v, v, t);
+        tcg_gen_andi_i64(v, v, 0x0000ffff0000ffffull);
+    }
+    if (width == vldbc_8) {
+        tcg_gen_shli_i64(t, v, 8);
+        tcg_gen_or_i64(v, v, t);
+        tcg_gen_andi_i64(v, v, 0x00ff00ff00ff00ffull);
+    }
+    tcg_temp_free_i64(t);
+}
+
+/**
+ * @brief Opposite of gen_pie_spread(): gather the even lanes of `v` in its low 32 bits
+ */
+static void gen_pie_compact(TCGv_i64 v, vldbc_type width)
+{
+    TCGv_i64 t = tcg_temp_new_i64();
+
+    if (width == vldbc_8) {
+        tcg_gen_andi_i64(v, v, 0x00ff00ff00ff00ffull);
+        tcg_gen_shri_i64(t, v, 8);
+        tcg_gen_or_i64(v, v, t);
+    }
+    if (width != vldbc_32) {
+        tcg_gen_andi_i64(v, v, 0x0000ffff0000ffffull);
+        tcg_gen_shri_i64(t, v, 16);
+        tcg_gen_or_i64(v, v, t);
+    }
+    tcg_gen_ext32u_i64(v, v);
+    tcg_temp_free_i64(t);
+}
+
+/**
+ * @brief Interleave (zip) or deinterleave (unzip) the lanes of qs0 and qs1, in place
+ */
+static void gen_pie_zip(bool unzip, uint32_t qs0, uint32_t qs1, vldbc_type width)
+{
+    const unsigned lane_bits = 8 << width;
+    TCGv_i64 in[4];
+    TCGv_i64 out[4];
+    TCGv_i64 a = tcg_temp_new_i64();
+    TCGv_i64 b = tcg_temp_new_i64();
+
+    for (int i = 0; i < 4; i++) {
+        in[i] = tcg_temp_new_i64();
+        out[i] = tcg_temp_new_i64();
+        tcg_gen_ld_i64(in[i], tcg_env, pie_qreg_ofs(i < 2 ? qs0 : qs1) + (i & 1) * 8);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (unzip) {
+            /* qs0 gets the even lanes of qs0:qs1, qs1 the odd ones */
+            const int src = (i & 1) * 2;
+            const int odd = i >> 1;
+
+            tcg_gen_shri_i64(a, in[src], odd * lane_bits);
+            tcg_gen_shri_i64(b, in[src + 1], odd * lane_bits);
+            gen_pie_compact(a, width);
+            gen_pie_compact(b, width);
+            tcg_gen_deposit_i64(out[i], a, b, 32, 32);
+        } else {
+            /* Half i of the result comes from the i-th 32-bit part of both registers */
+            tcg_gen_extract_i64(a, in[(i >> 1)], (i & 1) * 32, 32);
+            tcg_gen_extract_i64(b, in[2 + (i >> 1)], (i & 1) * 32, 32);
+            gen_pie_spread(a, width);
+            gen_pie_spread(b, width);
+            tcg_gen_shli_i64(b, b, lane_bits);
+            tcg_gen_or_i64(out[i], a, b);
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        tcg_gen_st_i64(out[i], tcg_env, pie_qreg_ofs(i < 2 ? qs0 : qs1) + (i & 1) * 8);
+        tcg_temp_free_i64(in[i]);
+        tcg_temp_free_i64(out[i]);
+    }
+    tcg_temp_free_i64(a);
+    tcg_temp_free_i64(b);
+}
+
 void HELPER(vld_64_s3)(CPUXtensaState *env, uint32_t vec, uint64_t data, uint32_t low_high)
 {
     esp_qreg_t *avr = cpu_vec_ptr(env, vec);
@@ -300,34 +573,6 @@ void HELPER(vldhbc_16_s3)(CPUXtensaState *env, uint32_t vec, uint64_t data)
     return;
 }
 
-void HELPER(vldbc_s3)(CPUXtensaState *env, uint32_t vec, uint32_t data, uint32_t bc_bits)
-{
-    esp_qreg_t *avr = cpu_vec_ptr(env, vec);
-    if (vldbc_8 == bc_bits)
-    {
-        for (int i=0 ; i< 16 ; i++)
-        {
-            avr->u8[i] = data&0xff;
-        }
-    } else if (vldbc_16 == bc_bits)
-    {
-        for (int i=0 ; i< 8 ; i++)
-        {
-            avr->u16[i] = data&0xffff;
-        }
-    } else if (vldbc_32 == bc_bits)
-    {
-        for (int i=0 ; i< 4 ; i++)
-        {
-            avr->u32[i] = data;
-        }
-    } else
-    {
-        qemu_log_mask(LOG_GUEST_ERROR, "unknown instruction extension! \n");
-    }
-    return;
-}
-
 uint64_t HELPER(vst_64_s3)(CPUXtensaState *env, uint32_t vec, uint32_t low_high)
 {
     CPUXtensaEsp32s3State* tie = (CPUXtensaEsp32s3State*)(env->ext);
@@ -654,10 +899,6 @@ static void translate_vldhbc_s3(DisasContext *dc, const OpcodeArg arg[], const u
 static void translate_vldbc_s3(DisasContext *dc, const OpcodeArg arg[], const uint32_t par[])
 {
     MemOp mop = MO_8;
-    TCGv_i32 index;
-    index = tcg_constant_i32((uint32_t)arg[0].imm);
-    TCGv_i32 ldbc_type = tcg_constant_i32(par[1]);
-
     TCGv_i32 addr = tcg_temp_new_i32();
 
     if (vldbc_8 == par[1])
@@ -681,11 +922,12 @@ static void translate_vldbc_s3(DisasContext *dc, const OpcodeArg arg[], const ui
     // Read data from memory
     tcg_gen_qemu_ld_i32(data, addr, dc->cring, mop);
 
-    gen_helper_vldbc_s3(tcg_env, index, data, ldbc_type);
+    // vldbc_8/16/32 are used as the MO_8/16/32 lane sizes
+    QEMU_BUILD_BUG_ON((int)vldbc_8 != MO_8 || (int)vldbc_16 != MO_16 || (int)vldbc_32 != MO_32);
+    tcg_gen_gvec_dup_i32(par[1], pie_qreg_ofs(arg[0].imm), PIE_VEC_SIZE, PIE_VEC_SIZE, data);
 
     tcg_temp_free_i32(data);
     tcg_temp_free_i32(addr);
-    tcg_temp_free_i32(index);
 
     if (par[0] == addr_ip)
     {
@@ -1356,108 +1598,10 @@ static void translate_movi_s3(DisasContext *dc, const OpcodeArg arg[], const uin
     tcg_temp_free_i32(sel);
 }
 
-void HELPER(vzip_s3)(CPUXtensaState *env, uint32_t qs0, uint32_t qs1, uint32_t width)
-{
-    CPUXtensaEsp32s3State* tie = (CPUXtensaEsp32s3State*)(env->ext);
-    Q_reg q_copy[2];
-    Q_reg* q0 =  &tie->Q[qs0];
-    Q_reg* q1 =  &tie->Q[qs1];
-    q_copy[0].u64[0] = q0->u64[0];
-    q_copy[0].u64[1] = q0->u64[1];
-    q_copy[1].u64[0] = q1->u64[0];
-    q_copy[1].u64[1] = q1->u64[1];
-    if (vldbc_8 == (vldbc_type)width)
-    {
-        for (int i=0 ; i< 8 ; i++)
-        {
-            q0->u8[i*2 + 0] = q_copy[0].u8[i];
-            q0->u8[i*2 + 1] = q_copy[1].u8[i];
-
-            q1->u8[i*2 + 0] = q_copy[0].u8[i + 8];
-            q1->u8[i*2 + 1] = q_copy[1].u8[i + 8];
-        }
-    } else if (vldbc_16 == (vldbc_type)width)
-    {
-        for (int i=0 ; i< 4 ; i++)
-        {
-            q0->u16[i*2 + 0] = q_copy[0].u16[i];
-            q0->u16[i*2 + 1] = q_copy[1].u16[i];
-
-            q1->u16[i*2 + 0] = q_copy[0].u16[i + 4];
-            q1->u16[i*2 + 1] = q_copy[1].u16[i + 4];
-        }
-
-    } else if (vldbc_32 == (vldbc_type)width)
-    {
-        for (int i=0 ; i< 2 ; i++)
-        {
-            q0->u32[i*2 + 0] = q_copy[0].u32[i];
-            q0->u32[i*2 + 1] = q_copy[1].u32[i];
-
-            q1->u32[i*2 + 0] = q_copy[0].u32[i + 2];
-            q1->u32[i*2 + 1] = q_copy[1].u32[i + 2];
-        }
-    }
-}
-
-void HELPER(vunzip_s3)(CPUXtensaState *env, uint32_t qs0, uint32_t qs1, uint32_t width)
-{
-    CPUXtensaEsp32s3State* tie = (CPUXtensaEsp32s3State*)(env->ext);
-    Q_reg q_copy[2];
-    Q_reg* q0 =  &tie->Q[qs0];
-    Q_reg* q1 =  &tie->Q[qs1];
-    q_copy[0].u64[0] = q0->u64[0];
-    q_copy[0].u64[1] = q0->u64[1];
-    q_copy[1].u64[0] = q1->u64[0];
-    q_copy[1].u64[1] = q1->u64[1];
-    if (vldbc_8 == (vldbc_type)width)
-    {
-        for (int i=0 ; i< 8 ; i++)
-        {
-            q0->u8[i]     = q_copy[0].u8[i*2 + 0];
-            q0->u8[i + 8] = q_copy[1].u8[i*2 + 0];
-
-            q1->u8[i]     = q_copy[0].u8[i*2 + 1];
-            q1->u8[i + 8] = q_copy[1].u8[i*2 + 1];
-        }
-    } else if (vldbc_16 == (vldbc_type)width)
-    {
-        for (int i=0 ; i< 4 ; i++)
-        {
-            q0->u16[i]     = q_copy[0].u16[i*2 + 0];
-            q0->u16[i + 4] = q_copy[1].u16[i*2 + 0];
-
-            q1->u16[i]     = q_copy[0].u16[i*2 + 1];
-            q1->u16[i + 4] = q_copy[1].u16[i*2 + 1];
-        }
-    } else if (vldbc_32 == (vldbc_type)width)
-    {
-        for (int i=0 ; i< 2 ; i++)
-        {
-            q0->u32[i]     = q_copy[0].u32[i*2 + 0];
-            q0->u32[i + 2] = q_copy[1].u32[i*2 + 0];
-
-            q1->u32[i]     = q_copy[0].u32[i*2 + 1];
-            q1->u32[i + 2] = q_copy[1].u32[i*2 + 1];
-        }
-    }
-}
-
 static void translate_zip_s3(DisasContext *dc, const OpcodeArg arg[], const uint32_t par[])
 {
-    TCGv_i32 qs0  = tcg_constant_i32((uint32_t)arg[0].imm);
-    TCGv_i32 qs1  = tcg_constant_i32((uint32_t)arg[1].imm);
-    TCGv_i32 width  = tcg_constant_i32((uint32_t)par[1]);
-    if (0 == par[0]) // zip operation
-    {
-        gen_helper_vzip_s3(tcg_env, qs0, qs1, width);
-    } else // unzip operation
-    {
-        gen_helper_vunzip_s3(tcg_env, qs0, qs1, width);
-    }
-    tcg_temp_free_i32(qs0);
-    tcg_temp_free_i32(qs1);
-    tcg_temp_free_i32(width);
+    // par[0]: 0 for zip, 1 for unzip, par[1]: vldbc_8/16/32 lane size
+    gen_pie_zip(par[0] != 0, arg[0].imm, arg[1].imm, par[1]);
 }
 
 
@@ -1655,7 +1799,11 @@ static void translate_vadds_s3(DisasContext *dc, const OpcodeArg arg[], const ui
     TCGv_i32 qy  = tcg_constant_i32((uint32_t)arg[start_index + 2].imm);
     TCGv_i32 op_type  = tcg_constant_i32((uint32_t)par[0]);
 
-    if (ee_add_op == (ee_arithmetic_type)par[3])
+    if (par[0] <= ldqa_s32)
+    {
+        gen_pie_adds(ee_sub_op == (ee_arithmetic_type)par[3], par[0],
+                     arg[start_index + 0].imm, arg[start_index + 1].imm, arg[start_index + 2].imm);
+    } else if (ee_add_op == (ee_arithmetic_type)par[3])
     {
         gen_helper_vadds_s3(tcg_env, qz, qx, qy, op_type);
     } else if (ee_sub_op == (ee_arithmetic_type)par[3])
@@ -1729,12 +1877,11 @@ static void translate_vmul_s3(DisasContext *dc, const OpcodeArg arg[], const uin
     TCGv_i32 qx  = tcg_constant_i32((uint32_t)arg[start_index + 1].imm);
     TCGv_i32 qy  = tcg_constant_i32((uint32_t)arg[start_index + 2].imm);
     TCGv_i32 op_type  = tcg_constant_i32((uint32_t)par[0]);
-    if (dc->sar_m32_5bit)
-    {
-        gen_helper_vmul_s3(tcg_env, qz, qx, qy, dc->sar_m32, op_type);
-    } else 
+    TCGv_i32 sar = dc->sar_m32_5bit ? dc->sar_m32 : cpu_SR[SAR];
+    if (!gen_pie_mul_shift(par[0], arg[start_index + 0].imm, arg[start_index + 1].imm,
+                           arg[start_index + 2].imm, sar))
     {
-        gen_helper_vmul_s3(tcg_env, qz, qx, qy, cpu_SR[SAR], op_type);
+        gen_helper_vmul_s3(tcg_env, qz, qx, qy, sar, op_type);
     }
     tcg_temp_free_i32(op_type);
     tcg_temp_free_i32(qz);
@@ -2383,8 +2530,16 @@ static void translate_vmax_s3(DisasContext *dc, const OpcodeArg arg[], const uin
     TCGv_i32 qx = tcg_constant_i32((uint32_t)arg[start_index + 1].imm);
     TCGv_i32 qy = tcg_constant_i32((uint32_t)arg[start_index + 2].imm);
     TCGv_i32 op_type = tcg_constant_i32((uint32_t)par[0]);
+    unsigned vece;
 
-    gen_helper_vmax_s3(tcg_env, qz, qx, qy, op_type);
+    if (pie_vmul_signed_vece(par[0], &vece))
+    {
+        tcg_gen_gvec_smax(vece, pie_qreg_ofs(arg[start_index + 0].imm), pie_qreg_ofs(arg[start_index + 1].imm),
+                         pie_qreg_ofs(arg[start_index + 2].imm), PIE_VEC_SIZE, PIE_VEC_SIZE);
+    } else
+    {
+        gen_helper_vmax_s3(tcg_env, qz, qx, qy, op_type);
+    }
     
     tcg_temp_free_i32(qz);
     tcg_temp_free_i32(qx);
@@ -2462,8 +2617,16 @@ static void translate_vmin_s3(DisasContext *dc, const OpcodeArg arg[], const uin
     TCGv_i32 qx = tcg_constant_i32((uint32_t)arg[start_index + 1].imm);
     TCGv_i32 qy = tcg_constant_i32((uint32_t)arg[start_index + 2].imm);
     TCGv_i32 op_type = tcg_constant_i32((uint32_t)par[0]);
+    unsigned vece;
 
-    gen_helper_vmin_s3(tcg_env, qz, qx, qy, op_type);
+    if (pie_vmul_signed_vece(par[0], &vece))
+    {
+        tcg_gen_gvec_smin(vece, pie_qreg_ofs(arg[start_index + 0].imm), pie_qreg_ofs(arg[start_index + 1].imm),
+                         pie_qreg_ofs(arg[start_index + 2].imm), PIE_VEC_SIZE, PIE_VEC_SIZE);
+    } else
+    {
+        gen_helper_vmin_s3(tcg_env, qz, qx, qy, op_type);
+    }
     
     tcg_temp_free_i32(qz);
     tcg_temp_free_i32(qx);
@@ -2614,8 +2777,21 @@ static void translate_vcmp_s3(DisasContext *dc, const OpcodeArg arg[], const uin
 
     TCGv_i32 op_type = tcg_constant_i32((uint32_t)par[0]);
     TCGv_i32 op_sel = tcg_constant_i32((uint32_t)par[1]);
+    static const TCGCond vcmp_cond[] = {
+        [ee_vcmp_eq] = TCG_COND_EQ,
+        [ee_vcmp_lt] = TCG_COND_LT,
+        [ee_vcmp_gt] = TCG_COND_GT,
+    };
+    unsigned vece;
 
-    gen_helper_vcmp_s3(tcg_env, qz, qx, qy, op_type, op_sel);
+    if (par[1] < ARRAY_SIZE(vcmp_cond) && pie_vmul_signed_vece(par[0], &vece))
+    {
+        tcg_gen_gvec_cmp(vcmp_cond[par[1]], vece, pie_qreg_ofs(arg[0].imm), pie_qreg_ofs(arg[1].imm),
+                         pie_qreg_ofs(arg[2].imm), PIE_VEC_SIZE, PIE_VEC_SIZE);
+    } else
+    {
+        gen_helper_vcmp_s3(tcg_env, qz, qx, qy, op_type, op_sel);
+    }
     
     tcg_temp_free_i32(qz);
     tcg_temp_free_i32(qx);
@@ -2669,8 +2845,28 @@ static void translate_bw_logic_s3(DisasContext *dc, const OpcodeArg arg[], const
     TCGv_i32 qy = tcg_constant_i32((uint32_t)arg[y_index].imm);
 
     TCGv_i32 op_type = tcg_constant_i32((uint32_t)par[0]);
+    const uint32_t z = pie_qreg_ofs(arg[0].imm);
+    const uint32_t x = pie_qreg_ofs(arg[1].imm);
+    const uint32_t y = pie_qreg_ofs(arg[y_index].imm);
 
-    gen_helper_bw_logic_s3(tcg_env, qz, qx, qy, op_type);
+    switch (par[0])
+    {
+    case bw_logic_or:
+        tcg_gen_gvec_or(MO_64, z, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        break;
+    case bw_logic_and:
+        tcg_gen_gvec_and(MO_64, z, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        break;
+    case bw_logic_xor:
+        tcg_gen_gvec_xor(MO_64, z, x, y, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        break;
+    case bw_logic_not:
+        tcg_gen_gvec_not(MO_64, z, x, PIE_VEC_SIZE, PIE_VEC_SIZE);
+        break;
+    default:
+        gen_helper_bw_logic_s3(tcg_env, qz, qx, qy, op_type);
+        break;
+    }
     
     tcg_temp_free_i32(qz);
     tcg_temp_free_i32(qx);
@@ -84,11 +84,43 @@ void xtensa_sync_phys_from_window(CPUXtensaState *env)
     copy_phys_from_window(env, env->sregs[WINDOW_BASE] * 4, 0, 16);
 }
 
+/*
+ * Only the registers outside of the current window are kept up to date in
+ * phys_regs, so when the windows overlap (call4/8/12, retw, rotw by up to
+ * 3) just the quads that leave and enter the window need to be copied, the
+ * others are moved within env->regs.
+ */
 static void xtensa_rotate_window_abs(CPUXtensaState *env, uint32_t position)
 {
-    xtensa_sync_phys_from_window(env);
-    env->sregs[WINDOW_BASE] = windowbase_bound(position, env);
-    xtensa_sync_window_from_phys(env);
+    uint32_t nareg = env->config->nareg;
+    uint32_t old_base = windowbase_bound(env->sregs[WINDOW_BASE], env);
+    uint32_t new_base = windowbase_bound(position, env);
+    uint32_t fwd = windowbase_bound(new_base - old_base, env);
+    uint32_t back = windowbase_bound(old_base - new_base, env);
+
+    if (fwd == 0) {
+        env->sregs[WINDOW_BASE] = new_base;
+    } else if (fwd < 4) {
+        uint32_t n = fwd * 4;
+
+        copy_phys_from_window(env, old_base * 4, 0, n);
+        memmove(env->regs, env->regs + n, (16 - n) * sizeof(uint32_t));
+        env->sregs[WINDOW_BASE] = new_base;
+        copy_window_from_phys(env, 16 - n,
+                              (new_base * 4 + 16 - n) % nareg, n);
+    } else if (back < 4) {
+        uint32_t n = back * 4;
+
+        copy_phys_from_window(env, (old_base * 4 + 16 - n) % nareg,
+                              16 - n, n);
+        memmove(env->regs + n, env->regs, (16 - n) * sizeof(uint32_t));
+        env->sregs[WINDOW_BASE] = new_base;
+        copy_window_from_phys(env, 0, new_base * 4, n);
+    } else {
+        xtensa_sync_phys_from_window(env);
+        env->sregs[WINDOW_BASE] = new_base;
+        xtensa_sync_window_from_phys(env);
+    }
 }
 
 void xtensa_rotate_window(CPUXtensaState *env, uint32_t delta)
@@ -101,15 +133,6 @@ void HELPER(sync_windowbase)(CPUXtensaState *env)
     xtensa_rotate_window_abs(env, env->windowbase_next);
 }
 
-void HELPER(entry)(CPUXtensaState *env, uint32_t pc, uint32_t s, uint32_t imm)
-{
-    int callinc = (env->sregs[PS] & PS_CALLINC) >> PS_CALLINC_SHIFT;
-
-    env->regs[(callinc << 2) | (s & 3)] = env->regs[s] - imm;
-    env->windowbase_next = env->sregs[WINDOW_BASE] + callinc;
-    env->sregs[WINDOW_START] |= windowstart_bit(env->windowbase_next, env);
-}
-
 void HELPER(window_check)(CPUXtensaState *env, uint32_t pc, uint32_t w)
 {
     uint32_t windowbase = windowbase_bound(env->sregs[WINDOW_BASE], env);
@@ -0,0 +1,297 @@
+/*
+ * QTests for the multi-block DMA transfers of the ESP32 SD/MMC Host Controller
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ *
+ * The IDMAC merges the descriptors pointing to consecutive buffers into a
+ * single CMD18/CMD25 transfer, which the card serves with a single backend
+ * request. Runs are split on non-contiguous buffers and after 32 descriptors.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/units.h"
+#include "libqtest.h"
+
+#define SDMMC_BASE          0x3ff68000
+#define SDMMC_CTRL          0x00
+#define SDMMC_BLKSIZ        0x1c
+#define SDMMC_BYTCNT        0x20
+#define SDMMC_CMDARG        0x28
+#define SDMMC_CMD           0x2c
+#define SDMMC_RESP0         0x30
+#define SDMMC_RINTSTS       0x44
+#define SDMMC_DBADDR        0x88
+#define SDMMC_IDSTS         0x8c
+
+#define SDMMC_CTRL_DMAEN        BIT(5)
+
+#define SDMMC_CMD_RESP_EXPECT   BIT(6)
+#define SDMMC_CMD_RESP_LONG     BIT(7)
+#define SDMMC_CMD_DATA_EXPECTED BIT(9)
+#define SDMMC_CMD_WRITE         BIT(10)
+#define SDMMC_CMD_AUTO_STOP     BIT(12)
+#define SDMMC_CMD_START         BIT(31)
+
+#define SDMMC_INT_ACD           BIT(14)
+#define SDMMC_INT_DATA_OVER     BIT(3)
+#define SDMMC_INT_CMD_DONE      BIT(2)
+
+#define SDMMC_IDSTS_RI          BIT(1)
+#define SDMMC_IDSTS_TI          BIT(0)
+
+#define SDMMC_DESC_LAST         BIT(2)
+#define SDMMC_DESC_FIRST        BIT(3)
+#define SDMMC_DESC_CHAINED      BIT(4)
+#define SDMMC_DESC_OWN          BIT(31)
+#define SDMMC_DESC_SIZE         16
+
+/* Descriptors and buffers live in the internal DRAM */
+#define DESC_BASE           0x3ffb0000
+#define BUF_BASE            0x3ffb1000
+#define BUF_GAP             0x200
+
+#define BLOCK_SIZE          512
+#define MAX_BLOCKS          40
+
+/* 1 MiB image: SDSC card, the addresses are in bytes */
+#define TEST_IMAGE_SIZE     (1 * MiB)
+
+static char *sd_path;
+
+static uint32_t sdmmc_cmd(QTestState *qts, uint32_t cmd, uint32_t arg,
+                          uint32_t flags)
+{
+    qtest_writel(qts, SDMMC_BASE + SDMMC_RINTSTS, UINT32_MAX);
+    qtest_writel(qts, SDMMC_BASE + SDMMC_CMDARG, arg);
+    qtest_writel(qts, SDMMC_BASE + SDMMC_CMD, SDMMC_CMD_START | flags | cmd);
+
+    g_assert(qtest_readl(qts, SDMMC_BASE + SDMMC_RINTSTS) &
+             SDMMC_INT_CMD_DONE);
+    return qtest_readl(qts, SDMMC_BASE + SDMMC_RESP0);
+}
+
+static QTestState *setup_sd_card(void)
+{
+    QTestState *qts;
+    uint32_t rca;
+
+    qts = qtest_initf("-machine esp32 "
+                      "-drive if=sd,format=raw,file=%s", sd_path);
+
+    sdmmc_cmd(qts, 0, 0, 0);
+    sdmmc_cmd(qts, 8, 0x1aa, SDMMC_CMD_RESP_EXPECT);
+    sdmmc_cmd(qts, 55, 0, SDMMC_CMD_RESP_EXPECT);
+    sdmmc_cmd(qts, 41, 0x00ff8000, SDMMC_CMD_RESP_EXPECT);
+    sdmmc_cmd(qts, 2, 0, SDMMC_CMD_RESP_EXPECT | SDMMC_CMD_RESP_LONG);
+    rca = sdmmc_cmd(qts, 3, 0, SDMMC_CMD_RESP_EXPECT) >> 16;
+    sdmmc_cmd(qts, 7, rca << 16, SDMMC_CMD_RESP_EXPECT);
+
+    qtest_writel(qts, SDMMC_BASE + SDMMC_CTRL, SDMMC_CTRL_DMAEN);
+    qtest_writel(qts, SDMMC_BASE + SDMMC_BLKSIZ, BLOCK_SIZE);
+    return qts;
+}
+
+/* The buffers follow each other, except from descriptor @gap on */
+static uint32_t buf_addr(int i, int gap)
+{
+    return BUF_BASE + i * BLOCK_SIZE + (i >= gap ? BUF_GAP : 0);
+}
+
+static void setup_descs(QTestState *qts, int blocks, int gap)
+{
+    for (int i = 0; i < blocks; i++) {
+        uint32_t desc = DESC_BASE + i * SDMMC_DESC_SIZE;
+        uint32_t flags = SDMMC_DESC_OWN | SDMMC_DESC_CHAINED;
+
+        if (i == 0) {
+            flags |= SDMMC_DESC_FIRST;
+        }
+        if (i == blocks - 1) {
+            flags |= SDMMC_DESC_LAST;
+        }
+        qtest_writel(qts, desc, flags);
+        qtest_writel(qts, desc + 4, BLOCK_SIZE);
+        qtest_writel(qts, desc + 8, buf_addr(i, gap));
+        qtest_writel(qts, desc + 12, desc + SDMMC_DESC_SIZE);
+    }
+}
+
+static void sdmmc_dma(QTestState *qts, bool is_write, uint32_t addr,
+                      int blocks, int gap)
+{
+    uint32_t flags = SDMMC_CMD_RESP_EXPECT | SDMMC_CMD_DATA_EXPECTED |
+                     SDMMC_CMD_AUTO_STOP;
+    uint32_t rintsts;
+
+    setup_descs(qts, blocks, gap);
+    qtest_writel(qts, SDMMC_BASE + SDMMC_IDSTS, UINT32_MAX);
+    qtest_writel(qts, SDMMC_BASE + SDMMC_BYTCNT, blocks * BLOCK_SIZE);
+    qtest_writel(qts, SDMMC_BASE + SDMMC_DBADDR, DESC_BASE);
+
+    if (is_write) {
+        sdmmc_cmd(qts, 25, addr, flags | SDMMC_CMD_WRITE);
+    } else {
+        sdmmc_cmd(qts, 18, addr, flags);
+    }
+
+    rintsts = qtest_readl(qts, SDMMC_BASE + SDMMC_RINTSTS);
+    g_assert(rintsts & SDMMC_INT_DATA_OVER);
+    g_assert(rintsts & SDMMC_INT_ACD);
+    g_assert(qtest_readl(qts, SDMMC_BASE + SDMMC_IDSTS) &
+             (is_write ? SDMMC_IDSTS_TI : SDMMC_IDSTS_RI));
+    g_assert_cmpuint(qtest_readl(qts, SDMMC_BASE + SDMMC_BYTCNT), ==, 0);
+
+    /* All the descriptors are handed back to the software */
+    for (int i = 0; i < blocks; i++) {
+        g_assert_false(qtest_readl(qts, DESC_BASE + i * SDMMC_DESC_SIZE) &
+                       SDMMC_DESC_OWN);
+    }
+}
+
+/* Fill @blocks blocks of the image at @addr, no two blocks are the same */
+static void write_sd_image(uint32_t addr, int blocks, uint8_t seed)
+{
+    g_autofree uint8_t *data = g_malloc(blocks * BLOCK_SIZE);
+    int fd, ret;
+
+    for (int i = 0; i < blocks * BLOCK_SIZE; i++) {
+        data[i] = (seed + i / BLOCK_SIZE) ^ i;
+    }
+
+    fd = open(sd_path, O_WRONLY);
+    g_assert(fd >= 0);
+    ret = pwrite(fd, data, blocks * BLOCK_SIZE, addr);
+    close(fd);
+    g_assert(ret == blocks * BLOCK_SIZE);
+}
+
+/* Read @blocks blocks with a DMA transfer and check them against the image */
+static void sdread_check(QTestState *qts, uint32_t addr, int blocks, int gap)
+{
+    uint8_t buf[BLOCK_SIZE];
+    uint8_t rbuf[BLOCK_SIZE];
+    int fd, ret;
+
+    sdmmc_dma(qts, false, addr, blocks, gap);
+
+    fd = open(sd_path, O_RDONLY);
+    g_assert(fd >= 0);
+    for (int i = 0; i < blocks; i++) {
+        ret = pread(fd, buf, BLOCK_SIZE, addr + i * BLOCK_SIZE);
+        g_assert(ret == BLOCK_SIZE);
+        qtest_memread(qts, buf_addr(i, gap), rbuf, BLOCK_SIZE);
+        g_assert(!memcmp(rbuf, buf, BLOCK_SIZE));
+    }
+    close(fd);
+}
+
+/* Check a run of contiguous buffers is read in one go */
+static void test_read_contiguous(void)
+{
+    QTestState *qts = setup_sd_card();
+
+    write_sd_image(0x4000, 4, 0x10);
+    sdread_check(qts, 0x4000, 4, MAX_BLOCKS);
+
+    qtest_quit(qts);
+}
+
+/* Check the transfer is split where the buffers stop being contiguous */
+static void test_read_split(void)
+{
+    QTestState *qts = setup_sd_card();
+
+    write_sd_image(0x8200, 5, 0x20);
+    sdread_check(qts, 0x8200, 5, 4);
+
+    qtest_quit(qts);
+}
+
+/* Check more descriptors than the IDMAC merges at once */
+static void test_read_long(void)
+{
+    QTestState *qts = setup_sd_card();
+
+    write_sd_image(0x20000, MAX_BLOCKS, 0x40);
+    sdread_check(qts, 0x20000, MAX_BLOCKS, MAX_BLOCKS);
+
+    qtest_quit(qts);
+}
+
+/* Check a multi-block write reaches the image, then read it back */
+static void test_write(void)
+{
+    const uint32_t addr = TEST_IMAGE_SIZE - 5 * BLOCK_SIZE;
+    QTestState *qts = setup_sd_card();
+    uint8_t buf[BLOCK_SIZE];
+    int fd, ret;
+
+    for (int i = 0; i < 5; i++) {
+        memset(buf, 0xa0 + i, BLOCK_SIZE);
+        qtest_memwrite(qts, buf_addr(i, 4), buf, BLOCK_SIZE);
+    }
+    sdmmc_dma(qts, true, addr, 5, 4);
+
+    fd = open(sd_path, O_RDONLY);
+    g_assert(fd >= 0);
+    for (int i = 0; i < 5; i++) {
+        ret = pread(fd, buf, BLOCK_SIZE, addr + i * BLOCK_SIZE);
+        g_assert(ret == BLOCK_SIZE);
+        g_assert_cmphex(buf[0], ==, 0xa0 + i);
+        g_assert_cmphex(buf[BLOCK_SIZE - 1], ==, 0xa0 + i);
+    }
+    close(fd);
+
+    /* Read the blocks back, in a different layout */
+    qtest_memset(qts, BUF_BASE, 0, MAX_BLOCKS * BLOCK_SIZE + BUF_GAP);
+    sdread_check(qts, addr, 5, 2);
+
+    qtest_quit(qts);
+}
+
+static void drive_destroy(void)
+{
+    unlink(sd_path);
+    g_free(sd_path);
+}
+
+static void drive_create(void)
+{
+    int fd, ret;
+    GError *error = NULL;
+
+    /* Create a temporary raw image */
+    fd = g_file_open_tmp("esp32_sdmmc_XXXXXX", &sd_path, &error);
+    if (fd == -1) {
+        fprintf(stderr, "unable to create sdmmc file: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_assert(sd_path != NULL);
+
+    ret = ftruncate(fd, TEST_IMAGE_SIZE);
+    g_assert_cmpint(ret, ==, 0);
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    drive_create();
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("esp32_sdmmc/read_contiguous", test_read_contiguous);
+    qtest_add_func("esp32_sdmmc/read_split", test_read_split);
+    qtest_add_func("esp32_sdmmc/read_long", test_read_long);
+    qtest_add_func("esp32_sdmmc/write", test_write);
+
+    ret = g_test_run();
+    drive_destroy();
+    return ret;
+}
@@ -0,0 +1,310 @@
+/*
+ * QTest testcase for the M25P80 Flash (Using the ESP32-C3 SPI1 Controller)
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "libqtest-single.h"
+#include "qemu/bitops.h"
+
+/*
+ * ESP32-C3 SPI1 Controller registers
+ */
+#define SPI1_BASE           0x60002000
+
+#define R_CMD               0x00
+#define   CMD_FLASH_READ       BIT(31)
+#define   CMD_USR              BIT(18)
+#define R_ADDR              0x04
+#define R_USER              0x18
+#define   USER_COMMAND         BIT(31)
+#define   USER_ADDR            BIT(30)
+#define   USER_DUMMY           BIT(29)
+#define   USER_MISO            BIT(28)
+#define   USER_MOSI            BIT(27)
+#define R_USER1             0x1c
+#define   USER1_ADDR_BITLEN_SHIFT     26
+#define R_USER2             0x20
+#define   USER2_COMMAND_BITLEN_SHIFT  28
+#define R_MOSI_DLEN         0x24
+#define R_MISO_DLEN         0x28
+#define R_W0                0x58
+
+/* Size of the W0..W15 data registers */
+#define SPI_BUF_SIZE        64
+
+/*
+ * Flash commands
+ */
+enum {
+    READ = 0x03,
+    FAST_READ = 0x0b,
+    PP = 0x02,
+    WREN = 0x6,
+    ERASE_4K = 0x20,
+};
+
+/* w25x16, which models the 8 dummy cycles of FAST_READ as 8 bytes */
+#define FLASH_SIZE          (2 * MiB)
+#define FAST_READ_DUMMY     (8 * 8)
+
+#define FLASH_SECTOR_SIZE   (4 * KiB)
+
+/* Sector erased and programmed by the write tests, not read by the others */
+#define WRITE_SECTOR_ADDR   (FLASH_SIZE / 2)
+
+/*
+ * Content of the flash image, different for each byte of a page and for
+ * each page of the flash.
+ */
+static uint8_t flash_pattern(uint32_t addr)
+{
+    addr %= FLASH_SIZE;
+    return (addr * 7) ^ (addr >> 8) ^ (addr >> 16);
+}
+
+static void spi_write_buf(const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i += 4) {
+        uint32_t word = 0;
+
+        for (size_t j = 0; j < 4 && i + j < len; j++) {
+            word |= buf[i + j] << (j * 8);
+        }
+        writel(SPI1_BASE + R_W0 + i, word);
+    }
+}
+
+static void spi_read_buf(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i += 4) {
+        uint32_t word = readl(SPI1_BASE + R_W0 + i);
+
+        for (size_t j = 0; j < 4 && i + j < len; j++) {
+            buf[i + j] = word >> (j * 8);
+        }
+    }
+}
+
+/*
+ * Run a user command with a 24-bit address, the data phase is read from
+ * the flash if rx_len is not 0, written to it if tx_len is not 0.
+ */
+static void spi_user_cmd(uint8_t cmd, bool with_addr, uint32_t addr,
+                         uint32_t dummy_cycles, size_t tx_len, size_t rx_len)
+{
+    uint32_t user = USER_COMMAND;
+    uint32_t user1 = 0;
+
+    if (with_addr) {
+        user |= USER_ADDR;
+        user1 |= 23 << USER1_ADDR_BITLEN_SHIFT;
+    }
+    if (dummy_cycles) {
+        user |= USER_DUMMY;
+        user1 |= dummy_cycles - 1;
+    }
+    if (tx_len) {
+        user |= USER_MOSI;
+        writel(SPI1_BASE + R_MOSI_DLEN, tx_len * 8 - 1);
+    }
+    if (rx_len) {
+        user |= USER_MISO;
+        writel(SPI1_BASE + R_MISO_DLEN, rx_len * 8 - 1);
+    }
+
+    writel(SPI1_BASE + R_USER, user);
+    writel(SPI1_BASE + R_USER1, user1);
+    writel(SPI1_BASE + R_USER2, (7 << USER2_COMMAND_BITLEN_SHIFT) | cmd);
+    writel(SPI1_BASE + R_ADDR, addr);
+    writel(SPI1_BASE + R_CMD, CMD_USR);
+}
+
+static void read_flash(uint8_t cmd, uint32_t dummy_cycles, uint32_t addr,
+                       uint8_t *buf, size_t len)
+{
+    spi_user_cmd(cmd, true, addr, dummy_cycles, 0, len);
+    spi_read_buf(buf, len);
+}
+
+static void erase_sector(uint32_t addr)
+{
+    spi_user_cmd(WREN, false, 0, 0, 0, 0);
+    spi_user_cmd(ERASE_4K, true, addr, 0, 0, 0);
+}
+
+static void program_flash(uint32_t addr, const uint8_t *buf, size_t len)
+{
+    spi_write_buf(buf, len);
+    spi_user_cmd(WREN, false, 0, 0, 0, 0);
+    spi_user_cmd(PP, true, addr, 0, len, 0);
+}
+
+static void test_read(void)
+{
+    static const uint32_t addrs[] = {
+        0, 0x1234, 0x10000 - 32, FLASH_SIZE - SPI_BUF_SIZE,
+    };
+    uint8_t buf[SPI_BUF_SIZE];
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(addrs); i++) {
+        read_flash(READ, 0, addrs[i], buf, sizeof(buf));
+        for (j = 0; j < sizeof(buf); j++) {
+            g_assert_cmphex(buf[j], ==, flash_pattern(addrs[i] + j));
+        }
+    }
+
+    /* Shorter than the data registers */
+    read_flash(READ, 0, 0x4321, buf, 5);
+    for (j = 0; j < 5; j++) {
+        g_assert_cmphex(buf[j], ==, flash_pattern(0x4321 + j));
+    }
+}
+
+static void test_read_wrap(void)
+{
+    uint32_t addr = FLASH_SIZE - 16;
+    uint8_t buf[SPI_BUF_SIZE];
+    int i;
+
+    /* The address wraps around at the end of the flash */
+    read_flash(READ, 0, addr, buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, flash_pattern(addr + i));
+    }
+}
+
+static void test_fast_read(void)
+{
+    uint32_t addr = 0x2468;
+    uint8_t buf[SPI_BUF_SIZE];
+    int i;
+
+    read_flash(FAST_READ, FAST_READ_DUMMY, addr, buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, flash_pattern(addr + i));
+    }
+}
+
+static void test_flash_read_cmd(void)
+{
+    uint32_t addr = 0x13570;
+    uint8_t buf[SPI_BUF_SIZE];
+    int i;
+
+    /* FLASH_READ sends READ with the address length of USER1 */
+    writel(SPI1_BASE + R_USER1, 23 << USER1_ADDR_BITLEN_SHIFT);
+    writel(SPI1_BASE + R_MISO_DLEN, sizeof(buf) * 8 - 1);
+    writel(SPI1_BASE + R_ADDR, addr);
+    writel(SPI1_BASE + R_CMD, CMD_FLASH_READ);
+
+    spi_read_buf(buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, flash_pattern(addr + i));
+    }
+}
+
+static void test_erase_sector(void)
+{
+    uint8_t buf[SPI_BUF_SIZE];
+    int i;
+
+    erase_sector(WRITE_SECTOR_ADDR);
+
+    read_flash(READ, 0, WRITE_SECTOR_ADDR, buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, 0xff);
+    }
+
+    /* The previous sector is untouched */
+    read_flash(READ, 0, WRITE_SECTOR_ADDR - sizeof(buf), buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==,
+                        flash_pattern(WRITE_SECTOR_ADDR - sizeof(buf) + i));
+    }
+}
+
+static void test_write_page(void)
+{
+    uint32_t my_addr = WRITE_SECTOR_ADDR + 0x100;
+    uint8_t page[SPI_BUF_SIZE];
+    uint8_t buf[SPI_BUF_SIZE];
+    int i;
+
+    erase_sector(WRITE_SECTOR_ADDR);
+
+    /* Fill the data registers with the address of each byte */
+    for (i = 0; i < sizeof(page); i++) {
+        page[i] = my_addr + i;
+    }
+    program_flash(my_addr, page, sizeof(page));
+
+    /* Clobber the data registers before reading back */
+    memset(buf, 0x5a, sizeof(buf));
+    spi_write_buf(buf, sizeof(buf));
+
+    read_flash(READ, 0, my_addr, buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, page[i]);
+    }
+
+    /* The bytes before the programmed ones are still erased */
+    read_flash(READ, 0, my_addr - sizeof(buf), buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, 0xff);
+    }
+
+    /* Shorter than the data registers, on a fresh page */
+    program_flash(my_addr + 0x100, page, 7);
+    read_flash(READ, 0, my_addr + 0x100, buf, 8);
+    for (i = 0; i < 7; i++) {
+        g_assert_cmphex(buf[i], ==, page[i]);
+    }
+    g_assert_cmphex(buf[7], ==, 0xff);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *tmp_path = NULL;
+    g_autofree uint8_t *image = NULL;
+    int ret;
+    int fd;
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    image = g_malloc(FLASH_SIZE);
+    for (i = 0; i < FLASH_SIZE; i++) {
+        image[i] = flash_pattern(i);
+    }
+
+    fd = g_file_open_tmp("qtest.esp32c3-flash.XXXXXX", &tmp_path, NULL);
+    g_assert(fd >= 0);
+    ret = write(fd, image, FLASH_SIZE);
+    g_assert(ret == FLASH_SIZE);
+    close(fd);
+
+    global_qtest = qtest_initf("-machine esp32c3 "
+                               "-drive file=%s,format=raw,if=mtd",
+                               tmp_path);
+
+    qtest_add_func("/esp32c3/spi1/read", test_read);
+    qtest_add_func("/esp32c3/spi1/read_wrap", test_read_wrap);
+    qtest_add_func("/esp32c3/spi1/fast_read", test_fast_read);
+    qtest_add_func("/esp32c3/spi1/flash_read_cmd", test_flash_read_cmd);
+    qtest_add_func("/esp32c3/spi1/erase_sector", test_erase_sector);
+    qtest_add_func("/esp32c3/spi1/write_page", test_write_page);
+
+    ret = g_test_run();
+
+    qtest_quit(global_qtest);
+    unlink(tmp_path);
+    return ret;
+}
@@ -0,0 +1,167 @@
+/*
+ * ESP timer core counter tests
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/timer/esp_timer_core.h"
+
+static void test_counter_integer_period(void)
+{
+    EspTimerCounter c;
+
+    /* 40 MHz: one tick every 25 ns */
+    esp_timer_counter_init(&c, 1, 25);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 1000), ==, 0);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 1000, 1), ==, ESP_TIMER_NEVER);
+
+    esp_timer_counter_run(&c, 100, true);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 100), ==, 0);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 124), ==, 0);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 125), ==, 1);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 100 + 25 * 1000), ==, 1000);
+
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 100, 1), ==, 125);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 100, 10), ==, 350);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 130, 1), ==, 150);
+}
+
+static void test_counter_fractional_period(void)
+{
+    EspTimerCounter c;
+
+    /* 3 ticks every 40 ns, i.e. one every 13.33 ns */
+    esp_timer_counter_init(&c, 3, 40);
+    esp_timer_counter_run(&c, 0, true);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 13), ==, 0);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 14), ==, 1);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 26), ==, 1);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 27), ==, 2);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 40), ==, 3);
+
+    /* Deadlines are the exact tick instants rounded up */
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 0, 1), ==, 14);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 0, 2), ==, 27);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 0, 3), ==, 40);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 20, 1), ==, 27);
+}
+
+static void test_counter_load_run(void)
+{
+    EspTimerCounter c;
+
+    esp_timer_counter_init(&c, 1, 25);
+    esp_timer_counter_run(&c, 0, true);
+
+    /* The next tick happens one full period after the load */
+    esp_timer_counter_load(&c, 1010, 5);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 1034), ==, 5);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 1035), ==, 6);
+
+    /* Stopping keeps the value, restarting counts from it */
+    esp_timer_counter_run(&c, 1060, false);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 5000), ==, 7);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 5000, 1), ==, ESP_TIMER_NEVER);
+    esp_timer_counter_run(&c, 5000, true);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 5024), ==, 7);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 5025), ==, 8);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 5000, 1), ==, 5025);
+}
+
+static void test_counter_rate_change(void)
+{
+    EspTimerCounter c;
+
+    /* First tick at 13.33 ns, the second one would be at 26.67 ns */
+    esp_timer_counter_init(&c, 3, 40);
+    esp_timer_counter_run(&c, 0, true);
+
+    /* 10 ns period from the first tick on: next one at 23.5 ns, not 23 */
+    esp_timer_counter_set_rate(&c, 20, 2, 20);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 20), ==, 1);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 23), ==, 1);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 24), ==, 2);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 33), ==, 2);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 34), ==, 3);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 20, 1), ==, 24);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 20, 2), ==, 34);
+
+    /* A remainder rounding up to a whole nanosecond moves the origin to it */
+    esp_timer_counter_init(&c, 3, 40);
+    esp_timer_counter_run(&c, 0, true);
+    esp_timer_counter_set_rate(&c, 20, 1, 10);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 23), ==, 1);
+    g_assert_cmpuint(esp_timer_counter_get(&c, 24), ==, 2);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, 20, 1), ==, 24);
+}
+
+static void test_counter_rate_change_no_drift(void)
+{
+    EspTimerCounter ref;
+    EspTimerCounter c;
+
+    esp_timer_counter_init(&ref, 3, 40);
+    esp_timer_counter_run(&ref, 0, true);
+
+    /* Same rate expressed differently, the remainder converts exactly */
+    esp_timer_counter_init(&c, 3, 40);
+    esp_timer_counter_run(&c, 0, true);
+    esp_timer_counter_set_rate(&c, 20, 6, 80);
+    esp_timer_counter_set_rate(&c, 1000, 3, 40);
+    esp_timer_counter_set_rate(&c, 1337, 30, 400);
+
+    for (int64_t now = 1337; now < 20000; now++) {
+        g_assert_cmpuint(esp_timer_counter_get(&c, now), ==,
+                         esp_timer_counter_get(&ref, now));
+        g_assert_cmpint(esp_timer_counter_expiry(&c, now, 7), ==,
+                        esp_timer_counter_expiry(&ref, now, 7));
+    }
+}
+
+static void test_counter_large_values(void)
+{
+    const int64_t now = 1000000000000000000LL;
+    EspTimerCounter c;
+
+    /* 80 MHz, (now - origin) * num needs more than 64 bits */
+    esp_timer_counter_init(&c, 80000000, 1000000000);
+    esp_timer_counter_run(&c, 0, true);
+    g_assert_cmpuint(esp_timer_counter_get(&c, now), ==, 80000000000000000ULL);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, now, 80), ==, now + 1000);
+
+    /* The counter value wraps around */
+    esp_timer_counter_load(&c, now, UINT64_MAX);
+    g_assert_cmpuint(esp_timer_counter_get(&c, now + 12), ==, UINT64_MAX);
+    g_assert_cmpuint(esp_timer_counter_get(&c, now + 13), ==, 0);
+
+    /* Deadlines that can't be represented never expire */
+    g_assert_cmpint(esp_timer_counter_expiry(&c, now + 13, UINT64_MAX),
+                    ==, ESP_TIMER_NEVER);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, now, UINT64_MAX / 2),
+                    ==, ESP_TIMER_NEVER);
+    g_assert_cmpint(esp_timer_counter_expiry(&c, INT64_MAX - 10, 80),
+                    ==, ESP_TIMER_NEVER);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/esp-timer-core/counter/integer-period",
+                    test_counter_integer_period);
+    g_test_add_func("/esp-timer-core/counter/fractional-period",
+                    test_counter_fractional_period);
+    g_test_add_func("/esp-timer-core/counter/load-run",
+                    test_counter_load_run);
+    g_test_add_func("/esp-timer-core/counter/rate-change",
+                    test_counter_rate_change);
+    g_test_add_func("/esp-timer-core/counter/rate-change-no-drift",
+                    test_counter_rate_change_no_drift);
+    g_test_add_func("/esp-timer-core/counter/large-values",
+                    test_counter_large_values);
+    return g_test_run();
+}
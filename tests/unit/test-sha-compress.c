@@ -0,0 +1,149 @@
+/*
+ * Multi-block SHA compression functions test
+ *
+ * Copyright (c) 2024 Espressif Systems (Shanghai) Co. Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or
+ * (at your option) any later version.
+ *
+ * sha*_compress_blocks() run the SHA-NI implementation when the host
+ * supports it, their result must match the portable one-block compressors
+ * bit for bit, whatever the number of blocks and the buffer alignment.
+ */
+
+#include "qemu/osdep.h"
+#include "crypto/sha1_i.h"
+#include "crypto/sha224_i.h"
+#include "crypto/sha256_i.h"
+
+#define MAX_BLOCKS  65
+
+/* One extra byte to test unaligned buffers */
+static unsigned char data[MAX_BLOCKS * 64 + 1];
+
+static const size_t block_counts[] = { 1, 2, 3, 4, 7, 16, MAX_BLOCKS };
+
+/* "abc", padded to a single block */
+static void fill_abc_block(unsigned char block[64])
+{
+    memset(block, 0, 64);
+    memcpy(block, "abc", 3);
+    block[3] = 0x80;
+    block[63] = 24;
+}
+
+static void test_sha1_abc(void)
+{
+    static const uint32_t digest[5] = {
+        0xa9993e36, 0x4706816a, 0xba3e2571, 0x7850c26c, 0x9cd0d89d,
+    };
+    struct sha1_state md;
+    unsigned char block[64];
+
+    fill_abc_block(block);
+    sha1_init(&md);
+    sha1_compress_blocks(md.state, block, 1);
+    g_assert_cmpmem(md.state, sizeof(md.state), digest, sizeof(digest));
+}
+
+static void test_sha256_abc(void)
+{
+    static const uint32_t digest[8] = {
+        0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223,
+        0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad,
+    };
+    struct sha256_state md;
+    unsigned char block[64];
+
+    fill_abc_block(block);
+    sha256_init(&md);
+    sha256_compress_blocks(&md, block, 1);
+    g_assert_cmpmem(md.state, sizeof(md.state), digest, sizeof(digest));
+}
+
+static void test_sha1_blocks(gconstpointer opaque)
+{
+    const size_t offset = GPOINTER_TO_SIZE(opaque);
+
+    for (int i = 0; i < ARRAY_SIZE(block_counts); i++) {
+        const size_t blocks = block_counts[i];
+        struct sha1_state ref;
+        struct sha1_state md;
+
+        sha1_init(&ref);
+        for (size_t b = 0; b < blocks; b++) {
+            sha1_compress(ref.state, data + offset + b * 64);
+        }
+
+        sha1_init(&md);
+        sha1_compress_blocks(md.state, data + offset, blocks);
+        g_assert_cmpmem(md.state, sizeof(md.state),
+                        ref.state, sizeof(ref.state));
+    }
+}
+
+static void test_sha256_blocks(gconstpointer opaque)
+{
+    const size_t offset = GPOINTER_TO_SIZE(opaque);
+
+    for (int i = 0; i < ARRAY_SIZE(block_counts); i++) {
+        const size_t blocks = block_counts[i];
+        struct sha256_state ref;
+        struct sha256_state md;
+
+        sha256_init(&ref);
+        for (size_t b = 0; b < blocks; b++) {
+            sha256_compress(&ref, data + offset + b * 64);
+        }
+
+        sha256_init(&md);
+        sha256_compress_blocks(&md, data + offset, blocks);
+        g_assert_cmpmem(md.state, sizeof(md.state),
+                        ref.state, sizeof(ref.state));
+    }
+}
+
+static void test_sha224_blocks(void)
+{
+    for (int i = 0; i < ARRAY_SIZE(block_counts); i++) {
+        const size_t blocks = block_counts[i];
+        sha224_state ref;
+        sha224_state md;
+
+        sha224_init(&ref);
+        for (size_t b = 0; b < blocks; b++) {
+            sha256_compress(&ref, data + b * 64);
+        }
+
+        sha224_init(&md);
+        sha224_compress_blocks(&md, data, blocks);
+        g_assert_cmpmem(md.state, sizeof(md.state),
+                        ref.state, sizeof(ref.state));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seed = 0x12345678;
+
+    /* Deterministic, non-repeating content */
+    for (size_t i = 0; i < sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 24;
+    }
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/sha-compress/sha1/abc", test_sha1_abc);
+    g_test_add_func("/sha-compress/sha256/abc", test_sha256_abc);
+    g_test_add_data_func("/sha-compress/sha1/aligned",
+                         GSIZE_TO_POINTER(0), test_sha1_blocks);
+    g_test_add_data_func("/sha-compress/sha1/unaligned",
+                         GSIZE_TO_POINTER(1), test_sha1_blocks);
+    g_test_add_data_func("/sha-compress/sha256/aligned",
+                         GSIZE_TO_POINTER(0), test_sha256_blocks);
+    g_test_add_data_func("/sha-compress/sha256/unaligned",
+                         GSIZE_TO_POINTER(1), test_sha256_blocks);
+    g_test_add_func("/sha-compress/sha224", test_sha224_blocks);
+    return g_test_run();
+}